@@ -11,6 +11,8 @@ DESTDIR ?=
 PREFIX ?= /usr/local
 CC ?= gcc
 OLVL ?= -O2
+# largest Argon2 S2K memory, as a power of two KiB
+ARGON2_MEM_EXP ?= 21
 CFLAGS ?=
 LDFLAGS ?=
 
@@ -23,7 +25,7 @@ MKALL = $(MKCFG) $(DEP)
 OBJ = $(SRC:.c=.o)
 TOBJ = $(TSRC:.c=.o)
 DEP = $(SRC:.c=.d) $(TSRC:.c=.d)
-TEST = $(filter-out $(BNTEST),$(filter-out $(PARSE),$(filter-out $(TAP),$(TSRC:.c=))))
+TEST = $(filter-out $(BENCH),$(filter-out $(BNTEST),$(filter-out $(PARSE),$(filter-out $(TAP),$(TSRC:.c=)))))
 UTEST = $(filter-out src/$(TARGET).o,$(SRC:.c=.o))
 SRC := $(wildcard src/*.c)
 TSRC := $(wildcard t/*.c)
@@ -35,16 +37,30 @@ LIBS := -lgcrypt -lgpg-error
 TARGET := derpgp
 TAP := t/tap
 PARSE := t/testparse
-BNTEST := t/factorial t/golden t/load_cmp t/randomized t/rsa t/test_div_algo
+BENCH := t/bench
+BNTEST := t/factorial t/golden t/load_cmp t/randomized t/rsa t/test_div_algo t/testbn t/testkernels t/testlanes
 BINDIR := bin
 MANDIR := share/man/man1
 MKALL += Makefile asan.mk
 DEBUG += -fno-builtin -fno-common -fverbose-asm
-CFLAGS += -pedantic-errors -std=c11 -fPIC -fuse-ld=gold -flto -fuse-linker-plugin
+CPPFLAGS += -DS2K_ARGON2_MEM_EXP=$(ARGON2_MEM_EXP)
+CFLAGS += -pedantic-errors -std=c11 -pthread -fPIC -fuse-ld=gold -flto=auto -fuse-linker-plugin
 CFLAGS += -Wall -Wextra -Wno-missing-field-initializers -Wstrict-overflow -Wimplicit-fallthrough=0
 CFLAGS += -fno-align-functions -fno-align-jumps -fno-align-labels -fno-align-loops -fno-strict-aliasing
 LDFLAGS += -Wl,-O2,-z,relro,-z,now,--sort-common,--as-needed
-LDFLAGS += -fPIC -fuse-ld=gold -flto -fuse-linker-plugin
+LDFLAGS += -pthread -fPIC -fuse-ld=gold -flto=auto -fuse-linker-plugin
 LDFLAGS += -fno-align-functions -fno-align-jumps -fno-align-labels -fno-align-loops -fno-strict-aliasing
 
+# compressed data packets use zlib and bzip2 if their headers are found
+HAVE_ZLIB != printf '\043include <zlib.h>\n' | $(CC) -E -x c - >/dev/null 2>&1 && echo 1
+HAVE_BZ2 != printf '\043include <bzlib.h>\n' | $(CC) -E -x c - >/dev/null 2>&1 && echo 1
+ifeq ($(HAVE_ZLIB),1)
+	CPPFLAGS += -DHAVE_ZLIB
+	LIBS += -lz
+endif
+ifeq ($(HAVE_BZ2),1)
+	CPPFLAGS += -DHAVE_BZ2
+	LIBS += -lbz2
+endif
+
 # vi:ft=make:
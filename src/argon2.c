@@ -0,0 +1,399 @@
+/*
+ * argon2.c:	Argon2id (RFC 9106) with its lanes on worker threads
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "argon2.h"
+#include "pool.h"
+
+/* Argon2 version 1.3 */
+#define ARGON2_VERSION		0x13
+#define ARGON2_TYPE_ID		2
+/* pseudo-random addresses per address block */
+#define ARGON2_ADDRESSES	ARGON2_BLOCK_WORDS
+
+#define ROTR64(x, n)		(((x) >> (n)) | ((x) << (64 - (n))))
+
+/* one pass and slice of `argon2id()` */
+typedef struct _argon2_ctx {
+	ARGON2_BLOCK *mem;
+	u32 lanes, lane_len, seg_len, blocks, passes;
+	u32 pass, slice;
+} ARGON2_CTX;
+
+/* BLAKE2b state */
+typedef struct _blake2b {
+	u64 h[8], t;
+	u8 buf[128];
+	size_t len, out_len;
+} BLAKE2B;
+
+static u64 const blake2b_iv[8] = {
+	0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+	0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179,
+};
+
+static u8 const blake2b_sigma[12][16] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+	{11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+	{7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+	{9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+	{2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+	{12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+	{13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+	{6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+	{10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+static inline u64 load64(u8 const *restrict p)
+{
+	u64 x = 0;
+	for (int i = 7; i >= 0; i--)
+		x = x << 8 | p[i];
+	return x;
+}
+
+static inline void store64(u8 *restrict p, u64 x)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = x >> (8 * i);
+}
+
+static inline void store32(u8 *restrict p, u32 x)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = x >> (8 * i);
+}
+
+#define B2B_G(a, b, c, d, x, y) \
+	do { \
+		a = a + b + (x); d = ROTR64(d ^ a, 32); \
+		c = c + d; b = ROTR64(b ^ c, 24); \
+		a = a + b + (y); d = ROTR64(d ^ a, 16); \
+		c = c + d; b = ROTR64(b ^ c, 63); \
+	} while (0)
+
+static void blake2b_compress(BLAKE2B *restrict s, u8 const *restrict block, bool last)
+{
+	u64 v[16], m[16];
+
+	for (int i = 0; i < 16; i++)
+		m[i] = load64(block + 8 * i);
+	for (int i = 0; i < 8; i++)
+		v[i] = s->h[i], v[i + 8] = blake2b_iv[i];
+	v[12] ^= s->t;
+	if (last)
+		v[14] = ~v[14];
+	for (int r = 0; r < 12; r++) {
+		u8 const *sg = blake2b_sigma[r];
+		B2B_G(v[0], v[4], v[8], v[12], m[sg[0]], m[sg[1]]);
+		B2B_G(v[1], v[5], v[9], v[13], m[sg[2]], m[sg[3]]);
+		B2B_G(v[2], v[6], v[10], v[14], m[sg[4]], m[sg[5]]);
+		B2B_G(v[3], v[7], v[11], v[15], m[sg[6]], m[sg[7]]);
+		B2B_G(v[0], v[5], v[10], v[15], m[sg[8]], m[sg[9]]);
+		B2B_G(v[1], v[6], v[11], v[12], m[sg[10]], m[sg[11]]);
+		B2B_G(v[2], v[7], v[8], v[13], m[sg[12]], m[sg[13]]);
+		B2B_G(v[3], v[4], v[9], v[14], m[sg[14]], m[sg[15]]);
+	}
+	for (int i = 0; i < 8; i++)
+		s->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void blake2b_init(BLAKE2B *restrict s, size_t out_len)
+{
+	memcpy(s->h, blake2b_iv, sizeof s->h);
+	/* no key, fanout and depth 1 */
+	s->h[0] ^= 0x01010000 ^ out_len;
+	s->t = s->len = 0;
+	s->out_len = out_len;
+}
+
+static void blake2b_update(BLAKE2B *restrict s, void const *restrict in, size_t in_len)
+{
+	u8 const *p = in;
+
+	while (in_len) {
+		size_t n;
+		/* the last block is held back for the final flag */
+		if (s->len == sizeof s->buf) {
+			s->t += sizeof s->buf;
+			blake2b_compress(s, s->buf, false);
+			s->len = 0;
+		}
+		n = sizeof s->buf - s->len;
+		if (n > in_len)
+			n = in_len;
+		memcpy(s->buf + s->len, p, n);
+		s->len += n, p += n, in_len -= n;
+	}
+}
+
+static void blake2b_final(BLAKE2B *restrict s, u8 *restrict out)
+{
+	u8 full[64];
+
+	s->t += s->len;
+	memset(s->buf + s->len, 0, sizeof s->buf - s->len);
+	blake2b_compress(s, s->buf, true);
+	for (int i = 0; i < 8; i++)
+		store64(full + 8 * i, s->h[i]);
+	memcpy(out, full, s->out_len);
+	explicit_bzero(s, sizeof *s);
+	explicit_bzero(full, sizeof full);
+}
+
+/* unkeyed BLAKE2b with an `out_len` of 1 to 64 octets */
+void argon2_blake2b(u8 *restrict out, size_t out_len, u8 const *restrict in, size_t in_len)
+{
+	BLAKE2B s;
+	blake2b_init(&s, out_len);
+	blake2b_update(&s, in, in_len);
+	blake2b_final(&s, out);
+}
+
+/* the variable-length hash H' over `len` prefixed to `a` and `b` */
+static void blake2b_long(u8 *restrict out, size_t out_len, u8 const *restrict a, size_t a_len,
+		u8 const *restrict b, size_t b_len)
+{
+	BLAKE2B s;
+	u8 len_le[4], v[64], next[64];
+
+	store32(len_le, out_len);
+	blake2b_init(&s, (out_len <= 64) ? out_len : 64);
+	blake2b_update(&s, len_le, sizeof len_le);
+	blake2b_update(&s, a, a_len);
+	blake2b_update(&s, b, b_len);
+	if (out_len <= 64) {
+		blake2b_final(&s, out);
+		return;
+	}
+	/* the first half of each 64-octet hash, then all of the last one */
+	blake2b_final(&s, v);
+	memcpy(out, v, 32);
+	out += 32, out_len -= 32;
+	while (out_len > 64) {
+		argon2_blake2b(next, 64, v, 64);
+		memcpy(v, next, 64);
+		memcpy(out, v, 32);
+		out += 32, out_len -= 32;
+	}
+	argon2_blake2b(out, out_len, v, 64);
+	explicit_bzero(v, sizeof v);
+	explicit_bzero(next, sizeof next);
+}
+
+/* a + b + 2 * lo(a) * lo(b), the multiplication hardened BLAKE2b round */
+#define BLAMKA(a, b)		((a) + (b) + 2 * ((a) & 0xffffffff) * ((b) & 0xffffffff))
+
+#define BLAMKA_G(a, b, c, d) \
+	do { \
+		a = BLAMKA(a, b); d = ROTR64(d ^ a, 32); \
+		c = BLAMKA(c, d); b = ROTR64(b ^ c, 24); \
+		a = BLAMKA(a, b); d = ROTR64(d ^ a, 16); \
+		c = BLAMKA(c, d); b = ROTR64(b ^ c, 63); \
+	} while (0)
+
+#define BLAMKA_ROUND(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15) \
+	do { \
+		BLAMKA_G(v0, v4, v8, v12); BLAMKA_G(v1, v5, v9, v13); \
+		BLAMKA_G(v2, v6, v10, v14); BLAMKA_G(v3, v7, v11, v15); \
+		BLAMKA_G(v0, v5, v10, v15); BLAMKA_G(v1, v6, v11, v12); \
+		BLAMKA_G(v2, v7, v8, v13); BLAMKA_G(v3, v4, v9, v14); \
+	} while (0)
+
+/*
+ * the compression function G: `next` = P(prev ^ ref) ^ prev ^ ref, xor'd
+ * into the old contents of `next` from the second pass on; P runs the round
+ * over the eight rows of sixteen words, then over the eight column pairs
+ */
+static void fill_block(ARGON2_BLOCK const prev, ARGON2_BLOCK const ref, ARGON2_BLOCK next, bool with_xor)
+{
+	u64 r[ARGON2_BLOCK_WORDS], z[ARGON2_BLOCK_WORDS];
+
+	for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+		r[i] = z[i] = prev[i] ^ ref[i];
+	if (with_xor) {
+		for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+			z[i] ^= next[i];
+	}
+	for (int i = 0; i < 8; i++) {
+		u64 *v = r + 16 * i;
+		BLAMKA_ROUND(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+				v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+	}
+	for (int i = 0; i < 8; i++) {
+		u64 *v = r + 2 * i;
+		BLAMKA_ROUND(v[0], v[1], v[16], v[17], v[32], v[33], v[48], v[49],
+				v[64], v[65], v[80], v[81], v[96], v[97], v[112], v[113]);
+	}
+	for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+		next[i] = z[i] ^ r[i];
+}
+
+/* the next block of data-independent addresses */
+static void next_addresses(ARGON2_BLOCK addr, ARGON2_BLOCK input, ARGON2_BLOCK const zero)
+{
+	input[6]++;
+	fill_block(zero, input, addr, false);
+	fill_block(zero, addr, addr, false);
+}
+
+/* the block of the lane `ref_lane` referenced from segment position `idx` */
+static u32 ref_index(ARGON2_CTX const *restrict ctx, u32 idx, u64 rand, bool same_lane)
+{
+	u64 area, rel;
+	u32 start = 0;
+
+	/* every block finished so far, less the previous one in this lane */
+	if (!ctx->pass)
+		area = (u64)ctx->slice * ctx->seg_len;
+	else
+		area = ctx->lane_len - ctx->seg_len;
+	area = same_lane ? area + idx - 1 : area - !idx;
+	/* biased towards recent blocks */
+	rel = rand & 0xffffffff;
+	rel = rel * rel >> 32;
+	rel = area - 1 - (area * rel >> 32);
+	if (ctx->pass && ctx->slice != ARGON2_SLICES - 1)
+		start = (ctx->slice + 1) * ctx->seg_len;
+
+	return (start + rel) % ctx->lane_len;
+}
+
+/* one segment of the current slice, in lane `lane` */
+static void fill_segment(void *restrict arg, size_t lane)
+{
+	ARGON2_CTX const *ctx = arg;
+	ARGON2_BLOCK addr, input = {0}, zero = {0};
+	/* Argon2id addresses the first half of the first pass independently of the data */
+	bool indep = !ctx->pass && ctx->slice < ARGON2_SLICES / 2;
+	u32 start = (!ctx->pass && !ctx->slice) ? 2 : 0;
+	size_t base = (size_t)lane * ctx->lane_len;
+
+	if (indep) {
+		input[0] = ctx->pass, input[1] = lane, input[2] = ctx->slice;
+		input[3] = ctx->blocks, input[4] = ctx->passes, input[5] = ARGON2_TYPE_ID;
+		if (start)
+			next_addresses(addr, input, zero);
+	}
+	for (u32 i = start; i < ctx->seg_len; i++) {
+		u32 col = ctx->slice * ctx->seg_len + i;
+		size_t cur = base + col, prev = col ? cur - 1 : base + ctx->lane_len - 1;
+		u32 ref_lane;
+		u64 rand;
+
+		if (indep) {
+			if (i % ARGON2_ADDRESSES == 0)
+				next_addresses(addr, input, zero);
+			rand = addr[i % ARGON2_ADDRESSES];
+		} else {
+			rand = ctx->mem[prev][0];
+		}
+		ref_lane = (!ctx->pass && !ctx->slice) ? lane : (rand >> 32) % ctx->lanes;
+		fill_block(ctx->mem[prev], ctx->mem[(size_t)ref_lane * ctx->lane_len
+				+ ref_index(ctx, i, rand, ref_lane == lane)], ctx->mem[cur], ctx->pass != 0);
+	}
+}
+
+/* grow the arena to `cnt` blocks, keeping it if it is large enough already; returns -1 if out of memory */
+static int arena_reserve(ARGON2_ARENA *restrict arena, size_t cnt)
+{
+	if (arena->cnt >= cnt)
+		return 0;
+	argon2_arena_free(arena);
+	/* the memory cost comes from the key, so running out is not fatal */
+	if (!(arena->blocks = malloc(cnt * sizeof *arena->blocks)))
+		return -1;
+	arena->cnt = cnt;
+	return 0;
+}
+
+/* wipe and release the arena */
+void argon2_arena_free(ARGON2_ARENA *restrict arena)
+{
+	if (arena->blocks)
+		explicit_bzero(arena->blocks, arena->cnt * sizeof *arena->blocks);
+	free(arena->blocks);
+	*arena = (ARGON2_ARENA){0};
+}
+
+/*
+ * Argon2id with no secret or associated data into the `tag_len`-octet
+ * `tag`, using the blocks of `arena`; each of the `lanes` segments of a
+ * slice is one `pool_for()` task on up to `nthreads` threads (0 for one
+ * per cpu), so a derivation costs its memory over the cores rather than
+ * over one thread; returns 0, or -1 for bad parameters
+ */
+int argon2id(ARGON2_ARENA *restrict arena, void const *restrict pass, size_t pass_len,
+		u8 const *restrict salt, size_t salt_len, u32 passes, u32 lanes, u32 mem_kib,
+		u8 *restrict tag, size_t tag_len, size_t nthreads)
+{
+	ARGON2_CTX ctx = {.lanes = lanes, .passes = passes};
+	BLAKE2B s;
+	u8 h0[64 + 8], params[4 * 6], len_le[4], block[sizeof(ARGON2_BLOCK)];
+	ARGON2_BLOCK last;
+
+	if (!passes || !lanes || lanes > 0xffffff || tag_len < 4 || tag_len > ARGON2_MAX_TAG
+			|| salt_len < 8 || mem_kib < 8 * lanes)
+		return -1;
+	/* whole segments in every lane */
+	ctx.blocks = mem_kib / (ARGON2_SLICES * lanes) * (ARGON2_SLICES * lanes);
+	ctx.lane_len = ctx.blocks / lanes;
+	ctx.seg_len = ctx.lane_len / ARGON2_SLICES;
+	if (arena_reserve(arena, ctx.blocks))
+		return -1;
+	ctx.mem = arena->blocks;
+
+	/* H0 over the parameters, passphrase and salt, then empty secret and data */
+	store32(params, lanes), store32(params + 4, tag_len), store32(params + 8, mem_kib);
+	store32(params + 12, passes), store32(params + 16, ARGON2_VERSION), store32(params + 20, ARGON2_TYPE_ID);
+	blake2b_init(&s, 64);
+	blake2b_update(&s, params, sizeof params);
+	store32(len_le, pass_len);
+	blake2b_update(&s, len_le, sizeof len_le);
+	blake2b_update(&s, pass, pass_len);
+	store32(len_le, salt_len);
+	blake2b_update(&s, len_le, sizeof len_le);
+	blake2b_update(&s, salt, salt_len);
+	store32(len_le, 0);
+	blake2b_update(&s, len_le, sizeof len_le);
+	blake2b_update(&s, len_le, sizeof len_le);
+	blake2b_final(&s, h0);
+
+	/* the first two blocks of every lane */
+	for (u32 l = 0; l < lanes; l++) {
+		for (u32 c = 0; c < 2; c++) {
+			store32(h0 + 64, c), store32(h0 + 68, l);
+			blake2b_long(block, sizeof block, h0, sizeof h0, NULL, 0);
+			for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+				ctx.mem[(size_t)l * ctx.lane_len + c][i] = load64(block + 8 * i);
+		}
+	}
+	/* lanes only meet at the slice boundaries */
+	for (ctx.pass = 0; ctx.pass < passes; ctx.pass++) {
+		for (ctx.slice = 0; ctx.slice < ARGON2_SLICES; ctx.slice++)
+			pool_for(lanes, nthreads, fill_segment, &ctx);
+	}
+
+	/* the xor of the last column */
+	memcpy(last, ctx.mem[ctx.lane_len - 1], sizeof last);
+	for (u32 l = 1; l < lanes; l++) {
+		for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+			last[i] ^= ctx.mem[(size_t)l * ctx.lane_len + ctx.lane_len - 1][i];
+	}
+	for (int i = 0; i < ARGON2_BLOCK_WORDS; i++)
+		store64(block + 8 * i, last[i]);
+	blake2b_long(tag, tag_len, block, sizeof block, NULL, 0);
+	explicit_bzero(h0, sizeof h0);
+	explicit_bzero(block, sizeof block);
+	explicit_bzero(last, sizeof last);
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * argon2.h:	header for argon2.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _ARGON2_H
+#define _ARGON2_H 1
+
+#include "defs.h"
+
+/* 1 KiB blocks of 64-bit words */
+#define ARGON2_BLOCK_WORDS	128
+/* slices per pass, with the lanes synchronized between them */
+#define ARGON2_SLICES		4
+/* longest tag, enough for any cipher key */
+#define ARGON2_MAX_TAG		64
+/* the largest memory exponent RFC 9580 allows (2^30 KiB) */
+#define ARGON2_MAX_MEM_EXP	30
+
+typedef u64 ARGON2_BLOCK[ARGON2_BLOCK_WORDS];
+
+/*
+ * the block memory of a derivation, kept between calls so a run of keys
+ * with the same parameters allocates once; wiped by `argon2_arena_free()`
+ */
+typedef struct _argon2_arena {
+	ARGON2_BLOCK *blocks;
+	size_t cnt;
+} ARGON2_ARENA;
+
+/* prototypes */
+void argon2_blake2b(u8 *restrict out, size_t out_len, u8 const *restrict in, size_t in_len);
+int argon2id(ARGON2_ARENA *restrict arena, void const *restrict pass, size_t pass_len,
+		u8 const *restrict salt, size_t salt_len, u32 passes, u32 lanes, u32 mem_kib,
+		u8 *restrict tag, size_t tag_len, size_t nthreads);
+void argon2_arena_free(ARGON2_ARENA *restrict arena);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * batchgcd.c:	rsa moduli sharing a prime, through product and remainder trees
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "batchgcd.h"
+#include "pool.h"
+
+/* tree depth for up to 2^63 leaves */
+#define TREE_LEVELS		64
+
+/*
+ * product tree over one batch of moduli: level 0 holds the moduli and
+ * every level above the products of adjacent pairs of the one below
+ */
+typedef struct _prod_tree {
+	size_t levels;
+	size_t cnt[TREE_LEVELS];
+	/* products, dropped between the leaves and the root once squared */
+	BIGINT *node[TREE_LEVELS];
+	/* squares of the products and their reciprocals for `bigint_mod()` */
+	BIGINT *sq[TREE_LEVELS];
+	BIGINT *inv[TREE_LEVELS];
+} PROD_TREE;
+
+/* one tree level in a `pool_for()` worker */
+typedef struct _level_ctx {
+	BIGINT *lower, *upper;
+	size_t lower_cnt;
+	BIGINT *sq, *inv;
+} LEVEL_CTX;
+
+/* the leaves of one batch in a `pool_for()` worker */
+typedef struct _leaf_ctx {
+	BIGINT const *moduli;
+	/* P mod N_i^2 for every leaf */
+	BIGINT *rems;
+	BIGINT *gcds;
+} LEAF_CTX;
+
+/* upper[i] = lower[2i] * lower[2i + 1], or lower[2i] itself at the end of an odd level */
+static void prod_node(void *restrict arg, size_t i)
+{
+	LEVEL_CTX *ctx = arg;
+	if (2 * i + 1 < ctx->lower_cnt)
+		bigint_mul(&ctx->upper[i], &ctx->lower[2 * i], &ctx->lower[2 * i + 1]);
+	else
+		bigint_copy(&ctx->upper[i], &ctx->lower[2 * i]);
+}
+
+/* square a node and precompute the reciprocal of the square */
+static void square_node(void *restrict arg, size_t i)
+{
+	LEVEL_CTX *ctx = arg;
+	bigint_mul(&ctx->sq[i], &ctx->lower[i], &ctx->lower[i]);
+	bigint_recip(&ctx->inv[i], &ctx->sq[i]);
+}
+
+/* lower[i] = upper[i / 2] mod node_i^2 */
+static void rem_node(void *restrict arg, size_t i)
+{
+	LEVEL_CTX *ctx = arg;
+	bigint_mod(&ctx->lower[i], &ctx->upper[i / 2], &ctx->sq[i], &ctx->inv[i]);
+}
+
+/* N_i divides P mod N_i^2, and gcd((P mod N_i^2) / N_i, N_i) is what N_i shares with the rest */
+static void leaf_gcd(void *restrict arg, size_t i)
+{
+	LEAF_CTX *ctx = arg;
+	struct bn a, n, z;
+
+	bigint_to_bn(&a, &ctx->rems[i]);
+	bigint_to_bn(&n, &ctx->moduli[i]);
+	bignum_div(&a, &n, &z);
+	bignum_gcd(&z, &n, &a);
+	bigint_from_bn(&ctx->gcds[i], &a);
+}
+
+static void free_level(BIGINT *restrict level, size_t cnt)
+{
+	if (!level)
+		return;
+	for (size_t i = 0; i < cnt; i++)
+		bigint_free(&level[i]);
+	free(level);
+}
+
+/* build the tree over `cnt` moduli level by level, with the squares if `squares` is set */
+static void tree_build(PROD_TREE *restrict tree, BIGINT const *restrict moduli, size_t cnt, bool squares, size_t nthreads)
+{
+	LEVEL_CTX ctx = {0};
+	size_t l;
+
+	/* the leaves are borrowed */
+	tree->cnt[0] = cnt;
+	tree->node[0] = (BIGINT *)moduli;
+	for (l = 0; tree->cnt[l] > 1; l++) {
+		tree->cnt[l + 1] = (tree->cnt[l] + 1) / 2;
+		xcalloc(&tree->node[l + 1], tree->cnt[l + 1], sizeof *tree->node[l + 1], "tree_build() xcalloc()");
+		ctx.lower = tree->node[l];
+		ctx.upper = tree->node[l + 1];
+		ctx.lower_cnt = tree->cnt[l];
+		pool_for(tree->cnt[l + 1], nthreads, prod_node, &ctx);
+	}
+	tree->levels = l + 1;
+	if (!squares)
+		return;
+
+	/*
+	 * every root is as long as this one and P mod P^2 is P, so the root
+	 * goes to the level below as it is; only a lone leaf needs its square
+	 */
+	for (l = 0; l == 0 || l + 1 < tree->levels; l++) {
+		xcalloc(&tree->sq[l], tree->cnt[l], sizeof *tree->sq[l], "tree_build() xcalloc()");
+		xcalloc(&tree->inv[l], tree->cnt[l], sizeof *tree->inv[l], "tree_build() xcalloc()");
+		ctx.lower = tree->node[l];
+		ctx.sq = tree->sq[l];
+		ctx.inv = tree->inv[l];
+		pool_for(tree->cnt[l], nthreads, square_node, &ctx);
+		/* only the squares are needed between the leaves and the root */
+		if (l) {
+			free_level(tree->node[l], tree->cnt[l]);
+			tree->node[l] = NULL;
+		}
+	}
+}
+
+static void tree_free(PROD_TREE *restrict tree)
+{
+	for (size_t l = 0; l < tree->levels; l++) {
+		if (l)
+			free_level(tree->node[l], tree->cnt[l]);
+		free_level(tree->sq[l], tree->cnt[l]);
+		free_level(tree->inv[l], tree->cnt[l]);
+	}
+	*tree = (PROD_TREE){0};
+}
+
+/* remainders of `root`, a multiple of the tree root below its square, modulo the squares of every leaf */
+static BIGINT *tree_rems(PROD_TREE const *restrict tree, BIGINT const *restrict root, size_t nthreads)
+{
+	LEVEL_CTX ctx = {0};
+	BIGINT *upper, *lower;
+	size_t top = tree->levels - 1;
+
+	xcalloc(&upper, 1, sizeof *upper, "tree_rems() xcalloc()");
+	if (!top)
+		bigint_mod(&upper[0], root, &tree->sq[0][0], &tree->inv[0][0]);
+	else
+		bigint_copy(&upper[0], root);
+	for (size_t l = top; l-- > 0;) {
+		xcalloc(&lower, tree->cnt[l], sizeof *lower, "tree_rems() xcalloc()");
+		ctx.lower = lower;
+		ctx.upper = upper;
+		ctx.sq = tree->sq[l];
+		ctx.inv = tree->inv[l];
+		pool_for(tree->cnt[l], nthreads, rem_node, &ctx);
+		free_level(upper, tree->cnt[l + 1]);
+		upper = lower;
+	}
+
+	return upper;
+}
+
+/* order moduli by value to find repeats */
+static int cmp_modulus(void const *a, void const *b)
+{
+	return bigint_cmp(a, b);
+}
+
+/*
+ * Bernstein's batch gcd: with P the product of all moduli, P mod N^2 is
+ * N * (P / N mod N), so gcd((P mod N^2) / N, N) is the part of N shared
+ * with any other modulus. More than `batch` moduli are split up: a tree
+ * over the batch products takes P down to P mod B^2 for every batch
+ * product B, and since N^2 divides B^2 one remainder tree per batch takes
+ * that on to its leaves, which keeps one tree of `batch` leaves in memory
+ * at a time besides the batch products
+ */
+void batch_gcd(BIGINT const *restrict moduli, size_t cnt, BIGINT *restrict gcds, size_t batch, size_t nthreads)
+{
+	PROD_TREE tree = {0};
+	BIGINT *roots = NULL, *prems = NULL;
+	size_t nbatch;
+
+	if (!cnt)
+		return;
+	if (!batch)
+		batch = BATCH_GCD_LEAVES;
+	nbatch = (cnt + batch - 1) / batch;
+
+	/* P mod B^2 for the product B of every batch, down a tree over the batch products */
+	if (nbatch > 1) {
+		xcalloc(&roots, nbatch, sizeof *roots, "batch_gcd() xcalloc()");
+		for (size_t b = 0; b < nbatch; b++) {
+			size_t len = (cnt - b * batch < batch) ? cnt - b * batch : batch;
+			tree_build(&tree, moduli + b * batch, len, false, nthreads);
+			bigint_copy(&roots[b], &tree.node[tree.levels - 1][0]);
+			tree_free(&tree);
+		}
+		tree_build(&tree, roots, nbatch, true, nthreads);
+		prems = tree_rems(&tree, &tree.node[tree.levels - 1][0], nthreads);
+		tree_free(&tree);
+		free_level(roots, nbatch);
+	}
+
+	for (size_t j = 0; j < nbatch; j++) {
+		size_t len = (cnt - j * batch < batch) ? cnt - j * batch : batch;
+		LEAF_CTX ctx = {.moduli = moduli + j * batch, .gcds = gcds + j * batch};
+
+		tree_build(&tree, ctx.moduli, len, true, nthreads);
+		ctx.rems = tree_rems(&tree, prems ? &prems[j] : &tree.node[tree.levels - 1][0], nthreads);
+		pool_for(len, nthreads, leaf_gcd, &ctx);
+		free_level(ctx.rems, len);
+		tree_free(&tree);
+	}
+
+	free_level(prems, nbatch);
+}
+
+size_t batch_gcd_list(PGP_LIST const *restrict pkts, int *restrict results, size_t batch, size_t nthreads)
+{
+	BIGINT *moduli, *uniq, *gcds;
+	size_t *pkt, *map, cnt = 0, nuniq = 0, weak = 0;
+
+	xcalloc(&moduli, FALLBACK(pkts->cnt, 1), sizeof *moduli, "batch_gcd_list() xcalloc()");
+	xcalloc(&pkt, FALLBACK(pkts->cnt, 1), sizeof *pkt, "batch_gcd_list() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		PGP_PACKET const *packet = &pkts->list[i];
+		int tag = TAGBITS(packet->pheader);
+		MPI const *n;
+
+		results[i] = -1;
+		if (tag == TAG_SECKEY || tag == TAG_SECSUBKEY)
+			n = &packet->seckey.modulus_n;
+		else if (tag == TAG_PUBKEY || tag == TAG_PUBSUBKEY)
+			n = &packet->pubkey.modulus_n;
+		else
+			continue;
+		if (!n->mdata || !n->length || n->length > RSA_MAX_BITS)
+			continue;
+		bigint_from_bytes(&moduli[cnt], n->mdata + 1, MPIBYTES(n->length));
+		pkt[cnt++] = i;
+	}
+
+	/* a key listed twice, as a secret and a public key say, must not count as shared */
+	xcalloc(&uniq, FALLBACK(cnt, 1), sizeof *uniq, "batch_gcd_list() xcalloc()");
+	xcalloc(&map, FALLBACK(cnt, 1), sizeof *map, "batch_gcd_list() xcalloc()");
+	for (size_t i = 0; i < cnt; i++)
+		bigint_copy(&uniq[i], &moduli[i]);
+	qsort(uniq, cnt, sizeof *uniq, cmp_modulus);
+	for (size_t i = 0; i < cnt; i++) {
+		if (nuniq && bigint_cmp(&uniq[i], &uniq[nuniq - 1]) == EQUAL) {
+			bigint_free(&uniq[i]);
+			continue;
+		}
+		BIGINT tmp = uniq[nuniq];
+		uniq[nuniq] = uniq[i];
+		uniq[i] = tmp;
+		nuniq++;
+	}
+	for (size_t i = 0; i < cnt; i++) {
+		BIGINT *found = bsearch(&moduli[i], uniq, nuniq, sizeof *uniq, cmp_modulus);
+		map[i] = found - uniq;
+	}
+
+	xcalloc(&gcds, FALLBACK(nuniq, 1), sizeof *gcds, "batch_gcd_list() xcalloc()");
+	batch_gcd(uniq, nuniq, gcds, batch, nthreads);
+	for (size_t i = 0; i < cnt; i++) {
+		BIGINT const *g = &gcds[map[i]];
+		/* the bit length of the shared part, or 0 if there is none */
+		results[pkt[i]] = (g->len == 1 && g->w[0] == 1) ? 0 : (int)bigint_bits(g);
+		if (results[pkt[i]] > 0)
+			weak++;
+	}
+
+	free_level(moduli, cnt);
+	free_level(uniq, cnt);
+	free_level(gcds, nuniq);
+	free(pkt);
+	free(map);
+
+	return weak;
+}
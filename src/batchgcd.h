@@ -0,0 +1,29 @@
+/*
+ * batchgcd.h:	header for batchgcd.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _BATCHGCD_H
+#define _BATCHGCD_H 1
+
+#include "defs.h"
+#include "rsa.h"
+
+/* room for squares of the largest modulus in the leaves */
+#ifndef BN_BYTES
+# define BN_BYTES		(2 * RSA_MAX_BITS / 8)
+#endif
+#include "bigint.h"
+
+/* moduli per product tree, which bounds the memory of one pass */
+#define BATCH_GCD_LEAVES	(1 << 14)
+
+/* prototypes */
+void batch_gcd(BIGINT const *restrict moduli, size_t cnt, BIGINT *restrict gcds, size_t batch, size_t nthreads);
+size_t batch_gcd_list(PGP_LIST const *restrict pkts, int *restrict results, size_t batch, size_t nthreads);
+
+#endif
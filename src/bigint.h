@@ -0,0 +1,501 @@
+/*
+ * bigint.h:	variable-length integers for product and remainder trees
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _BIGINT_H
+#define _BIGINT_H 1
+
+#include "defs.h"
+#include "bn.h"
+#include "ntt.h"
+
+/*
+ * operand lengths in words where each multiplication takes over from the
+ * one before, measured with the sweep in t/bench on the build host; the
+ * sweep prints the crossovers it sees, which a different machine can pass
+ * back through CFLAGS in the environment
+ */
+#ifndef KARATSUBA_THRESHOLD
+# define KARATSUBA_THRESHOLD	48
+#endif
+#ifndef TOOM3_THRESHOLD
+# define TOOM3_THRESHOLD	256
+#endif
+#ifndef NTT_THRESHOLD
+# define NTT_THRESHOLD		2048
+#endif
+/* divisor length in words below which reciprocals come from long division */
+#define RECIP_THRESHOLD		32
+
+/*
+ * heap-allocated number, least significant word first, with `w[len - 1]`
+ * never zero; zero-initialize before first use and `bigint_free()` after
+ */
+typedef struct _bigint {
+	DTYPE *w;
+	/* words in use and allocated */
+	size_t len, max;
+} BIGINT;
+
+/* grow `x` to hold at least `n` words, keeping its value */
+static inline void bigint_reserve(BIGINT *restrict x, size_t n)
+{
+	if (n <= x->max)
+		return;
+	xrealloc(&x->w, sizeof *x->w * n, "bigint_reserve() xrealloc()");
+	x->max = n;
+}
+
+static inline void bigint_free(BIGINT *restrict x)
+{
+	free(x->w);
+	*x = (BIGINT){0};
+}
+
+/* drop leading zero words */
+static inline void bigint_trim(BIGINT *restrict x)
+{
+	while (x->len && !x->w[x->len - 1])
+		x->len--;
+}
+
+static inline void bigint_from_int(BIGINT *restrict x, DTYPE val)
+{
+	bigint_reserve(x, 1);
+	x->w[0] = val;
+	x->len = 1;
+	bigint_trim(x);
+}
+
+/* load `len` big-endian bytes */
+static inline void bigint_from_bytes(BIGINT *restrict x, u8 const *restrict buf, size_t len)
+{
+	size_t n = (len + WORD_SIZE - 1) / WORD_SIZE;
+
+	bigint_reserve(x, FALLBACK(n, 1));
+	memset(x->w, 0, sizeof *x->w * n);
+	for (size_t i = 0; i < len; i++)
+		x->w[i / WORD_SIZE] |= (DTYPE)buf[len - 1 - i] << (8 * (i % WORD_SIZE));
+	x->len = n;
+	bigint_trim(x);
+}
+
+static inline void bigint_copy(BIGINT *restrict c, BIGINT const *restrict a)
+{
+	bigint_reserve(c, FALLBACK(a->len, 1));
+	memcpy(c->w, a->w, sizeof *a->w * a->len);
+	c->len = a->len;
+}
+
+/* copy into a fixed-width number, which must be wide enough */
+static inline void bigint_to_bn(struct bn *restrict b, BIGINT const *restrict x)
+{
+	require(x->len <= BN_ARRAY_SIZE, "bigint does not fit");
+	memcpy(b->array, x->w, sizeof *x->w * x->len);
+	memset(b->array + x->len, 0, sizeof *x->w * (BN_ARRAY_SIZE - x->len));
+	_bignum_fix_top(b, x->len);
+}
+
+static inline void bigint_from_bn(BIGINT *restrict x, struct bn *restrict b)
+{
+	bigint_reserve(x, FALLBACK(b->top, 1));
+	memcpy(x->w, b->array, sizeof *x->w * b->top);
+	x->len = b->top;
+}
+
+/* returns `LARGER`, `EQUAL` or `SMALLER` like `bignum_cmp()` */
+static inline int bigint_cmp(BIGINT const *restrict a, BIGINT const *restrict b)
+{
+	return _cmp_words(a->w, a->len, b->w, b->len);
+}
+
+static inline size_t bigint_bits(BIGINT const *restrict x)
+{
+	size_t bits = x->len * 8 * WORD_SIZE;
+	if (!x->len)
+		return 0;
+	for (DTYPE top = x->w[x->len - 1]; !(top & (DTYPE)DTYPE_MSB); top <<= 1)
+		bits--;
+	return bits;
+}
+
+/* add the `tn`-word `t` into the `cn`-word `c` at word `off`, carrying up to the top of `c` */
+static inline void _bigint_add_at(DTYPE *c, size_t cn, size_t off, DTYPE *t, size_t tn)
+{
+	DTYPE carry;
+	size_t i;
+
+	/* words of `t` past the end of `c` must be zero */
+	if (tn > cn - off)
+		tn = cn - off;
+	carry = _add_words(c + off, c + off, t, tn);
+	for (i = off + tn; carry && i < cn; i++)
+		carry = !++c[i];
+}
+
+/* subtract the `tn`-word `t` from the `cn`-word `c`, borrowing up to the top of `c` */
+static inline void _bigint_sub_at(DTYPE *c, size_t cn, DTYPE *t, size_t tn)
+{
+	DTYPE borrow = _sub_words(c, c, t, tn);
+	for (size_t i = tn; borrow && i < cn; i++)
+		borrow = !c[i]--;
+}
+
+/* c = a + b into na + 1 words, with na >= nb */
+static inline void _bigint_add_words(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	memcpy(c, a, sizeof *a * na);
+	c[na] = 0;
+	_bigint_add_at(c, na + 1, 0, b, nb);
+}
+
+static inline void _bigint_mul_words(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb);
+
+/* c = a * b for na >= 2 * nb, one nb-word slice of `a` at a time */
+static inline void _bigint_mul_slices(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	DTYPE *t;
+
+	xmalloc(&t, sizeof *t * 2 * nb, "_bigint_mul_slices() xmalloc()");
+	memset(c, 0, sizeof *c * (na + nb));
+	for (size_t off = 0; off < na; off += nb) {
+		size_t k = (na - off < nb) ? na - off : nb;
+		_bigint_mul_words(t, a + off, k, b, nb);
+		_bigint_add_at(c, na + nb, off, t, k + nb);
+	}
+	free(t);
+}
+
+/*
+ * Karatsuba for nb > (na + 1) / 2: both split at h words, a = a1 * B^h + a0
+ * and b = b1 * B^h + b0, and a0 * b1 + a1 * b0 comes from one product
+ * (a0 + a1) * (b0 + b1) - a0 * b0 - a1 * b1
+ */
+static inline void _bigint_mul_karatsuba(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	DTYPE *sa, *sb, *t;
+	size_t h = (na + 1) / 2;
+
+	xmalloc(&sa, sizeof *sa * (4 * h + 4), "_bigint_mul_karatsuba() xmalloc()");
+	sb = sa + h + 1;
+	t = sb + h + 1;
+	_bigint_add_words(sa, a, h, a + h, na - h);
+	_bigint_add_words(sb, b, h, b + h, nb - h);
+	_bigint_mul_words(c, a, h, b, h);
+	_bigint_mul_words(c + 2 * h, a + h, na - h, b + h, nb - h);
+	_bigint_mul_words(t, sa, h + 1, sb, h + 1);
+	_bigint_sub_at(t, 2 * h + 2, c, 2 * h);
+	_bigint_sub_at(t, 2 * h + 2, c + 2 * h, na + nb - 2 * h);
+	_bigint_add_at(c, na + nb, h, t, 2 * h + 2);
+	free(sa);
+}
+
+/* x = -x over n words */
+static inline void _bigint_neg_words(DTYPE *x, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		x[i] = ~x[i];
+	for (i = 0; i < n && !++x[i]; i++)
+		;
+}
+
+/* x /= 2 over n words in two's complement, for an even x */
+static inline void _bigint_half_words(DTYPE *x, size_t n)
+{
+	for (size_t i = 0; i + 1 < n; i++)
+		x[i] = (x[i] >> 1) | (x[i + 1] << (8 * WORD_SIZE - 1));
+	x[n - 1] = (x[n - 1] >> 1) | (x[n - 1] & (DTYPE)DTYPE_MSB);
+}
+
+/*
+ * x /= 3 over n words in two's complement, for a multiple of 3: each word
+ * of the quotient is the difference times 3^-1 mod B, which is exact mod
+ * B^n and so keeps the sign
+ */
+static inline void _bigint_divexact3_words(DTYPE *x, size_t n)
+{
+	DTYPE const inv3 = (DTYPE)-1 / 3 * 2 + 1, third = (DTYPE)-1 / 3;
+	DTYPE borrow = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		DTYPE s = x[i], d = s - borrow;
+		borrow = d > s;
+		x[i] = d * inv3;
+		borrow += (x[i] > third) + (x[i] > 2 * third);
+	}
+}
+
+/*
+ * x(1), |x(-1)| and x(2) into `e` words each for x = x2 * X^2 + x1 * X + x0
+ * in pieces of `k` words at most; returns whether x(-1) is negative
+ */
+static inline bool _bigint_toom3_eval(DTYPE *p1, DTYPE *pm1, DTYPE *p2, DTYPE *x, size_t nx, size_t k, size_t e)
+{
+	DTYPE *t;
+	size_t l0 = (nx < k) ? nx : k, l1 = (nx - l0 < k) ? nx - l0 : k, l2 = nx - l0 - l1;
+	bool neg;
+
+	xcalloc(&t, 3 * e, sizeof *t, "_bigint_toom3_eval() xcalloc()");
+	memcpy(t, x, sizeof *x * l0);
+	memcpy(t + e, x + l0, sizeof *x * l1);
+	memcpy(t + 2 * e, x + l0 + l1, sizeof *x * l2);
+	/* x0 + x2, then x(1) and x(-1) */
+	_add_words(t, t, t + 2 * e, e);
+	_add_words(p1, t, t + e, e);
+	_sub_words(pm1, t, t + e, e);
+	if ((neg = pm1[e - 1] & (DTYPE)DTYPE_MSB))
+		_bigint_neg_words(pm1, e);
+	/* x(2) = ((2 * x2 + x1) * 2) + x0 */
+	_sub_words(t, t, t + 2 * e, e);
+	_add_words(p2, t + 2 * e, t + 2 * e, e);
+	_add_words(p2, p2, t + e, e);
+	_add_words(p2, p2, p2, e);
+	_add_words(p2, p2, t, e);
+	free(t);
+	return neg;
+}
+
+/*
+ * Toom-3 for nb > (na + 1) / 2: both split into three pieces of k words,
+ * the five products at 0, 1, -1, 2 and infinity are interpolated back into
+ * the five coefficients, in two's complement over w words since the
+ * partial results can go negative
+ */
+static inline void _bigint_mul_toom3(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	size_t k = (na + 2) / 3, e = k + 2, w = 2 * e, cn = na + nb;
+	size_t la2 = na - 2 * k, lb0 = (nb < k) ? nb : k, lb2 = (nb > 2 * k) ? nb - 2 * k : 0;
+	DTYPE *ea, *eb, *r0, *r1, *rm1, *r2, *rinf;
+	DTYPE *coef[5];
+	bool neg;
+
+	xcalloc(&ea, 6 * e + 5 * w, sizeof *ea, "_bigint_mul_toom3() xcalloc()");
+	eb = ea + 3 * e;
+	r0 = eb + 3 * e;
+	r1 = r0 + w, rm1 = r1 + w, r2 = rm1 + w, rinf = r2 + w;
+	neg = _bigint_toom3_eval(ea, ea + e, ea + 2 * e, a, na, k, e);
+	neg ^= _bigint_toom3_eval(eb, eb + e, eb + 2 * e, b, nb, k, e);
+	_bigint_mul_words(r0, a, k, b, lb0);
+	_bigint_mul_words(r1, ea, e, eb, e);
+	_bigint_mul_words(rm1, ea + e, e, eb + e, e);
+	_bigint_mul_words(r2, ea + 2 * e, e, eb + 2 * e, e);
+	if (lb2)
+		_bigint_mul_words(rinf, a + 2 * k, la2, b + 2 * k, lb2);
+	if (neg)
+		_bigint_neg_words(rm1, w);
+
+	/* r2 = (r2 - rm1) / 3, r1 = (r1 - rm1) / 2 and rm1 = rm1 - r0 */
+	_sub_words(r2, r2, rm1, w);
+	_bigint_divexact3_words(r2, w);
+	_sub_words(r1, r1, rm1, w);
+	_bigint_half_words(r1, w);
+	_sub_words(rm1, rm1, r0, w);
+	/* c3 = (r2 - 2 * r1 - rm1) / 2 - 2 * rinf */
+	_sub_words(r2, r2, r1, w);
+	_sub_words(r2, r2, r1, w);
+	_sub_words(r2, r2, rm1, w);
+	_bigint_half_words(r2, w);
+	_sub_words(r2, r2, rinf, w);
+	_sub_words(r2, r2, rinf, w);
+	/* c2 = rm1 + r1 - rinf and c1 = r1 - c3 */
+	_add_words(rm1, rm1, r1, w);
+	_sub_words(rm1, rm1, rinf, w);
+	_sub_words(r1, r1, r2, w);
+
+	/* every coefficient is now non-negative */
+	coef[0] = r0, coef[1] = r1, coef[2] = rm1, coef[3] = r2, coef[4] = rinf;
+	memset(c, 0, sizeof *c * cn);
+	for (size_t i = 0; i < 5 && i * k < cn; i++) {
+		size_t len = w;
+		while (len && !coef[i][len - 1])
+			len--;
+		_bigint_add_at(c, cn, i * k, coef[i], len);
+	}
+	free(ea);
+}
+
+/*
+ * c = a * b into na + nb words, with `c` apart from `a` and `b`: schoolbook,
+ * Karatsuba, Toom-3 or NTT by the length of the shorter operand, and
+ * lopsided operands one slice of the longer at a time
+ */
+static inline void _bigint_mul_words(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	if (na < nb) {
+		DTYPE *p = a;
+		size_t n = na;
+		a = b, na = nb;
+		b = p, nb = n;
+	}
+	if (!nb) {
+		memset(c, 0, sizeof *c * na);
+		return;
+	}
+	if (nb < KARATSUBA_THRESHOLD) {
+		_mul_words(c, a, na, b, nb);
+		return;
+	}
+	if (nb >= NTT_THRESHOLD) {
+		ntt_mul_words(c, a, na, b, nb);
+		return;
+	}
+	/* lopsided operands would leave the top pieces of b empty */
+	if (nb <= (na + 1) / 2) {
+		_bigint_mul_slices(c, a, na, b, nb);
+		return;
+	}
+	if (nb >= TOOM3_THRESHOLD)
+		_bigint_mul_toom3(c, a, na, b, nb);
+	else
+		_bigint_mul_karatsuba(c, a, na, b, nb);
+}
+
+/* c = a * b; `c` may be `a` or `b` */
+static inline void bigint_mul(BIGINT *c, BIGINT const *a, BIGINT const *b)
+{
+	BIGINT t = {0};
+
+	if (!a->len || !b->len) {
+		c->len = 0;
+		return;
+	}
+	bigint_reserve(&t, a->len + b->len);
+	_bigint_mul_words(t.w, a->w, a->len, b->w, b->len);
+	t.len = a->len + b->len;
+	bigint_trim(&t);
+	bigint_free(c);
+	*c = t;
+}
+
+/*
+ * v <= floor(B^2n / m) into n + 2 words for the n-word `m`: the reciprocal
+ * of the top h words, shifted up, is good to about h words, and one Newton
+ * step v = 2v - m * v^2 / B^2n doubles that; the top h words of m are
+ * only good to h - 1 words when its top word is small, so h is two words
+ * over n / 2 to leave the result off by a few units at most
+ */
+static inline void _bigint_recip_words(DTYPE *v, DTYPE *m, size_t n)
+{
+	DTYPE *u, *w, *vh, *s, *p, *x;
+	size_t h, l, i;
+
+	if (n <= RECIP_THRESHOLD) {
+		xcalloc(&u, 5 * n + 3, sizeof *u, "_bigint_recip_words() xcalloc()");
+		w = u + 2 * n + 1;
+		u[2 * n] = 1;
+		_divmod_words(v, NULL, u, 2 * n + 1, m, n, w);
+		free(u);
+		return;
+	}
+
+	h = n / 2 + 2;
+	l = n - h;
+	xcalloc(&vh, (h + 2) + (2 * h + 4) + (3 * n + 8) + (n + 4), sizeof *vh, "_bigint_recip_words() xcalloc()");
+	s = vh + h + 2;
+	p = s + 2 * h + 4;
+	x = p + 3 * n + 8;
+	_bigint_recip_words(vh, m + l, h);
+
+	/* m * v0^2 / B^2n with v0 = vh * B^l is m * vh^2 / B^(2n - 2l) */
+	_bigint_mul_words(s, vh, h + 2, vh, h + 2);
+	_bigint_mul_words(p, m, n, s, 2 * h + 4);
+	/* x = 2 * vh * B^l - that, in n + 4 words */
+	memcpy(x + l, vh, sizeof *vh * (h + 2));
+	_bigint_add_at(x, n + 4, l, vh, h + 2);
+	_bigint_sub_at(x, n + 4, p + 2 * n - 2 * l, n + 4);
+
+	/*
+	 * a Newton step never lands above B^2n / m, and flooring the product
+	 * above costs at most one unit, so x - 1 is a lower bound a few units
+	 * below at most, which is all `_bigint_barrett_words()` needs
+	 */
+	for (i = 0; !x[i]--; i++)
+		;
+	memcpy(v, x, sizeof *v * (n + 2));
+	free(vh);
+}
+
+/* v = floor(B^2n / m), or a few units below, for the n-word `m`, for `bigint_mod()` */
+static inline void bigint_recip(BIGINT *restrict v, BIGINT const *restrict m)
+{
+	require(m->len, "division by zero");
+	bigint_reserve(v, m->len + 2);
+	_bigint_recip_words(v->w, m->w, m->len);
+	v->len = m->len + 2;
+	bigint_trim(v);
+}
+
+/*
+ * r = a mod m for an `na`-word a with n <= na <= 2n, into n words of `r`:
+ * q = (a / B^(n - 1)) * v / B^(n + 1) is a few units below the quotient,
+ * and only needs the top words of a
+ */
+static inline void _bigint_barrett_words(DTYPE *r, DTYPE *a, size_t na, DTYPE *m, size_t n, DTYPE *v, size_t nv)
+{
+	DTYPE *p, *q, *t;
+	size_t nh = na - (n - 1), np = nh + nv, nq;
+
+	xmalloc(&p, sizeof *p * (np + na + np + n), "_bigint_barrett_words() xmalloc()");
+	_bigint_mul_words(p, a + n - 1, nh, v, nv);
+	nq = (np > n + 1) ? np - (n + 1) : 0;
+	q = p + n + 1;
+	while (nq && !q[nq - 1])
+		nq--;
+	/* a - q * m, which fits in the low words of a */
+	t = p + np;
+	memcpy(t, a, sizeof *a * na);
+	if (nq) {
+		DTYPE *qm = t + na;
+		_bigint_mul_words(qm, q, nq, m, n);
+		/* the top word of q * m is zero if it does not fit */
+		_bigint_sub_at(t, na, qm, (nq + n < na) ? nq + n : na);
+	}
+	for (;;) {
+		size_t dn = na;
+		while (dn && !t[dn - 1])
+			dn--;
+		if (_cmp_words(t, dn, m, n) == SMALLER)
+			break;
+		_bigint_sub_at(t, na, m, n);
+	}
+	memcpy(r, t, sizeof *r * n);
+	free(p);
+}
+
+/* r = a mod m given v from `bigint_recip(v, m)`; `r` may be `a` */
+static inline void bigint_mod(BIGINT *r, BIGINT const *a, BIGINT const *m, BIGINT const *v)
+{
+	BIGINT t = {0};
+	size_t n = m->len;
+
+	require(n, "division by zero");
+	if (bigint_cmp(a, m) == SMALLER) {
+		if (r != a)
+			bigint_copy(r, a);
+		return;
+	}
+	bigint_copy(&t, a);
+	/* fold the top 2n words into n words until the rest fits */
+	while (t.len > 2 * n) {
+		size_t off = t.len - 2 * n;
+		_bigint_barrett_words(t.w + off, t.w + off, 2 * n, m->w, n, v->w, v->len);
+		memset(t.w + off + n, 0, sizeof *t.w * n);
+		t.len = off + n;
+		bigint_trim(&t);
+	}
+	if (t.len >= n) {
+		_bigint_barrett_words(t.w, t.w, t.len, m->w, n, v->w, v->len);
+		t.len = n;
+		bigint_trim(&t);
+	}
+	bigint_free(r);
+	*r = t;
+}
+
+#endif
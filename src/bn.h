@@ -31,20 +31,34 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 /* This macro defines the word size in bytes of the array that constitues the big-number data structure. */
+/* 64-bit words need a 128-bit type for intermediate results. */
 #ifndef WORD_SIZE
+ #if defined(__SIZEOF_INT128__)
+  #define WORD_SIZE 8
+ #else
   #define WORD_SIZE 4
+ #endif
+#endif
+
+/* Size of big-numbers in bytes; override to hold larger operands (e.g. 512 for 4096-bit RSA) */
+#ifndef BN_BYTES
+  #define BN_BYTES 128
 #endif
+#define BN_ARRAY_SIZE    (BN_BYTES / WORD_SIZE)
 
-/* Size of big-numbers in bytes */
-#define BN_ARRAY_SIZE    (128 / WORD_SIZE)
+/* Largest sliding window used by bignum_powmod() and the fixed window of bignum_powmod_sec() */
+#define BN_WINDOW_MAX    6
+#define BN_WINDOW_SEC    4
 
 
 /* Here comes the compile-time specialization for how large the underlying array size should be. */
-/* The choices are 1, 2 and 4 bytes in size with uint32, uint64 for WORD_SIZE==4, as temporary. */
+/* The choices are 1, 2, 4 and 8 bytes in size with uint32, uint64 for WORD_SIZE==4 and */
+/* unsigned __int128 for WORD_SIZE==8 as temporary. */
 #ifndef WORD_SIZE
-  #error Must define WORD_SIZE to be 1, 2, 4
+  #error Must define WORD_SIZE to be 1, 2, 4, 8
 #elif (WORD_SIZE == 1)
   /* Data type of array in structure */
   #define DTYPE                    uint8_t
@@ -52,39 +66,99 @@
   #define DTYPE_MSB                ((DTYPE_TMP)(0x80))
   /* Data-type larger than DTYPE, for holding intermediate results of calculations */
   #define DTYPE_TMP                uint32_t
-  /* sprintf format string */
-  #define SPRINTF_FORMAT_STR       "%.02x"
-  #define SSCANF_FORMAT_STR        "%2hhx"
   /* Max value of integer type */
   #define MAX_VAL                  ((DTYPE_TMP)0xFF)
 #elif (WORD_SIZE == 2)
   #define DTYPE                    uint16_t
   #define DTYPE_TMP                uint32_t
   #define DTYPE_MSB                ((DTYPE_TMP)(0x8000))
-  #define SPRINTF_FORMAT_STR       "%.04x"
-  #define SSCANF_FORMAT_STR        "%4hx"
   #define MAX_VAL                  ((DTYPE_TMP)0xFFFF)
 #elif (WORD_SIZE == 4)
   #define DTYPE                    uint32_t
   #define DTYPE_TMP                uint64_t
   #define DTYPE_MSB                ((DTYPE_TMP)(0x80000000))
-  #define SPRINTF_FORMAT_STR       "%.08x"
-  #define SSCANF_FORMAT_STR        "%8x"
   #define MAX_VAL                  ((DTYPE_TMP)0xFFFFFFFF)
+#elif (WORD_SIZE == 8)
+  __extension__ typedef unsigned __int128 bn_uint128_t;
+  #define DTYPE                    uint64_t
+  #define DTYPE_TMP                bn_uint128_t
+  #define DTYPE_MSB                ((DTYPE_TMP)(0x8000000000000000))
+  #define MAX_VAL                  ((DTYPE_TMP)0xFFFFFFFFFFFFFFFF)
+#endif
+/* Byte-swap one word, for big-endian loads and stores on little-endian hosts */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+ #if (WORD_SIZE == 1)
+  #define DTYPE_BSWAP(w)           (w)
+ #elif (WORD_SIZE == 2)
+  #define DTYPE_BSWAP(w)           __builtin_bswap16(w)
+ #elif (WORD_SIZE == 4)
+  #define DTYPE_BSWAP(w)           __builtin_bswap32(w)
+ #elif (WORD_SIZE == 8)
+  #define DTYPE_BSWAP(w)           __builtin_bswap64(w)
+ #endif
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  #define DTYPE_BSWAP(w)           (w)
 #endif
 #ifndef DTYPE
-  #error DTYPE must be defined to uint8_t, uint16_t uint32_t or whatever
+  #error DTYPE must be defined to uint8_t, uint16_t, uint32_t, uint64_t or whatever
+#endif
+
+
+/* MULX/ADCX/ADOX multiply-accumulate rows on x86-64, selected at runtime through cpuid */
+#if (WORD_SIZE == 8) && defined(__x86_64__) && defined(__GNUC__) && !defined(BN_NO_ASM)
+  #include <cpuid.h>
+  #include <stdatomic.h>
+  #define BN_ASM_ADX               1
+  /*
+    -1 until bignum_use_asm() has looked at the CPU; weak, so every translation
+    unit including this header shares the one flag
+  */
+  __attribute__((weak)) _Atomic int _bn_adx = -1;
+  #define BN_ASM_ROWS              (_bn_asm_rows())
+  #define BN_MULADD_ASM(r, a, n, b) _muladd_words_adx(r, a, n, b)
+#else
+  #define BN_ASM_ROWS              0
+  #define BN_MULADD_ASM(r, a, n, b) ((DTYPE)0)
 #endif
 
 
 /* Custom assert macro - easy to disable */
-#define require(p, msg) assert(p && #msg)
+#define require(p, msg) assert((p) && #msg)
 
 
-/* Data-holding structure: array of DTYPEs */
+/*
+  Data-holding structure: array of DTYPEs, least significant word first.
+  Only the low `top` words are meaningful and array[top - 1] is never zero;
+  words above them hold garbage. Code that writes `array` directly should
+  start from bignum_init() and finish with bignum_normalize().
+*/
 struct bn
 {
   DTYPE array[BN_ARRAY_SIZE];
+  int top;  /* words in use */
+};
+
+
+/* Fixed-width kernels on nwords-word operands, see BN_DEFINE_KERNELS() */
+struct bn_kernel
+{
+  int nwords;
+  DTYPE (*add)(DTYPE* c, DTYPE* a, DTYPE* b);              /* c = a + b, returns carry */
+  DTYPE (*sub)(DTYPE* c, DTYPE* a, DTYPE* b);              /* c = a - b, returns borrow */
+  void (*mul)(DTYPE* c, DTYPE* a, DTYPE* b);               /* 2 * nwords-word c = a * b */
+  void (*sqr)(DTYPE* c, DTYPE* a);                         /* 2 * nwords-word c = a * a */
+  void (*redc)(DTYPE* c, DTYPE* t, DTYPE* n, DTYPE ninv);  /* c = t / R mod n */
+};
+
+
+/* Montgomery context for repeated multiplication modulo an odd n */
+struct bn_mont
+{
+  struct bn n;   /* modulus, zero-padded to nwords words */
+  struct bn rr;  /* R^2 mod n, with R = 2^(nwords * bits per word) */
+  DTYPE ninv;    /* -n^-1 mod 2^(bits per word) */
+  int nwords;    /* words per operand: those of n, or rounded up to a kernel width */
+  const struct bn_kernel* kern; /* fixed-width kernels for nwords, or NULL */
 };
 
 
@@ -92,12 +166,27 @@ struct bn
 enum { SMALLER = -1, EQUAL = 0, LARGER = 1 };
 
 
+/* Hex conversion tables: digit values are tagged with 0x10 so invalid characters map to 0 */
+static const char _bn_hex_digits[] = "0123456789abcdef";
+static const unsigned char _bn_hex_val[256] =
+{
+  ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+  ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+  ['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e, ['f'] = 0x1f,
+  ['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d, ['E'] = 0x1e, ['F'] = 0x1f,
+};
+
+
 /* Initialization functions: */
 static inline void bignum_init(struct bn* n);
+static inline void bignum_normalize(struct bn* n);                       /* Recompute n->top after writing n->array */
 static inline void bignum_from_int(struct bn* n, DTYPE_TMP i);
 static inline int  bignum_to_int(struct bn* n);
 static inline void bignum_from_string(struct bn* n, char* str, int nbytes);
 static inline void bignum_to_string(struct bn* n, char* str, int maxsize);
+static inline void bignum_from_bytes(struct bn* n, const unsigned char* buf, size_t len); /* Big-endian, e.g. MPI.mdata */
+static inline int  bignum_to_bytes(struct bn* n, unsigned char* buf, size_t len);        /* Zero-padded to len, non-zero if truncated */
+static inline int  bignum_num_bytes(struct bn* n);                                        /* Bytes needed by bignum_to_bytes() */
 
 /* Basic arithmetic operations: */
 static inline void bignum_add(struct bn* a, struct bn* b, struct bn* c); /* c = a + b */
@@ -105,6 +194,7 @@ static inline void bignum_sub(struct bn* a, struct bn* b, struct bn* c); /* c =
 static inline void bignum_mul(struct bn* a, struct bn* b, struct bn* c); /* c = a * b */
 static inline void bignum_div(struct bn* a, struct bn* b, struct bn* c); /* c = a / b */
 static inline void bignum_mod(struct bn* a, struct bn* b, struct bn* c); /* c = a % b */
+static inline void bignum_divmod(struct bn* a, struct bn* b, struct bn* c, struct bn* d); /* c = a / b, d = a % b */
 
 /* Bitwise operations: */
 static inline void bignum_and(struct bn* a, struct bn* b, struct bn* c); /* c = a & b */
@@ -119,14 +209,54 @@ static inline int  bignum_is_zero(struct bn* n);                         /* For
 static inline void bignum_inc(struct bn* n);                             /* Increment: add one to n */
 static inline void bignum_dec(struct bn* n);                             /* Decrement: subtract one from n */
 static inline void bignum_pow(struct bn* a, struct bn* b, struct bn* c); /* Calculate a^b -- e.g. 2^10 => 1024 */
+static inline int  bignum_pow_checked(struct bn* a, struct bn* b, struct bn* c); /* Same, non-zero if a^b was truncated */
 static inline void bignum_assign(struct bn* dst, struct bn* src);        /* Copy src into dst -- dst := src */
 
-
-/* Functions for shifting number in-place. */
-static inline void _lshift_one_bit(struct bn* a);
-static inline void _rshift_one_bit(struct bn* a);
-static inline void _lshift_word(struct bn* a, int nwords);
-static inline void _rshift_word(struct bn* a, int nwords);
+/* Modular exponentiation (odd moduli only) */
+static inline void bignum_powmod(struct bn* a, struct bn* e, struct bn* n, struct bn* c);     /* c = a^e mod n */
+static inline void bignum_powmod_sec(struct bn* a, struct bn* e, struct bn* n, struct bn* c); /* Same, constant-time in e */
+static inline int  bignum_use_asm(int enable);                                                 /* Toggle MULX/ADX paths, returns if in use */
+static inline void bignum_mont_init(struct bn_mont* ctx, struct bn* n);                        /* Precompute n' and R^2 mod n */
+static inline void bignum_mont_mul(struct bn_mont* ctx, struct bn* a, struct bn* b, struct bn* c); /* c = a * b / R mod n */
+static inline void bignum_mont_to(struct bn_mont* ctx, struct bn* a, struct bn* c);            /* c = a * R mod n */
+static inline void bignum_mont_from(struct bn_mont* ctx, struct bn* a, struct bn* c);          /* c = a / R mod n */
+static inline void bignum_mont_powmod(struct bn_mont* ctx, struct bn* a, struct bn* e, struct bn* c);
+static inline void bignum_mont_powmod_sec(struct bn_mont* ctx, struct bn* a, struct bn* e, struct bn* c);
+
+/* Greatest common divisor and modular inverse */
+static inline void bignum_gcd(struct bn* a, struct bn* b, struct bn* c);    /* c = gcd(a, b) */
+static inline void bignum_lcm(struct bn* a, struct bn* b, struct bn* c);    /* c = lcm(a, b) */
+static inline int  bignum_modinv(struct bn* a, struct bn* m, struct bn* c); /* c = a^-1 mod m, non-zero if gcd(a, m) != 1 */
+
+
+/* Word-array helpers. */
+static inline int  _bignum_words(struct bn* a);
+static inline void _bignum_fix_top(struct bn* a, int n);
+static inline DTYPE _bignum_word(struct bn* a, int i);
+static inline void _bignum_pad(struct bn* a, int n);
+static inline DTYPE* _bignum_padded(struct bn* a, int n, DTYPE* scratch);
+static inline void _divmod_words(DTYPE* q, DTYPE* r, DTYPE* u, int m, DTYPE* v, int n, DTYPE* w);
+static inline int  _bignum_bits(struct bn* a);
+static inline DTYPE _load_be(const unsigned char* p);
+static inline void _store_be(unsigned char* p, DTYPE w);
+static inline void _mul_words(DTYPE* c, DTYPE* a, int na, DTYPE* b, int nb);
+static inline DTYPE _muladd_words(DTYPE* r, DTYPE* a, int n, DTYPE b);
+#ifdef BN_ASM_ADX
+static inline DTYPE _muladd_words_adx(DTYPE* r, DTYPE* a, int n, DTYPE b);
+#endif
+static inline int  _bignum_mul_ovf(struct bn* a, struct bn* b, struct bn* c);
+static inline int  _bignum_bit(struct bn* a, int i);
+static inline DTYPE _mont_ninv(DTYPE n0);
+static inline void _mont_mul_words(DTYPE* c, DTYPE* a, DTYPE* b, DTYPE* n, DTYPE ninv, int s);
+static inline const struct bn_kernel* _bn_kernel_find(int n);
+static inline int  _ctz_words(DTYPE* a, int n);
+static inline void _rshift_words(DTYPE* a, int n, int nbits);
+static inline DTYPE _add_words(DTYPE* c, DTYPE* a, DTYPE* b, int n);
+static inline DTYPE _sub_words(DTYPE* c, DTYPE* a, DTYPE* b, int n);
+static inline int  _cmp_words(DTYPE* a, int na, DTYPE* b, int nb);
+static inline void _halve_words(DTYPE* x, DTYPE* m, int n, int nbits, DTYPE ninv);
+static inline void _bingcd_words(DTYPE* u, DTYPE* v, int n, DTYPE* x1, DTYPE* x2, DTYPE* m);
+static inline int  _modinv_odd(DTYPE* x, struct bn* a, struct bn* m);
 
 
 /* Public / Exported functions. */
@@ -139,14 +269,21 @@ static inline void bignum_init(struct bn* n)
   {
     n->array[i] = 0;
   }
+  n->top = 0;
 }
 
 
-static inline void bignum_from_int(struct bn* n, DTYPE_TMP i)
+static inline void bignum_normalize(struct bn* n)
 {
   require(n, "n is null");
 
-  bignum_init(n);
+  _bignum_fix_top(n, BN_ARRAY_SIZE);
+}
+
+
+static inline void bignum_from_int(struct bn* n, DTYPE_TMP i)
+{
+  require(n, "n is null");
 
   /* Endianness issue if machine is not little-endian? */
 #ifdef WORD_SIZE
@@ -163,8 +300,12 @@ static inline void bignum_from_int(struct bn* n, DTYPE_TMP i)
   DTYPE_TMP num_32 = 32;
   DTYPE_TMP tmp = i >> num_32; /* bit-shift with U64 operands to force 64-bit results */
   n->array[1] = tmp;
+ #elif (WORD_SIZE == 8)
+  n->array[0] = (DTYPE)i;
+  n->array[1] = (DTYPE)(i >> 64);
  #endif
 #endif
+  _bignum_fix_top(n, (int)(sizeof(DTYPE_TMP) / WORD_SIZE));
 }
 
 
@@ -173,19 +314,13 @@ static inline int bignum_to_int(struct bn* n)
   require(n, "n is null");
 
   int ret = 0;
+  int i;
 
   /* Endianness issue if machine is not little-endian? */
-#if (WORD_SIZE == 1)
-  ret += n->array[0];
-  ret += n->array[1] << 8;
-  ret += n->array[2] << 16;
-  ret += n->array[3] << 24;
-#elif (WORD_SIZE == 2)
-  ret += n->array[0];
-  ret += n->array[1] << 16;
-#elif (WORD_SIZE == 4)
-  ret += n->array[0];
-#endif
+  for (i = 0; (i < n->top) && ((i * WORD_SIZE) < (int)sizeof(int)); ++i)
+  {
+    ret += (int)((unsigned)n->array[i] << (8 * WORD_SIZE * i));
+  }
 
   return ret;
 }
@@ -195,61 +330,132 @@ static inline void bignum_from_string(struct bn* n, char* str, int nbytes)
 {
   require(n, "n is null");
   require(str, "str is null");
-  require(nbytes > 0, "nbytes must be positive");
-  require((nbytes & 1) == 0, "string format must be in hex -> equal number of bytes");
+  require(nbytes >= 0, "nbytes must not be negative");
 
-  bignum_init(n);
+  int i = nbytes; /* index into string, one past the current word's last digit */
+  int j = 0;      /* index into array */
+  int k;
 
-  DTYPE tmp;                        /* DTYPE is defined in bn.h - uint{8,16,32,64}_t */
-  int i = nbytes - (2 * WORD_SIZE); /* index into string */
-  int j = 0;                        /* index into array */
-
-  /* reading last hex-byte "MSB" from string first -> big endian */
-  /* MSB ~= most significant byte / block ? :) */
-  while (i >= 0)
+  /* reading last hex-digits "LSB" from string first, the top word may be partial */
+  while ((i > 0) && (j < BN_ARRAY_SIZE))
   {
-    tmp = 0;
-    sscanf(&str[i], SSCANF_FORMAT_STR, &tmp);
+    DTYPE tmp = 0;
+    for (k = (i > (2 * WORD_SIZE)) ? (i - (2 * WORD_SIZE)) : 0; k < i; ++k)
+    {
+      unsigned char v = _bn_hex_val[(unsigned char)str[k]];
+      require(v, "string format must be in hex");
+      tmp = (DTYPE)((tmp << 4) | (v & 0x0f));
+    }
     n->array[j] = tmp;
     i -= (2 * WORD_SIZE); /* step WORD_SIZE hex-byte(s) back in the string. */
     j += 1;               /* step one element forward in the array. */
   }
+  _bignum_fix_top(n, j);
 }
 
 
-void bignum_to_string(struct bn* n, char* str, int nbytes)
+static inline void bignum_to_string(struct bn* n, char* str, int nbytes)
 {
   require(n, "n is null");
   require(str, "str is null");
   require(nbytes > 0, "nbytes must be positive");
-  require((nbytes & 1) == 0, "string format must be in hex -> equal number of bytes");
 
-  int j = BN_ARRAY_SIZE - 1; /* index into array - reading "MSB" first -> big-endian */
-  int i = 0;                 /* index into string representation. */
+  int k = (2 * WORD_SIZE * _bignum_words(n)) - 1; /* hex digit index, "MSB" first -> big-endian */
+  int i = 0;                                      /* index into string representation. */
 
-  /* reading last array-element "MSB" first -> big endian */
-  while ((j >= 0) && (nbytes > (i + 1)))
+  /* leading zeros are never emitted, so zero is the empty string */
+  for (; (k >= 0) && (i < (nbytes - 1)); --k)
   {
-    sprintf(&str[i], SPRINTF_FORMAT_STR, n->array[j]);
-    i += (2 * WORD_SIZE); /* step WORD_SIZE hex-byte(s) forward in the string. */
-    j -= 1;               /* step one element back in the array. */
+    unsigned v = (unsigned)(n->array[k / (2 * WORD_SIZE)] >> (4 * (k % (2 * WORD_SIZE)))) & 0x0f;
+    if ((v == 0) && (i == 0))
+    {
+      continue;
+    }
+    str[i++] = _bn_hex_digits[v];
   }
 
-  /* Count leading zeros: */
-  j = 0;
-  while (str[j] == '0')
+  /* Zero-terminate string */
+  str[i] = 0;
+}
+
+
+static inline void bignum_from_bytes(struct bn* n, const unsigned char* buf, size_t len)
+{
+  require(n, "n is null");
+  require((buf != NULL) || (len == 0), "buf is null");
+
+  /* leading zero bytes (e.g. the pad byte in front of MPI.mdata) don't count toward the width */
+  while ((len > 0) && (*buf == 0))
   {
-    j += 1;
+    buf += 1;
+    len -= 1;
   }
+  require(len <= BN_BYTES, "number too large for BN_BYTES");
 
-  /* Move string j places ahead, effectively skipping leading zeros */
-  for (i = 0; i < (nbytes - j); ++i)
+  int j = 0; /* index into array */
+
+  /* whole words from the end of the buffer "LSB" first */
+  while (len >= WORD_SIZE)
+  {
+    len -= WORD_SIZE;
+    n->array[j++] = _load_be(buf + len);
+  }
+  /* partial top word */
+  if (len > 0)
   {
-    str[i] = str[i + j];
+    DTYPE tmp = 0;
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+      tmp = (DTYPE)((tmp << 8) | buf[i]);
+    }
+    n->array[j++] = tmp;
   }
+  _bignum_fix_top(n, j);
+}
 
-  /* Zero-terminate string */
-  str[i] = 0;
+
+static inline int bignum_to_bytes(struct bn* n, unsigned char* buf, size_t len)
+{
+  require(n, "n is null");
+  require((buf != NULL) || (len == 0), "buf is null");
+
+  int j = 0;   /* index into array */
+  int ovf = 0;
+
+  /* whole words into the end of the buffer "LSB" first */
+  while ((len >= WORD_SIZE) && (j < n->top))
+  {
+    len -= WORD_SIZE;
+    _store_be(buf + len, n->array[j++]);
+  }
+  /* partial top word, or zero padding once the number is exhausted */
+  if ((len > 0) && (j < n->top))
+  {
+    DTYPE tmp = n->array[j++];
+    while (len > 0)
+    {
+      buf[--len] = (unsigned char)tmp;
+      tmp = (DTYPE)(tmp >> 8);
+    }
+    ovf |= (tmp != 0);
+  }
+  while (len > 0)
+  {
+    buf[--len] = 0;
+  }
+  /* any word left over is non-zero and did not fit */
+  ovf |= (j < n->top);
+
+  return ovf;
+}
+
+
+static inline int bignum_num_bytes(struct bn* n)
+{
+  require(n, "n is null");
+
+  return (_bignum_bits(n) + 7) / 8;
 }
 
 
@@ -261,7 +467,19 @@ static inline void bignum_dec(struct bn* n)
   DTYPE res;
 
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+
+  /* Zero wraps around to the largest value */
+  if (n->top == 0)
+  {
+    for (i = 0; i < BN_ARRAY_SIZE; ++i)
+    {
+      n->array[i] = (DTYPE)MAX_VAL;
+    }
+    n->top = BN_ARRAY_SIZE;
+    return;
+  }
+
+  for (i = 0; i < n->top; ++i)
   {
     tmp = n->array[i];
     res = tmp - 1;
@@ -272,6 +490,7 @@ static inline void bignum_dec(struct bn* n)
       break;
     }
   }
+  _bignum_fix_top(n, n->top);
 }
 
 
@@ -283,7 +502,7 @@ void bignum_inc(struct bn* n)
   DTYPE_TMP tmp; /* copy of n */
 
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  for (i = 0; i < n->top; ++i)
   {
     tmp = n->array[i];
     res = tmp + 1;
@@ -291,9 +510,20 @@ void bignum_inc(struct bn* n)
 
     if (res > tmp)
     {
-      break;
+      return;
     }
   }
+
+  /* Carry out of the top word; the largest value wraps around to zero */
+  if (n->top < BN_ARRAY_SIZE)
+  {
+    n->array[n->top] = 1;
+    n->top += 1;
+  }
+  else
+  {
+    n->top = 0;
+  }
 }
 
 
@@ -304,14 +534,31 @@ static inline void bignum_add(struct bn* a, struct bn* b, struct bn* c)
   require(c, "c is null");
 
   DTYPE_TMP tmp;
+  DTYPE sa[BN_ARRAY_SIZE], sb[BN_ARRAY_SIZE];
   int carry = 0;
+  int n = (a->top > b->top) ? a->top : b->top;
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  const struct bn_kernel* k = _bn_kernel_find(n);
+  if (k)
+  {
+    carry = k->add(c->array, _bignum_padded(a, k->nwords, sa), _bignum_padded(b, k->nwords, sb));
+    n = k->nwords;
+  }
+  else
+  {
+    for (i = 0; i < n; ++i)
+    {
+      tmp = (DTYPE_TMP)_bignum_word(a, i) + _bignum_word(b, i) + carry;
+      carry = (tmp > MAX_VAL);
+      c->array[i] = (tmp & MAX_VAL);
+    }
+  }
+  if (carry && (n < BN_ARRAY_SIZE))
   {
-    tmp = a->array[i] + b->array[i] + carry;
-    carry = (tmp > MAX_VAL);
-    c->array[i] = (tmp & MAX_VAL);
+    c->array[n] = 1;
+    n += 1;
   }
+  _bignum_fix_top(c, n);
 }
 
 
@@ -324,16 +571,38 @@ void bignum_sub(struct bn* a, struct bn* b, struct bn* c)
   DTYPE_TMP res;
   DTYPE_TMP tmp1;
   DTYPE_TMP tmp2;
+  DTYPE sa[BN_ARRAY_SIZE], sb[BN_ARRAY_SIZE];
   int borrow = 0;
+  int n = (a->top > b->top) ? a->top : b->top;
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  const struct bn_kernel* k = _bn_kernel_find(n);
+  if (k)
+  {
+    borrow = k->sub(c->array, _bignum_padded(a, k->nwords, sa), _bignum_padded(b, k->nwords, sb));
+    n = k->nwords;
+    i = n;
+  }
+  else
+  {
+    for (i = 0; i < n; ++i)
+    {
+      tmp1 = (DTYPE_TMP)_bignum_word(a, i) + (MAX_VAL + 1); /* + number_base */
+      tmp2 = (DTYPE_TMP)_bignum_word(b, i) + borrow;
+      res = (tmp1 - tmp2);
+      c->array[i] = (DTYPE)(res & MAX_VAL); /* "modulo number_base" == "% (number_base - 1)" if number_base is 2^N */
+      borrow = (res <= MAX_VAL);
+    }
+  }
+  /* a < b wraps around modulo the full width */
+  if (borrow)
   {
-    tmp1 = (DTYPE_TMP)a->array[i] + (MAX_VAL + 1); /* + number_base */
-    tmp2 = (DTYPE_TMP)b->array[i] + borrow;;
-    res = (tmp1 - tmp2);
-    c->array[i] = (DTYPE)(res & MAX_VAL); /* "modulo number_base" == "% (number_base - 1)" if number_base is 2^N */
-    borrow = (res <= MAX_VAL);
+    for (; i < BN_ARRAY_SIZE; ++i)
+    {
+      c->array[i] = (DTYPE)MAX_VAL;
+    }
+    n = BN_ARRAY_SIZE;
   }
+  _bignum_fix_top(c, n);
 }
 
 
@@ -343,29 +612,7 @@ static inline void bignum_mul(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
-  struct bn row;
-  struct bn tmp;
-  int i, j;
-
-  bignum_init(c);
-
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
-  {
-    bignum_init(&row);
-
-    for (j = 0; j < BN_ARRAY_SIZE; ++j)
-    {
-      if (i + j < BN_ARRAY_SIZE)
-      {
-        bignum_init(&tmp);
-        DTYPE_TMP intermediate = ((DTYPE_TMP)a->array[i] * (DTYPE_TMP)b->array[j]);
-        bignum_from_int(&tmp, intermediate);
-        _lshift_word(&tmp, i + j);
-        bignum_add(&tmp, &row, &row);
-      }
-    }
-    bignum_add(c, &row, c);
-  }
+  _bignum_mul_ovf(a, b, c);
 }
 
 
@@ -375,33 +622,7 @@ void bignum_div(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
-  struct bn current;
-  struct bn denom;
-  struct bn tmp;
-
-  bignum_from_int(&current, 1);               // int current = 1;
-  bignum_assign(&denom, b);                   // denom = b
-  bignum_assign(&tmp, a);                     // tmp   = a
-
-  while (bignum_cmp(&denom, a) != LARGER)     // while (denom <= a) {
-  {
-    _lshift_one_bit(&current);                //   current <<= 1;
-    _lshift_one_bit(&denom);                  //   denom <<= 1;
-  }
-  _rshift_one_bit(&denom);                    // denom >>= 1;
-  _rshift_one_bit(&current);                  // current >>= 1;
-  bignum_init(c);                             // int answer = 0;
-
-  while (!bignum_is_zero(&current))           // while (current != 0)
-  {
-    if (bignum_cmp(&tmp, &denom) != SMALLER)  //   if (dividend >= denom)
-    {
-      bignum_sub(&tmp, &denom, &tmp);         //     dividend -= denom;
-      bignum_or(c, &current, c);              //     answer |= current;
-    }
-    _rshift_one_bit(&current);                //   current >>= 1;
-    _rshift_one_bit(&denom);                  //   denom >>= 1;
-  }                                           // return answer;
+  bignum_divmod(a, b, c, NULL);
 }
 
 
@@ -414,22 +635,35 @@ static inline void bignum_lshift(struct bn* a, struct bn* b, int nbits)
   /* Handle shift in multiples of word-size */
   const int nbits_pr_word = (WORD_SIZE * 8);
   int nwords = nbits / nbits_pr_word;
-  if (nwords != 0)
+  int na = a->top;
+  int top, i, k;
+  DTYPE hi, lo;
+
+  nbits -= (nwords * nbits_pr_word);
+  if ((na == 0) || (nwords >= BN_ARRAY_SIZE))
   {
-    _lshift_word(a, nwords);
-    nbits -= (nwords * nbits_pr_word);
+    b->top = 0;
+    return;
   }
 
-  if (nbits != 0)
+  /* Most significant word first, so b may alias a: word i only reads words i - nwords and below */
+  top = na + nwords + (nbits != 0);
+  if (top > BN_ARRAY_SIZE)
   {
-    int i;
-    for (i = (BN_ARRAY_SIZE - 1); i > 0; --i)
-    {
-      a->array[i] = (a->array[i] << nbits) | (a->array[i - 1] >> ((8 * WORD_SIZE) - nbits));
-    }
-    a->array[i] <<= nbits;
+    top = BN_ARRAY_SIZE;
+  }
+  for (i = (top - 1); i >= nwords; --i)
+  {
+    k = i - nwords;
+    hi = (k < na) ? a->array[k] : 0;
+    lo = ((k > 0) && (nbits != 0)) ? a->array[k - 1] : 0;
+    b->array[i] = (DTYPE)(hi << nbits) | (DTYPE)(nbits ? (lo >> (nbits_pr_word - nbits)) : 0);
+  }
+  for (; i >= 0; --i)
+  {
+    b->array[i] = 0;
   }
-  bignum_assign(b, a);
+  _bignum_fix_top(b, top);
 }
 
 
@@ -442,47 +676,93 @@ void bignum_rshift(struct bn* a, struct bn* b, int nbits)
   /* Handle shift in multiples of word-size */
   const int nbits_pr_word = (WORD_SIZE * 8);
   int nwords = nbits / nbits_pr_word;
-  if (nwords != 0)
+  int na = a->top;
+  int top, i, k;
+  DTYPE hi, lo;
+
+  nbits -= (nwords * nbits_pr_word);
+  if (nwords >= na)
   {
-    _rshift_word(a, nwords);
-    nbits -= (nwords * nbits_pr_word);
+    b->top = 0;
+    return;
   }
 
-  if (nbits != 0)
+  /* Least significant word first, so b may alias a: word i only reads words i + nwords and above */
+  top = na - nwords;
+  for (i = 0; i < top; ++i)
   {
-    int i;
-    for (i = 0; i < (BN_ARRAY_SIZE - 1); ++i)
-    {
-      a->array[i] = (a->array[i] >> nbits) | (a->array[i + 1] << ((8 * WORD_SIZE) - nbits));
-    }
-    a->array[i] >>= nbits;
+    k = i + nwords;
+    lo = a->array[k];
+    hi = ((k + 1) < na) ? a->array[k + 1] : 0;
+    b->array[i] = (DTYPE)(lo >> nbits) | (DTYPE)(nbits ? (hi << (nbits_pr_word - nbits)) : 0);
   }
-  bignum_assign(b, a);
+  _bignum_fix_top(b, top);
 }
 
 
 static inline void bignum_mod(struct bn* a, struct bn* b, struct bn* c)
+{
+  require(a, "a is null");
+  require(b, "b is null");
+  require(c, "c is null");
+
+  bignum_divmod(a, b, NULL, c);
+}
+
+
+static inline void bignum_divmod(struct bn* a, struct bn* b, struct bn* c, struct bn* d)
 {
   /*
-    mod(a,b) = a - ((a / b) * b)
+    Word-at-a-time long division (Knuth, TAOCP vol. 2, 4.3.1, Algorithm D).
 
-    example:
-      mod(8, 3) = 8 - ((8 / 3) * 3) = 2
+    Either c or d may be NULL when only the quotient or only the remainder
+    is wanted. Results are computed into locals first, so c and d may alias
+    a or b.
   */
   require(a, "a is null");
   require(b, "b is null");
-  require(c, "c is null");
 
-  struct bn tmp;
+  DTYPE q[BN_ARRAY_SIZE];
+  DTYPE r[BN_ARRAY_SIZE];
+  DTYPE w[(2 * BN_ARRAY_SIZE) + 1];
+  int m = _bignum_words(a);
+  int n = _bignum_words(b);
+  int i;
 
-  /* c = (a / b) */
-  bignum_div(a, b, c);
+  require(n > 0, "division by zero");
 
-  /* tmp = (c * b) */
-  bignum_mul(c, b, &tmp);
+  /* Divisor larger than dividend: a / b = 0, a % b = a */
+  if (m < n)
+  {
+    if (d)
+    {
+      bignum_assign(d, a);
+    }
+    if (c)
+    {
+      c->top = 0;
+    }
+    return;
+  }
 
-  /* c = a - tmp */
-  bignum_sub(a, &tmp, c);
+  _divmod_words(q, r, a->array, m, b->array, n, w);
+
+  if (c)
+  {
+    for (i = 0; i <= (m - n); ++i)
+    {
+      c->array[i] = q[i];
+    }
+    _bignum_fix_top(c, m - n + 1);
+  }
+  if (d)
+  {
+    for (i = 0; i < n; ++i)
+    {
+      d->array[i] = r[i];
+    }
+    _bignum_fix_top(d, n);
+  }
 }
 
 
@@ -492,11 +772,13 @@ void bignum_and(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
+  int n = (a->top < b->top) ? a->top : b->top;
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  for (i = 0; i < n; ++i)
   {
     c->array[i] = (a->array[i] & b->array[i]);
   }
+  _bignum_fix_top(c, n);
 }
 
 
@@ -506,11 +788,13 @@ static inline void bignum_or(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
+  int n = (a->top > b->top) ? a->top : b->top;
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  for (i = 0; i < n; ++i)
   {
-    c->array[i] = (a->array[i] | b->array[i]);
+    c->array[i] = (_bignum_word(a, i) | _bignum_word(b, i));
   }
+  c->top = n;
 }
 
 
@@ -520,11 +804,13 @@ void bignum_xor(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
+  int n = (a->top > b->top) ? a->top : b->top;
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  for (i = 0; i < n; ++i)
   {
-    c->array[i] = (a->array[i] ^ b->array[i]);
+    c->array[i] = (_bignum_word(a, i) ^ _bignum_word(b, i));
   }
+  _bignum_fix_top(c, n);
 }
 
 
@@ -533,10 +819,16 @@ static inline int bignum_cmp(struct bn* a, struct bn* b)
   require(a, "a is null");
   require(b, "b is null");
 
-  int i = BN_ARRAY_SIZE;
-  do
+  /* Both are normalized, so the one with more words is larger */
+  if (a->top != b->top)
+  {
+    return (a->top > b->top) ? LARGER : SMALLER;
+  }
+
+  int i = a->top;
+  while (i != 0)
   {
-    i -= 1; /* Decrement first, to start with last array element */
+    i -= 1; /* Decrement first, to start with the top word */
     if (a->array[i] > b->array[i])
     {
       return LARGER;
@@ -546,7 +838,6 @@ static inline int bignum_cmp(struct bn* a, struct bn* b)
       return SMALLER;
     }
   }
-  while (i != 0);
 
   return EQUAL;
 }
@@ -556,16 +847,7 @@ int bignum_is_zero(struct bn* n)
 {
   require(n, "n is null");
 
-  int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
-  {
-    if (n->array[i])
-    {
-      return 0;
-    }
-  }
-
-  return 1;
+  return (n->top == 0);
 }
 
 
@@ -575,37 +857,44 @@ static inline void bignum_pow(struct bn* a, struct bn* b, struct bn* c)
   require(b, "b is null");
   require(c, "c is null");
 
-  struct bn tmp;
+  bignum_pow_checked(a, b, c);
+}
 
-  bignum_init(c);
 
-  if (bignum_cmp(b, c) == EQUAL)
-  {
-    /* Return 1 when exponent is 0 -- n^0 = 1 */
-    bignum_inc(c);
-  }
-  else
-  {
-    /* Copy a -> tmp */
-    bignum_assign(&tmp, a);
+static inline int bignum_pow_checked(struct bn* a, struct bn* b, struct bn* c)
+{
+  /*
+    Left-to-right binary exponentiation: one squaring per bit of b plus
+    one multiplication per set bit. Every intermediate value is a^k for a
+    prefix k of b, so it can only exceed the fixed width if a^b does.
 
-    bignum_dec(b);
+    Returns non-zero if a^b did not fit and c holds a^b truncated to
+    BN_ARRAY_SIZE words. b is left untouched; c may alias a or b.
+  */
+  require(a, "a is null");
+  require(b, "b is null");
+  require(c, "c is null");
 
-    /* Begin summing products: */
-    while (!bignum_is_zero(b))
-    {
+  struct bn base;
+  struct bn acc;
+  int ovf = 0;
+  int i;
 
-      /* c = tmp * tmp */
-      bignum_mul(&tmp, a, c);
-      /* Decrement b by one */
-      bignum_dec(b);
+  bignum_assign(&base, a);
+  bignum_from_int(&acc, 1);
 
-      bignum_assign(&tmp, c);
+  for (i = _bignum_bits(b) - 1; i >= 0; --i)
+  {
+    ovf |= _bignum_mul_ovf(&acc, &acc, &acc);
+    if (_bignum_bit(b, i))
+    {
+      ovf |= _bignum_mul_ovf(&acc, &base, &acc);
     }
-
-    /* c = tmp */
-    bignum_assign(c, &tmp);
   }
+
+  bignum_assign(c, &acc);
+
+  return ovf;
 }
 
 
@@ -615,74 +904,1408 @@ static inline void bignum_assign(struct bn* dst, struct bn* src)
   require(src, "src is null");
 
   int i;
-  for (i = 0; i < BN_ARRAY_SIZE; ++i)
+  for (i = 0; i < src->top; ++i)
   {
     dst->array[i] = src->array[i];
   }
+  dst->top = src->top;
 }
 
 
-/* Private / Static functions. */
-static inline void _rshift_word(struct bn* a, int nwords)
+static inline void bignum_mont_init(struct bn_mont* ctx, struct bn* n)
 {
-  /* Naive method: */
-  require(a, "a is null");
-  require(nwords >= 0, "no negative shifts");
+  require(ctx, "ctx is null");
+  require(n, "n is null");
+  require((n->top > 0) && (n->array[0] & 1), "modulus must be odd");
 
+  DTYPE u[(2 * BN_ARRAY_SIZE) + 1];
+  DTYPE w[(3 * BN_ARRAY_SIZE) + 2];
+  int t = _bignum_words(n);
+  int s = t;
   int i;
-  for (i = 0; i < nwords; ++i)
+
+  /* Round the operand length up to a fixed-width kernel when one is close */
+  ctx->kern = _bn_kernel_find(t);
+  if (ctx->kern)
   {
-    a->array[i] = a->array[i + 1];
+    s = ctx->kern->nwords;
   }
-  for (; i < BN_ARRAY_SIZE; ++i)
+
+  bignum_assign(&ctx->n, n);
+  _bignum_pad(&ctx->n, s);
+  ctx->nwords = s;
+  ctx->ninv = _mont_ninv(n->array[0]);
+
+  /* R^2 mod n, with R = 2^(s * bits per word) */
+  for (i = 0; i < (2 * s); ++i)
   {
-    a->array[i] = 0;
+    u[i] = 0;
   }
+  u[2 * s] = 1;
+  _divmod_words(NULL, ctx->rr.array, u, (2 * s) + 1, n->array, t, w);
+  _bignum_fix_top(&ctx->rr, t);
 }
 
 
-static inline void _lshift_word(struct bn* a, int nwords)
+static inline void bignum_mont_mul(struct bn_mont* ctx, struct bn* a, struct bn* b, struct bn* c)
 {
+  require(ctx, "ctx is null");
   require(a, "a is null");
-  require(nwords >= 0, "no negative shifts");
+  require(b, "b is null");
+  require(c, "c is null");
 
-  int i;
-  /* Shift whole words */
-  for (i = (BN_ARRAY_SIZE - 1); i >= nwords; --i)
+  DTYPE t[2 * BN_ARRAY_SIZE], sa[BN_ARRAY_SIZE], sb[BN_ARRAY_SIZE];
+  /* The kernels read all nwords words of a and b and write all nwords words of c */
+  DTYPE* pa = _bignum_padded(a, ctx->nwords, sa);
+  DTYPE* pb = (a == b) ? pa : _bignum_padded(b, ctx->nwords, sb);
+
+  if (ctx->kern)
   {
-    a->array[i] = a->array[i - nwords];
+    if (a == b)
+    {
+      ctx->kern->sqr(t, pa);
+    }
+    else
+    {
+      ctx->kern->mul(t, pa, pb);
+    }
+    ctx->kern->redc(c->array, t, ctx->n.array, ctx->ninv);
   }
-  /* Zero pad shifted words. */
-  for (; i >= 0; --i)
+  else
   {
-    a->array[i] = 0;
+    _mont_mul_words(c->array, pa, pb, ctx->n.array, ctx->ninv, ctx->nwords);
   }
+  _bignum_fix_top(c, ctx->nwords);
 }
 
 
-static inline void _lshift_one_bit(struct bn* a)
+static inline void bignum_mont_to(struct bn_mont* ctx, struct bn* a, struct bn* c)
 {
+  require(ctx, "ctx is null");
   require(a, "a is null");
+  require(c, "c is null");
 
-  int i;
-  for (i = (BN_ARRAY_SIZE - 1); i > 0; --i)
-  {
-    a->array[i] = (a->array[i] << 1) | (a->array[i - 1] >> ((8 * WORD_SIZE) - 1));
-  }
-  a->array[0] <<= 1;
+  struct bn tmp;
+
+  /* c = (a mod n) * R^2 * R^-1 = a * R mod n */
+  bignum_mod(a, &ctx->n, &tmp);
+  bignum_mont_mul(ctx, &tmp, &ctx->rr, c);
 }
 
 
-static inline void _rshift_one_bit(struct bn* a)
+static inline void bignum_mont_from(struct bn_mont* ctx, struct bn* a, struct bn* c)
 {
+  require(ctx, "ctx is null");
   require(a, "a is null");
+  require(c, "c is null");
 
-  int i;
-  for (i = 0; i < (BN_ARRAY_SIZE - 1); ++i)
+  struct bn one;
+
+  /* c = a * 1 * R^-1 mod n */
+  bignum_from_int(&one, 1);
+  bignum_mont_mul(ctx, a, &one, c);
+}
+
+
+static inline void bignum_mont_powmod(struct bn_mont* ctx, struct bn* a, struct bn* e, struct bn* c)
+{
+  /*
+    Left-to-right sliding-window exponentiation: squarings for every
+    exponent bit, but only one multiplication per window of up to
+    `wbits` bits, using a table of the odd powers a^1, a^3, ... a^(2^wbits - 1).
+
+    Running time depends on the exponent; use bignum_mont_powmod_sec()
+    for secret exponents.
+  */
+  require(ctx, "ctx is null");
+  require(a, "a is null");
+  require(e, "e is null");
+  require(c, "c is null");
+
+  struct bn table[1 << (BN_WINDOW_MAX - 1)];
+  struct bn acc;
+  struct bn sqr;
+  int ebits = _bignum_bits(e);
+  int wbits, i, l, val;
+  int started = 0;
+
+  /* Window size by exponent length, trading table setup for multiplications */
+  wbits = (ebits > 671) ? 6 : (ebits > 239) ? 5 : (ebits > 79) ? 4 : (ebits > 23) ? 3 : 1;
+
+  bignum_mont_to(ctx, a, &table[0]);
+  bignum_mont_mul(ctx, &table[0], &table[0], &sqr);
+  for (i = 1; i < (1 << (wbits - 1)); ++i)
   {
-    a->array[i] = (a->array[i] >> 1) | (a->array[i + 1] << ((8 * WORD_SIZE) - 1));
+    bignum_mont_mul(ctx, &table[i - 1], &sqr, &table[i]);
   }
-  a->array[BN_ARRAY_SIZE - 1] >>= 1;
-}
+
+  /* acc = 1 in Montgomery form, for the zero exponent */
+  bignum_from_int(&acc, 1);
+  bignum_mont_to(ctx, &acc, &acc);
+
+  i = ebits - 1;
+  while (i >= 0)
+  {
+    if (!_bignum_bit(e, i))
+    {
+      if (started)
+      {
+        bignum_mont_mul(ctx, &acc, &acc, &acc);
+      }
+      i -= 1;
+      continue;
+    }
+
+    /* Longest window of at most wbits bits that ends in a one bit */
+    l = (wbits < (i + 1)) ? wbits : (i + 1);
+    while (!_bignum_bit(e, i - l + 1))
+    {
+      l -= 1;
+    }
+    val = 0;
+    for (int j = i; j > (i - l); --j)
+    {
+      val = (val << 1) | _bignum_bit(e, j);
+    }
+
+    if (started)
+    {
+      for (int j = 0; j < l; ++j)
+      {
+        bignum_mont_mul(ctx, &acc, &acc, &acc);
+      }
+      bignum_mont_mul(ctx, &acc, &table[val >> 1], &acc);
+    }
+    else
+    {
+      bignum_assign(&acc, &table[val >> 1]);
+      started = 1;
+    }
+    i -= l;
+  }
+
+  bignum_mont_from(ctx, &acc, c);
+}
+
+
+static inline void bignum_mont_powmod_sec(struct bn_mont* ctx, struct bn* a, struct bn* e, struct bn* c)
+{
+  /*
+    Fixed-window exponentiation for secret exponents: every window costs
+    the same squarings and one multiplication, and every table entry is
+    read on each lookup, so neither timing nor memory access pattern
+    depends on the exponent bits. Only the exponent's word length leaks.
+  */
+  require(ctx, "ctx is null");
+  require(a, "a is null");
+  require(e, "e is null");
+  require(c, "c is null");
+
+  struct bn table[1 << BN_WINDOW_SEC];
+  struct bn acc;
+  struct bn sel;
+  int s = ctx->nwords;
+  int ewords = _bignum_words(e);
+  int nbits = ((ewords > s) ? ewords : s) * (8 * WORD_SIZE);
+  int i, j, k;
+  unsigned idx;
+  DTYPE mask;
+
+  /* table[k] = a^k in Montgomery form */
+  bignum_from_int(&table[0], 1);
+  bignum_mont_to(ctx, &table[0], &table[0]);
+  bignum_mont_to(ctx, a, &table[1]);
+  for (k = 2; k < (1 << BN_WINDOW_SEC); ++k)
+  {
+    bignum_mont_mul(ctx, &table[k - 1], &table[1], &table[k]);
+  }
+
+  bignum_assign(&acc, &table[0]);
+  for (i = nbits - BN_WINDOW_SEC; i >= 0; i -= BN_WINDOW_SEC)
+  {
+    for (j = 0; j < BN_WINDOW_SEC; ++j)
+    {
+      bignum_mont_mul(ctx, &acc, &acc, &acc);
+    }
+
+    idx = 0;
+    for (j = (BN_WINDOW_SEC - 1); j >= 0; --j)
+    {
+      idx = (idx << 1) | (unsigned)_bignum_bit(e, i + j);
+    }
+
+    /* Masked scan over the whole table instead of indexing it */
+    for (j = 0; j < s; ++j)
+    {
+      sel.array[j] = 0;
+    }
+    for (k = 0; k < (1 << BN_WINDOW_SEC); ++k)
+    {
+      mask = (DTYPE)((DTYPE)0 - (DTYPE)((((unsigned)k ^ idx) - 1) >> ((8 * sizeof(unsigned)) - 1)));
+      for (j = 0; j < s; ++j)
+      {
+        sel.array[j] |= (table[k].array[j] & mask);
+      }
+    }
+    _bignum_fix_top(&sel, s);
+    bignum_mont_mul(ctx, &acc, &sel, &acc);
+  }
+
+  bignum_mont_from(ctx, &acc, c);
+}
+
+
+static inline void bignum_powmod(struct bn* a, struct bn* e, struct bn* n, struct bn* c)
+{
+  require(a, "a is null");
+  require(e, "e is null");
+  require(n, "n is null");
+  require(c, "c is null");
+
+  struct bn_mont ctx;
+
+  bignum_mont_init(&ctx, n);
+  bignum_mont_powmod(&ctx, a, e, c);
+}
+
+
+static inline void bignum_powmod_sec(struct bn* a, struct bn* e, struct bn* n, struct bn* c)
+{
+  require(a, "a is null");
+  require(e, "e is null");
+  require(n, "n is null");
+  require(c, "c is null");
+
+  struct bn_mont ctx;
+
+  bignum_mont_init(&ctx, n);
+  bignum_mont_powmod_sec(&ctx, a, e, c);
+}
+
+
+static inline void bignum_gcd(struct bn* a, struct bn* b, struct bn* c)
+{
+  /*
+    Binary (Stein) gcd: strip the common power of two, then subtract the
+    smaller odd number from the larger and shift out the new zero bits,
+    which only needs word-array subtractions and shifts, no divisions.
+  */
+  require(a, "a is null");
+  require(b, "b is null");
+  require(c, "c is null");
+
+  DTYPE u[BN_ARRAY_SIZE];
+  DTYPE v[BN_ARRAY_SIZE];
+  int n = (a->top > b->top) ? a->top : b->top;
+  int ka, kb, i;
+
+  /* gcd(a, 0) = a */
+  if (a->top == 0 || b->top == 0)
+  {
+    bignum_assign(c, (a->top == 0) ? b : a);
+    return;
+  }
+  for (i = 0; i < n; ++i)
+  {
+    u[i] = _bignum_word(a, i);
+    v[i] = _bignum_word(b, i);
+  }
+  ka = _ctz_words(u, n);
+  kb = _ctz_words(v, n);
+  _rshift_words(u, n, ka);
+  _rshift_words(v, n, kb);
+  _bingcd_words(u, v, n, NULL, NULL, NULL);
+
+  for (i = 0; i < n; ++i)
+  {
+    c->array[i] = u[i];
+  }
+  _bignum_fix_top(c, n);
+  bignum_lshift(c, c, (ka < kb) ? ka : kb);
+}
+
+
+static inline void bignum_lcm(struct bn* a, struct bn* b, struct bn* c)
+{
+  require(a, "a is null");
+  require(b, "b is null");
+  require(c, "c is null");
+
+  struct bn g;
+
+  /* lcm(a, 0) = 0 */
+  if (a->top == 0 || b->top == 0)
+  {
+    c->top = 0;
+    return;
+  }
+  /* a / gcd(a, b) * b, dividing first so only the result can overflow */
+  bignum_gcd(a, b, &g);
+  bignum_div(a, &g, &g);
+  bignum_mul(&g, b, c);
+}
+
+
+static inline int bignum_modinv(struct bn* a, struct bn* m, struct bn* c)
+{
+  /*
+    Odd moduli go straight to the binary extended gcd. For even m the
+    inverse only exists for odd a, and comes from the inverse of m modulo
+    a instead: with y = m^-1 mod a, (1 + m * (a - y)) is divisible by a
+    and the quotient x satisfies a * x = 1 mod m.
+  */
+  require(a, "a is null");
+  require(m, "m is null");
+  require(c, "c is null");
+  require(m->top > 0, "modulus is zero");
+
+  DTYPE t[2 * BN_ARRAY_SIZE];
+  DTYPE q[2 * BN_ARRAY_SIZE];
+  DTYPE w[(3 * BN_ARRAY_SIZE) + 1];
+  struct bn r, y;
+  int nm = m->top;
+  int nt, nq, i;
+
+  bignum_mod(a, m, &r);
+  /* Everything is congruent to zero modulo one */
+  if ((nm == 1) && (m->array[0] == 1))
+  {
+    c->top = 0;
+    return 0;
+  }
+  if (m->array[0] & 1)
+  {
+    /* Through r, since c may alias m */
+    if (_modinv_odd(r.array, &r, m))
+    {
+      c->top = 0;
+      return 1;
+    }
+    _bignum_fix_top(&r, nm);
+    bignum_assign(c, &r);
+    return 0;
+  }
+  if ((r.top == 0) || !(r.array[0] & 1))
+  {
+    c->top = 0;
+    return 1;
+  }
+  if ((r.top == 1) && (r.array[0] == 1))
+  {
+    bignum_from_int(c, 1);
+    return 0;
+  }
+
+  /* y = (m mod r)^-1 mod r, then t = m * (r - y) + 1 and x = t / r */
+  bignum_mod(m, &r, &y);
+  if (_modinv_odd(y.array, &y, &r))
+  {
+    c->top = 0;
+    return 1;
+  }
+  _bignum_fix_top(&y, r.top);
+  bignum_sub(&r, &y, &y);
+  _mul_words(t, m->array, nm, y.array, y.top);
+  nt = nm + y.top;
+  i = 0;
+  while (++t[i] == 0)
+  {
+    i += 1;
+  }
+  while (t[nt - 1] == 0)
+  {
+    nt -= 1;
+  }
+  _divmod_words(q, NULL, t, nt, r.array, r.top, w);
+  /* x < m, so the quotient fits in the words of m */
+  nq = nt - r.top + 1;
+  nq = (nq < nm) ? nq : nm;
+  for (i = 0; i < nq; ++i)
+  {
+    c->array[i] = q[i];
+  }
+  _bignum_fix_top(c, nq);
+
+  return 0;
+}
+
+
+#ifdef BN_ASM_ADX
+/* Whether the cpu has MULX and ADX */
+static inline int _bn_cpu_adx(void)
+{
+  unsigned eax, ebx = 0, ecx, edx;
+
+  /* cpuid leaf 7: EBX bit 8 is BMI2 (mulx), bit 19 is ADX (adcx/adox) */
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+  {
+    return 0;
+  }
+
+  return (int)(((ebx >> 8) & 1) & ((ebx >> 19) & 1));
+}
+
+
+/* The flag, probing the cpu the first time without overriding a bignum_use_asm() call racing with it */
+static inline int _bn_asm_rows(void)
+{
+  int adx = atomic_load_explicit(&_bn_adx, memory_order_relaxed);
+
+  if (adx < 0)
+  {
+    int expected = -1;
+    adx = _bn_cpu_adx();
+    if (!atomic_compare_exchange_strong(&_bn_adx, &expected, adx))
+    {
+      adx = expected;
+    }
+  }
+
+  return adx;
+}
+#endif
+
+
+static inline int bignum_use_asm(int enable)
+{
+  /*
+    The first multiplication probes the cpu by itself; call it with 0 to
+    force the portable C loops everywhere, e.g. for cross-checking, and
+    with 1 to go back to the fastest rows the cpu has.
+  */
+#ifdef BN_ASM_ADX
+  int adx = enable && _bn_cpu_adx();
+
+  atomic_store(&_bn_adx, adx);
+
+  return adx;
+#else
+  (void)enable;
+
+  return 0;
+#endif
+}
+
+
+/* Private / Static functions. */
+static inline int _bignum_words(struct bn* a)
+{
+  require(a, "a is null");
+
+  /* Number of words up to and including the most significant non-zero one */
+  return a->top;
+}
+
+
+static inline void _bignum_fix_top(struct bn* a, int n)
+{
+  /* Set top from the low n words, dropping leading zero words */
+  while ((n > 0) && (a->array[n - 1] == 0))
+  {
+    n -= 1;
+  }
+  a->top = n;
+}
+
+
+static inline DTYPE _bignum_word(struct bn* a, int i)
+{
+  return (i < a->top) ? a->array[i] : 0;
+}
+
+
+static inline void _bignum_pad(struct bn* a, int n)
+{
+  /* Zero the words from top up to n, for kernels working on fixed word counts; the value is unchanged */
+  int i;
+  for (i = a->top; i < n; ++i)
+  {
+    a->array[i] = 0;
+  }
+}
+
+
+static inline DTYPE* _bignum_padded(struct bn* a, int n, DTYPE* scratch)
+{
+  /*
+    The words of a zero-padded to n for the kernels, copied into scratch
+    unless a already fills them; inputs are never written, so keys and
+    montgomery contexts can be shared between threads
+  */
+  int i;
+
+  if (a->top >= n)
+  {
+    return a->array;
+  }
+  for (i = 0; i < a->top; ++i)
+  {
+    scratch[i] = a->array[i];
+  }
+  for (; i < n; ++i)
+  {
+    scratch[i] = 0;
+  }
+
+  return scratch;
+}
+
+
+static inline void _divmod_words(DTYPE* q, DTYPE* r, DTYPE* u, int m, DTYPE* v, int n, DTYPE* w)
+{
+  /*
+    Divide the m-word number u by the n-word number v, with v[n - 1] != 0
+    and m >= n. The (m - n + 1)-word quotient goes to q and the n-word
+    remainder to r; either may be NULL. w is scratch space of at least
+    (m + n + 1) words.
+  */
+  require(u, "u is null");
+  require(v, "v is null");
+  require(w, "w is null");
+  require((n > 0) && (m >= n), "dividend must be at least as long as divisor");
+  require(v[n - 1] != 0, "divisor has a leading zero word");
+
+  const int nbits = (8 * WORD_SIZE);
+  DTYPE* un = w;              /* normalized dividend, m + 1 words */
+  DTYPE* vn = w + (m + 1);    /* normalized divisor, n words */
+  DTYPE_TMP qhat, rhat, p, t;
+  DTYPE k, borrow;
+  int s, i, j;
+
+  /* Fast path for single-word divisors: plain short division */
+  if (n == 1)
+  {
+    rhat = 0;
+    for (j = (m - 1); j >= 0; --j)
+    {
+      t = (rhat << nbits) | u[j];
+      if (q)
+      {
+        q[j] = (DTYPE)(t / v[0]);
+      }
+      rhat = t % v[0];
+    }
+    if (r)
+    {
+      r[0] = (DTYPE)rhat;
+    }
+    return;
+  }
+
+  /* Normalize so the top bit of the divisor is set; this keeps every
+     quotient-word estimate below within 2 of the true value. */
+  s = 0;
+  while (((DTYPE)(v[n - 1] << s) & DTYPE_MSB) == 0)
+  {
+    s += 1;
+  }
+  for (i = (n - 1); i > 0; --i)
+  {
+    vn[i] = (DTYPE)(v[i] << s) | (DTYPE)(s ? (v[i - 1] >> (nbits - s)) : 0);
+  }
+  vn[0] = (DTYPE)(v[0] << s);
+  un[m] = (DTYPE)(s ? (u[m - 1] >> (nbits - s)) : 0);
+  for (i = (m - 1); i > 0; --i)
+  {
+    un[i] = (DTYPE)(u[i] << s) | (DTYPE)(s ? (u[i - 1] >> (nbits - s)) : 0);
+  }
+  un[0] = (DTYPE)(u[0] << s);
+
+  for (j = (m - n); j >= 0; --j)
+  {
+    /* Estimate the quotient word from the top two dividend words */
+    t = ((DTYPE_TMP)un[j + n] << nbits) | un[j + n - 1];
+    qhat = t / vn[n - 1];
+    rhat = t % vn[n - 1];
+    while ((qhat > MAX_VAL) || ((qhat * vn[n - 2]) > ((rhat << nbits) | un[j + n - 2])))
+    {
+      qhat -= 1;
+      rhat += vn[n - 1];
+      if (rhat > MAX_VAL)
+      {
+        break;
+      }
+    }
+
+    /* Multiply and subtract: un[j .. j + n] -= qhat * vn */
+    k = 0;
+    borrow = 0;
+    for (i = 0; i < n; ++i)
+    {
+      p = (qhat * vn[i]) + k;
+      k = (DTYPE)(p >> nbits);
+      t = (DTYPE_TMP)un[i + j] - (DTYPE)p - borrow;
+      un[i + j] = (DTYPE)t;
+      borrow = (DTYPE)((t >> nbits) != 0);
+    }
+    t = (DTYPE_TMP)un[j + n] - k - borrow;
+    un[j + n] = (DTYPE)t;
+
+    /* Estimate was still one too large (rare): add the divisor back */
+    if ((t >> nbits) != 0)
+    {
+      qhat -= 1;
+      k = 0;
+      for (i = 0; i < n; ++i)
+      {
+        t = (DTYPE_TMP)un[i + j] + vn[i] + k;
+        un[i + j] = (DTYPE)t;
+        k = (DTYPE)(t >> nbits);
+      }
+      un[j + n] += k;
+    }
+    if (q)
+    {
+      q[j] = (DTYPE)qhat;
+    }
+  }
+
+  /* Undo the normalization shift on the remainder */
+  if (r)
+  {
+    for (i = 0; i < (n - 1); ++i)
+    {
+      r[i] = (DTYPE)(un[i] >> s) | (DTYPE)(s ? (un[i + 1] << (nbits - s)) : 0);
+    }
+    r[n - 1] = (DTYPE)(un[n - 1] >> s);
+  }
+}
+
+
+static inline int _bignum_bits(struct bn* a)
+{
+  require(a, "a is null");
+
+  int n = _bignum_words(a);
+  int bits = 0;
+
+  if (n == 0)
+  {
+    return 0;
+  }
+  DTYPE top = a->array[n - 1];
+  while (top)
+  {
+    top >>= 1;
+    bits += 1;
+  }
+
+  return ((n - 1) * (8 * WORD_SIZE)) + bits;
+}
+
+
+static inline int _bignum_bit(struct bn* a, int i)
+{
+  require(a, "a is null");
+
+  int w = i / (8 * WORD_SIZE);
+
+  return (w < a->top) ? (int)((a->array[w] >> (i % (8 * WORD_SIZE))) & 1) : 0;
+}
+
+
+static inline DTYPE _load_be(const unsigned char* p)
+{
+#ifdef DTYPE_BSWAP
+  DTYPE w;
+  memcpy(&w, p, WORD_SIZE);
+  return DTYPE_BSWAP(w);
+#else
+  DTYPE w = 0;
+  int i;
+  for (i = 0; i < WORD_SIZE; ++i)
+  {
+    w = (DTYPE)((w << 8) | p[i]);
+  }
+  return w;
+#endif
+}
+
+
+static inline void _store_be(unsigned char* p, DTYPE w)
+{
+#ifdef DTYPE_BSWAP
+  w = DTYPE_BSWAP(w);
+  memcpy(p, &w, WORD_SIZE);
+#else
+  int i;
+  for (i = WORD_SIZE - 1; i >= 0; --i)
+  {
+    p[i] = (unsigned char)w;
+    w = (DTYPE)(w >> 8);
+  }
+#endif
+}
+
+
+static inline void _mul_words(DTYPE* c, DTYPE* a, int na, DTYPE* b, int nb)
+{
+  /* Schoolbook product of an na-word and an nb-word number into (na + nb) words of c */
+  int i;
+
+  for (i = 0; i < nb; ++i)
+  {
+    c[i] = 0;
+  }
+  for (i = 0; i < na; ++i)
+  {
+    c[i + nb] = _muladd_words(c + i, b, nb, a[i]);
+  }
+}
+
+
+static inline DTYPE _muladd_words(DTYPE* r, DTYPE* a, int n, DTYPE b)
+{
+  /* r[0 .. n) += a[0 .. n) * b, returns the carry word */
+  DTYPE_TMP cs;
+  DTYPE carry = 0;
+  int i;
+
+  if (BN_ASM_ROWS)
+  {
+    return BN_MULADD_ASM(r, a, n, b);
+  }
+  for (i = 0; i < n; ++i)
+  {
+    cs = (DTYPE_TMP)r[i] + ((DTYPE_TMP)a[i] * b) + carry;
+    r[i] = (DTYPE)cs;
+    carry = (DTYPE)(cs >> (8 * WORD_SIZE));
+  }
+
+  return carry;
+}
+
+
+#ifdef BN_ASM_ADX
+static inline DTYPE _muladd_words_adx(DTYPE* r, DTYPE* a, int n, DTYPE b)
+{
+  /*
+    Same as _muladd_words() with two interleaved carry chains: adcx adds
+    the low product words into r through CF, while adox adds the high word
+    of the previous product through OF. mulx, mov, lea and jrcxz leave the
+    flags alone, so neither chain is ever broken inside the loop.
+  */
+  uint64_t lo, hi, prev;
+  uint64_t cnt = (uint64_t)n;
+
+  __asm__ volatile (
+    "xor %k[prev], %k[prev]\n\t"  /* prev = 0, clears CF and OF */
+    "jrcxz 2f\n"
+    "1:\n\t"
+    "mulx (%[a]), %[lo], %[hi]\n\t"
+    "adcx (%[r]), %[lo]\n\t"
+    "adox %[prev], %[lo]\n\t"
+    "mov %[lo], (%[r])\n\t"
+    "mov %[hi], %[prev]\n\t"
+    "lea 8(%[a]), %[a]\n\t"
+    "lea 8(%[r]), %[r]\n\t"
+    "lea -1(%%rcx), %%rcx\n\t"
+    "jrcxz 2f\n\t"
+    "jmp 1b\n"
+    "2:\n\t"
+    "mov $0, %k[lo]\n\t"          /* carry = prev + CF + OF, which cannot overflow */
+    "adcx %[lo], %[prev]\n\t"
+    "adox %[lo], %[prev]\n\t"
+    : [r] "+r" (r), [a] "+r" (a), [lo] "=&r" (lo), [hi] "=&r" (hi), [prev] "=&r" (prev), "+c" (cnt)
+    : "d" (b)
+    : "cc", "memory");
+
+  return prev;
+}
+#endif
+
+
+static inline int _bignum_mul_ovf(struct bn* a, struct bn* b, struct bn* c)
+{
+  /* c = a * b truncated to the fixed width; returns non-zero if anything was cut off */
+  DTYPE t[2 * BN_ARRAY_SIZE];
+  int na = a->top;
+  int nb = b->top;
+  int nc = (na && nb) ? (na + nb) : 0;
+  int ovf = 0;
+  int i;
+  const struct bn_kernel* k = _bn_kernel_find(na);
+
+  /* Both operands close to the same kernel width: pad them and use it */
+  if (k && (k == _bn_kernel_find(nb)))
+  {
+    DTYPE sa[BN_ARRAY_SIZE], sb[BN_ARRAY_SIZE];
+    if (a == b)
+    {
+      k->sqr(t, _bignum_padded(a, k->nwords, sa));
+    }
+    else
+    {
+      k->mul(t, _bignum_padded(a, k->nwords, sa), _bignum_padded(b, k->nwords, sb));
+    }
+    nc = 2 * k->nwords;
+  }
+  else
+  {
+    _mul_words(t, a->array, na, b->array, nb);
+  }
+  for (i = 0; (i < nc) && (i < BN_ARRAY_SIZE); ++i)
+  {
+    c->array[i] = t[i];
+  }
+  _bignum_fix_top(c, i);
+  for (i = BN_ARRAY_SIZE; i < nc; ++i)
+  {
+    ovf |= (t[i] != 0);
+  }
+
+  return ovf;
+}
+
+
+static inline DTYPE _mont_ninv(DTYPE n0)
+{
+  /*
+    Newton iteration for n0^-1 mod 2^(bits per word): any odd n0 is its own
+    inverse mod 8, and every step doubles the number of correct low bits.
+  */
+  DTYPE_TMP x = n0;
+  int i;
+  for (i = 0; i < 5; ++i)
+  {
+    x = (DTYPE)(x * (DTYPE)(2 - (DTYPE)(x * n0)));
+  }
+
+  return (DTYPE)(0 - x);
+}
+
+
+static inline void _mont_mul_words(DTYPE* c, DTYPE* a, DTYPE* b, DTYPE* n, DTYPE ninv, int s)
+{
+  /*
+    Montgomery product c = a * b * R^-1 mod n of s-word operands below n,
+    interleaving each row of the product with one word of reduction
+    (coarsely integrated operand scanning). c may alias a or b.
+  */
+  const int nbits = (8 * WORD_SIZE);
+  DTYPE t[BN_ARRAY_SIZE + 2];
+  DTYPE d[BN_ARRAY_SIZE];
+  DTYPE_TMP cs;
+  DTYPE m, carry, borrow, mask;
+  int i, j;
+
+  for (j = 0; j < (s + 2); ++j)
+  {
+    t[j] = 0;
+  }
+
+  for (i = 0; i < s; ++i)
+  {
+    /* t += a * b[i] */
+    carry = 0;
+    for (j = 0; j < s; ++j)
+    {
+      cs = (DTYPE_TMP)t[j] + ((DTYPE_TMP)a[j] * b[i]) + carry;
+      t[j] = (DTYPE)cs;
+      carry = (DTYPE)(cs >> nbits);
+    }
+    cs = (DTYPE_TMP)t[s] + carry;
+    t[s] = (DTYPE)cs;
+    t[s + 1] = (DTYPE)(cs >> nbits);
+
+    /* t = (t + m * n) / 2^nbits, with m chosen to clear the low word */
+    m = (DTYPE)((DTYPE_TMP)t[0] * ninv);
+    cs = (DTYPE_TMP)t[0] + ((DTYPE_TMP)m * n[0]);
+    carry = (DTYPE)(cs >> nbits);
+    for (j = 1; j < s; ++j)
+    {
+      cs = (DTYPE_TMP)t[j] + ((DTYPE_TMP)m * n[j]) + carry;
+      t[j - 1] = (DTYPE)cs;
+      carry = (DTYPE)(cs >> nbits);
+    }
+    cs = (DTYPE_TMP)t[s] + carry;
+    t[s - 1] = (DTYPE)cs;
+    t[s] = t[s + 1] + (DTYPE)(cs >> nbits);
+  }
+
+  /* t < 2n: subtract n once, selecting the result without branching */
+  borrow = 0;
+  for (j = 0; j < s; ++j)
+  {
+    cs = (DTYPE_TMP)t[j] - n[j] - borrow;
+    d[j] = (DTYPE)cs;
+    borrow = (DTYPE)((cs >> nbits) != 0);
+  }
+  mask = (DTYPE)((DTYPE)0 - (DTYPE)(t[s] < borrow));
+  for (j = 0; j < s; ++j)
+  {
+    c[j] = (t[j] & mask) | (d[j] & (DTYPE)~mask);
+  }
+}
+
+
+static inline int _ctz_words(DTYPE* a, int n)
+{
+  /* Trailing zero bits of the non-zero n-word number a */
+  int i, k;
+
+  for (i = 0; a[i] == 0; ++i)
+  {
+    require(i + 1 < n, "a is zero");
+  }
+#if defined(__GNUC__)
+  k = __builtin_ctzll((unsigned long long)a[i]);
+#else
+  DTYPE w = a[i];
+  for (k = 0; !(w & 1); ++k)
+  {
+    w >>= 1;
+  }
+#endif
+
+  return (i * (8 * WORD_SIZE)) + k;
+}
+
+
+static inline void _rshift_words(DTYPE* a, int n, int nbits)
+{
+  /* a >>= nbits in place, over n words */
+  const int nbits_pr_word = (8 * WORD_SIZE);
+  const int ws = nbits / nbits_pr_word;
+  const int bs = nbits % nbits_pr_word;
+  DTYPE lo, hi;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    lo = ((i + ws) < n) ? a[i + ws] : 0;
+    hi = ((i + ws + 1) < n) ? a[i + ws + 1] : 0;
+    a[i] = (DTYPE)(lo >> bs) | (DTYPE)(bs ? (hi << (nbits_pr_word - bs)) : 0);
+  }
+}
+
+
+static inline DTYPE _add_words(DTYPE* c, DTYPE* a, DTYPE* b, int n)
+{
+  /* c = a + b over n words, returns the carry */
+  DTYPE_TMP cs;
+  DTYPE carry = 0;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    cs = (DTYPE_TMP)a[i] + b[i] + carry;
+    c[i] = (DTYPE)cs;
+    carry = (DTYPE)(cs >> (8 * WORD_SIZE));
+  }
+
+  return carry;
+}
+
+
+static inline DTYPE _sub_words(DTYPE* c, DTYPE* a, DTYPE* b, int n)
+{
+  /* c = a - b over n words, returns the borrow */
+  DTYPE_TMP cs;
+  DTYPE borrow = 0;
+  int i;
+
+  for (i = 0; i < n; ++i)
+  {
+    cs = (DTYPE_TMP)a[i] - b[i] - borrow;
+    c[i] = (DTYPE)cs;
+    borrow = (DTYPE)((cs >> (8 * WORD_SIZE)) != 0);
+  }
+
+  return borrow;
+}
+
+
+static inline int _cmp_words(DTYPE* a, int na, DTYPE* b, int nb)
+{
+  /* Compare an na-word and an nb-word number without leading zero words */
+  int i;
+
+  if (na != nb)
+  {
+    return (na > nb) ? LARGER : SMALLER;
+  }
+  for (i = na - 1; i >= 0; --i)
+  {
+    if (a[i] != b[i])
+    {
+      return (a[i] > b[i]) ? LARGER : SMALLER;
+    }
+  }
+
+  return EQUAL;
+}
+
+
+static inline void _halve_words(DTYPE* x, DTYPE* m, int n, int nbits, DTYPE ninv)
+{
+  /*
+    x = x / 2^nbits mod m, for x < m with m odd and 0 < nbits <= bits per word.
+    As in a Montgomery reduction step, adding the right multiple of m
+    clears the low nbits bits, so up to a whole word of halvings costs a
+    single multiply-accumulate row instead of one addition per bit.
+  */
+  const int nbits_pr_word = (8 * WORD_SIZE);
+  DTYPE t = (DTYPE)((DTYPE_TMP)x[0] * ninv);
+  DTYPE carry;
+  int i;
+
+  if (nbits < nbits_pr_word)
+  {
+    t &= (DTYPE)(((DTYPE)1 << nbits) - 1);
+  }
+  carry = _muladd_words(x, m, n, t);
+  if (nbits == nbits_pr_word)
+  {
+    for (i = 0; i < (n - 1); ++i)
+    {
+      x[i] = x[i + 1];
+    }
+    x[n - 1] = carry;
+    return;
+  }
+  for (i = 0; i < (n - 1); ++i)
+  {
+    x[i] = (DTYPE)(x[i] >> nbits) | (DTYPE)(x[i + 1] << (nbits_pr_word - nbits));
+  }
+  x[n - 1] = (DTYPE)(x[n - 1] >> nbits) | (DTYPE)(carry << (nbits_pr_word - nbits));
+}
+
+
+static inline void _bingcd_words(DTYPE* u, DTYPE* v, int n, DTYPE* x1, DTYPE* x2, DTYPE* m)
+{
+  /*
+    Binary gcd of the odd n-word numbers u and v, left in both.
+
+    When x1 and x2 are given, they are kept as cofactors modulo the odd
+    n-word m: if x1 * a = u and x2 * a = v mod m on entry, that still
+    holds on return, so for gcd 1 both end up as a^-1 mod m. The working
+    lengths of u and v shrink as they do, so the subtractions and shifts
+    get cheaper towards the end.
+  */
+  const int nbits_pr_word = (8 * WORD_SIZE);
+  DTYPE ninv = m ? _mont_ninv(m[0]) : 0;
+  DTYPE* p;
+  int nu = n, nv = n;
+  int k, s, cmp;
+
+  while ((nu > 0) && (u[nu - 1] == 0))
+  {
+    nu -= 1;
+  }
+  while ((nv > 0) && (v[nv - 1] == 0))
+  {
+    nv -= 1;
+  }
+  while ((cmp = _cmp_words(u, nu, v, nv)) != EQUAL)
+  {
+    /* Keep the larger one in u */
+    if (cmp == SMALLER)
+    {
+      p = u, u = v, v = p;
+      p = x1, x1 = x2, x2 = p;
+      k = nu, nu = nv, nv = k;
+    }
+    _sub_words(u, u, v, nu);
+    k = _ctz_words(u, nu);
+    _rshift_words(u, nu, k);
+    while ((nu > 0) && (u[nu - 1] == 0))
+    {
+      nu -= 1;
+    }
+    if (x1)
+    {
+      if (_sub_words(x1, x1, x2, n))
+      {
+        _add_words(x1, x1, m, n);
+      }
+      for (; k > 0; k -= s)
+      {
+        s = (k < nbits_pr_word) ? k : nbits_pr_word;
+        _halve_words(x1, m, n, s, ninv);
+      }
+    }
+  }
+}
+
+
+static inline int _modinv_odd(DTYPE* x, struct bn* a, struct bn* m)
+{
+  /*
+    Inverse of a < m modulo the odd m into m->top words of x, which may
+    alias a->array but not m->array; returns non-zero if there is none.
+  */
+  DTYPE u[BN_ARRAY_SIZE];
+  DTYPE v[BN_ARRAY_SIZE];
+  DTYPE x2[BN_ARRAY_SIZE];
+  DTYPE ninv = _mont_ninv(m->array[0]);
+  const int n = m->top;
+  int k, s, i;
+
+  if (a->top == 0)
+  {
+    return 1;
+  }
+  for (i = 0; i < n; ++i)
+  {
+    u[i] = _bignum_word(a, i);
+    v[i] = m->array[i];
+    x[i] = 0;
+    x2[i] = 0;
+  }
+  x[0] = 1;
+  /* x = 2^-k mod m for the k zero bits shifted out of u */
+  k = _ctz_words(u, n);
+  _rshift_words(u, n, k);
+  for (; k > 0; k -= s)
+  {
+    s = (k < (8 * WORD_SIZE)) ? k : (8 * WORD_SIZE);
+    _halve_words(x, m->array, n, s, ninv);
+  }
+  _bingcd_words(u, v, n, x, x2, m->array);
+
+  /* u = v = gcd(a, m) */
+  if (u[0] != 1)
+  {
+    return 1;
+  }
+  for (i = 1; i < n; ++i)
+  {
+    if (u[i] != 0)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+  Fixed-width kernels for the common RSA sizes, and 1536 bits for the
+  CRT halves of 3072-bit keys.
+
+  BN_DEFINE_KERNELS(bits) expands to add, sub, mul, sqr and Montgomery
+  reduction routines whose word counts are compile-time constants, with
+  the inner loops fully unrolled, so carries can stay in registers
+  instead of being reloaded at every iteration of a generic loop.
+  Operands are exactly BN_KWORDS(bits) words; callers zero-pad shorter
+  numbers first. _bn_kernel_find() picks a width at runtime.
+*/
+#define BN_KWORDS(bits)          ((bits) / (8 * WORD_SIZE))
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8))
+  #define BN_UNROLL              _Pragma("GCC unroll 128")
+#else
+  #define BN_UNROLL
+#endif
+
+#define BN_DEFINE_KERNELS(bits)                                                          \
+static inline DTYPE _bn_add_##bits(DTYPE* c, DTYPE* a, DTYPE* b)                         \
+{                                                                                        \
+  /* c = a + b, returns the carry out */                                                 \
+  DTYPE_TMP cs = 0;                                                                      \
+  int i;                                                                                 \
+  BN_UNROLL                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    cs += (DTYPE_TMP)a[i] + b[i];                                                        \
+    c[i] = (DTYPE)cs;                                                                    \
+    cs >>= (8 * WORD_SIZE);                                                              \
+  }                                                                                      \
+  return (DTYPE)cs;                                                                      \
+}                                                                                        \
+                                                                                         \
+static inline DTYPE _bn_sub_##bits(DTYPE* c, DTYPE* a, DTYPE* b)                         \
+{                                                                                        \
+  /* c = a - b, returns the borrow out */                                                \
+  DTYPE_TMP cs;                                                                          \
+  DTYPE borrow = 0;                                                                      \
+  int i;                                                                                 \
+  BN_UNROLL                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    cs = (DTYPE_TMP)a[i] - b[i] - borrow;                                                \
+    c[i] = (DTYPE)cs;                                                                    \
+    borrow = (DTYPE)((cs >> (8 * WORD_SIZE)) & 1);                                       \
+  }                                                                                      \
+  return borrow;                                                                         \
+}                                                                                        \
+                                                                                         \
+static inline void _bn_mul_##bits(DTYPE* c, DTYPE* a, DTYPE* b)                          \
+{                                                                                        \
+  /* c = a * b, 2 * BN_KWORDS(bits) words; c must not alias a or b */                    \
+  DTYPE_TMP cs;                                                                          \
+  DTYPE carry;                                                                           \
+  int i, j;                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    c[i] = 0;                                                                            \
+  }                                                                                      \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    if (BN_ASM_ROWS)                                                                     \
+    {                                                                                    \
+      c[i + BN_KWORDS(bits)] = BN_MULADD_ASM(c + i, b, BN_KWORDS(bits), a[i]);           \
+      continue;                                                                          \
+    }                                                                                    \
+    carry = 0;                                                                           \
+    BN_UNROLL                                                                            \
+    for (j = 0; j < BN_KWORDS(bits); ++j)                                                \
+    {                                                                                    \
+      cs = (DTYPE_TMP)c[i + j] + ((DTYPE_TMP)a[i] * b[j]) + carry;                       \
+      c[i + j] = (DTYPE)cs;                                                              \
+      carry = (DTYPE)(cs >> (8 * WORD_SIZE));                                            \
+    }                                                                                    \
+    c[i + BN_KWORDS(bits)] = carry;                                                      \
+  }                                                                                      \
+}                                                                                        \
+                                                                                         \
+static inline void _bn_sqr_##bits(DTYPE* c, DTYPE* a)                                    \
+{                                                                                        \
+  /* c = a * a: each cross product once, doubled, then the squares on the diagonal */    \
+  DTYPE_TMP cs;                                                                          \
+  DTYPE carry;                                                                           \
+  int i, j;                                                                              \
+  for (i = 0; i < (2 * BN_KWORDS(bits)); ++i)                                            \
+  {                                                                                      \
+    c[i] = 0;                                                                            \
+  }                                                                                      \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    if (BN_ASM_ROWS)                                                                     \
+    {                                                                                    \
+      c[i + BN_KWORDS(bits)] =                                                           \
+        BN_MULADD_ASM(c + (2 * i) + 1, a + i + 1, BN_KWORDS(bits) - i - 1, a[i]);        \
+      continue;                                                                          \
+    }                                                                                    \
+    carry = 0;                                                                           \
+    for (j = i + 1; j < BN_KWORDS(bits); ++j)                                            \
+    {                                                                                    \
+      cs = (DTYPE_TMP)c[i + j] + ((DTYPE_TMP)a[i] * a[j]) + carry;                       \
+      c[i + j] = (DTYPE)cs;                                                              \
+      carry = (DTYPE)(cs >> (8 * WORD_SIZE));                                            \
+    }                                                                                    \
+    c[i + BN_KWORDS(bits)] = carry;                                                      \
+  }                                                                                      \
+  carry = 0;                                                                             \
+  BN_UNROLL                                                                              \
+  for (i = 0; i < (2 * BN_KWORDS(bits)); ++i)                                            \
+  {                                                                                      \
+    DTYPE top = (DTYPE)(c[i] >> ((8 * WORD_SIZE) - 1));                                  \
+    c[i] = (DTYPE)(c[i] << 1) | carry;                                                   \
+    carry = top;                                                                         \
+  }                                                                                      \
+  carry = 0;                                                                             \
+  BN_UNROLL                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    cs = (DTYPE_TMP)c[2 * i] + ((DTYPE_TMP)a[i] * a[i]) + carry;                         \
+    c[2 * i] = (DTYPE)cs;                                                                \
+    cs = (DTYPE_TMP)c[(2 * i) + 1] + (cs >> (8 * WORD_SIZE));                            \
+    c[(2 * i) + 1] = (DTYPE)cs;                                                          \
+    carry = (DTYPE)(cs >> (8 * WORD_SIZE));                                              \
+  }                                                                                      \
+}                                                                                        \
+                                                                                         \
+static inline void _bn_redc_##bits(DTYPE* c, DTYPE* t, DTYPE* n, DTYPE ninv)             \
+{                                                                                        \
+  /* c = t * R^-1 mod n for a 2 * BN_KWORDS(bits)-word t < n * R; t is clobbered */      \
+  DTYPE d[BN_KWORDS(bits)];                                                              \
+  DTYPE_TMP cs;                                                                          \
+  DTYPE m, carry, borrow, mask;                                                          \
+  DTYPE extra = 0;                                                                       \
+  int i, j;                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    m = (DTYPE)((DTYPE_TMP)t[i] * ninv);                                                 \
+    carry = 0;                                                                           \
+    if (BN_ASM_ROWS)                                                                     \
+    {                                                                                    \
+      carry = BN_MULADD_ASM(t + i, n, BN_KWORDS(bits), m);                               \
+    }                                                                                    \
+    else                                                                                 \
+    {                                                                                    \
+      BN_UNROLL                                                                          \
+      for (j = 0; j < BN_KWORDS(bits); ++j)                                              \
+      {                                                                                  \
+        cs = (DTYPE_TMP)t[i + j] + ((DTYPE_TMP)m * n[j]) + carry;                        \
+        t[i + j] = (DTYPE)cs;                                                            \
+        carry = (DTYPE)(cs >> (8 * WORD_SIZE));                                          \
+      }                                                                                  \
+    }                                                                                    \
+    /* the carry out of t[i + N] is picked up by the next row */                         \
+    cs = (DTYPE_TMP)t[i + BN_KWORDS(bits)] + carry + extra;                              \
+    t[i + BN_KWORDS(bits)] = (DTYPE)cs;                                                  \
+    extra = (DTYPE)(cs >> (8 * WORD_SIZE));                                              \
+  }                                                                                      \
+  /* (extra, t high half) < 2n: subtract n once, selecting without branching */          \
+  borrow = _bn_sub_##bits(d, t + BN_KWORDS(bits), n);                                    \
+  mask = (DTYPE)((DTYPE)0 - (DTYPE)(extra < borrow));                                    \
+  BN_UNROLL                                                                              \
+  for (i = 0; i < BN_KWORDS(bits); ++i)                                                  \
+  {                                                                                      \
+    c[i] = (t[i + BN_KWORDS(bits)] & mask) | (d[i] & (DTYPE)~mask);                      \
+  }                                                                                      \
+}
+
+#define BN_KERNEL_ENTRY(bits) \
+  { BN_KWORDS(bits), _bn_add_##bits, _bn_sub_##bits, _bn_mul_##bits, _bn_sqr_##bits, _bn_redc_##bits }
+
+#if (BN_BYTES >= 128)
+BN_DEFINE_KERNELS(1024)
+#endif
+#if (BN_BYTES >= 192)
+BN_DEFINE_KERNELS(1536)
+#endif
+#if (BN_BYTES >= 256)
+BN_DEFINE_KERNELS(2048)
+#endif
+#if (BN_BYTES >= 384)
+BN_DEFINE_KERNELS(3072)
+#endif
+#if (BN_BYTES >= 512)
+BN_DEFINE_KERNELS(4096)
+#endif
+
+/* Specialized widths in increasing order, terminated by a zero entry */
+static const struct bn_kernel _bn_kernels[] =
+{
+#ifndef BN_NO_KERNELS
+ #if (BN_BYTES >= 128)
+  BN_KERNEL_ENTRY(1024),
+ #endif
+ #if (BN_BYTES >= 192)
+  BN_KERNEL_ENTRY(1536),
+ #endif
+ #if (BN_BYTES >= 256)
+  BN_KERNEL_ENTRY(2048),
+ #endif
+ #if (BN_BYTES >= 384)
+  BN_KERNEL_ENTRY(3072),
+ #endif
+ #if (BN_BYTES >= 512)
+  BN_KERNEL_ENTRY(4096),
+ #endif
+#endif
+  { 0, NULL, NULL, NULL, NULL, NULL },
+};
+
+
+static inline const struct bn_kernel* _bn_kernel_find(int n)
+{
+  /* Smallest specialized width holding n words, unless n would fill less than half of it */
+  const struct bn_kernel* k;
+  for (k = _bn_kernels; k->nwords != 0; ++k)
+  {
+    if (n <= k->nwords)
+    {
+      return ((2 * n) > k->nwords) ? k : NULL;
+    }
+  }
+
+  return NULL;
+}
+
 
 #endif /* #ifndef _BIGNUM_H */
@@ -0,0 +1,243 @@
+/*
+ * cdata.c:	streaming decompression of compressed data packets
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "cdata.h"
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_BZ2
+# include <bzlib.h>
+#endif
+
+/*
+ * the state behind a `cdata_open()` stream: at most one window of
+ * compressed octets is held, and the decompressed ones go straight into
+ * the buffer stdio hands `cdata_read()`
+ */
+typedef struct _cdata_stream {
+	FILE *src;
+	/* compressed octets of the packet not yet read from `src`, `SIZE_MAX` if it runs to the end */
+	size_t left;
+	int algo;
+	/* the compressed stream ended, or was corrupt */
+	bool done;
+	/* compressed octets read but not yet decompressed */
+	u8 const *next;
+	size_t avail;
+#ifdef HAVE_ZLIB
+	z_stream z;
+#endif
+#ifdef HAVE_BZ2
+	bz_stream bz;
+#endif
+	u8 in[CDATA_WINDOW];
+} CDATA_STREAM;
+
+bool cdata_supported(int algo)
+{
+	switch (algo) {
+	case CMPR_RAW:
+		return true;
+#ifdef HAVE_ZLIB
+	case CMPR_ZIP: /* fallthrough */
+	case CMPR_ZLIB:
+		return true;
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2:
+		return true;
+#endif
+	}
+
+	return false;
+}
+
+/* read the next window of the packet; returns false at its end */
+static bool cdata_fill(CDATA_STREAM *restrict st)
+{
+	size_t want = (st->left < sizeof st->in) ? st->left : sizeof st->in, got;
+
+	if (!want)
+		return false;
+	got = fread(st->in, 1, want, st->src);
+	if (st->left != SIZE_MAX)
+		st->left -= got;
+	/* a short packet ends where the file does */
+	if (got < want)
+		st->left = 0;
+	st->next = st->in;
+	st->avail = got;
+
+	return got;
+}
+
+/* decompress what is available into `buf`; returns the octets written */
+static size_t cdata_step(CDATA_STREAM *restrict st, u8 *restrict buf, size_t size)
+{
+	size_t got = 0;
+
+	switch (st->algo) {
+	case CMPR_RAW:
+		got = (st->avail < size) ? st->avail : size;
+		memcpy(buf, st->next, got);
+		st->next += got;
+		st->avail -= got;
+		break;
+#ifdef HAVE_ZLIB
+	case CMPR_ZIP: /* fallthrough */
+	case CMPR_ZLIB: {
+		int ret;
+		st->z.next_in = (Bytef *)st->next;
+		st->z.avail_in = st->avail;
+		st->z.next_out = buf;
+		st->z.avail_out = (size < UINT_MAX) ? size : UINT_MAX;
+		ret = inflate(&st->z, Z_NO_FLUSH);
+		got = ((size < UINT_MAX) ? size : UINT_MAX) - st->z.avail_out;
+		st->next = st->z.next_in;
+		st->avail = st->z.avail_in;
+		if (ret == Z_STREAM_END) {
+			st->done = true;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			WARNXMSG("corrupt compressed data packet:", st->z.msg ? st->z.msg : "inflate() failed");
+			st->done = true;
+		}
+		break;
+	}
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2: {
+		int ret;
+		st->bz.next_in = (char *)st->next;
+		st->bz.avail_in = st->avail;
+		st->bz.next_out = (char *)buf;
+		st->bz.avail_out = (size < UINT_MAX) ? size : UINT_MAX;
+		ret = BZ2_bzDecompress(&st->bz);
+		got = ((size < UINT_MAX) ? size : UINT_MAX) - st->bz.avail_out;
+		st->next = (u8 const *)st->bz.next_in;
+		st->avail = st->bz.avail_in;
+		if (ret == BZ_STREAM_END) {
+			st->done = true;
+		} else if (ret != BZ_OK) {
+			WARNX("corrupt compressed data packet: BZ2_bzDecompress() failed");
+			st->done = true;
+		}
+		break;
+	}
+#endif
+	}
+
+	return got;
+}
+
+static ssize_t cdata_read(void *cookie, char *buf, size_t size)
+{
+	CDATA_STREAM *st = cookie;
+	size_t out = 0;
+
+	while (out < size && !st->done) {
+		size_t got;
+		if (!st->avail && !cdata_fill(st) && st->algo == CMPR_RAW) {
+			st->done = true;
+			break;
+		}
+		got = cdata_step(st, (u8 *)buf + out, size - out);
+		out += got;
+		/* the decompressor wants more than the packet has */
+		if (!got && !st->avail && !st->left && !st->done) {
+			WARNX("truncated compressed data packet");
+			st->done = true;
+		}
+	}
+
+	return out;
+}
+
+/* leave `src` just past the packet */
+static int cdata_close(void *cookie)
+{
+	CDATA_STREAM *st = cookie;
+
+	switch (st->algo) {
+#ifdef HAVE_ZLIB
+	case CMPR_ZIP: /* fallthrough */
+	case CMPR_ZLIB:
+		inflateEnd(&st->z);
+		break;
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2:
+		BZ2_bzDecompressEnd(&st->bz);
+		break;
+#endif
+	}
+	cdata_skip(st->src, st->left);
+	free(st);
+
+	return 0;
+}
+
+/*
+ * a stream of the decompressed contents of the `len` compressed octets
+ * that follow in `src`, or of the rest of it if `len` is `SIZE_MAX`;
+ * closing it leaves `src` open just past them, returns NULL if `algo`
+ * is not supported
+ */
+FILE *cdata_open(FILE *restrict src, int algo, size_t len)
+{
+	cookie_io_functions_t const io = {.read = cdata_read, .close = cdata_close};
+	CDATA_STREAM *st;
+	FILE *file;
+
+	if (!cdata_supported(algo))
+		return NULL;
+	xcalloc(&st, 1, sizeof *st, "cdata_open() xcalloc()");
+	st->src = src;
+	st->left = len;
+	st->algo = algo;
+	switch (algo) {
+#ifdef HAVE_ZLIB
+	/* ZIP is a raw deflate stream, ZLIB has a header and checksum */
+	case CMPR_ZIP:
+		if (inflateInit2(&st->z, -MAX_WBITS) != Z_OK)
+			ERRX("cdata_open() inflateInit2()");
+		break;
+	case CMPR_ZLIB:
+		if (inflateInit2(&st->z, MAX_WBITS) != Z_OK)
+			ERRX("cdata_open() inflateInit2()");
+		break;
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2:
+		if (BZ2_bzDecompressInit(&st->bz, 0, 0) != BZ_OK)
+			ERRX("cdata_open() BZ2_bzDecompressInit()");
+		break;
+#endif
+	}
+	if (!(file = fopencookie(st, "rb", io)))
+		ERR("cdata_open() fopencookie()");
+	setvbuf(file, NULL, _IOFBF, CDATA_WINDOW);
+
+	return file;
+}
+
+/* read past `len` octets of `src`, or all of it if `len` is `SIZE_MAX`; returns false if it ended first */
+bool cdata_skip(FILE *restrict src, size_t len)
+{
+	u8 buf[4096];
+
+	while (len) {
+		size_t want = (len < sizeof buf) ? len : sizeof buf, got = fread(buf, 1, want, src);
+		if (len != SIZE_MAX)
+			len -= got;
+		if (got < want)
+			return len == SIZE_MAX;
+	}
+
+	return true;
+}
@@ -0,0 +1,25 @@
+/*
+ * cdata.h:	header for cdata.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _CDATA_H
+#define _CDATA_H 1
+
+#include "defs.h"
+
+/* compressed octets read ahead of the decompressor, and decompressed octets buffered for the reader */
+#define CDATA_WINDOW		(64 * 1024)
+/* compressed or encrypted packets inside one another, as gpg limits them */
+#define CDATA_MAX_DEPTH		8
+
+/* prototypes */
+bool cdata_supported(int algo);
+FILE *cdata_open(FILE *restrict src, int algo, size_t len);
+bool cdata_skip(FILE *restrict src, size_t len);
+
+#endif
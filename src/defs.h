@@ -19,11 +19,18 @@
 /* global version and usage strings */
 
 #define VERSION_STRING		"DerpGP v0.0.1"
-#define USAGE_STRING		"[-hv] [-i“<in.gpg>”] [-o“<out.pem>”]\n\t" \
+#define USAGE_STRING		"[-ghvw] [-c[<rounds>]] [-i“<in.gpg>”] [-k“<id|fpr>”] [-o“<out.pem>”] [-p“<pass.txt>”] [-s“<sess.txt>”] [-u“<email>”]\n\t" \
+	"-c,--validate:\t\tCheck secret keys, with <rounds> of Miller-Rabin on the primes\n\t" \
+	"-g,--batch-gcd:\t\tReport RSA moduli sharing a prime with any other in the input\n\t" \
 	"-h,--help:\t\tShow help/usage information\n\t" \
 	"-i,--input:\t\tName of the file to use for input\n\t" \
+	"-k,--key:\t\tOnly convert the key or subkey with this 16 digit key id or 40 digit fingerprint\n\t" \
 	"-o,--output:\t\tName of the file to use for output\n\t" \
-	"-v,--version:\t\tShow version information\n\t"
+	"-p,--passphrase-file:\tDecrypt protected secret keys with the passphrase on the first line of this file\n\t" \
+	"-s,--session-key-file:\tDecrypt encrypted data packets with the <algo>:<hex key> session key on the first line of this file, as gpg --show-session-key prints it\n\t" \
+	"-u,--uid:\t\tOnly convert the key with a user id for this email address\n\t" \
+	"-v,--version:\t\tShow version information\n\t" \
+	"-w,--weak-key-scan:\tReport RSA moduli with a small factor or the RSALib (ROCA) structure\n\t"
 #define	RED			"\033[91m"
 #define	GREEN			"\033[92m"
 #define	YELLOW			"\033[93m"
@@ -161,6 +168,8 @@ enum pubkey_algorithms {
 	PUB_ELGA = 0x14,
 	/* Reserved for Diffie-Hellman (X9.42, as defined for IETF-S/MIME) */
 	PUB_DH = 0x15,
+	/* EdDSA [RFC8032] */
+	PUB_EDDSA = 0x16,
 	/* Private/Experimental algorithm */
 	PUB_PRIV0 = 0x64, PUB_PRIV1 = 0x65,
 	PUB_PRIV2 = 0x66, PUB_PRIV3 = 0x67,
@@ -227,6 +236,22 @@ enum s2k_conventions {
 	STR_S2K1 = 0xfe, STR_S2K2 = 0xff,
 };
 
+/* string-to-key specifier types */
+enum s2k_specifiers {
+	/* hash of the passphrase */
+	S2K_SIMPLE = 0x00,
+	/* hash of an 8 octet salt and the passphrase */
+	S2K_SALTED = 0x01,
+	/* Reserved */
+	S2K_RSRVD = 0x02,
+	/* salt and passphrase repeated until a coded number of octets are hashed */
+	S2K_ITERSALTED = 0x03,
+	/* Argon2id over a 16 octet salt (RFC 9580) */
+	S2K_ARGON2 = 0x04,
+	/* GnuPG extension for keys without secret parts */
+	S2K_GNU = 0x65,
+};
+
 /* hash algorithms */
 enum hash_algorithms {
 	/* MD5 [HAC] "MD5" */
@@ -254,6 +279,65 @@ enum hash_algorithms {
 	HASH_PRIV8 = 0x6c, HASH_PRIV9 = 0x6d,
 };
 
+/* signature types */
+enum sig_classes {
+	/* Signature of a binary document */
+	SIG_BINARY = 0x00,
+	/* Signature of a canonical text document */
+	SIG_TEXT = 0x01,
+	/* Generic, persona, casual and positive certifications of a User ID */
+	SIG_CERT_GENERIC = 0x10, SIG_CERT_PERSONA = 0x11,
+	SIG_CERT_CASUAL = 0x12, SIG_CERT_POSITIVE = 0x13,
+	/* Subkey Binding Signature */
+	SIG_SUBKEY_BIND = 0x18,
+	/* Primary Key Binding Signature */
+	SIG_PRIMARY_BIND = 0x19,
+	/* Signature directly on a key */
+	SIG_DIRECT_KEY = 0x1f,
+	/* Key revocation signature */
+	SIG_KEY_REVOKE = 0x20,
+	/* Subkey revocation signature */
+	SIG_SUBKEY_REVOKE = 0x28,
+	/* Certification revocation signature */
+	SIG_CERT_REVOKE = 0x30,
+};
+
+/* signature subpacket types */
+enum sigsub_types {
+	/* Signature Creation Time */
+	SUB_CREATED = 0x02,
+	/* Signature Expiration Time */
+	SUB_SIG_EXPIRES = 0x03,
+	/* Key Expiration Time */
+	SUB_KEY_EXPIRES = 0x09,
+	/* Issuer */
+	SUB_ISSUER = 0x10,
+	/* Primary User ID */
+	SUB_PRIMARY_UID = 0x19,
+	/* Key Flags */
+	SUB_KEY_FLAGS = 0x1b,
+	/* Issuer Fingerprint */
+	SUB_ISSUER_FPR = 0x21,
+};
+
+/* the first octet of the key flags subpacket */
+enum key_flags {
+	/* may certify other keys */
+	KEY_CERTIFY = 0x01,
+	/* may sign data */
+	KEY_SIGN = 0x02,
+	/* may encrypt communications */
+	KEY_ENCRYPT_COMM = 0x04,
+	/* may encrypt storage */
+	KEY_ENCRYPT_STORE = 0x08,
+	/* the private key may have been split by a secret-sharing mechanism */
+	KEY_SPLIT = 0x10,
+	/* may authenticate */
+	KEY_AUTH = 0x20,
+	/* the private key may be in the possession of more than one person */
+	KEY_SHARED = 0x80,
+};
+
 /* structures */
 
 /* Multi Precision Integers */
@@ -274,8 +358,13 @@ typedef struct _s2k {
 	int s2k_mode;
 	u8 hash_algo;
 	u8 salt[8];
-	/* the serialized iteration count. */
+	/* the serialized (coded) iteration count, see `S2K_COUNT()` */
 	u32 cnt;
+	/* Argon2 salt, passes, lanes and memory exponent (2^mem_exp KiB) */
+	u8 argon2_salt[16];
+	u8 passes;
+	u8 lanes;
+	u8 mem_exp;
 } S2K;
 
 /*
@@ -304,7 +393,7 @@ typedef struct _seckey_info {
 	 * be decrypted before use; the protected
 	 * MPIs are simply (void* ) pointers to memory
 	 */
-	int is_protected : 1;
+	unsigned is_protected : 1;
 	/* SHA1 instead of a 16-bit checksum */
 	int sha1_chk;
 	/* checksum for old protection modes */
@@ -317,11 +406,13 @@ typedef struct _seckey_info {
 	u8 iv_len;
 	/* initialization vector for CFB modes */
 	u8 iv[16];
+	/* offset of the encrypted secret MPIs in `pdata`, or 0 if they were not found */
+	size_t enc_off;
 } SECKEY_INFO;
 
 /* PGP signatures have hashed and unhashed areas with signature subpackets */
 typedef struct _sub_packet {
-	/* allocated */
+	/* allocated, or 0 if `subpkt_data` points into the packet data */
 	size_t subpkt_size;
 	/* used (serialized) */
 	size_t subpkt_len;
@@ -329,6 +420,22 @@ typedef struct _sub_packet {
 	u8 *subpkt_data;
 } SIGSUB_PACKET;
 
+/* one subpacket of an area, borrowed from the packet data */
+typedef struct _sigsub {
+	u8 const *data;
+	/* without the type octet */
+	size_t len;
+	u8 type;
+	/* the critical bit */
+	bool critical;
+} SIGSUB;
+
+/* position in a subpacket area, see `sigsub_next()` */
+typedef struct _sigsub_iter {
+	u8 const *cur;
+	u8 const *end;
+} SIGSUB_ITER;
+
 /*
  * PGP Packet Types
  */
@@ -347,6 +454,25 @@ typedef struct _pkesess_packet {
 	MPI sess_data[2];
 } PKESESS_PACKET;
 
+/* Signature Packet
+ *
+ * FIXME: we only support V4 :>
+ */
+typedef struct _sig_packet {
+	/* 0 if the packet could not be parsed */
+	u8 version;
+	u8 sig_class;
+	u8 pubkey_algo;
+	u8 hash_algo;
+	/* subpacket areas, borrowed from `pdata` */
+	SIGSUB_PACKET hashed;
+	SIGSUB_PACKET unhashed;
+	/* leftmost 16 bits of the signed hash value */
+	u8 hash_left[2];
+	/* RSA m^d mod n */
+	MPI sig_mpi;
+} SIG_PACKET;
+
 /* Symmetric-Key Encrypted Session Key Packet */
 typedef struct _skesess_packet {
 	u8 version;
@@ -529,14 +655,14 @@ typedef struct _ui_packet {
 		unsigned revoked : 1;
 		int expired : 1;
 	} flags;
-	/* NULL or the result of mailbox_from_userid. */
-	char *mbox;
+	/* NULL or the lowercased mailbox of the user id, interned */
+	char const *mbox;
 	/*
 	 * the text contained in the user id packet, which is normally the
 	 * name and email address of the key holder.
 	 * for convenience an extra Nul is always appended.
 	 */
-	char *uid_txt;
+	char const *uid_txt;
 } UI_PACKET;
 
 /* Public-Subkey Packet */
@@ -596,10 +722,14 @@ typedef struct _pgp_packet {
 	};
 	u8 plen_raw[4];
 	u8 *pdata;
+	/* v4 fingerprint of a key packet, ending in its key id, set by `key_fingerprint()` */
+	u8 fpr[20];
+	u8 fpr_len;
 	/* parsed packet data */
 	union {
 		RSRVD_PACKET rsrvd;
 		PKESESS_PACKET pkesess;
+		SIG_PACKET sig;
 		SKESESS_PACKET skesess;
 		OPSIG_PACKET opsig;
 		SECKEY_PACKET seckey;
@@ -622,10 +752,41 @@ typedef struct _pgp_packet {
 	};
 } PGP_PACKET;
 
+/*
+ * interned strings in chunks that never move, so packets point into them;
+ * see `str_intern()`
+ */
+typedef struct _str_arena {
+	struct _str_chunk *chunks;
+	/* open-addressing table of the interned strings, at most half full */
+	struct _str_slot *slots;
+	size_t size, cnt;
+} STR_ARENA;
+
+/* a symmetric session key, e.g. the one `gpg --show-session-key` prints */
+typedef struct _sess_key {
+	u8 sym_algo;
+	u8 len;
+	/* up to 256 bits */
+	u8 key[32];
+} SESS_KEY;
+
 /* struct definition for dynamic array of pgp structs */
 typedef struct _pgp_list {
 	size_t cnt, max;
 	PGP_PACKET *list;
+	/* user id text and mailboxes of every packet in the list */
+	STR_ARENA strs;
+	/* compressed or encrypted packets currently being read through */
+	u8 depth;
+	/* decrypts encrypted data packets while reading, if set */
+	SESS_KEY const *sess;
+	/*
+	 * encrypted data packets that failed their quick or modification
+	 * detection check; the packets read out of them are already in the
+	 * list, so it must not be used unless this is 0 once reading is done
+	 */
+	size_t seipd_bad;
 } PGP_LIST;
 
 /* struct definition for NULL-terminated string dynamic array */
@@ -660,7 +821,8 @@ static char const *const pubkey_types[128] = {
 	[PUB_RSASIG] = "PUB_RSASIG", [PUB_ELGAENC] = "PUB_ELGAENC",
 	[PUB_DSA] = "PUB_DSA", [PUB_ELCURVE] = "PUB_ELCURVE",
 	[PUB_ECDSA] = "PUB_ECDSA", [PUB_ELGA] = "PUB_ELGA",
-	[PUB_DH] = "PUB_DH", [PUB_PRIV0] = "PUB_PRIV0",
+	[PUB_DH] = "PUB_DH", [PUB_EDDSA] = "PUB_EDDSA",
+	[PUB_PRIV0] = "PUB_PRIV0",
 	[PUB_PRIV1] = "PUB_PRIV1", [PUB_PRIV2] = "PUB_PRIV2",
 	[PUB_PRIV3] = "PUB_PRIV3", [PUB_PRIV4] = "PUB_PRIV4",
 	[PUB_PRIV5] = "PUB_PRIV5", [PUB_PRIV6] = "PUB_PRIV6",
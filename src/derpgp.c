@@ -8,20 +8,35 @@
  */
 
 #include "base64.h"
+#include "batchgcd.h"
+#include "keyindex.h"
 #include "packet.h"
 #include "parse.h"
+#include "residue.h"
+#include "rsa.h"
+#include "s2k.h"
 #include <gcrypt.h>
 #include <getopt.h>
+#include <time.h>
 
 /* static variables */
 static struct option const long_opts[] = {
+	{"validate", optional_argument, 0, 'c'},
+	{"batch-gcd", no_argument, 0, 'g'},
 	{"help", no_argument, 0, 'h'},
 	{"input", required_argument, 0, 'i'},
+	{"key", required_argument, 0, 'k'},
 	{"output", required_argument, 0, 'o'},
+	{"passphrase-file", required_argument, 0, 'p'},
+	{"session-key-file", required_argument, 0, 's'},
+	{"uid", required_argument, 0, 'u'},
 	{"version", no_argument, 0, 'v'},
+	{"weak-key-scan", no_argument, 0, 'w'},
 	{0}
 };
 static int option_index;
+/* derived passphrase keys, wiped on exit */
+static S2K_CACHE s2k_cache;
 
 /* getopts variables */
 extern char *optarg;
@@ -31,10 +46,51 @@ extern char **environ;
 /* silence linter */
 int getopt_long(int ___argc, char *const ___argv[], char const *__shortopts, struct option const *__longopts, int *__longind);
 
-PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restrict out_file)
+/* read the first line of `path` into secure memory, setting `len` */
+static char *read_passphrase(char const *restrict path, size_t *restrict len)
+{
+	FILE *file = xfopen(path, "rb");
+	char *pass;
+
+	if (!(pass = gcry_calloc_secure(S2K_MAX_PASS_BYTES + 1, 1)))
+		ERR("read_passphrase() gcry_calloc_secure()");
+	if (!fgets(pass, S2K_MAX_PASS_BYTES + 1, file))
+		pass[0] = 0;
+	xfclose(&file);
+	*len = strcspn(pass, "\r\n");
+	pass[*len] = 0;
+
+	return pass;
+}
+
+/* read a session key from the first line of `path` into secure memory, as `gpg --show-session-key` prints it */
+static SESS_KEY *read_session_key(char const *restrict path)
+{
+	SESS_KEY *sess;
+	char *line;
+	size_t len;
+
+	if (!(sess = gcry_calloc_secure(1, sizeof *sess)))
+		ERR("read_session_key() gcry_calloc_secure()");
+	line = read_passphrase(path, &len);
+	/* don't echo the key */
+	if (!sess_key_parse(line, sess))
+		ERRX("invalid session key, expected <algo>:<hex key>");
+	gcry_free(line);
+
+	return sess;
+}
+
+PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restrict out_file, int *restrict rounds,
+		bool *restrict gcd_scan, bool *restrict weak_scan, char const **restrict pass_file,
+		char const **restrict key_spec, char const **restrict uid_spec)
 {
 	int opt;
+	char *end;
+	long val;
 	PGP_LIST pkts = {0};
+	char const **inputs, *sess_file = NULL;
+	size_t ninputs = 0;
 	bool read_stdin = false;
 
 	/* print an error if option not found */
@@ -42,11 +98,8 @@ PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restric
 	/* reset option indices to reuse argv */
 	option_index = 0;
 	optind = 1;
-	/* attempt to read standard input if part of a pipe */
-	if (!isatty(STDIN_FILENO)) {
-		read_pgp_bin(NULL, "/dev/stdin", &pkts);
-		read_stdin = true;
-	}
+	/* inputs are read once every option is known, as they may need the session key */
+	xcalloc(&inputs, FALLBACK((size_t)argc, 1), sizeof *inputs, "parse_opts() xcalloc()");
 
 	/* process options */
 	while ((opt = getopt_long(argc, argv, optstring, long_opts, &option_index)) != -1) {
@@ -54,17 +107,29 @@ PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restric
 
 		/* input file flag */
 		case 'i':
-			/* attempt to read standard input if argument is "-" */
-			if (!strcmp(optarg, "-")) {
-				/* don't read stdin twice */
-				if (read_stdin)
-					break;
-				read_pgp_bin(NULL, "/dev/stdin", &pkts);
-				read_stdin = true;
+			inputs[ninputs++] = optarg;
+			break;
+
+		/* validate flag, with optional miller-rabin rounds */
+		case 'c':
+			*rounds = 0;
+			if (!optarg)
 				break;
-			}
-			/* else read the file specified */
-			read_pgp_bin(NULL, optarg, &pkts);
+			errno = 0;
+			val = strtol(optarg, &end, 10);
+			if (errno || *end || end == optarg || val < 0 || val > INT_MAX)
+				ERRXMSG("invalid Miller-Rabin round count", optarg);
+			*rounds = (int)val;
+			break;
+
+		/* batch gcd flag */
+		case 'g':
+			*gcd_scan = true;
+			break;
+
+		/* key selection flag, matched once every input is read */
+		case 'k':
+			*key_spec = optarg;
 			break;
 
 		/* output file flag */
@@ -75,6 +140,21 @@ PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restric
 			*out_file = xfopen(optarg, "wb");
 			break;
 
+		/* passphrase file flag, read once libgcrypt secure memory is up */
+		case 'p':
+			*pass_file = optarg;
+			break;
+
+		/* session key file flag, read before any input */
+		case 's':
+			sess_file = optarg;
+			break;
+
+		/* user id selection flag, matched once every input is read */
+		case 'u':
+			*uid_spec = optarg;
+			break;
+
 		/* version flag */
 		case 'v':
 			fprintf(stderr, "%s\n", VERSION_STRING);
@@ -82,6 +162,11 @@ PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restric
 			/* unused break */
 			break;
 
+		/* weak key scan flag */
+		case 'w':
+			*weak_scan = true;
+			break;
+
 		/* usage and unrecognized flags */
 		case 'h':
 		case '?':
@@ -91,20 +176,122 @@ PGP_LIST parse_opts(int argc, char **argv, char const *optstring, FILE **restric
 		}
 	}
 
+	/* the session key stays in secure memory, and out of argv */
+	if (sess_file)
+		pkts.sess = read_session_key(sess_file);
+	/* attempt to read standard input if part of a pipe */
+	if (!isatty(STDIN_FILENO)) {
+		append_pgp_bin("/dev/stdin", &pkts);
+		read_stdin = true;
+	}
+	for (size_t i = 0; i < ninputs; i++) {
+		/* attempt to read standard input if argument is "-" */
+		if (!strcmp(inputs[i], "-")) {
+			/* don't read stdin twice */
+			if (read_stdin)
+				continue;
+			append_pgp_bin("/dev/stdin", &pkts);
+			read_stdin = true;
+			continue;
+		}
+		/* else read the file specified after the ones before it */
+		append_pgp_bin(inputs[i], &pkts);
+	}
+	free(inputs);
+
 	return pkts;
 }
 
+/* print the failed checks in `results`, returning how many packets were checked */
+static size_t report_failures(PGP_LIST const *restrict pkts, int const *restrict results,
+		char const *const *restrict names, size_t nnames)
+{
+	size_t checked = 0;
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] < 0)
+			continue;
+		checked++;
+		if (!results[i])
+			continue;
+		fprintf(stderr, RED "packet %zu (%s) failed:" RST, i,
+				packet_types[TAGBITS(pkts->list[i].pheader)]);
+		for (size_t j = 0; j < nnames; j++) {
+			if (results[i] & (1 << j))
+				fprintf(stderr, " %s", names[j]);
+		}
+		fputc('\n', stderr);
+	}
+	return checked;
+}
+
+/* keep only the certificate packets of the key or subkey `spec` names */
+static void select_key(PGP_LIST *restrict pkts, char const *restrict spec)
+{
+	KEY_INDEX index;
+	u8 id[KEY_FPR_LEN];
+	size_t id_len, idx;
+
+	if (!(id_len = key_spec_parse(spec, id)))
+		ERRXMSG("invalid key id or fingerprint", spec);
+	key_index_build(&index, pkts);
+	idx = key_index_find(&index, id, id_len);
+	key_index_free(&index);
+	if (idx == SIZE_MAX)
+		ERRXMSG("no key matching", spec);
+	key_select(pkts, idx);
+}
+
+/* keep only the certificate with a user id for the mailbox `email` */
+static void select_uid(PGP_LIST *restrict pkts, char const *restrict email)
+{
+	UID_INDEX index;
+	size_t idx;
+
+	/* the rest of the packets wait until a key is picked */
+	parse_uid_packets(pkts);
+	uid_index_build(&index, pkts);
+	idx = uid_index_find(&index, email, 0);
+	uid_index_free(&index);
+	if (idx == SIZE_MAX)
+		ERRXMSG("no key with a user id for", email);
+	key_select(pkts, idx);
+}
+
+/* whether a valid binding signature follows the subkey at `idx` */
+static bool subkey_bound(PGP_LIST const *restrict pkts, int const *restrict sig_results, size_t idx)
+{
+	for (size_t i = idx + 1; i < pkts->cnt; i++) {
+		int tag = TAGBITS(pkts->list[i].pheader);
+		/* gpg keyrings put trust packets after signatures */
+		if (tag == TAG_TRUST)
+			continue;
+		if (tag != TAG_SIG)
+			break;
+		if (pkts->list[i].sig.sig_class == SIG_SUBKEY_BIND && sig_results[i] == RSA_SIG_VALID)
+			return true;
+	}
+	return false;
+}
+
 /* cleanup wrapper for `atexit()/at_quick_exit()` */
 static inline void cleanup(void)
 {
+	s2k_cache_wipe(&s2k_cache);
 	gcry_control(GCRYCTL_TERM_SECMEM, 0);
 }
 
 int main(int argc, char **argv)
 {
 	FILE *out_file = NULL;
-	char const *const optstring = "hvi:o:";
-	PGP_LIST pkts = parse_opts(argc, argv, optstring, &out_file);
+	char const *const optstring = "c::ghvwi:k:o:p:s:u:", *pass_file = NULL, *key_spec = NULL, *uid_spec = NULL;
+	char *pass = NULL;
+	u8 (*keys)[S2K_MAX_KEY_BYTES] = NULL;
+	/* -1 unless `--validate` was passed */
+	int rounds = -1, *results = NULL, *sig_results = NULL, *gcd_results = NULL, *weak_results = NULL;
+	int *s2k_results = NULL;
+	size_t invalid = 0, bad_sigs = 0, shared = 0, weak = 0, bad_s2k = 0, checked, pass_len;
+	bool gcd_scan = false, weak_scan = false;
+	PGP_LIST pkts;
 
 	/*
 	 * Allocate a pool of 512k secure memory.  This makes the secure memory
@@ -122,8 +309,78 @@ int main(int argc, char **argv)
 	atexit(cleanup);
 	at_quick_exit(cleanup);
 
+	/* key packets are fingerprinted as they are read */
+	pkts = parse_opts(argc, argv, optstring, &out_file, &rounds, &gcd_scan, &weak_scan, &pass_file,
+			&key_spec, &uid_spec);
+	/*
+	 * packets from inside an encrypted data packet are in the list before
+	 * its MDC is checked, so nothing may look at the list before this
+	 */
+	if (pkts.seipd_bad)
+		ERRX("an encrypted data packet could not be decrypted or failed its modification detection check");
+	/* drop every packet outside the selected key before anything is parsed */
+	if (uid_spec)
+		select_uid(&pkts, uid_spec);
+	if (key_spec)
+		select_key(&pkts, key_spec);
 	/* handle packets */
 	parse_pgp_packets(&pkts);
+	/* derive the keys protecting every passphrase-protected secret key and decrypt it */
+	if (pass_file) {
+		struct timespec start, end;
+		double secs;
+		pass = read_passphrase(pass_file, &pass_len);
+		if (!(keys = gcry_calloc_secure(FALLBACK(pkts.cnt, 1), sizeof *keys)))
+			ERR("main() keys gcry_calloc_secure()");
+		xcalloc(&s2k_results, FALLBACK(pkts.cnt, 1), sizeof *s2k_results, "main() s2k_results xcalloc()");
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		/* keys and subkeys sharing a salt and count share one derivation */
+		s2k_derive_list(&pkts, pass, pass_len, 0, &s2k_cache, keys, s2k_results, 0);
+		bad_s2k = s2k_unprotect_list(&pkts, keys, s2k_results, 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		checked = report_failures(&pkts, s2k_results, s2k_check_names, ARRLEN(s2k_check_names));
+		fprintf(stderr, "%zu of %zu protected keys decrypted with %zu derivations (%.1f derivations/s)\n",
+				checked - bad_s2k, checked, s2k_cache.derived,
+				(secs > 0) ? (double)s2k_cache.derived / secs : 0.0);
+	}
+	/* check self-signatures and subkey bindings before trusting any key */
+	xcalloc(&sig_results, FALLBACK(pkts.cnt, 1), sizeof *sig_results, "main() sig_results xcalloc()");
+	bad_sigs = rsa_verify_list(&pkts, sig_results, 0);
+	if (bad_sigs) {
+		checked = report_failures(&pkts, sig_results, rsa_sig_check_names, ARRLEN(rsa_sig_check_names));
+		fprintf(stderr, "%zu of %zu self-signatures failed verification\n", bad_sigs, checked);
+	}
+	/* check every unprotected secret key before anything is written */
+	if (rounds >= 0) {
+		xcalloc(&results, FALLBACK(pkts.cnt, 1), sizeof *results, "main() results xcalloc()");
+		invalid = rsa_validate_list(&pkts, results, rounds);
+		checked = report_failures(&pkts, results, rsa_check_names, ARRLEN(rsa_check_names));
+		fprintf(stderr, "%zu of %zu secret keys failed validation\n", invalid, checked);
+	}
+	/* look for moduli sharing a prime with any other modulus in the input */
+	if (gcd_scan) {
+		xcalloc(&gcd_results, FALLBACK(pkts.cnt, 1), sizeof *gcd_results, "main() gcd_results xcalloc()");
+		shared = batch_gcd_list(&pkts, gcd_results, 0, 0);
+		checked = 0;
+		for (size_t i = 0; i < pkts.cnt; i++) {
+			if (gcd_results[i] < 0)
+				continue;
+			checked++;
+			if (gcd_results[i] > 0) {
+				fprintf(stderr, RED "packet %zu (%s) shares a %d-bit factor with another modulus\n" RST,
+						i, packet_types[TAGBITS(pkts.list[i].pheader)], gcd_results[i]);
+			}
+		}
+		fprintf(stderr, "%zu of %zu moduli share a factor\n", shared, checked);
+	}
+	/* fingerprint moduli with small factors or the RSALib structure */
+	if (weak_scan) {
+		xcalloc(&weak_results, FALLBACK(pkts.cnt, 1), sizeof *weak_results, "main() weak_results xcalloc()");
+		weak = weak_scan_list(&pkts, weak_results, 0);
+		checked = report_failures(&pkts, weak_results, weak_check_names, ARRLEN(weak_check_names));
+		fprintf(stderr, "%zu of %zu moduli look weak\n", weak, checked);
+	}
 #ifdef _DEBUG
 	puts(GREEN "PGP packets found:" RST);
 #endif
@@ -133,16 +390,32 @@ int main(int argc, char **argv)
 		HPRINT(pkts.list[i].pheader);
 		printf(YELLOW "%-10s\n" RST, packet_types[cur_tag]);
 #endif
-		/* write to `-o` file if specified */
-		if (cur_tag == TAG_SECSUBKEY) {
+		/* write to `-o` file if specified, leaving out unbound keys and keys that failed validation */
+		if (cur_tag != TAG_SECSUBKEY)
+			continue;
+		if (!subkey_bound(&pkts, sig_results, i)) {
+			WARNXARR("no valid binding signature, skipping secret subkey packet", i);
+			continue;
+		}
+		if (!(results && results[i] > 0) && !(gcd_results && gcd_results[i] > 0)
+				&& !(weak_results && weak_results[i] > 0)) {
 			fwrite(pkts.list[i].seckey.rsa.der_data, 1,
 					pkts.list[i].seckey.rsa.der_len, FALLBACK(out_file, stderr));
 		}
 	}
 
 	/* cleanup */
+	free(results);
+	free(sig_results);
+	free(gcd_results);
+	free(weak_results);
+	free(s2k_results);
+	/* secure memory is wiped when freed */
+	gcry_free(keys);
+	gcry_free(pass);
+	gcry_free((SESS_KEY *)pkts.sess);
 	free_pgp_list(&pkts);
 	xfclose(&out_file);
 
-	return 0;
+	return (invalid || bad_sigs || shared || weak || bad_s2k) ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,323 @@
+/*
+ * keyindex.c:	key ids and fingerprints, and selecting one key out of a keyring
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "keyindex.h"
+#include "packet.h"
+#include "parse.h"
+#include "rsa.h"
+#include "strarena.h"
+#include <ctype.h>
+
+/* primary keys start a certificate, subkeys one of its parts */
+static inline bool is_primary(PGP_PACKET const *restrict packet)
+{
+	int tag = TAGBITS(packet->pheader);
+	return tag == TAG_SECKEY || tag == TAG_PUBKEY;
+}
+
+static inline bool is_subkey(PGP_PACKET const *restrict packet)
+{
+	int tag = TAGBITS(packet->pheader);
+	return tag == TAG_SECSUBKEY || tag == TAG_PUBSUBKEY;
+}
+
+/*
+ * parse a 16 digit key id or 40 digit fingerprint, with an optional `0x`
+ * and any spaces gpg prints between groups, into `id`; returns its length
+ * in octets, or 0 if it is neither
+ */
+size_t key_spec_parse(char const *restrict spec, u8 *restrict id)
+{
+	size_t digits = 0;
+
+	if (spec[0] == '0' && (spec[1] == 'x' || spec[1] == 'X'))
+		spec += 2;
+	for (; *spec; spec++) {
+		int nib;
+		if (*spec == ' ')
+			continue;
+		if (!isxdigit((unsigned char)*spec) || digits == 2 * KEY_FPR_LEN)
+			return 0;
+		nib = isdigit((unsigned char)*spec) ? *spec - '0' : tolower((unsigned char)*spec) - 'a' + 10;
+		if (digits % 2)
+			id[digits / 2] |= nib;
+		else
+			id[digits / 2] = nib << 4;
+		digits++;
+	}
+
+	return (digits == 2 * KEY_ID_LEN || digits == 2 * KEY_FPR_LEN) ? digits / 2 : 0;
+}
+
+void key_index_build(KEY_INDEX *restrict index, PGP_LIST const *restrict pkts)
+{
+	index->pkts = pkts;
+	for (index->size = 16; index->size < 2 * pkts->cnt; index->size *= 2);
+	xcalloc(&index->slots, index->size, sizeof *index->slots, "key_index_build() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		size_t slot;
+		if (!pkts->list[i].fpr_len)
+			continue;
+		slot = key_id(&pkts->list[i]) & (index->size - 1);
+		while (index->slots[slot])
+			slot = (slot + 1) & (index->size - 1);
+		index->slots[slot] = i + 1;
+	}
+}
+
+/* the first key packet with the key id or fingerprint `id`, or `SIZE_MAX` */
+size_t key_index_find(KEY_INDEX const *restrict index, u8 const *restrict id, size_t id_len)
+{
+	u8 const *tail = id + id_len - KEY_ID_LEN;
+	size_t slot, found = SIZE_MAX;
+	u64 want = 0;
+
+	if (id_len != KEY_ID_LEN && id_len != KEY_FPR_LEN)
+		return SIZE_MAX;
+	for (size_t i = 0; i < KEY_ID_LEN; i++)
+		want = want << 8 | tail[i];
+	/* a keyring may repeat a key, so keep probing for the earliest */
+	for (slot = want & (index->size - 1); index->slots[slot]; slot = (slot + 1) & (index->size - 1)) {
+		PGP_PACKET const *packet = &index->pkts->list[index->slots[slot] - 1];
+		if (key_id(packet) != want || memcmp(packet->fpr + KEY_FPR_LEN - id_len, id, id_len))
+			continue;
+		if (index->slots[slot] - 1 < found)
+			found = index->slots[slot] - 1;
+	}
+
+	return found;
+}
+
+void key_index_free(KEY_INDEX *restrict index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->size = 0;
+}
+
+/* index the parsed user ids with a mailbox under the primary key before them */
+void uid_index_build(UID_INDEX *restrict index, PGP_LIST const *restrict pkts)
+{
+	size_t key = SIZE_MAX, cnt = 0;
+
+	for (size_t i = 0; i < pkts->cnt; i++)
+		cnt += TAGBITS(pkts->list[i].pheader) == TAG_UID;
+	index->pkts = pkts;
+	for (index->size = 16; index->size < 2 * cnt; index->size *= 2);
+	xcalloc(&index->slots, index->size, sizeof *index->slots, "uid_index_build() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		size_t slot;
+		if (is_primary(&pkts->list[i]))
+			key = i;
+		if (TAGBITS(pkts->list[i].pheader) != TAG_UID || !pkts->list[i].ui.mbox || key == SIZE_MAX)
+			continue;
+		slot = str_hash(pkts->list[i].ui.mbox, strlen(pkts->list[i].ui.mbox)) & (index->size - 1);
+		while (index->slots[slot].uid)
+			slot = (slot + 1) & (index->size - 1);
+		index->slots[slot] = (UID_SLOT){.uid = i + 1, .key = key};
+	}
+}
+
+/*
+ * the first primary key at or after packet `start` with a user id for
+ * `email`, which may be a whole user id like "Name <email>"; mailboxes
+ * are compared lowercased, returns `SIZE_MAX` if there is none
+ */
+size_t uid_index_find(UID_INDEX const *restrict index, char const *restrict email, size_t start)
+{
+	char buf[UID_MAX_MBOX];
+	char const *mbox;
+	size_t len, slot, found = SIZE_MAX;
+
+	if (!(len = uid_mailbox(email, strlen(email), buf)))
+		return SIZE_MAX;
+	/* every mailbox of the list is interned, so one no user id has is not there either */
+	if (!(mbox = str_lookup(&index->pkts->strs, buf, len)))
+		return SIZE_MAX;
+	for (slot = str_hash(mbox, len) & (index->size - 1); index->slots[slot].uid;
+			slot = (slot + 1) & (index->size - 1)) {
+		UID_SLOT const *ent = &index->slots[slot];
+		if (index->pkts->list[ent->uid - 1].ui.mbox == mbox && ent->key >= start && ent->key < found)
+			found = ent->key;
+	}
+
+	return found;
+}
+
+void uid_index_free(UID_INDEX *restrict index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->size = 0;
+}
+
+/*
+ * keep the packets of the key at `idx` and free the rest, before they are
+ * parsed: a primary key keeps its whole certificate, and a subkey keeps
+ * its primary key with the user ids and signatures before the first
+ * subkey, so its binding signature can still be checked; returns the
+ * packets kept
+ */
+size_t key_select(PGP_LIST *restrict pkts, size_t idx)
+{
+	size_t primary = SIZE_MAX, end = pkts->cnt, kept = 0;
+
+	for (size_t i = 0; i <= idx; i++) {
+		if (is_primary(&pkts->list[i]))
+			primary = i;
+	}
+	for (size_t i = idx + 1; i < pkts->cnt; i++) {
+		if (is_primary(&pkts->list[i]) || (idx != primary && is_subkey(&pkts->list[i]))) {
+			end = i;
+			break;
+		}
+	}
+
+	for (size_t i = 0, in_head = 0; i < pkts->cnt; i++) {
+		/* the primary key up to its first subkey */
+		if (i == primary)
+			in_head = 1;
+		else if (is_primary(&pkts->list[i]) || is_subkey(&pkts->list[i]))
+			in_head = 0;
+		if (in_head || (i >= idx && i < end))
+			pkts->list[kept++] = pkts->list[i];
+		else
+			free_pgp_packet(&pkts->list[i]);
+	}
+	pkts->cnt = kept;
+
+	return kept;
+}
+
+/*
+ * a self-signature of the key starting at `primary` that applies to `tag`
+ * packets, or NULL; a signature that does not name its issuer is nobody's
+ */
+static SIG_PACKET const *self_sig(PGP_LIST const *restrict pkts, size_t primary, size_t idx, int tag, SIG_PACKET *restrict buf)
+{
+	PGP_PACKET const *packet = &pkts->list[idx];
+	SIG_PACKET const *sig = &packet->sig;
+	u8 id[KEY_ID_LEN];
+
+	/* signatures not parsed yet only have their subpacket areas read */
+	if (!sig->version) {
+		if (!sig_subpackets(packet, buf))
+			return NULL;
+		sig = buf;
+	}
+	if (!sig_issuer(sig, id) || (pkts->list[primary].fpr_len
+			&& memcmp(id, pkts->list[primary].fpr + KEY_FPR_LEN - KEY_ID_LEN, KEY_ID_LEN)))
+		return NULL;
+	switch (sig->sig_class) {
+	case SIG_CERT_GENERIC: /* fallthrough */
+	case SIG_CERT_PERSONA:
+	case SIG_CERT_CASUAL:
+	case SIG_CERT_POSITIVE:
+		return (tag == TAG_UID) ? sig : NULL;
+	case SIG_SUBKEY_BIND:
+		return (tag == TAG_SECSUBKEY || tag == TAG_PUBSUBKEY) ? sig : NULL;
+	case SIG_DIRECT_KEY: /* fallthrough */
+	case SIG_KEY_REVOKE:
+		return (tag == TAG_SECKEY || tag == TAG_PUBKEY) ? sig : NULL;
+	case SIG_SUBKEY_REVOKE:
+		return (tag == TAG_SECSUBKEY || tag == TAG_PUBSUBKEY) ? sig : NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * fill `meta` for the key packet at `idx` from its self-signatures: a
+ * certification flagged primary user id wins, then the newest, and
+ * subkeys use their newest binding signature; only the signatures of
+ * this key are looked at, and only the subpackets asked for are decoded,
+ * so a keyring can be filtered without parsing it; given `sig_results`
+ * from `rsa_verify_list()`, only signatures that verified are looked at,
+ * so nobody can revoke a key or lift its expiry by tacking a forged
+ * signature onto it, and without them revocations are ignored; returns
+ * false if the key has no self-signature
+ */
+bool key_meta(PGP_LIST const *restrict pkts, size_t idx, int const *restrict sig_results, KEY_META *restrict meta)
+{
+	PGP_PACKET const *key = &pkts->list[idx];
+	size_t primary = SIZE_MAX, end = pkts->cnt, uid = SIZE_MAX;
+	u32 best_time = 0;
+	bool best_primary = false;
+	SIG_PACKET const *best = NULL;
+	SIG_PACKET buf, best_buf;
+
+	*meta = (KEY_META){.sig = SIZE_MAX, .primary_uid = SIZE_MAX};
+	if ((!is_primary(key) && !is_subkey(key)) || packet_len(key) < 5 || key->pdata[0] != 4)
+		return false;
+	meta->created = BETOH32(key->pdata + 1);
+	for (size_t i = 0; i <= idx; i++) {
+		if (is_primary(&pkts->list[i]))
+			primary = i;
+	}
+	if (primary == SIZE_MAX)
+		return false;
+	for (size_t i = idx + 1; i < pkts->cnt; i++) {
+		if (is_primary(&pkts->list[i]) || is_subkey(&pkts->list[i])) {
+			end = i;
+			break;
+		}
+	}
+
+	for (size_t i = idx + 1, comp = idx; i < end; i++) {
+		int tag = TAGBITS(pkts->list[i].pheader);
+		SIG_PACKET const *sig;
+		u32 time;
+		bool is_uid_primary;
+		if (tag != TAG_SIG) {
+			comp = i;
+			continue;
+		}
+		if (sig_results && sig_results[i] != RSA_SIG_VALID)
+			continue;
+		if (!(sig = self_sig(pkts, primary, i, TAGBITS(pkts->list[comp].pheader), &buf)))
+			continue;
+		if (sig->sig_class == SIG_KEY_REVOKE || sig->sig_class == SIG_SUBKEY_REVOKE) {
+			if (sig_results)
+				meta->revoked = true;
+			continue;
+		}
+		time = sig_created(sig);
+		is_uid_primary = TAGBITS(pkts->list[comp].pheader) == TAG_UID && sig_primary_uid(sig);
+		if (uid == SIZE_MAX && comp != idx)
+			uid = comp;
+		if (best && (best_primary > is_uid_primary || (best_primary == is_uid_primary && time < best_time)))
+			continue;
+		if (is_uid_primary)
+			uid = comp;
+		best_buf = *sig;
+		best = &best_buf;
+		best_time = time;
+		best_primary = is_uid_primary;
+		meta->sig = i;
+	}
+	if (!best)
+		return false;
+
+	if (sig_key_expires(best))
+		meta->expires = meta->created + sig_key_expires(best);
+	if (!sig_key_flags(best, &meta->flags))
+		meta->flags = 0xff;
+	if (idx == primary)
+		meta->primary_uid = uid;
+
+	return true;
+}
+
+/* whether a key may be used for every one of `usage` at time `when` */
+bool key_usable(KEY_META const *restrict meta, u8 usage, u32 when)
+{
+	if (meta->revoked || (meta->flags & usage) != usage)
+		return false;
+	return !meta->expires || when < meta->expires;
+}
@@ -0,0 +1,78 @@
+/*
+ * keyindex.h:	header for keyindex.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _KEYINDEX_H
+#define _KEYINDEX_H 1
+
+#include "defs.h"
+
+/* octets in a key id and a v4 fingerprint */
+#define KEY_ID_LEN		8
+#define KEY_FPR_LEN		20
+
+/*
+ * open-addressing index of the key packets in a list by key id, which is
+ * already uniformly distributed and so is its own hash; kept at most half
+ * full, and only valid until the list changes
+ */
+typedef struct _key_index {
+	PGP_LIST const *pkts;
+	/* packet index + 1 of each key, 0 for an empty slot */
+	size_t *slots;
+	/* a power of two */
+	size_t size;
+} KEY_INDEX;
+
+/* a user id and the primary key it belongs to */
+typedef struct _uid_slot {
+	/* user id packet index + 1, 0 for an empty slot */
+	size_t uid;
+	size_t key;
+} UID_SLOT;
+
+/*
+ * open-addressing index of the user ids in a list by their mailbox; the
+ * mailboxes are interned, so a probe compares pointers, and a mailbox no
+ * user id has misses without touching the table
+ */
+typedef struct _uid_index {
+	PGP_LIST const *pkts;
+	UID_SLOT *slots;
+	/* a power of two */
+	size_t size;
+} UID_INDEX;
+
+/* what the newest self-signature of a key says about it */
+typedef struct _key_meta {
+	/* key creation time */
+	u32 created;
+	/* expiration time, or 0 if the key does not expire */
+	u32 expires;
+	/* `enum key_flags`, every usage if the signature has no key flags */
+	u8 flags;
+	/* a revocation signature of the key verified */
+	bool revoked;
+	/* the self-signature used and, for a primary key, its primary user id, or `SIZE_MAX` */
+	size_t sig;
+	size_t primary_uid;
+} KEY_META;
+
+/* prototypes */
+size_t key_spec_parse(char const *restrict spec, u8 *restrict id);
+void key_index_build(KEY_INDEX *restrict index, PGP_LIST const *restrict pkts);
+size_t key_index_find(KEY_INDEX const *restrict index, u8 const *restrict id, size_t id_len);
+void key_index_free(KEY_INDEX *restrict index);
+void uid_index_build(UID_INDEX *restrict index, PGP_LIST const *restrict pkts);
+size_t uid_index_find(UID_INDEX const *restrict index, char const *restrict email, size_t start);
+void uid_index_free(UID_INDEX *restrict index);
+size_t key_select(PGP_LIST *restrict pkts, size_t idx);
+bool key_meta(PGP_LIST const *restrict pkts, size_t idx, int const *restrict sig_results, KEY_META *restrict meta);
+bool key_usable(KEY_META const *restrict meta, u8 usage, u32 when);
+
+#endif
@@ -0,0 +1,474 @@
+/*
+ * lanes.h:	montgomery exponentiation on many independent moduli at once
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _LANES_H
+#define _LANES_H 1
+
+#include "defs.h"
+#include "bn.h"
+#include "pool.h"
+#include <stdatomic.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(BN_NO_ASM)
+# include <cpuid.h>
+# include <immintrin.h>
+# define LANES_SIMD		1
+#endif
+
+/*
+ * every number is split into LANE_BITS-bit limbs and limb i of LANES
+ * numbers sits side by side, so one vector instruction works on the same
+ * limb of every lane; a product of two limbs is below 2^52, and the
+ * accumulators, which get two of them per limb of the modulus, stay below
+ * 2^64 for anything bn.h holds without carrying between steps
+ */
+#define LANES			8
+#define LANE_BITS		26
+#define LANE_MASK		((1u << LANE_BITS) - 1)
+/* two spare bits keep every intermediate result below 2n without a final subtraction */
+#define LANE_LIMBS(bits)	(((bits) + 2 + LANE_BITS - 1) / LANE_BITS)
+#define LANE_MAX_LIMBS		LANE_LIMBS(BN_BYTES * 8)
+/* largest fixed window of `lanes_powmod()` */
+#define LANE_WINDOW		5
+
+/* the same limb of every lane, zero-extended so the vector multiplies read it as is */
+typedef u64 LANE_ROW[LANES];
+
+/* up to LANES moduli of the same limb count, see `lanes_mont_init()` */
+typedef struct _lane_mont {
+	LANE_ROW n[LANE_MAX_LIMBS];
+	/* R^2 mod n with R = 2^(LANE_BITS * limbs) */
+	LANE_ROW rr[LANE_MAX_LIMBS];
+	/* -n^-1 mod 2^LANE_BITS */
+	LANE_ROW ninv;
+	int limbs;
+	/* lanes holding a caller's modulus, the rest repeat lane 0 */
+	int used;
+	struct bn mod[LANES];
+} LANE_MONT;
+
+/* one operand of `lanes_powmod_batch()` */
+typedef struct _lane_key {
+	int limbs;
+	size_t idx;
+} LANE_KEY;
+
+/* shared state of `lanes_powmod_batch()` */
+typedef struct _lane_batch {
+	struct bn *const *a, *const *e, *const *n, *const *c;
+	/* operands sorted by limb count, and where each group of lanes starts */
+	LANE_KEY *keys;
+	size_t *groups;
+} LANE_BATCH;
+
+/*
+ * widest vector unit, -1 until the first multiplication or `lanes_use_simd()`
+ * has looked at the cpu; weak, so every translation unit shares the one flag
+ */
+__attribute__((weak)) _Atomic int _lanes_isa = -1;
+enum lane_isa { LANES_C, LANES_AVX2, LANES_AVX512 };
+
+/* limb `k` of `a`, for `a` below 2^(LANE_BITS * limbs) */
+static inline u64 _lane_limb(struct bn *restrict a, int k)
+{
+	int bit = k * LANE_BITS, i = bit / (8 * WORD_SIZE), sh = bit % (8 * WORD_SIZE);
+	DTYPE w = _bignum_word(a, i) >> sh;
+
+	if (sh + LANE_BITS > 8 * WORD_SIZE)
+		w |= _bignum_word(a, i + 1) << (8 * WORD_SIZE - sh);
+	return w & LANE_MASK;
+}
+
+/* spread the first `cnt` numbers into lanes, repeating the first in the rest */
+static inline void _lanes_load(LANE_ROW *restrict x, int limbs, struct bn *const *restrict a, int cnt)
+{
+	for (int l = 0; l < LANES; l++) {
+		struct bn *src = a[(l < cnt) ? l : 0];
+		for (int k = 0; k < limbs; k++)
+			x[k][l] = _lane_limb(src, k);
+	}
+}
+
+/* lane `l` back into `c` */
+static inline void _lanes_store(struct bn *restrict c, LANE_ROW *restrict x, int limbs, int l)
+{
+	bignum_init(c);
+	for (int k = limbs - 1; k >= 0; k--) {
+		int bit = k * LANE_BITS, i = bit / (8 * WORD_SIZE), sh = bit % (8 * WORD_SIZE);
+		c->array[i] |= (DTYPE)x[k][l] << sh;
+		if (sh + LANE_BITS > 8 * WORD_SIZE)
+			c->array[i + 1] |= (DTYPE)x[k][l] >> (8 * WORD_SIZE - sh);
+	}
+	bignum_normalize(c);
+}
+
+/*
+ * c = a * b / R mod n in every lane, with operands and result below 2n:
+ * word-serial montgomery (CIOS) where each step adds a_i * b and m * n
+ * into unreduced 64-bit accumulators that shift down one limb, so only the
+ * lowest limb carries until the result is normalized at the end; `c` may
+ * be `a` or `b`, as it is only written once everything has been read
+ */
+static inline void _lanes_mont_mul_c(LANE_MONT *restrict ctx, LANE_ROW *c, LANE_ROW *a, LANE_ROW *b)
+{
+	u64 t[LANE_MAX_LIMBS][LANES], cy[LANES], m[LANES];
+	int s = ctx->limbs;
+
+	memset(t, 0, sizeof *t * s);
+	for (int i = 0; i < s; i++) {
+		for (int l = 0; l < LANES; l++) {
+			u64 u = t[0][l] + a[i][l] * b[0][l];
+			m[l] = (u * ctx->ninv[l]) & LANE_MASK;
+			cy[l] = (u + m[l] * ctx->n[0][l]) >> LANE_BITS;
+		}
+		for (int j = 1; j < s; j++) {
+			for (int l = 0; l < LANES; l++)
+				t[j - 1][l] = t[j][l] + a[i][l] * b[j][l] + m[l] * ctx->n[j][l];
+		}
+		for (int l = 0; l < LANES; l++) {
+			t[0][l] += cy[l];
+			t[s - 1][l] = 0;
+		}
+	}
+	for (int j = 0; j < s - 1; j++) {
+		for (int l = 0; l < LANES; l++) {
+			t[j + 1][l] += t[j][l] >> LANE_BITS;
+			c[j][l] = t[j][l] & LANE_MASK;
+		}
+	}
+	memcpy(c[s - 1], t[s - 1], sizeof *t);
+}
+
+#ifdef LANES_SIMD
+/*
+ * the same loop on `VEC`-wide vectors, V of them per row: the 32x32->64
+ * multiply (vpmuludq) is all it needs, as every limb and m fit in 32 bits;
+ * steps go two at a time so each pass over the accumulators in memory
+ * does twice the multiplications, with a single step left for odd lengths
+ */
+#define LANES_DEFINE_KERNEL(isa, VEC, V, load, store, mul, add, srl, and, set1)                 \
+__attribute__((target(#isa)))                                                                    \
+static void _lanes_mont_mul_##isa(LANE_MONT *restrict ctx, LANE_ROW *c, LANE_ROW *a, LANE_ROW *b) \
+{                                                                                                \
+	VEC t[LANE_MAX_LIMBS][V], ninv[V], n0[V], n1[V], b0[V], b1[V];                           \
+	VEC mask = set1(LANE_MASK), zero = set1(0);                                              \
+	int s = ctx->limbs, i = 0;                                                               \
+                                                                                                 \
+	for (int v = 0; v < V; v++) {                                                            \
+		ninv[v] = load((void *)&ctx->ninv[v * (LANES / (V))]);                               \
+		n0[v] = load((void *)&ctx->n[0][v * (LANES / (V))]);                                 \
+		b0[v] = load((void *)&b[0][v * (LANES / (V))]);                                      \
+		n1[v] = (s > 1) ? load((void *)&ctx->n[1][v * (LANES / (V))]) : zero;                \
+		b1[v] = (s > 1) ? load((void *)&b[1][v * (LANES / (V))]) : zero;                     \
+	}                                                                                        \
+	for (int j = 0; j < s; j++) {                                                            \
+		for (int v = 0; v < V; v++)                                                      \
+			t[j][v] = zero;                                                          \
+	}                                                                                        \
+	for (; s >= 3 && i + 1 < s; i += 2) {                                                    \
+		for (int v = 0; v < V; v++) {                                                    \
+			VEC a0 = load((void *)&a[i][v * (LANES / (V))]);                             \
+			VEC a1 = load((void *)&a[i + 1][v * (LANES / (V))]);                         \
+			VEC b2 = load((void *)&b[2][v * (LANES / (V))]);                             \
+			VEC n2 = load((void *)&ctx->n[2][v * (LANES / (V))]);                        \
+			VEC u = add(t[0][v], mul(a0, b0[v]));                                    \
+			VEC m0 = and(mul(u, ninv[v]), mask), m1, t1;                             \
+			/* the first step up to its second limb, then the second step's m */     \
+			u = srl(add(u, mul(m0, n0[v])), LANE_BITS);                              \
+			u = add(add(u, t[1][v]), add(mul(a0, b1[v]), mul(m0, n1[v])));           \
+			t1 = add(t[2][v], add(mul(a0, b2), mul(m0, n2)));                        \
+			u = add(u, mul(a1, b0[v]));                                              \
+			m1 = and(mul(u, ninv[v]), mask);                                         \
+			u = srl(add(u, mul(m1, n0[v])), LANE_BITS);                              \
+			t1 = add(add(t1, u), add(mul(a1, b1[v]), mul(m1, n1[v])));               \
+			for (int j = 1; j + 2 < s; j++) {                                        \
+				VEC x = add(mul(a0, load((void *)&b[j + 2][v * (LANES / (V))])),     \
+						mul(m0, load((void *)&ctx->n[j + 2][v * (LANES / (V))]))); \
+				VEC y = add(mul(a1, load((void *)&b[j + 1][v * (LANES / (V))])),     \
+						mul(m1, load((void *)&ctx->n[j + 1][v * (LANES / (V))]))); \
+				t[j][v] = add(t[j + 2][v], add(x, y));                           \
+			}                                                                        \
+			t[s - 2][v] = add(mul(a1, load((void *)&b[s - 1][v * (LANES / (V))])),       \
+					mul(m1, load((void *)&ctx->n[s - 1][v * (LANES / (V))])));   \
+			t[s - 1][v] = zero;                                                      \
+			t[0][v] = t1;                                                            \
+		}                                                                                \
+	}                                                                                        \
+	for (; i < s; i++) {                                                                     \
+		for (int v = 0; v < V; v++) {                                                    \
+			VEC ai = load((void *)&a[i][v * (LANES / (V))]);                             \
+			VEC u = add(t[0][v], mul(ai, b0[v]));                                    \
+			VEC m = and(mul(u, ninv[v]), mask);                                      \
+			VEC cy = srl(add(u, mul(m, n0[v])), LANE_BITS);                          \
+			for (int j = 1; j < s; j++) {                                            \
+				VEC x = mul(ai, load((void *)&b[j][v * (LANES / (V))]));             \
+				VEC y = mul(m, load((void *)&ctx->n[j][v * (LANES / (V))]));         \
+				t[j - 1][v] = add(add(t[j][v], x), y);                           \
+			}                                                                        \
+			t[0][v] = add(t[0][v], cy);                                              \
+			t[s - 1][v] = zero;                                                      \
+		}                                                                                \
+	}                                                                                        \
+	for (int j = 0; j < s - 1; j++) {                                                        \
+		for (int v = 0; v < V; v++) {                                                    \
+			t[j + 1][v] = add(t[j + 1][v], srl(t[j][v], LANE_BITS));                 \
+			store((void *)&c[j][v * (LANES / (V))], and(t[j][v], mask));                 \
+		}                                                                                \
+	}                                                                                        \
+	for (int v = 0; v < V; v++)                                                              \
+		store((void *)&c[s - 1][v * (LANES / (V))], t[s - 1][v]);                            \
+}
+
+LANES_DEFINE_KERNEL(avx2, __m256i, LANES / 4, _mm256_loadu_si256, _mm256_storeu_si256,
+		_mm256_mul_epu32, _mm256_add_epi64, _mm256_srli_epi64, _mm256_and_si256, _mm256_set1_epi64x)
+LANES_DEFINE_KERNEL(avx512f, __m512i, LANES / 8, _mm512_loadu_si512, _mm512_storeu_si512,
+		_mm512_mul_epu32, _mm512_add_epi64, _mm512_srli_epi64, _mm512_and_si512, _mm512_set1_epi64)
+#endif
+
+/* the widest unit the cpu has */
+static inline int _lanes_cpu_isa(void)
+{
+#ifdef LANES_SIMD
+	unsigned eax, ebx = 0, ecx = 0, edx, xcr0_lo = 0, xcr0_hi;
+	int isa = LANES_C;
+
+	/* cpuid leaf 1: ECX bit 27 is OSXSAVE, so xgetbv says which registers the kernel saves */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !((ecx >> 27) & 1))
+		return isa;
+	__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	/* cpuid leaf 7: EBX bit 5 is AVX2, bit 16 is AVX-512F */
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return isa;
+	/* ymm state, then opmask and zmm state too */
+	if (((ebx >> 5) & 1) && (xcr0_lo & 0x06) == 0x06)
+		isa = LANES_AVX2;
+	if (((ebx >> 16) & 1) && (xcr0_lo & 0xe6) == 0xe6)
+		isa = LANES_AVX512;
+	return isa;
+#else
+	return LANES_C;
+#endif
+}
+
+/* the flag, probing the cpu the first time without overriding a `lanes_use_simd()` call racing with it */
+static inline int _lanes_isa_get(void)
+{
+	int isa = atomic_load_explicit(&_lanes_isa, memory_order_relaxed);
+
+	if (isa < 0) {
+		int expected = -1;
+		isa = _lanes_cpu_isa();
+		if (!atomic_compare_exchange_strong(&_lanes_isa, &expected, isa))
+			isa = expected;
+	}
+
+	return isa;
+}
+
+/*
+ * the widest unit the cpu has, checked on the first multiplication; call
+ * with 0 to force the portable loops, e.g. for cross-checking
+ */
+static inline int lanes_use_simd(int enable)
+{
+	int isa = enable ? _lanes_cpu_isa() : LANES_C;
+
+	atomic_store(&_lanes_isa, isa);
+	return isa;
+}
+
+static inline void lanes_mont_mul(LANE_MONT *restrict ctx, LANE_ROW *c, LANE_ROW *a, LANE_ROW *b)
+{
+	int isa = _lanes_isa_get();
+
+#ifdef LANES_SIMD
+	if (isa == LANES_AVX512) {
+		_lanes_mont_mul_avx512f(ctx, c, a, b);
+		return;
+	}
+	if (isa == LANES_AVX2) {
+		_lanes_mont_mul_avx2(ctx, c, a, b);
+		return;
+	}
+#endif
+	_lanes_mont_mul_c(ctx, c, a, b);
+}
+
+/*
+ * set up lanes for the first `cnt` of `n`, which must be odd and have the
+ * limb count of the first one; lanes past `cnt` repeat the first modulus
+ */
+static inline void lanes_mont_init(LANE_MONT *restrict ctx, struct bn *const *restrict n, int cnt)
+{
+	struct bn two, k;
+	struct bn *mods[LANES];
+
+	require(cnt > 0 && cnt <= LANES, "lane count out of range");
+	ctx->limbs = LANE_LIMBS(_bignum_bits(n[0]));
+	ctx->used = cnt;
+	require(ctx->limbs <= LANE_MAX_LIMBS, "modulus too large for lanes");
+	bignum_from_int(&two, 2);
+	bignum_from_int(&k, 2 * LANE_BITS * ctx->limbs);
+	for (int l = 0; l < LANES; l++) {
+		struct bn *src = n[(l < cnt) ? l : 0];
+		require(src->top > 0 && (src->array[0] & 1), "modulus must be odd");
+		require(LANE_LIMBS(_bignum_bits(src)) == ctx->limbs, "moduli must have the same limb count");
+		bignum_assign(&ctx->mod[l], src);
+		/* -n^-1 mod 2^64 reduces to -n^-1 mod 2^LANE_BITS */
+		ctx->ninv[l] = _mont_ninv(src->array[0]) & LANE_MASK;
+		mods[l] = &ctx->mod[l];
+	}
+	_lanes_load(ctx->n, ctx->limbs, mods, LANES);
+	/* R^2 mod n, through the scalar code once per modulus */
+	for (int l = 0; l < LANES; l++) {
+		struct bn r;
+		bignum_powmod(&two, &k, &ctx->mod[l], &r);
+		for (int j = 0; j < ctx->limbs; j++)
+			ctx->rr[j][l] = _lane_limb(&r, j);
+	}
+}
+
+/*
+ * c[l] = a[l]^e[l] mod n[l] for the lanes in use: fixed windows over the
+ * longest exponent with a masked scan of the whole table, so neither the
+ * exponents nor which lane is which changes the timing or memory accesses;
+ * only the length of the longest exponent shows, through the window size
+ */
+static inline void lanes_powmod(LANE_MONT *restrict ctx, struct bn *const *restrict a,
+		struct bn *const *restrict e, struct bn *const *restrict c)
+{
+	int s = ctx->limbs, ebits = 0, wbits, top;
+	LANE_ROW *table, *acc, *sel;
+	struct bn base[LANES], *bp[LANES];
+
+	for (int l = 0; l < ctx->used; l++) {
+		int bits = _bignum_bits(e[l]);
+		if (bits > ebits)
+			ebits = bits;
+		/* bases at or above n come down first so they fit the limbs */
+		bignum_assign(&base[l], a[l]);
+		if (bignum_cmp(&base[l], &ctx->mod[l]) != SMALLER)
+			bignum_mod(&base[l], &ctx->mod[l], &base[l]);
+		bp[l] = &base[l];
+	}
+	/* 2^w table entries against ebits / w multiplications, and a table that stays in cache */
+	wbits = (ebits > 320) ? LANE_WINDOW : (ebits > 96) ? 4 : (ebits > 24) ? 3 : 2;
+	xmalloc(&table, sizeof *table * s * ((1 << wbits) + 2), "lanes_powmod() xmalloc()");
+	acc = table + s * (1 << wbits);
+	sel = acc + s;
+
+	/* table[k] = a^k in montgomery form, starting from 1 * R^2 / R = R */
+	memset(sel, 0, sizeof *sel * s);
+	for (int l = 0; l < LANES; l++)
+		sel[0][l] = 1;
+	lanes_mont_mul(ctx, table, sel, ctx->rr);
+	_lanes_load(sel, s, bp, ctx->used);
+	lanes_mont_mul(ctx, table + s, sel, ctx->rr);
+	for (int k = 2; k < (1 << wbits); k++)
+		lanes_mont_mul(ctx, table + k * s, table + (k - 1) * s, table + s);
+
+	/* the first window is a lookup alone, an empty exponent leaves 1 */
+	memcpy(acc, table, sizeof *acc * s);
+	top = (ebits + wbits - 1) / wbits * wbits - wbits;
+	for (int i = top; i >= 0; i -= wbits) {
+		u32 idx[LANES] = {0};
+		for (int l = 0; l < ctx->used; l++) {
+			for (int j = wbits - 1; j >= 0; j--)
+				idx[l] = (idx[l] << 1) | (u32)_bignum_bit(e[l], i + j);
+		}
+		memset(sel, 0, sizeof *sel * s);
+		for (u32 k = 0; k < (1u << wbits); k++) {
+			u64 mask[LANES];
+			for (int l = 0; l < LANES; l++)
+				mask[l] = 0 - (u64)(((k ^ idx[l]) - 1) >> 31);
+			for (int j = 0; j < s; j++) {
+				for (int l = 0; l < LANES; l++)
+					sel[j][l] |= table[k * s + j][l] & mask[l];
+			}
+		}
+		if (i == top) {
+			memcpy(acc, sel, sizeof *acc * s);
+			continue;
+		}
+		for (int j = 0; j < wbits; j++)
+			lanes_mont_mul(ctx, acc, acc, acc);
+		lanes_mont_mul(ctx, acc, acc, sel);
+	}
+
+	/* out of montgomery form, where the result is at most n */
+	memset(sel, 0, sizeof *sel * s);
+	for (int l = 0; l < LANES; l++)
+		sel[0][l] = 1;
+	lanes_mont_mul(ctx, acc, acc, sel);
+	for (int l = 0; l < ctx->used; l++) {
+		_lanes_store(c[l], acc, s, l);
+		if (bignum_cmp(c[l], &ctx->mod[l]) != SMALLER)
+			bignum_sub(c[l], &ctx->mod[l], c[l]);
+	}
+	free(table);
+}
+
+/* by limb count, then by index so lanes keep the callers' order */
+static int _lane_key_cmp(void const *a, void const *b)
+{
+	LANE_KEY const *x = a, *y = b;
+	if (x->limbs != y->limbs)
+		return (x->limbs > y->limbs) - (x->limbs < y->limbs);
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+/* one group of up to LANES operands with the same limb count */
+static void _lanes_batch_group(void *restrict arg, size_t g)
+{
+	LANE_BATCH *ctx = arg;
+	LANE_MONT *mont;
+	struct bn *a[LANES], *e[LANES], *n[LANES], *c[LANES];
+	size_t start = ctx->groups[g];
+	int cnt = (int)(ctx->groups[g + 1] - start);
+
+	for (int l = 0; l < cnt; l++) {
+		size_t i = ctx->keys[start + l].idx;
+		a[l] = ctx->a[i], e[l] = ctx->e[i], n[l] = ctx->n[i], c[l] = ctx->c[i];
+	}
+	xmalloc(&mont, sizeof *mont, "_lanes_batch_group() xmalloc()");
+	lanes_mont_init(mont, n, cnt);
+	lanes_powmod(mont, a, e, c);
+	free(mont);
+}
+
+/*
+ * c[i] = a[i]^e[i] mod n[i] for `cnt` odd moduli of any sizes: operands are
+ * sorted by limb count and packed LANES at a time, and the groups are spread
+ * over up to `nthreads` threads (0 for one per online cpu)
+ */
+static inline void lanes_powmod_batch(struct bn *const *a, struct bn *const *e, struct bn *const *n,
+		struct bn *const *c, size_t cnt, size_t nthreads)
+{
+	LANE_BATCH ctx = {.a = a, .e = e, .n = n, .c = c};
+	size_t ngroups = 0;
+
+	if (!cnt)
+		return;
+	xcalloc(&ctx.keys, cnt, sizeof *ctx.keys, "lanes_powmod_batch() xcalloc()");
+	xcalloc(&ctx.groups, cnt + 1, sizeof *ctx.groups, "lanes_powmod_batch() xcalloc()");
+	for (size_t i = 0; i < cnt; i++)
+		ctx.keys[i] = (LANE_KEY){.limbs = LANE_LIMBS(_bignum_bits(n[i])), .idx = i};
+	qsort(ctx.keys, cnt, sizeof *ctx.keys, _lane_key_cmp);
+	for (size_t i = 1; i < cnt; i++) {
+		size_t start = ctx.groups[ngroups];
+		if (i - start == LANES || ctx.keys[i].limbs != ctx.keys[start].limbs)
+			ctx.groups[++ngroups] = i;
+	}
+	ctx.groups[++ngroups] = cnt;
+	pool_for(ngroups, nthreads, _lanes_batch_group, &ctx);
+	free(ctx.keys);
+	free(ctx.groups);
+}
+
+#endif
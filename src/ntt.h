@@ -0,0 +1,211 @@
+/*
+ * ntt.h:	number-theoretic transform multiplication for very long operands
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _NTT_H
+#define _NTT_H 1
+
+#include "defs.h"
+#include "bn.h"
+
+/*
+ * the words of both operands are taken as coefficients and convolved
+ * modulo three primes k * 2^50 + 1 just under 2^62; a coefficient of the
+ * convolution is below n * 2^128, and the three primes together cover
+ * 2^185, so any product up to 2^50 words comes back exactly through the
+ * chinese remainder theorem
+ */
+#define NTT_PRIMES		3
+#define NTT_MAX_LOG		50
+
+/* one prime with its Montgomery constants */
+typedef struct _ntt_prime {
+	DTYPE p;
+	/* -p^-1 mod 2^64, and 2^128 mod p to bring values into Montgomery form */
+	DTYPE ninv, r2;
+	/* generator of the multiplicative group */
+	DTYPE gen;
+} NTT_PRIME;
+
+static NTT_PRIME const ntt_primes[NTT_PRIMES] = {
+	{0x3fdc000000000001, 0, 0, 3},
+	{0x3f18000000000001, 0, 0, 10},
+	{0x3ec4000000000001, 0, 0, 37},
+};
+
+/* a * b / 2^64 mod p for a * b < p * 2^64 */
+static inline DTYPE _ntt_mul(DTYPE a, DTYPE b, NTT_PRIME const *restrict q)
+{
+	DTYPE_TMP t = (DTYPE_TMP)a * b;
+	DTYPE m = (DTYPE)t * q->ninv;
+	DTYPE u = (t + (DTYPE_TMP)m * q->p) >> 64;
+	return (u >= q->p) ? u - q->p : u;
+}
+
+static inline DTYPE _ntt_add(DTYPE a, DTYPE b, DTYPE p)
+{
+	DTYPE s = a + b;
+	return (s >= p) ? s - p : s;
+}
+
+static inline DTYPE _ntt_sub(DTYPE a, DTYPE b, DTYPE p)
+{
+	return (a >= b) ? a - b : a + p - b;
+}
+
+/* a into Montgomery form, for any a < 2^64 */
+static inline DTYPE _ntt_mont(DTYPE a, NTT_PRIME const *restrict q)
+{
+	return _ntt_mul(a % q->p, q->r2, q);
+}
+
+/* b^e in Montgomery form for `b` in Montgomery form */
+static inline DTYPE _ntt_pow(DTYPE b, DTYPE e, NTT_PRIME const *restrict q)
+{
+	DTYPE r = _ntt_mont(1, q);
+	for (; e; e >>= 1) {
+		if (e & 1)
+			r = _ntt_mul(r, b, q);
+		b = _ntt_mul(b, b, q);
+	}
+	return r;
+}
+
+static inline void _ntt_prime_init(NTT_PRIME *restrict q, NTT_PRIME const *restrict src)
+{
+	DTYPE_TMP r = ((DTYPE_TMP)1 << 64) % src->p;
+	*q = *src;
+	q->ninv = _mont_ninv(q->p);
+	q->r2 = (r * r) % q->p;
+}
+
+/*
+ * roots of unity for a transform of `n` points, in Montgomery form: the
+ * powers of a primitive 2m-th root sit at rt[m .. 2m) for every power of
+ * two m below n, which keeps every butterfly pass walking forward
+ */
+static inline void _ntt_roots(DTYPE *restrict rt, size_t n, bool inverse, NTT_PRIME const *restrict q)
+{
+	size_t half = n / 2;
+	DTYPE w = _ntt_pow(_ntt_mont(q->gen, q), (q->p - 1) / n, q);
+
+	if (inverse)
+		w = _ntt_pow(w, q->p - 2, q);
+	rt[half] = _ntt_mont(1, q);
+	for (size_t j = 1; j < half; j++)
+		rt[half + j] = _ntt_mul(rt[half + j - 1], w, q);
+	/* a 2m-th root is the square of a 4m-th one */
+	for (size_t m = half / 2; m; m /= 2) {
+		for (size_t j = 0; j < m; j++)
+			rt[m + j] = rt[2 * m + 2 * j];
+	}
+}
+
+/* decimation in frequency, natural order in and bit-reversed order out */
+static inline void _ntt_forward(DTYPE *restrict a, size_t n, DTYPE const *restrict rt, NTT_PRIME const *restrict q)
+{
+	for (size_t m = n / 2; m; m /= 2) {
+		for (size_t s = 0; s < n; s += 2 * m) {
+			for (size_t j = 0; j < m; j++) {
+				DTYPE u = a[s + j], v = a[s + j + m];
+				a[s + j] = _ntt_add(u, v, q->p);
+				a[s + j + m] = _ntt_mul(_ntt_sub(u, v, q->p), rt[m + j], q);
+			}
+		}
+	}
+}
+
+/* decimation in time, bit-reversed order in and natural order out */
+static inline void _ntt_inverse(DTYPE *restrict a, size_t n, DTYPE const *restrict rt, NTT_PRIME const *restrict q)
+{
+	for (size_t m = 1; m < n; m *= 2) {
+		for (size_t s = 0; s < n; s += 2 * m) {
+			for (size_t j = 0; j < m; j++) {
+				DTYPE u = a[s + j], v = _ntt_mul(a[s + j + m], rt[m + j], q);
+				a[s + j] = _ntt_add(u, v, q->p);
+				a[s + j + m] = _ntt_sub(u, v, q->p);
+			}
+		}
+	}
+}
+
+/* the cyclic convolution of `a` and `b` modulo one prime into `r`, using `fb` and `rt` as scratch */
+static inline void _ntt_convolve(DTYPE *restrict r, DTYPE const *a, size_t na, DTYPE const *b, size_t nb,
+		size_t n, DTYPE *restrict fb, DTYPE *restrict rt, NTT_PRIME const *restrict q)
+{
+	/* 1 / n, and back out of the 2^-64 the pointwise products pick up */
+	DTYPE scale = _ntt_pow(_ntt_mont(n, q), q->p - 2, q);
+	bool square = a == b && na == nb;
+
+	scale = _ntt_mul(scale, q->r2, q);
+	_ntt_roots(rt, n, false, q);
+	for (size_t i = 0; i < n; i++)
+		r[i] = (i < na) ? a[i] % q->p : 0;
+	_ntt_forward(r, n, rt, q);
+	if (!square) {
+		for (size_t i = 0; i < n; i++)
+			fb[i] = (i < nb) ? b[i] % q->p : 0;
+		_ntt_forward(fb, n, rt, q);
+	}
+	for (size_t i = 0; i < n; i++)
+		r[i] = _ntt_mul(_ntt_mul(r[i], square ? r[i] : fb[i], q), scale, q);
+	_ntt_roots(rt, n, true, q);
+	_ntt_inverse(r, n, rt, q);
+}
+
+/*
+ * c = a * b into na + nb words; `a` may be `b` for a square, which saves
+ * one transform per prime
+ */
+static inline void ntt_mul_words(DTYPE *c, DTYPE const *a, size_t na, DTYPE const *b, size_t nb)
+{
+	NTT_PRIME q[NTT_PRIMES];
+	DTYPE *res, *fb, *rt;
+	/* Garner's constants: p0^-1 mod p1 and (p0 * p1)^-1 mod p2 in Montgomery form */
+	DTYPE inv0, inv01, p0_2;
+	DTYPE_TMP p01;
+	size_t n = 1, log = 0;
+	DTYPE acc[2] = {0};
+
+	while (n < na + nb - 1)
+		n *= 2, log++;
+	require(log <= NTT_MAX_LOG, "ntt operands too long");
+	for (size_t k = 0; k < NTT_PRIMES; k++)
+		_ntt_prime_init(&q[k], &ntt_primes[k]);
+	xmalloc(&res, sizeof *res * 5 * n, "ntt_mul_words() xmalloc()");
+	fb = res + 3 * n;
+	rt = fb + n;
+	for (size_t k = 0; k < NTT_PRIMES; k++)
+		_ntt_convolve(res + k * n, a, na, b, nb, n, fb, rt, &q[k]);
+
+	inv0 = _ntt_pow(_ntt_mont(q[0].p, &q[1]), q[1].p - 2, &q[1]);
+	p0_2 = _ntt_mont(q[0].p, &q[2]);
+	inv01 = _ntt_pow(_ntt_mul(p0_2, _ntt_mont(q[1].p, &q[2]), &q[2]), q[2].p - 2, &q[2]);
+	p01 = (DTYPE_TMP)q[0].p * q[1].p;
+	for (size_t i = 0; i < na + nb; i++) {
+		DTYPE r0 = (i < n) ? res[i] : 0, r1 = (i < n) ? res[n + i] : 0, r2 = (i < n) ? res[2 * n + i] : 0;
+		/* x = r0 + p0 * t1 + p0 * p1 * t2 with t1 < p1 and t2 < p2 */
+		DTYPE t1 = _ntt_mul(_ntt_sub(r1, r0 % q[1].p, q[1].p), inv0, &q[1]);
+		DTYPE x2 = _ntt_add(r0 % q[2].p, _ntt_mul(t1, p0_2, &q[2]), q[2].p);
+		DTYPE t2 = _ntt_mul(_ntt_sub(r2, x2, q[2].p), inv01, &q[2]);
+		DTYPE_TMP lo = (DTYPE_TMP)q[0].p * t1 + r0;
+		DTYPE_TMP mid = (DTYPE_TMP)(DTYPE)p01 * t2;
+		DTYPE_TMP hi = (DTYPE_TMP)(DTYPE)(p01 >> 64) * t2;
+		DTYPE_TMP s;
+
+		/* acc += x, then shift the low word out into c */
+		s = (DTYPE_TMP)acc[0] + (DTYPE)lo + (DTYPE)mid;
+		c[i] = (DTYPE)s;
+		s = (s >> 64) + acc[1] + (DTYPE)(lo >> 64) + (DTYPE)(mid >> 64) + (DTYPE)hi;
+		acc[0] = (DTYPE)s;
+		acc[1] = (DTYPE)(hi >> 64) + (DTYPE)(s >> 64);
+	}
+	free(res);
+}
+
+#endif
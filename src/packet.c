@@ -8,6 +8,11 @@
  */
 
 #include "packet.h"
+#include "s2k.h"
+#include "sha1mb.h"
+#include "strarena.h"
+#include <ctype.h>
+#include <gcrypt.h>
 
 size_t parse_pubkey_packet(PGP_PACKET *restrict packet)
 {
@@ -34,6 +39,208 @@ size_t parse_pubkey_packet(PGP_PACKET *restrict packet)
 	return mpi_offset;
 }
 
+/*
+ * parse the symmetric algorithm, S2K specifier and IV following an S2K usage
+ * octet at `off` into a new `seckey_info`, returning the octets used; the
+ * encrypted secret MPIs follow, and are left alone
+ */
+static size_t parse_s2k(PGP_PACKET *restrict packet, size_t off)
+{
+	SECKEY_INFO *info;
+	size_t len = packet_len(packet), start = off;
+	u8 const *data = packet->pdata;
+
+	/* algorithm and mode octets */
+	if (len < off + 2)
+		return 0;
+	xcalloc(&info, 1, sizeof *info, "parse_s2k() xcalloc()");
+	packet->seckey.seckey_info = info;
+	info->is_protected = 1;
+	/* 0xfe protects the secret MPIs with a SHA1 hash instead of a checksum */
+	info->sha1_chk = packet->seckey.string_to_key == STR_S2K1;
+	info->seckey_algo = packet->seckey.sym_encryption_algo = data[off++];
+	info->s2k.s2k_mode = data[off++];
+
+	switch (info->s2k.s2k_mode) {
+	/* salt, passes, lanes and memory exponent, with no hash octet */
+	case S2K_ARGON2:
+		if (len < off + sizeof info->s2k.argon2_salt + 3)
+			return off - start;
+		memcpy(info->s2k.argon2_salt, data + off, sizeof info->s2k.argon2_salt);
+		off += sizeof info->s2k.argon2_salt;
+		info->s2k.passes = data[off++];
+		info->s2k.lanes = data[off++];
+		info->s2k.mem_exp = data[off++];
+		break;
+	case S2K_SIMPLE:
+		if (len < off + 1)
+			return off - start;
+		info->s2k.hash_algo = data[off++];
+		break;
+	case S2K_SALTED:
+	case S2K_ITERSALTED:
+		if (len < off + 1 + sizeof info->s2k.salt)
+			return off - start;
+		info->s2k.hash_algo = data[off++];
+		memcpy(info->s2k.salt, data + off, sizeof info->s2k.salt);
+		off += sizeof info->s2k.salt;
+		if (info->s2k.s2k_mode == S2K_SALTED)
+			break;
+		if (len < off + 1)
+			return off - start;
+		info->s2k.cnt = data[off++];
+		break;
+	/* no IV follows a gnu-dummy or an unknown specifier */
+	default:
+		return off - start;
+	}
+
+	info->iv_len = s2k_block_len(info->seckey_algo);
+	if (!info->iv_len || len < off + info->iv_len)
+		return off - start;
+	memcpy(info->iv, data + off, info->iv_len);
+	packet->seckey.iv = info->iv;
+	off += info->iv_len;
+	info->enc_off = off;
+
+	return off - start;
+}
+
+/*
+ * parse the secret MPIs d, p, q and u at `data` and DER encode the key,
+ * returning the octets used; `data` is the packet body of an unprotected
+ * key or the decrypted block of a protected one, already bounds checked
+ * by `secret_mpis_len()` in that case
+ */
+size_t parse_secret_mpis(PGP_PACKET *restrict packet, u8 *restrict data)
+{
+	size_t off = 0;
+
+	packet->seckey.rsa.exponent_d = &packet->seckey.exponent_d;
+	off += read_mpi(data + off, &packet->seckey.exponent_d);
+	packet->seckey.rsa.prime_p = &packet->seckey.prime_p;
+	off += read_mpi(data + off, &packet->seckey.prime_p);
+	packet->seckey.rsa.prime_q = &packet->seckey.prime_q;
+	off += read_mpi(data + off, &packet->seckey.prime_q);
+	packet->seckey.rsa.mult_inverse = &packet->seckey.mult_inverse;
+	off += read_mpi(data + off, &packet->seckey.mult_inverse);
+	der_encode_alt(packet);
+
+	return off;
+}
+
+/*
+ * the message a v4 fingerprint hashes, 0x99, the two octet length and the
+ * public part, returning 0 for other packets and keys we cannot fingerprint
+ */
+static inline int fingerprint_msg(PGP_PACKET *restrict packet, SHA1_MSG *restrict msg)
+{
+	size_t len;
+
+	switch (TAGBITS(packet->pheader)) {
+	case TAG_SECKEY: /* fallthrough */
+	case TAG_PUBKEY:
+	case TAG_SECSUBKEY:
+	case TAG_PUBSUBKEY:
+		break;
+	default:
+		return 0;
+	}
+	if (!(len = pubkey_body_len(packet)) || len > 0xffff)
+		return 0;
+	*msg = (SHA1_MSG){.hdr = {0x99, len >> 8, len}, .hdr_len = 3, .data = packet->pdata, .len = len,
+		.digest = packet->fpr};
+	return 1;
+}
+
+/* set the v4 fingerprint of a key or subkey packet, returning its length or 0 */
+size_t key_fingerprint(PGP_PACKET *restrict packet)
+{
+	SHA1_MSG msg;
+
+	packet->fpr_len = 0;
+	if (!fingerprint_msg(packet, &msg))
+		return 0;
+	sha1_mb(&msg, 1);
+	packet->fpr_len = sizeof packet->fpr;
+
+	return packet->fpr_len;
+}
+
+/*
+ * fingerprint every key packet in the list which has no fingerprint yet,
+ * in batches so the SHA1 lanes stay full; returns the keys fingerprinted
+ */
+size_t key_fingerprint_list(PGP_LIST *restrict pkts)
+{
+	SHA1_MSG msgs[FPR_BATCH];
+	size_t idx[FPR_BATCH], batch = 0, done = 0;
+
+	for (size_t i = 0; i <= pkts->cnt; i++) {
+		if (i < pkts->cnt && !pkts->list[i].fpr_len && fingerprint_msg(&pkts->list[i], &msgs[batch]))
+			idx[batch++] = i;
+		if (batch == FPR_BATCH || (i == pkts->cnt && batch)) {
+			sha1_mb(msgs, batch);
+			for (size_t j = 0; j < batch; j++)
+				pkts->list[idx[j]].fpr_len = sizeof pkts->list[idx[j]].fpr;
+			done += batch;
+			batch = 0;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * the mailbox of a user id, lowercased into `buf`: the address in the
+ * final angle brackets, or the whole user id if it is a bare address;
+ * returns its length, or 0 if there is none
+ */
+size_t uid_mailbox(char const *restrict uid, size_t len, char *restrict buf)
+{
+	char const *start = uid, *open;
+	size_t ats = 0, at = 0;
+
+	if (len && uid[len - 1] == '>' && (open = memrchr(uid, '<', len - 1))) {
+		start = open + 1;
+		len = uid + len - 1 - start;
+	}
+	if (!len || len > UID_MAX_MBOX)
+		return 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = start[i];
+		if (isspace(c) || c == '<' || c == '>' || !c)
+			return 0;
+		if (c == '@')
+			ats++, at = i;
+		buf[i] = tolower(c);
+	}
+
+	return (ats == 1 && at && at < len - 1) ? len : 0;
+}
+
+/*
+ * point a user id packet at its text and mailbox, interned in `strs` so a
+ * user id repeated across keyrings is stored once, and hash it the way
+ * gpg's name hash does; returns the octets parsed
+ */
+size_t parse_uid_packet(PGP_PACKET *restrict packet, STR_ARENA *restrict strs)
+{
+	size_t len = packet_len(packet), mbox_len;
+	char mbox[UID_MAX_MBOX];
+
+	if (packet->ui.uid_txt)
+		return len;
+	packet->ui.uid_txt = str_intern(strs, (char const *)packet->pdata, len);
+	packet->ui.name_len = (len > INT_MAX) ? INT_MAX : (int)len;
+	mbox_len = uid_mailbox(packet->ui.uid_txt, len, mbox);
+	packet->ui.mbox = mbox_len ? str_intern(strs, mbox, mbox_len) : NULL;
+	packet->ui.name_hash = str_arena_alloc(strs, 20);
+	gcry_md_hash_buffer(GCRY_MD_RMD160, packet->ui.name_hash, packet->pdata, len);
+
+	return len;
+}
+
 size_t parse_seckey_packet(PGP_PACKET *restrict packet)
 {
 	/*
@@ -70,27 +277,17 @@ size_t parse_seckey_packet(PGP_PACKET *restrict packet)
 #define ADD_TO_MPI_OFFSET(value) \
 			(mpi_offset += value)
 		printf(YELLOW "%s " RST, s2k_types[packet->seckey.string_to_key]);
-		packet->seckey.rsa.exponent_d = &packet->seckey.exponent_d;
-		ADD_TO_MPI_OFFSET(read_mpi(packet->pdata + mpi_offset, &packet->seckey.exponent_d));
+		ADD_TO_MPI_OFFSET(parse_secret_mpis(packet, packet->pdata + mpi_offset));
 		printf(RED "[MPI length: %#4x] " RST, packet->seckey.exponent_d.length);
-		packet->seckey.rsa.prime_p = &packet->seckey.prime_p;
-		ADD_TO_MPI_OFFSET(read_mpi(packet->pdata + mpi_offset, &packet->seckey.prime_p));
 		printf(RED "[MPI length: %#4x] " RST, packet->seckey.prime_p.length);
-		packet->seckey.rsa.prime_q = &packet->seckey.prime_q;
-		ADD_TO_MPI_OFFSET(read_mpi(packet->pdata + mpi_offset, &packet->seckey.prime_q));
 		printf(RED "[MPI length: %#4x] " RST, packet->seckey.prime_q.length);
-		packet->seckey.rsa.mult_inverse = &packet->seckey.mult_inverse;
-		ADD_TO_MPI_OFFSET(read_mpi(packet->pdata + mpi_offset, &packet->seckey.mult_inverse));
 		printf(RED "[MPI length: %#4x]\n" RST, packet->seckey.mult_inverse.length);
-		der_encode_alt(packet);
 		break;
 	/* s2k specifier */
 	case STR_S2K1: /* fallthrough */
 	case STR_S2K2:
-		packet->seckey.sym_encryption_algo = packet->pdata[mpi_offset];
-		ADD_TO_MPI_OFFSET(1);
-		/* TODO XXX: implement rest of s2k handling */
 		printf(YELLOW "%s\n" RST, s2k_types[packet->seckey.string_to_key]);
+		ADD_TO_MPI_OFFSET(parse_s2k(packet, mpi_offset));
 		break;
 	/* symmetric-key algorithm */
 	default:
@@ -105,6 +302,63 @@ size_t parse_seckey_packet(PGP_PACKET *restrict packet)
 	return mpi_offset;
 }
 
+/*
+ * the header and subpacket areas of a version 4 signature into `sig`,
+ * without reading its MPIs, so subpackets can be looked at without
+ * parsing the whole signature; `version` is left alone, returns the
+ * offset of the MPIs or 0 if the signature is not one we can read
+ */
+size_t sig_subpackets(PGP_PACKET const *restrict packet, SIG_PACKET *restrict sig)
+{
+	size_t len = packet_len(packet), off = 0;
+	u8 *data = packet->pdata;
+
+	/* version, class, algorithms and the hashed area length */
+	if (len < 6 || data[0] != 4)
+		return 0;
+	sig->sig_class = data[1];
+	sig->pubkey_algo = data[2];
+	sig->hash_algo = data[3];
+	off = 4;
+	/* the subpacket areas are used in place */
+	sig->hashed.subpkt_len = BETOH16(data + off);
+	sig->hashed.subpkt_data = data + off + 2;
+	off += 2 + sig->hashed.subpkt_len;
+	if (len < off + 2)
+		return 0;
+	sig->unhashed.subpkt_len = BETOH16(data + off);
+	sig->unhashed.subpkt_data = data + off + 2;
+	off += 2 + sig->unhashed.subpkt_len;
+	if (len < off + 2)
+		return 0;
+	memcpy(sig->hash_left, data + off, sizeof sig->hash_left);
+
+	return off + 2;
+}
+
+size_t parse_sig_packet(PGP_PACKET *restrict packet)
+{
+	/*
+	 * FIXME: we only support version 4, so leave `version`
+	 * at zero for anything else.
+	 */
+	SIG_PACKET *sig = &packet->sig;
+	size_t len = packet_len(packet), off;
+	u8 *data = packet->pdata;
+
+	if (!(off = sig_subpackets(packet, sig)))
+		return 0;
+	/* only RSA has a single MPI */
+	if (sig->pubkey_algo == PUB_RSA || sig->pubkey_algo == PUB_RSASIG) {
+		if (len < off + 2 || len < off + 2 + MPIBYTES(BETOH16(data + off)))
+			return 0;
+		off += read_mpi(data + off, &sig->sig_mpi);
+	}
+	sig->version = data[0];
+
+	return off;
+}
+
 size_t der_encode(PGP_PACKET *restrict packet)
 {
 	/* SEQUENCE, TWO LENGTH BYTES */
@@ -13,12 +13,271 @@
 #include "errs.h"
 #include "defs.h"
 
+/* key packets hashed per `sha1_mb()` call by `key_fingerprint_list()` */
+#define FPR_BATCH		256
+/* longest mailbox `uid_mailbox()` accepts (RFC 5321) */
+#define UID_MAX_MBOX		254
+
 /* prototypes */
 size_t parse_pubkey_packet(PGP_PACKET *restrict packet);
 size_t parse_seckey_packet(PGP_PACKET *restrict packet);
+size_t parse_sig_packet(PGP_PACKET *restrict packet);
+size_t sig_subpackets(PGP_PACKET const *restrict packet, SIG_PACKET *restrict sig);
+size_t parse_secret_mpis(PGP_PACKET *restrict packet, u8 *restrict data);
+size_t key_fingerprint(PGP_PACKET *restrict packet);
+size_t key_fingerprint_list(PGP_LIST *restrict pkts);
+size_t uid_mailbox(char const *restrict uid, size_t len, char *restrict buf);
+size_t parse_uid_packet(PGP_PACKET *restrict packet, STR_ARENA *restrict strs);
 size_t der_encode(PGP_PACKET *restrict packet);
 size_t der_encode_alt(PGP_PACKET *restrict packet);
 
+/* body length from an old format packet header */
+static inline size_t packet_len(PGP_PACKET const *restrict packet)
+{
+	switch (packet->pheader & 0x03) {
+	case LEN_ONE:
+		return packet->plen_one;
+	case LEN_TWO:
+		return packet->plen_two;
+	case LEN_FOUR:
+		return packet->plen_four;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * length of the public part of a version 4 key packet, which fingerprints
+ * and signatures cover, or 0 if it is malformed or a secret key of an
+ * algorithm we cannot find the end of
+ */
+static inline size_t pubkey_body_len(PGP_PACKET const *restrict packet)
+{
+	size_t len = packet_len(packet), off = 6, mpis;
+	u8 const *data = packet->pdata;
+
+	if (len < off || data[0] != 4)
+		return 0;
+	/* the whole body of a public key packet is the public key */
+	if (TAGBITS(packet->pheader) == TAG_PUBKEY || TAGBITS(packet->pheader) == TAG_PUBSUBKEY)
+		return len;
+
+	switch (data[5]) {
+	/* modulus_n and exponent_e */
+	case PUB_RSA: /* fallthrough */
+	case PUB_RSAENC:
+	case PUB_RSASIG:
+		mpis = 2;
+		break;
+	/* prime p, generator g and y */
+	case PUB_ELGAENC: /* fallthrough */
+	case PUB_ELGA:
+		mpis = 3;
+		break;
+	/* primes p and q, generator g and y */
+	case PUB_DSA:
+		mpis = 4;
+		break;
+	/* a curve oid before the point */
+	case PUB_ELCURVE: /* fallthrough */
+	case PUB_ECDSA:
+	case PUB_EDDSA:
+		if (len < off + 1 || !data[off] || data[off] == 0xff)
+			return 0;
+		off += 1 + data[off];
+		mpis = 1;
+		break;
+	default:
+		return 0;
+	}
+	for (size_t i = 0; i < mpis; i++) {
+		if (len < off + 2)
+			return 0;
+		off += 2 + MPIBYTES(BETOH16(data + off));
+	}
+	/* ecdh keys end in their kdf parameters */
+	if (data[5] == PUB_ELCURVE) {
+		if (len < off + 1)
+			return 0;
+		off += 1 + data[off];
+	}
+
+	return (off <= len) ? off : 0;
+}
+
+/* whether a key packet is an RSA one, the only keys whose MPIs are parsed */
+static inline bool key_is_rsa(PGP_PACKET const *restrict packet)
+{
+	u8 const *data = packet->pdata;
+
+	return packet_len(packet) > 5 && (data[5] == PUB_RSA || data[5] == PUB_RSAENC || data[5] == PUB_RSASIG);
+}
+
+/* the 64-bit key id of a packet fingerprinted by `key_fingerprint()` */
+static inline u64 key_id(PGP_PACKET const *restrict packet)
+{
+	u64 id = 0;
+	for (size_t i = sizeof packet->fpr - 8; i < sizeof packet->fpr; i++)
+		id = id << 8 | packet->fpr[i];
+	return id;
+}
+
+/* length of the secret MPIs d, p, q and u in `len` octets at `data`, or 0 if they are malformed */
+static inline size_t secret_mpis_len(u8 const *restrict data, size_t len)
+{
+	size_t off = 0;
+
+	for (int i = 0; i < 4; i++) {
+		size_t bits;
+		if (len < off + 2)
+			return 0;
+		bits = BETOH16(data + off);
+		off += 2;
+		if (len < off + MPIBYTES(bits))
+			return 0;
+		/* the bits above the length must be clear, as `read_mpi()` asserts */
+		if (bits % 8 && data[off] >> (bits % 8))
+			return 0;
+		off += MPIBYTES(bits);
+	}
+
+	return off;
+}
+
+/* start iterating over the subpackets of `area` */
+static inline SIGSUB_ITER sigsub_iter(SIGSUB_PACKET const *restrict area)
+{
+	return (SIGSUB_ITER){.cur = area->subpkt_data, .end = area->subpkt_data + area->subpkt_len};
+}
+
+/*
+ * the next subpacket of the area into `sub`, as a slice of the packet data;
+ * returns false at the end of the area or at a subpacket that overruns it
+ */
+static inline bool sigsub_next(SIGSUB_ITER *restrict iter, SIGSUB *restrict sub)
+{
+	u8 const *cur = iter->cur, *end = iter->end;
+	size_t sub_len;
+
+	if (cur >= end)
+		return false;
+	/* one, two or five octet subpacket lengths */
+	if (cur[0] < 192) {
+		sub_len = cur[0];
+		cur += 1;
+	} else if (cur[0] < 255) {
+		if (end - cur < 2)
+			return false;
+		sub_len = ((cur[0] - 192) << 8) + cur[1] + 192;
+		cur += 2;
+	} else {
+		if (end - cur < 5)
+			return false;
+		sub_len = BETOH32(cur + 1);
+		cur += 5;
+	}
+	/* the length covers the type octet */
+	if (!sub_len || sub_len > (size_t)(end - cur)) {
+		iter->cur = end;
+		return false;
+	}
+	sub->type = cur[0] & 0x7f;
+	sub->critical = cur[0] >> 7;
+	sub->data = cur + 1;
+	sub->len = sub_len - 1;
+	iter->cur = cur + sub_len;
+
+	return true;
+}
+
+/* find the first subpacket of `type`, returning its data and setting `len`, or NULL */
+static inline u8 const *find_subpacket(SIGSUB_PACKET const *restrict area, u8 type, size_t *restrict len)
+{
+	SIGSUB_ITER iter = sigsub_iter(area);
+	SIGSUB sub;
+
+	while (sigsub_next(&iter, &sub)) {
+		/* ignore the critical bit */
+		if (sub.type == type) {
+			*len = sub.len;
+			return sub.data;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * typed accessors, which only decode the subpacket asked for; everything
+ * but the issuer has to be in the hashed area to be trusted
+ */
+
+/* signature creation time, or 0 if it has none */
+static inline u32 sig_created(SIG_PACKET const *restrict sig)
+{
+	u8 const *sub;
+	size_t len;
+
+	if (!(sub = find_subpacket(&sig->hashed, SUB_CREATED, &len)) || len != 4)
+		return 0;
+	return BETOH32(sub);
+}
+
+/* seconds after the key creation time that the key expires, or 0 if never */
+static inline u32 sig_key_expires(SIG_PACKET const *restrict sig)
+{
+	u8 const *sub;
+	size_t len;
+
+	if (!(sub = find_subpacket(&sig->hashed, SUB_KEY_EXPIRES, &len)) || len != 4)
+		return 0;
+	return BETOH32(sub);
+}
+
+/* the first octet of the key flags into `flags`; returns false if it has none */
+static inline bool sig_key_flags(SIG_PACKET const *restrict sig, u8 *restrict flags)
+{
+	u8 const *sub;
+	size_t len;
+
+	if (!(sub = find_subpacket(&sig->hashed, SUB_KEY_FLAGS, &len)))
+		return false;
+	*flags = len ? sub[0] : 0;
+	return true;
+}
+
+/* whether the user id certified by `sig` is the primary one */
+static inline bool sig_primary_uid(SIG_PACKET const *restrict sig)
+{
+	u8 const *sub;
+	size_t len;
+
+	return (sub = find_subpacket(&sig->hashed, SUB_PRIMARY_UID, &len)) && len == 1 && sub[0];
+}
+
+/*
+ * the key id of the issuer into `id`, from the issuer fingerprint or the
+ * issuer subpacket in either area; returns false if it names none
+ */
+static inline bool sig_issuer(SIG_PACKET const *restrict sig, u8 *restrict id)
+{
+	u8 const *sub;
+	size_t len;
+
+	if (((sub = find_subpacket(&sig->hashed, SUB_ISSUER_FPR, &len))
+			|| (sub = find_subpacket(&sig->unhashed, SUB_ISSUER_FPR, &len))) && len == 21 && sub[0] == 4) {
+		memcpy(id, sub + 1 + 12, 8);
+		return true;
+	}
+	if (((sub = find_subpacket(&sig->hashed, SUB_ISSUER, &len))
+			|| (sub = find_subpacket(&sig->unhashed, SUB_ISSUER, &len))) && len == 8) {
+		memcpy(id, sub, 8);
+		return true;
+	}
+
+	return false;
+}
+
 static inline size_t read_mpi(u8 *restrict mpi_buf, MPI *restrict mpi_ptr)
 {
 	size_t byte_length;
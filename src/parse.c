@@ -18,13 +18,31 @@ size_t parse_pgp_packets(PGP_LIST *restrict pkts)
 	for (i = 0; i < pkts->cnt; i++) {
 		int packet_type = TAGBITS(pkts->list[i].pheader);
 		size_t (*const parse_pkt)(PGP_PACKET *restrict) = dispatch_table[packet_type][0];
-		if (parse_pkt)
+		/* user ids share the string arena of the list */
+		if (packet_type == TAG_UID)
+			parse_uid_packet(&pkts->list[i], &pkts->strs);
+		else if (parse_pkt)
 			parse_pkt(&pkts->list[i]);
 	}
 
 	return i;
 }
 
+/* parse only the user ids, e.g. to look keys up by mailbox before the rest; returns how many */
+size_t parse_uid_packets(PGP_LIST *restrict pkts)
+{
+	size_t cnt = 0;
+
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (TAGBITS(pkts->list[i].pheader) != TAG_UID)
+			continue;
+		parse_uid_packet(&pkts->list[i], &pkts->strs);
+		cnt++;
+	}
+
+	return cnt;
+}
+
 /* read ascii armor pgp format */
 size_t read_pgp_aa(FILE *restrict file_ctx, char const *restrict filename, PGP_LIST *restrict list)
 {
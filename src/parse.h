@@ -10,7 +10,10 @@
 #ifndef _PARSE_H
 #define _PARSE_H 1
 
+#include "cdata.h"
 #include "defs.h"
+#include "seipd.h"
+#include "strarena.h"
 
 /* dispatch table forward declaration */
 static size_t (*const dispatch_table[64][2])(PGP_PACKET *restrict);
@@ -18,6 +21,11 @@ static size_t (*const dispatch_table[64][2])(PGP_PACKET *restrict);
 /* function prototypes */
 size_t parse_pubkey_packet(PGP_PACKET *restrict packet);
 size_t parse_seckey_packet(PGP_PACKET *restrict packet);
+size_t parse_sig_packet(PGP_PACKET *restrict packet);
+size_t key_fingerprint(PGP_PACKET *restrict packet);
+size_t key_fingerprint_list(PGP_LIST *restrict pkts);
+size_t parse_uid_packet(PGP_PACKET *restrict packet, STR_ARENA *restrict strs);
+size_t parse_uid_packets(PGP_LIST *restrict pkts);
 size_t parse_pgp_packets(PGP_LIST *restrict pkts);
 size_t read_pgp_aa(FILE *restrict file_ctx, char const *restrict filename, PGP_LIST *restrict list);
 
@@ -33,6 +41,22 @@ static inline size_t free_pubkey_packet(PGP_PACKET *restrict packet)
 	return ret;
 }
 
+/* zero the secret MPIs and their DER encoding, which are copied out of secure memory when a key is decrypted */
+static inline void wipe_seckey_packet(PGP_PACKET *restrict packet)
+{
+	MPI *const secrets[] = {
+		&packet->seckey.exponent_d, &packet->seckey.prime_p,
+		&packet->seckey.prime_q, &packet->seckey.mult_inverse,
+	};
+
+	for (size_t i = 0; i < ARRLEN(secrets); i++) {
+		if (secrets[i]->mdata)
+			explicit_bzero(secrets[i]->mdata, MPIBYTES(secrets[i]->length) + 1);
+	}
+	if (packet->seckey.rsa.der_data)
+		explicit_bzero(packet->seckey.rsa.der_data, packet->seckey.rsa.der_len);
+}
+
 static inline size_t free_seckey_packet(PGP_PACKET *restrict packet)
 {
 	/* count number of non-NULL pointers */
@@ -42,8 +66,10 @@ static inline size_t free_seckey_packet(PGP_PACKET *restrict packet)
 		+ !!packet->seckey.prime_p.mdata
 		+ !!packet->seckey.mult_inverse.mdata
 		+ !!packet->seckey.exponent_d.mdata
-		+ !!packet->seckey.rsa.der_data;
+		+ !!packet->seckey.rsa.der_data
+		+ !!packet->seckey.seckey_info;
 
+	wipe_seckey_packet(packet);
 	free(packet->seckey.modulus_n.mdata);
 	free(packet->seckey.exponent_e.mdata);
 	free(packet->seckey.exponent_d.mdata);
@@ -51,21 +77,38 @@ static inline size_t free_seckey_packet(PGP_PACKET *restrict packet)
 	free(packet->seckey.prime_p.mdata);
 	free(packet->seckey.prime_q.mdata);
 	free(packet->seckey.rsa.der_data);
+	free(packet->seckey.seckey_info);
 	return ret;
 }
 
+static inline size_t free_sig_packet(PGP_PACKET *restrict packet)
+{
+	/* the subpacket areas belong to `pdata` */
+	size_t ret = !!packet->sig.sig_mpi.mdata;
+
+	free(packet->sig.sig_mpi.mdata);
+
+	return ret;
+}
+
+static inline void free_pgp_packet(PGP_PACKET *restrict packet)
+{
+	size_t (*const cleanup_pkt)(PGP_PACKET *restrict) = dispatch_table[TAGBITS(packet->pheader)][1];
+
+	if (cleanup_pkt)
+		cleanup_pkt(packet);
+	free(packet->pdata);
+}
+
 static inline void free_pgp_list(PGP_LIST *restrict pkts)
 {
 	/* return if passed NULL pointers */
 	if (!pkts || !pkts->list)
 		return;
-	for (size_t i = 0; i < pkts->cnt; i++) {
-		int packet_type = TAGBITS(pkts->list[i].pheader);
-		size_t (*const cleanup_pkt)(PGP_PACKET *restrict) = dispatch_table[packet_type][1];
-		if (cleanup_pkt)
-			cleanup_pkt(&pkts->list[i]);
-		free(pkts->list[i].pdata);
-	}
+	for (size_t i = 0; i < pkts->cnt; i++)
+		free_pgp_packet(&pkts->list[i]);
+	/* user ids point into the arena */
+	str_arena_free(&pkts->strs);
 	free(pkts->list);
 	pkts->list = NULL;
 	pkts->cnt = 0;
@@ -93,6 +136,123 @@ static inline void add_pgp_list(PGP_LIST *restrict pkts, PGP_PACKET const *restr
 	pkts->list[pkts->cnt - 1] = *packet;
 }
 
+static inline size_t read_pgp_bin(FILE *restrict file_ctx, char const *restrict filename, PGP_LIST *restrict list);
+
+/* body length from an old format header, `SIZE_MAX` if it is indeterminate; returns false if it could not be read */
+static inline bool read_old_len(FILE *restrict file, PGP_PACKET *restrict cur, size_t *restrict len)
+{
+	*len = SIZE_MAX;
+	switch (cur->pheader & 0x03) {
+	case LEN_ONE:
+		if (!xfread(&cur->plen_raw, 1, sizeof cur->plen_one, file))
+			return false;
+		*len = cur->plen_raw[0];
+		break;
+	case LEN_TWO:
+		if (!xfread(&cur->plen_raw, 1, sizeof cur->plen_two, file))
+			return false;
+		*len = BETOH16(cur->plen_raw);
+		break;
+	case LEN_FOUR:
+		if (!xfread(&cur->plen_raw, 1, sizeof cur->plen_four, file))
+			return false;
+		*len = BETOH32(cur->plen_raw);
+		break;
+	/* indeterminate length runs to the end of the file */
+	case LEN_OTHER:
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * read the packets inside a compressed packet body of `len` octets into
+ * the list in its place, decompressing them as they are read so the
+ * whole stream is never held, and leave `file` just past it; returns
+ * false if the rest of `file` cannot be read
+ */
+static inline bool read_cdata(FILE *restrict file, size_t len, PGP_LIST *restrict list)
+{
+	FILE *inner;
+	u8 algo;
+
+	if (!len || !xfread(&algo, 1, sizeof algo, file))
+		return false;
+	if (len != SIZE_MAX)
+		len--;
+
+	if (list->depth >= CDATA_MAX_DEPTH || !(inner = cdata_open(file, algo, len))) {
+		WARNXMSG("skipping compressed data packet:", (list->depth >= CDATA_MAX_DEPTH)
+			? "nested too deep" : (algo < ARRLEN(compression_types) && compression_types[algo])
+			? compression_types[algo] : "unknown algorithm");
+		return cdata_skip(file, len) && len != SIZE_MAX;
+	}
+	list->depth++;
+	/* closes `inner` */
+	read_pgp_bin(inner, NULL, list);
+	list->depth--;
+
+	return len != SIZE_MAX;
+}
+
+/*
+ * read the packets inside an encrypted and integrity protected packet
+ * body into the list in its place, decrypting them with the session key
+ * of the list as they are read, and leave `file` just past it; without a
+ * session key it is skipped, returns false if the rest of `file` cannot
+ * be read
+ */
+static inline bool read_seipd(FILE *restrict file, size_t len, bool partial, PGP_LIST *restrict list)
+{
+	FILE *inner;
+
+	if (!list->sess || list->depth >= CDATA_MAX_DEPTH) {
+		WARNXMSG("skipping encrypted data packet:", list->sess ? "nested too deep" : "no session key");
+		seipd_skip(file, len, partial);
+		return true;
+	}
+	if (!(inner = seipd_open(file, len, partial, list->sess, &list->seipd_bad)))
+		return true;
+	list->depth++;
+	/* closes `inner`, checking its MDC */
+	read_pgp_bin(inner, NULL, list);
+	list->depth--;
+
+	return true;
+}
+
+/*
+ * read the packets of a binary keyring in a literal data packet body,
+ * such as `gpg --export-secret-keys | gpg -c` makes, into the list in its
+ * place; any other literal data is skipped rather than held, returns
+ * false if the rest of `file` cannot be read
+ */
+static inline bool read_litdata(FILE *restrict file, size_t len, bool partial, PGP_LIST *restrict list)
+{
+	FILE *inner = body_open(file, len, partial);
+	u8 hdr[2], name[UINT8_MAX], date[4];
+	int c;
+
+	/* the format, file name and date before the data */
+	if (!xfread(hdr, 1, sizeof hdr, inner) || (hdr[1] && !xfread(name, 1, hdr[1], inner))
+			|| !xfread(date, 1, sizeof date, inner) || (c = getc(inner)) == EOF || ungetc(c, inner) == EOF) {
+		fclose(inner);
+		return len != SIZE_MAX;
+	}
+	if (hdr[0] == 'b' && list->depth < CDATA_MAX_DEPTH && (c & 0x80) && FMTBITS(c) == FMT_OLD
+			&& (TAGBITS(c) == TAG_SECKEY || TAGBITS(c) == TAG_PUBKEY)) {
+		list->depth++;
+		/* closes `inner` */
+		read_pgp_bin(inner, NULL, list);
+		list->depth--;
+		return len != SIZE_MAX;
+	}
+	fclose(inner);
+
+	return len != SIZE_MAX;
+}
+
 /* read binary pgp format */
 static inline size_t read_pgp_bin(FILE *restrict file_ctx, char const *restrict filename, PGP_LIST *restrict list)
 {
@@ -116,6 +276,16 @@ static inline size_t read_pgp_bin(FILE *restrict file_ctx, char const *restrict
 	switch (FMTBITS(cur.pheader)) {
 	/* old format header */
 	case FMT_OLD:
+		/* compressed and literal data packets are replaced by the packets inside them */
+		if (TAGBITS(cur.pheader) == TAG_CDATA || TAGBITS(cur.pheader) == TAG_LITDATA) {
+			size_t len;
+			if (!read_old_len(file, &cur, &len))
+				goto BASE_CASE;
+			if (!((TAGBITS(cur.pheader) == TAG_CDATA) ? read_cdata(file, len, list)
+					: read_litdata(file, len, false, list)))
+				goto BASE_CASE;
+			return read_pgp_bin(file, filename, list);
+		}
 		/* header length */
 		switch (cur.pheader & 0x03) {
 		/* one byte length */
@@ -168,9 +338,21 @@ static inline size_t read_pgp_bin(FILE *restrict file_ctx, char const *restrict
 	/*
 	 * new format header
 	 *
-	 * TODO XXX: implement new format header handling
+	 * TODO XXX: implement new format header handling for other packets
 	 */
-	case FMT_NEW: /* fallthrough */
+	case FMT_NEW:
+		/* encrypted and literal data packets are replaced by the packets inside them */
+		if ((cur.pheader & 0x3f) == TAG_SEIPDATA || (cur.pheader & 0x3f) == TAG_LITDATA) {
+			size_t len;
+			bool partial;
+			if (!read_new_len(file, &len, &partial))
+				goto BASE_CASE;
+			if (!(((cur.pheader & 0x3f) == TAG_SEIPDATA) ? read_seipd(file, len, partial, list)
+					: read_litdata(file, len, partial, list)))
+				goto BASE_CASE;
+			return read_pgp_bin(file, filename, list);
+		}
+		goto BASE_CASE;
 	/* unrecognized header */
 	default:
 		goto BASE_CASE;
@@ -183,9 +365,24 @@ static inline size_t read_pgp_bin(FILE *restrict file_ctx, char const *restrict
 /* base-case common exit point */
 BASE_CASE:
 	fclose(file);
+	/* fingerprint the keys read in one batch, so selecting one needs no parsing */
+	key_fingerprint_list(list);
 	return list->cnt;
 }
 
+/* read binary pgp format from `filename` after the packets already in the list; returns the packets in it */
+static inline size_t append_pgp_bin(char const *restrict filename, PGP_LIST *restrict list)
+{
+	FILE *file;
+
+	if (!list->list)
+		init_pgp_list(list);
+	if (!(file = fopen(filename, "rb")))
+		ERR("append_pgp_bin() fopen()");
+
+	return read_pgp_bin(file, NULL, list);
+}
+
 /*
  * static function pointer array
  *
@@ -194,7 +391,7 @@ BASE_CASE:
 static size_t (*const dispatch_table[64][2])(PGP_PACKET *restrict) = {
 	[TAG_RSRVD] = {0},
 	[TAG_PKESESS] = {0},
-	[TAG_SIG] = {0},
+	[TAG_SIG] = {parse_sig_packet, free_sig_packet},
 	[TAG_SKESESS] = {0},
 	[TAG_OPSIG] = {0},
 	[TAG_SECKEY] = {parse_seckey_packet, free_seckey_packet},
@@ -0,0 +1,78 @@
+/*
+ * pool.h:	parallel loops over worker threads
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H 1
+
+#include "errs.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* upper bound on worker threads */
+#define POOL_MAX		256
+
+/* shared state of one `pool_for()` call */
+typedef struct _pool_job {
+	/* next index to hand out */
+	atomic_size_t next;
+	size_t cnt;
+	void (*fn)(void *restrict, size_t);
+	void *ctx;
+} POOL_JOB;
+
+/* number of online cpus, at least one */
+static inline size_t pool_cpus(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+	return (cpus > POOL_MAX) ? POOL_MAX : (size_t)cpus;
+}
+
+/* claim indices one at a time so uneven items balance out between threads */
+static inline void *pool_worker(void *arg)
+{
+	POOL_JOB *job = arg;
+	size_t i;
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->cnt)
+		job->fn(job->ctx, i);
+	return NULL;
+}
+
+/*
+ * call `fn(ctx, i)` for every `i < cnt` on up to `nthreads` threads
+ * (0 for one per online cpu); the calling thread takes part, and
+ * falls back to doing all of the work if no threads can be started
+ */
+static inline void pool_for(size_t cnt, size_t nthreads, void (*fn)(void *restrict, size_t), void *ctx)
+{
+	pthread_t tids[POOL_MAX];
+	POOL_JOB job = {.cnt = cnt, .fn = fn, .ctx = ctx};
+	size_t started = 0;
+
+	atomic_init(&job.next, 0);
+	if (!nthreads)
+		nthreads = pool_cpus();
+	if (nthreads > cnt)
+		nthreads = cnt;
+	if (nthreads > POOL_MAX)
+		nthreads = POOL_MAX;
+	for (; started + 1 < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, pool_worker, &job)) {
+			WARNX("pool_for() pthread_create()");
+			break;
+		}
+	}
+	pool_worker(&job);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+}
+
+#endif
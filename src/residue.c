@@ -0,0 +1,169 @@
+/*
+ * residue.c:	rsa moduli modulo many small primes in one pass, and the weak keys they give away
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "residue.h"
+#include "pool.h"
+
+/* adding and subtracting 1.5 * 2^52 rounds a double below 2^51 to the nearest integer */
+#define ROUND_MAGIC		6755399441055744.0
+/* the RSALib generator */
+#define ROCA_GEN		65537
+
+/* one modulus of a packet */
+typedef struct _weak_ref {
+	MPI const *n;
+	size_t pkt;
+} WEAK_REF;
+
+/* shared state of `weak_scan_list()` */
+typedef struct _weak_ctx {
+	RESIDUE_CTX const *residues;
+	WEAK_REF const *refs;
+	size_t cnt;
+	int *results;
+} WEAK_CTX;
+
+void residue_init(RESIDUE_CTX *restrict ctx)
+{
+	u8 composite[1 << RESIDUE_PRIME_BITS] = {0};
+	size_t cnt = 0;
+
+	for (size_t p = 3; p < sizeof composite; p += 2) {
+		if (composite[p])
+			continue;
+		for (size_t m = p * p; m < sizeof composite; m += 2 * p)
+			composite[m] = 1;
+		ctx->primes[cnt] = p;
+		ctx->recips[cnt] = 1.0 / p;
+		cnt++;
+	}
+	assert(cnt == RESIDUE_PRIMES);
+	/* everything is 0 mod 1, exactly, so the padding costs nothing but the lanes */
+	for (; cnt < RESIDUE_LANES; cnt++)
+		ctx->primes[cnt] = ctx->recips[cnt] = 1.0;
+
+	/* the primes come in order, so the first ROCA_PRIMES are the ones up to ROCA_MAX_PRIME */
+	memset(ctx->roca, 0, sizeof ctx->roca);
+	for (size_t i = 0; i < ROCA_PRIMES; i++) {
+		u32 p = ctx->primes[i], g = ROCA_GEN % p, x = 1;
+		do {
+			ctx->roca[i][x / 64] |= (u64)1 << (x % 64);
+			x = x * g % p;
+		} while (x != 1);
+	}
+}
+
+/*
+ * res[i] = n mod the ith prime for the big-endian `len`-byte n, by Horner
+ * over RESIDUE_CHUNK_BYTES chunks from the top: r * 2^40 + chunk is exact
+ * in a double, and the quotient by p comes from the precomputed reciprocal
+ * rounded to the nearest integer, which is off by less than a half, so the
+ * remainder stays in (-p, p) and only the final one needs its sign fixed;
+ * with no branch left the inner loop runs across the primes in vectors,
+ * with an avx2 clone picked at load time where the cpu has it
+ */
+__attribute__((target_clones("avx2", "default")))
+void residue_mod(RESIDUE_CTX const *restrict ctx, u8 const *restrict buf, size_t len, u16 *restrict res)
+{
+	_Alignas(32) double r[RESIDUE_LANES] = {0};
+	size_t top = len % RESIDUE_CHUNK_BYTES;
+
+	for (size_t off = 0; off < len;) {
+		size_t clen = (off || !top) ? RESIDUE_CHUNK_BYTES : top;
+		double shift = (double)((u64)1 << (8 * clen));
+		u64 chunk = 0;
+		for (size_t i = 0; i < clen; i++)
+			chunk = chunk << 8 | buf[off + i];
+		off += clen;
+		for (size_t i = 0; i < RESIDUE_LANES; i++) {
+			double x = r[i] * shift + (double)chunk;
+			double q = (x * ctx->recips[i] + ROUND_MAGIC) - ROUND_MAGIC;
+			r[i] = x - q * ctx->primes[i];
+		}
+	}
+	for (size_t i = 0; i < RESIDUE_PRIMES; i++)
+		res[i] = (r[i] < 0) ? r[i] + ctx->primes[i] : r[i];
+}
+
+int weak_check(RESIDUE_CTX const *restrict ctx, u8 const *restrict buf, size_t len)
+{
+	u16 res[RESIDUE_PRIMES];
+	int ret = WEAK_NONE;
+	bool roca = true;
+
+	if (!len)
+		return WEAK_NONE;
+	residue_mod(ctx, buf, len, res);
+	if (!(buf[len - 1] & 1))
+		ret |= WEAK_SMALL_FACTOR;
+	for (size_t i = 0; i < RESIDUE_PRIMES; i++) {
+		if (!res[i])
+			ret |= WEAK_SMALL_FACTOR;
+	}
+	/*
+	 * RSALib primes are k * M + (65537^a mod M) with M the product of the
+	 * first primes, so n = p * q is a power of 65537 modulo each of them
+	 */
+	for (size_t i = 0; i < ROCA_PRIMES && roca; i++)
+		roca = ctx->roca[i][res[i] / 64] >> (res[i] % 64) & 1;
+	if (roca)
+		ret |= WEAK_ROCA;
+
+	return ret;
+}
+
+/* one chunk of moduli */
+static void weak_chunk(void *restrict arg, size_t chunk)
+{
+	WEAK_CTX *ctx = arg;
+	size_t end = (chunk + 1) * WEAK_SCAN_CHUNK;
+
+	if (end > ctx->cnt)
+		end = ctx->cnt;
+	for (size_t i = chunk * WEAK_SCAN_CHUNK; i < end; i++) {
+		MPI const *n = ctx->refs[i].n;
+		ctx->results[ctx->refs[i].pkt] = weak_check(ctx->residues, n->mdata + 1, MPIBYTES(n->length));
+	}
+}
+
+size_t weak_scan_list(PGP_LIST const *restrict pkts, int *restrict results, size_t nthreads)
+{
+	RESIDUE_CTX residues;
+	WEAK_CTX ctx = {.residues = &residues, .results = results};
+	WEAK_REF *refs;
+	size_t weak = 0;
+
+	residue_init(&residues);
+	xcalloc(&refs, FALLBACK(pkts->cnt, 1), sizeof *refs, "weak_scan_list() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		PGP_PACKET const *packet = &pkts->list[i];
+		int tag = TAGBITS(packet->pheader);
+		MPI const *n;
+
+		results[i] = -1;
+		if (tag == TAG_SECKEY || tag == TAG_SECSUBKEY)
+			n = &packet->seckey.modulus_n;
+		else if (tag == TAG_PUBKEY || tag == TAG_PUBSUBKEY)
+			n = &packet->pubkey.modulus_n;
+		else
+			continue;
+		if (!n->mdata || !n->length || n->length > RSA_MAX_BITS)
+			continue;
+		refs[ctx.cnt++] = (WEAK_REF){.n = n, .pkt = i};
+	}
+	ctx.refs = refs;
+	pool_for((ctx.cnt + WEAK_SCAN_CHUNK - 1) / WEAK_SCAN_CHUNK, nthreads, weak_chunk, &ctx);
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] > 0)
+			weak++;
+	}
+	free(refs);
+
+	return weak;
+}
@@ -0,0 +1,62 @@
+/*
+ * residue.h:	header for residue.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _RESIDUE_H
+#define _RESIDUE_H 1
+
+#include "defs.h"
+#include "rsa.h"
+
+/*
+ * residues are taken modulo every odd prime below 2^RESIDUE_PRIME_BITS,
+ * and a residue shifted up by one chunk of the modulus plus the chunk
+ * stays below the 2^53 a double holds exactly
+ */
+#define RESIDUE_PRIME_BITS	12
+#define RESIDUE_PRIMES		563
+#define RESIDUE_CHUNK_BYTES	5
+/* the prime table padded to whole vectors, so the loop over it needs no scalar tail */
+#define RESIDUE_LANES		((RESIDUE_PRIMES + 7) & ~7)
+#define RESIDUE_MAX_CHUNKS	((RSA_MAX_BITS / 8 + RESIDUE_CHUNK_BYTES - 1) / RESIDUE_CHUNK_BYTES)
+/* the RSALib fingerprint is checked modulo the odd primes up to this */
+#define ROCA_MAX_PRIME		167
+#define ROCA_PRIMES		38
+/* moduli per `pool_for()` task */
+#define WEAK_SCAN_CHUNK		256
+
+/* weak key classes reported by `weak_check()`, or'd together */
+enum weak_checks {
+	WEAK_NONE = 0x00,
+	/* even, or divisible by an odd prime below 2^RESIDUE_PRIME_BITS */
+	WEAK_SMALL_FACTOR = 0x01,
+	/* n mod p is a power of 65537 mod p for every odd prime up to ROCA_MAX_PRIME */
+	WEAK_ROCA = 0x02,
+};
+
+/* weak key class names for reporting */
+static char const *const weak_check_names[] = {
+	"WEAK_SMALL_FACTOR", "WEAK_ROCA",
+};
+
+/* the primes with their reciprocals, see `residue_init()` */
+typedef struct _residue_ctx {
+	/* as doubles, so one pass over the modulus works on every prime at once */
+	_Alignas(32) double primes[RESIDUE_LANES];
+	_Alignas(32) double recips[RESIDUE_LANES];
+	/* bit r set if r is a power of 65537 mod the ith prime */
+	u64 roca[ROCA_PRIMES][(ROCA_MAX_PRIME + 63) / 64];
+} RESIDUE_CTX;
+
+/* prototypes */
+void residue_init(RESIDUE_CTX *restrict ctx);
+void residue_mod(RESIDUE_CTX const *restrict ctx, u8 const *restrict buf, size_t len, u16 *restrict res);
+int weak_check(RESIDUE_CTX const *restrict ctx, u8 const *restrict buf, size_t len);
+size_t weak_scan_list(PGP_LIST const *restrict pkts, int *restrict results, size_t nthreads);
+
+#endif
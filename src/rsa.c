@@ -0,0 +1,611 @@
+/*
+ * rsa.c:	rsa secret key checks, private-key operations and signature verification
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "rsa.h"
+#include "packet.h"
+#include "pool.h"
+#include <gcrypt.h>
+
+/* room for products of two numbers below the largest modulus */
+#define BN_BYTES		(2 * RSA_MAX_BITS / 8)
+#include "bn.h"
+#include "lanes.h"
+
+/* most signatures verified with one set of key constants */
+#define VERIFY_CHUNK		64
+/*
+ * fewest signatures of one key worth a `lanes_powmod()`, which does the
+ * work of all LANES of them; it only beats the scalar ladder with avx-512
+ */
+#define VERIFY_LANES_MIN	6
+/* `verify_sig()` left s^e mod n to its caller */
+#define VERIFY_PENDING		(-2)
+
+/* libgcrypt digests for the OpenPGP hash algorithms */
+static int const md_algos[] = {
+	[HASH_MD5] = GCRY_MD_MD5, [HASH_SHA1] = GCRY_MD_SHA1,
+	[HASH_RIPE] = GCRY_MD_RMD160, [HASH_SHA256] = GCRY_MD_SHA256,
+	[HASH_SHA384] = GCRY_MD_SHA384, [HASH_SHA512] = GCRY_MD_SHA512,
+	[HASH_SHA224] = GCRY_MD_SHA224,
+};
+
+/*
+ * PKCS#1 CRT form of a private key: m = c^d mod n is computed as
+ * m1 = c^dP mod p and m2 = c^dQ mod q, recombined with Garner's
+ * formula m = m2 + q * ((m1 - m2) * qInv mod p)
+ */
+struct _rsa_crt {
+	struct bn_mont mont_p, mont_q, mont_n;
+	struct bn e, dp, dq;
+	/* qInv = q^-1 mod p, kept in montgomery form modulo p */
+	struct bn qinv_r;
+	/* modulus length in bytes */
+	size_t len;
+};
+
+/* shared arguments for `crt_one()`, the inputs and outputs are `len` octets apart */
+typedef struct _crt_ctx {
+	RSA_CRT const *crt;
+	u8 const *in;
+	u8 *out;
+	int *results;
+} CRT_CTX;
+
+/* shared arguments for `validate_one()` */
+typedef struct _validate_ctx {
+	PGP_LIST const *pkts;
+	int *results;
+	int rounds;
+} VALIDATE_CTX;
+
+/* a self-signature and the packets it covers */
+typedef struct _sig_ref {
+	/* signature and primary key packet indices */
+	size_t sig, key;
+	/* user id or subkey packet index, `SIZE_MAX` before the first one */
+	size_t comp;
+} SIG_REF;
+
+/* shared arguments for `verify_chunk()` */
+typedef struct _verify_ctx {
+	PGP_LIST const *pkts;
+	SIG_REF const *refs;
+	/* start of each chunk in `refs`, followed by the total */
+	size_t const *chunks;
+	int *results;
+} VERIFY_CTX;
+
+/* constants of the primary key shared by a chunk of signatures */
+typedef struct _verify_key {
+	struct bn_mont mont;
+	struct bn e;
+	/* modulus length in bytes */
+	size_t len;
+	u8 fpr[20];
+	/* the modulus in every lane, set up once a chunk has enough signatures */
+	LANE_MONT *lanes;
+} VERIFY_KEY;
+
+/* signatures of a chunk waiting for s^e mod n, see `verify_flush()` */
+typedef struct _verify_batch {
+	int cnt;
+	size_t sig[LANES];
+	struct bn s[LANES];
+	/* the encoded hash each result has to match */
+	u8 em[LANES][RSA_MAX_BITS / 8];
+} VERIFY_BATCH;
+
+/* load an MPI parsed by `read_mpi()`, returning non-zero if it is missing, zero or too large */
+static inline int load_mpi(struct bn *restrict n, MPI const *restrict mpi)
+{
+	if (!mpi->mdata || !mpi->length || mpi->length > RSA_MAX_BITS)
+		return 1;
+	/* `read_mpi()` stores the value after a leading zero byte */
+	bignum_from_bytes(n, mpi->mdata + 1, MPIBYTES(mpi->length));
+	return bignum_is_zero(n);
+}
+
+/* returns non-zero unless `a * b = 1 mod m` */
+static inline int check_inverse(struct bn *restrict a, struct bn *restrict b, struct bn *restrict m)
+{
+	struct bn x, y;
+	bignum_mod(a, m, &x);
+	bignum_mod(b, m, &y);
+	bignum_mul(&x, &y, &x);
+	bignum_mod(&x, m, &x);
+	bignum_from_int(&y, 1);
+	return bignum_cmp(&x, &y) != EQUAL;
+}
+
+/* `rounds` Miller-Rabin rounds with random bases, returning non-zero if `p` is composite */
+static inline int miller_rabin(struct bn *restrict p, int rounds)
+{
+	struct bn_mont mont;
+	struct bn r, p_1, p_3, one, minus_one, a, x;
+	unsigned char buf[BN_BYTES];
+	int nbytes = bignum_num_bytes(p);
+	int s, j;
+
+	/* 2 and 3 are prime, other small and even numbers are not */
+	if (p->top == 1 && p->array[0] <= 3)
+		return p->array[0] < 2;
+	if (!(p->array[0] & 1))
+		return 1;
+
+	/* p - 1 = 2^s * r with r odd */
+	bignum_assign(&p_1, p);
+	bignum_dec(&p_1);
+	bignum_assign(&r, &p_1);
+	for (s = 0; !(r.array[0] & 1); s++)
+		bignum_rshift(&r, &r, 1);
+	bignum_assign(&p_3, &p_1);
+	bignum_dec(&p_3);
+	bignum_dec(&p_3);
+
+	/* compare in montgomery form to keep the squarings cheap */
+	bignum_mont_init(&mont, p);
+	bignum_from_int(&one, 1);
+	bignum_mont_to(&mont, &one, &one);
+	bignum_mont_to(&mont, &p_1, &minus_one);
+	for (int i = 0; i < rounds; i++) {
+		/* base in [2, p - 2] */
+		gcry_randomize(buf, nbytes, GCRY_WEAK_RANDOM);
+		bignum_from_bytes(&a, buf, nbytes);
+		bignum_mod(&a, &p_3, &a);
+		bignum_inc(&a);
+		bignum_inc(&a);
+		/* p is secret, so the exponent is too */
+		bignum_mont_powmod_sec(&mont, &a, &r, &x);
+		bignum_mont_to(&mont, &x, &x);
+		if (bignum_cmp(&x, &one) == EQUAL || bignum_cmp(&x, &minus_one) == EQUAL)
+			continue;
+		for (j = 1; j < s; j++) {
+			bignum_mont_mul(&mont, &x, &x, &x);
+			if (bignum_cmp(&x, &minus_one) == EQUAL)
+				break;
+		}
+		if (j == s)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* one private operation of `rsa_crt_private_list()` in a `pool_for()` worker */
+static void crt_one(void *restrict arg, size_t i)
+{
+	CRT_CTX *ctx = arg;
+	size_t len = ctx->crt->len;
+
+	ctx->results[i] = rsa_crt_private(ctx->crt, ctx->in + i * len, len, ctx->out + i * len);
+}
+
+/* check one secret key in a `pool_for()` worker */
+static void validate_one(void *restrict arg, size_t i)
+{
+	VALIDATE_CTX *ctx = arg;
+	PGP_PACKET const *packet = &ctx->pkts->list[i];
+	int tag = TAGBITS(packet->pheader);
+
+	ctx->results[i] = -1;
+	/* `parse_seckey_packet()` only sets `rsa.exponent_d` once it has read the secret MPIs */
+	if (tag != TAG_SECKEY && tag != TAG_SECSUBKEY)
+		return;
+	if (!packet->seckey.rsa.exponent_d)
+		return;
+	ctx->results[i] = rsa_validate(&packet->seckey, ctx->rounds);
+}
+
+/* modulus and public exponent of a public or secret key packet */
+static inline void key_mpis(PGP_PACKET const *restrict packet, MPI const **n, MPI const **e)
+{
+	int tag = TAGBITS(packet->pheader);
+	if (tag == TAG_SECKEY || tag == TAG_SECSUBKEY) {
+		*n = &packet->seckey.modulus_n;
+		*e = &packet->seckey.exponent_e;
+		return;
+	}
+	*n = &packet->pubkey.modulus_n;
+	*e = &packet->pubkey.exponent_e;
+}
+
+/* hash a key packet the way signatures and fingerprints cover it */
+static inline void hash_key(gcry_md_hd_t md, PGP_PACKET const *restrict packet, size_t len)
+{
+	u8 hdr[3] = {0x99, len >> 8, len};
+	gcry_md_write(md, hdr, sizeof hdr);
+	gcry_md_write(md, packet->pdata, len);
+}
+
+/* check one signature by the key in `key`, returning -1 if it is not one we can check */
+/*
+ * check everything about a signature but its value, which is queued in
+ * `batch` for `verify_flush()`; returns the result, or `VERIFY_PENDING`
+ */
+static int verify_sig(VERIFY_KEY *restrict key, PGP_LIST const *restrict pkts, SIG_REF const *restrict ref,
+	VERIFY_BATCH *restrict batch)
+{
+	PGP_PACKET const *packet = &pkts->list[ref->sig];
+	PGP_PACKET const *comp = (ref->comp != SIZE_MAX) ? &pkts->list[ref->comp] : NULL;
+	SIG_PACKET const *sig = &packet->sig;
+	int comp_tag = comp ? TAGBITS(comp->pheader) : TAG_RSRVD;
+	u8 *em = batch->em[batch->cnt], trailer[6], *digest;
+	u8 const *issuer;
+	size_t len, asn_len, md_len, pad_len, hashed_len;
+	gcry_md_hd_t md;
+	struct bn *s = &batch->s[batch->cnt];
+	int algo;
+
+	if (sig->version != 4 || (sig->pubkey_algo != PUB_RSA && sig->pubkey_algo != PUB_RSASIG))
+		return -1;
+	if (sig->hash_algo >= ARRLEN(md_algos) || !(algo = md_algos[sig->hash_algo]))
+		return -1;
+	/* leave signatures by other keys alone */
+	if ((issuer = find_subpacket(&sig->hashed, SUB_ISSUER_FPR, &len))
+			|| (issuer = find_subpacket(&sig->unhashed, SUB_ISSUER_FPR, &len))) {
+		if (len == 21 && issuer[0] == 4 && memcmp(issuer + 1, key->fpr, 20))
+			return -1;
+	}
+	if ((issuer = find_subpacket(&sig->hashed, SUB_ISSUER, &len))
+			|| (issuer = find_subpacket(&sig->unhashed, SUB_ISSUER, &len))) {
+		if (len == 8 && memcmp(issuer, key->fpr + 12, 8))
+			return -1;
+	}
+
+	/* the class decides which packets after the primary key are covered */
+	switch (sig->sig_class) {
+	case SIG_CERT_GENERIC: /* fallthrough */
+	case SIG_CERT_PERSONA:
+	case SIG_CERT_CASUAL:
+	case SIG_CERT_POSITIVE:
+	case SIG_CERT_REVOKE:
+		if (comp_tag != TAG_UID && comp_tag != TAG_UATTR)
+			return -1;
+		break;
+	case SIG_SUBKEY_BIND: /* fallthrough */
+	case SIG_SUBKEY_REVOKE:
+		if (comp_tag != TAG_PUBSUBKEY && comp_tag != TAG_SECSUBKEY)
+			return -1;
+		if (!pubkey_body_len(comp))
+			return -1;
+		break;
+	case SIG_DIRECT_KEY: /* fallthrough */
+	case SIG_KEY_REVOKE:
+		comp = NULL;
+		break;
+	default:
+		return -1;
+	}
+
+	if (load_mpi(s, &sig->sig_mpi) || bignum_cmp(s, &key->mont.n) != SMALLER)
+		return RSA_SIG_BAD_MPI;
+
+	/* key, then the user id or subkey, then the hashed part of the signature */
+	if (gcry_md_open(&md, algo, 0))
+		return -1;
+	hash_key(md, &pkts->list[ref->key], pubkey_body_len(&pkts->list[ref->key]));
+	if (comp_tag == TAG_PUBSUBKEY || comp_tag == TAG_SECSUBKEY) {
+		hash_key(md, comp, pubkey_body_len(comp));
+	} else if (comp) {
+		len = packet_len(comp);
+		u8 hdr[5] = {(comp_tag == TAG_UID) ? 0xb4 : 0xd1, len >> 24, len >> 16, len >> 8, len};
+		gcry_md_write(md, hdr, sizeof hdr);
+		gcry_md_write(md, comp->pdata, len);
+	}
+	hashed_len = 6 + sig->hashed.subpkt_len;
+	gcry_md_write(md, packet->pdata, hashed_len);
+	trailer[0] = 4;
+	trailer[1] = 0xff;
+	trailer[2] = hashed_len >> 24;
+	trailer[3] = hashed_len >> 16;
+	trailer[4] = hashed_len >> 8;
+	trailer[5] = hashed_len;
+	gcry_md_write(md, trailer, sizeof trailer);
+	digest = gcry_md_read(md, algo);
+	md_len = gcry_md_get_algo_dlen(algo);
+	if (memcmp(digest, sig->hash_left, sizeof sig->hash_left)) {
+		gcry_md_close(md);
+		return RSA_SIG_BAD_DIGEST;
+	}
+
+	/* EM = 0x00 0x01 0xff ... 0xff 0x00 DigestInfo hash */
+	gcry_md_get_asnoid(algo, NULL, &asn_len);
+	if (key->len < asn_len + md_len + 11) {
+		gcry_md_close(md);
+		return RSA_SIG_BAD_SIG;
+	}
+	pad_len = key->len - asn_len - md_len - 3;
+	em[0] = 0x00;
+	em[1] = 0x01;
+	memset(em + 2, 0xff, pad_len);
+	em[pad_len + 2] = 0x00;
+	gcry_md_get_asnoid(algo, em + pad_len + 3, &asn_len);
+	memcpy(em + key->len - md_len, digest, md_len);
+	gcry_md_close(md);
+	batch->sig[batch->cnt++] = ref->sig;
+
+	return VERIFY_PENDING;
+}
+
+/* s^e mod n of the signatures queued in `batch`, compared to their encoded hashes */
+static void verify_flush(VERIFY_KEY *restrict key, VERIFY_BATCH *restrict batch, int *restrict results)
+{
+	u8 out[RSA_MAX_BITS / 8];
+
+	if (batch->cnt >= VERIFY_LANES_MIN && _lanes_isa_get() == LANES_AVX512
+			&& LANE_LIMBS(_bignum_bits(&key->mont.n)) <= LANE_MAX_LIMBS) {
+		struct bn *n[LANES], *a[LANES], *e[LANES], *c[LANES];
+		for (int l = 0; l < LANES; l++) {
+			/* idle lanes repeat the last signature, into slots nobody reads */
+			n[l] = &key->mont.n, e[l] = &key->e;
+			a[l] = &batch->s[(l < batch->cnt) ? l : batch->cnt - 1], c[l] = &batch->s[l];
+		}
+		if (!key->lanes) {
+			xmalloc(&key->lanes, sizeof *key->lanes, "verify_flush() xmalloc()");
+			lanes_mont_init(key->lanes, n, LANES);
+		}
+		lanes_powmod(key->lanes, a, e, c);
+	} else {
+		/* only the public exponent, so the variable-time ladder is fine */
+		for (int i = 0; i < batch->cnt; i++)
+			bignum_mont_powmod(&key->mont, &batch->s[i], &key->e, &batch->s[i]);
+	}
+	for (int i = 0; i < batch->cnt; i++) {
+		bignum_to_bytes(&batch->s[i], out, key->len);
+		results[batch->sig[i]] = memcmp(batch->em[i], out, key->len) ? RSA_SIG_BAD_SIG : RSA_SIG_VALID;
+	}
+	batch->cnt = 0;
+}
+
+/* check a chunk of signatures by one primary key in a `pool_for()` worker */
+static void verify_chunk(void *restrict arg, size_t i)
+{
+	VERIFY_CTX *ctx = arg;
+	SIG_REF const *ref = &ctx->refs[ctx->chunks[i]], *end = &ctx->refs[ctx->chunks[i + 1]];
+	PGP_PACKET const *packet = &ctx->pkts->list[ref->key];
+	size_t key_len = pubkey_body_len(packet);
+	MPI const *n_mpi, *e_mpi;
+	VERIFY_KEY key = {0};
+	VERIFY_BATCH batch;
+	gcry_md_hd_t md;
+	struct bn n;
+
+	/* the results stay at -1 for keys we cannot use */
+	key_mpis(packet, &n_mpi, &e_mpi);
+	if (!key_len || !key_is_rsa(packet) || load_mpi(&n, n_mpi) || load_mpi(&key.e, e_mpi) || !(n.array[0] & 1))
+		return;
+	if (gcry_md_open(&md, GCRY_MD_SHA1, 0))
+		return;
+	/* the v4 fingerprint, ending in the key id */
+	hash_key(md, packet, key_len);
+	memcpy(key.fpr, gcry_md_read(md, GCRY_MD_SHA1), sizeof key.fpr);
+	gcry_md_close(md);
+	bignum_mont_init(&key.mont, &n);
+	key.len = bignum_num_bytes(&n);
+
+	/* the signatures that get as far as their value go through the lanes LANES at a time */
+	for (batch.cnt = 0; ref < end; ref++) {
+		if ((ctx->results[ref->sig] = verify_sig(&key, ctx->pkts, ref, &batch)) == VERIFY_PENDING
+				&& batch.cnt == LANES)
+			verify_flush(&key, &batch, ctx->results);
+	}
+	verify_flush(&key, &batch, ctx->results);
+	free(key.lanes);
+}
+
+int rsa_validate(SECKEY_PACKET const *restrict seckey, int rounds)
+{
+	struct bn n, e, d, p, q, u, t;
+	int ret = RSA_VALID;
+
+	if (load_mpi(&n, &seckey->modulus_n) | load_mpi(&e, &seckey->exponent_e)
+			| load_mpi(&d, &seckey->exponent_d) | load_mpi(&p, &seckey->prime_p)
+			| load_mpi(&q, &seckey->prime_q) | load_mpi(&u, &seckey->mult_inverse))
+		return RSA_BAD_MPI;
+	/* p = n, q = 1 would pass everything below */
+	bignum_from_int(&t, 1);
+	if (bignum_cmp(&p, &t) != LARGER || bignum_cmp(&q, &t) != LARGER)
+		return RSA_BAD_MPI;
+
+	/* n = p * q */
+	bignum_mul(&p, &q, &t);
+	if (bignum_cmp(&t, &n) != EQUAL)
+		ret |= RSA_BAD_N;
+
+	/*
+	 * d * e = 1 mod lcm(p - 1, q - 1), checked modulo p - 1 and q - 1
+	 * since a number is a multiple of lcm(a, b) exactly when it is a
+	 * multiple of both; this skips the gcd and keeps the products small
+	 */
+	bignum_assign(&t, &p);
+	bignum_dec(&t);
+	if (check_inverse(&d, &e, &t))
+		ret |= RSA_BAD_D;
+	bignum_assign(&t, &q);
+	bignum_dec(&t);
+	if (check_inverse(&d, &e, &t))
+		ret |= RSA_BAD_D;
+
+	/* u = p^-1 mod q in OpenPGP, unlike the q^-1 mod p of PKCS#1 */
+	if (bignum_cmp(&u, &q) != SMALLER || check_inverse(&u, &p, &q))
+		ret |= RSA_BAD_U;
+
+	if (rounds > 0) {
+		if (miller_rabin(&p, rounds))
+			ret |= RSA_BAD_P;
+		if (miller_rabin(&q, rounds))
+			ret |= RSA_BAD_Q;
+	}
+
+	return ret;
+}
+
+RSA_CRT *rsa_crt_new(SECKEY_PACKET const *restrict seckey)
+{
+	RSA_CRT *crt;
+	struct bn n, d, p, q, t;
+
+	if (load_mpi(&n, &seckey->modulus_n) | load_mpi(&d, &seckey->exponent_d)
+			| load_mpi(&p, &seckey->prime_p) | load_mpi(&q, &seckey->prime_q))
+		return NULL;
+	/* montgomery needs odd moduli, and q must be invertible modulo p */
+	if (!(n.array[0] & p.array[0] & q.array[0] & 1))
+		return NULL;
+	xcalloc(&crt, 1, sizeof *crt, "rsa_crt_new() xcalloc()");
+	if (load_mpi(&crt->e, &seckey->exponent_e) || bignum_modinv(&q, &p, &t)) {
+		free(crt);
+		return NULL;
+	}
+
+	bignum_mont_init(&crt->mont_p, &p);
+	bignum_mont_init(&crt->mont_q, &q);
+	bignum_mont_init(&crt->mont_n, &n);
+	bignum_mont_to(&crt->mont_p, &t, &crt->qinv_r);
+	/* dP = d mod (p - 1), dQ = d mod (q - 1) */
+	bignum_dec(&p);
+	bignum_mod(&d, &p, &crt->dp);
+	bignum_dec(&q);
+	bignum_mod(&d, &q, &crt->dq);
+	crt->len = bignum_num_bytes(&n);
+
+	return crt;
+}
+
+size_t rsa_crt_size(RSA_CRT const *restrict crt)
+{
+	return crt->len;
+}
+
+int rsa_crt_private(RSA_CRT const *restrict key, u8 const *restrict in, size_t in_len, u8 *restrict out)
+{
+	/* bn.h takes plain pointers but only writes its results, so threads can share the key */
+	RSA_CRT *crt = (RSA_CRT *)key;
+	struct bn c, h, t, m[2];
+	struct bn *p = &crt->mont_p.n, *q = &crt->mont_q.n, *n = &crt->mont_n.n;
+
+	/* the input must be a number below n */
+	if (in_len > crt->len)
+		return 1;
+	bignum_from_bytes(&c, in, in_len);
+	if (bignum_cmp(&c, n) != SMALLER)
+		return 1;
+	/*
+	 * m1 = c^dP mod p, m2 = c^dQ mod q, in this thread; `bignum_mont_to()`
+	 * reduces c modulo the half-size primes
+	 */
+	bignum_mont_powmod_sec(&crt->mont_p, &c, &crt->dp, &m[0]);
+	bignum_mont_powmod_sec(&crt->mont_q, &c, &crt->dq, &m[1]);
+
+	/* h = (m1 - m2) * qInv mod p, with m2 reduced modulo p first */
+	bignum_mod(&m[1], p, &t);
+	if (bignum_cmp(&m[0], &t) == SMALLER)
+		bignum_add(&m[0], p, &m[0]);
+	bignum_sub(&m[0], &t, &h);
+	bignum_mont_mul(&crt->mont_p, &h, &crt->qinv_r, &h);
+	/* m = m2 + q * h */
+	bignum_mul(q, &h, &t);
+	bignum_add(&t, &m[1], &t);
+
+	/* catch faults in either half before they can leak a factor of n */
+	bignum_mont_powmod(&crt->mont_n, &t, &crt->e, &h);
+	if (bignum_cmp(&h, &c) != EQUAL)
+		return 1;
+	bignum_to_bytes(&t, out, crt->len);
+
+	return 0;
+}
+
+size_t rsa_crt_private_list(RSA_CRT const *restrict crt, u8 const *restrict in, u8 *restrict out,
+	int *restrict results, size_t cnt, size_t nthreads)
+{
+	CRT_CTX ctx = {.crt = crt, .in = in, .out = out, .results = results};
+	size_t failed = 0;
+
+	pool_for(cnt, nthreads, crt_one, &ctx);
+	for (size_t i = 0; i < cnt; i++) {
+		if (results[i])
+			failed++;
+	}
+
+	return failed;
+}
+
+void rsa_crt_free(RSA_CRT *restrict crt)
+{
+	/* wipe the secret exponents and primes */
+	if (crt)
+		explicit_bzero(crt, sizeof *crt);
+	free(crt);
+}
+
+size_t rsa_validate_list(PGP_LIST const *restrict pkts, int *restrict results, int rounds)
+{
+	VALIDATE_CTX ctx = {.pkts = pkts, .results = results, .rounds = rounds};
+	size_t invalid = 0;
+
+	pool_for(pkts->cnt, 0, validate_one, &ctx);
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] > 0)
+			invalid++;
+	}
+
+	return invalid;
+}
+
+size_t rsa_verify_list(PGP_LIST const *restrict pkts, int *restrict results, size_t nthreads)
+{
+	VERIFY_CTX ctx = {.pkts = pkts, .results = results};
+	SIG_REF *refs;
+	size_t *chunks;
+	size_t key = SIZE_MAX, comp = SIZE_MAX, nrefs = 0, nchunks = 0, invalid = 0;
+
+	xcalloc(&refs, FALLBACK(pkts->cnt, 1), sizeof *refs, "rsa_verify_list() refs xcalloc()");
+	xcalloc(&chunks, pkts->cnt + 1, sizeof *chunks, "rsa_verify_list() chunks xcalloc()");
+	/*
+	 * pair every signature with the primary key and the user id or subkey
+	 * before it, and cut the signatures of each key into chunks which
+	 * share the montgomery constants and fingerprint of that key
+	 */
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		results[i] = -1;
+		switch (TAGBITS(pkts->list[i].pheader)) {
+		case TAG_PUBKEY: /* fallthrough */
+		case TAG_SECKEY:
+			key = i;
+			comp = SIZE_MAX;
+			break;
+		case TAG_UID: /* fallthrough */
+		case TAG_UATTR:
+		case TAG_PUBSUBKEY:
+		case TAG_SECSUBKEY:
+			comp = i;
+			break;
+		case TAG_SIG:
+			if (key == SIZE_MAX)
+				break;
+			if (!nrefs || refs[nrefs - 1].key != key || nrefs - chunks[nchunks - 1] == VERIFY_CHUNK)
+				chunks[nchunks++] = nrefs;
+			refs[nrefs++] = (SIG_REF){.sig = i, .key = key, .comp = comp};
+			break;
+		}
+	}
+	chunks[nchunks] = nrefs;
+
+	ctx.refs = refs;
+	ctx.chunks = chunks;
+	pool_for(nchunks, nthreads, verify_chunk, &ctx);
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] > 0)
+			invalid++;
+	}
+	free(refs);
+	free(chunks);
+
+	return invalid;
+}
@@ -0,0 +1,70 @@
+/*
+ * rsa.h:	header for rsa.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _RSA_H
+#define _RSA_H 1
+
+#include "defs.h"
+
+/* largest modulus `rsa_validate()` handles */
+#define RSA_MAX_BITS		8192
+
+/* failed checks reported by `rsa_validate()`, or'd together */
+enum rsa_checks {
+	RSA_VALID = 0x00,
+	/* missing, zero or oversized MPIs */
+	RSA_BAD_MPI = 0x01,
+	/* p * q != n */
+	RSA_BAD_N = 0x02,
+	/* d * e != 1 mod lcm(p - 1, q - 1) */
+	RSA_BAD_D = 0x04,
+	/* u * p != 1 mod q */
+	RSA_BAD_U = 0x08,
+	/* p or q failed Miller-Rabin */
+	RSA_BAD_P = 0x10,
+	RSA_BAD_Q = 0x20,
+};
+
+/* failed check names for reporting */
+static char const *const rsa_check_names[] = {
+	"RSA_BAD_MPI", "RSA_BAD_N", "RSA_BAD_D",
+	"RSA_BAD_U", "RSA_BAD_P", "RSA_BAD_Q",
+};
+
+/* failed checks reported by `rsa_verify_list()` */
+enum rsa_sig_checks {
+	RSA_SIG_VALID = 0x00,
+	/* missing signature MPI, or not below the modulus */
+	RSA_SIG_BAD_MPI = 0x01,
+	/* the quick check octets do not match the hash */
+	RSA_SIG_BAD_DIGEST = 0x02,
+	/* s^e mod n is not the PKCS#1 v1.5 encoded hash */
+	RSA_SIG_BAD_SIG = 0x04,
+};
+
+/* failed signature check names for reporting */
+static char const *const rsa_sig_check_names[] = {
+	"RSA_SIG_BAD_MPI", "RSA_SIG_BAD_DIGEST", "RSA_SIG_BAD_SIG",
+};
+
+/* precomputed CRT private key, see `rsa_crt_new()` */
+typedef struct _rsa_crt RSA_CRT;
+
+/* prototypes */
+int rsa_validate(SECKEY_PACKET const *restrict seckey, int rounds);
+size_t rsa_validate_list(PGP_LIST const *restrict pkts, int *restrict results, int rounds);
+RSA_CRT *rsa_crt_new(SECKEY_PACKET const *restrict seckey);
+size_t rsa_crt_size(RSA_CRT const *restrict crt);
+int rsa_crt_private(RSA_CRT const *restrict crt, u8 const *restrict in, size_t in_len, u8 *restrict out);
+size_t rsa_crt_private_list(RSA_CRT const *restrict crt, u8 const *restrict in, u8 *restrict out,
+	int *restrict results, size_t cnt, size_t nthreads);
+void rsa_crt_free(RSA_CRT *restrict crt);
+size_t rsa_verify_list(PGP_LIST const *restrict pkts, int *restrict results, size_t nthreads);
+
+#endif
@@ -0,0 +1,428 @@
+/*
+ * s2k.c:	string-to-key derivation of the keys protecting secret key packets
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "s2k.h"
+#include "argon2.h"
+#include "pool.h"
+#include <gcrypt.h>
+
+/* passphrase id, mode, hash, salt, coded count, key length and the Argon2 parameters */
+#define S2K_TAG_BYTES		38
+/* first table size */
+#define S2K_CACHE_MIN		16
+
+/* cache slot states */
+enum s2k_cache_states {
+	S2K_ENT_EMPTY,
+	/* queued in the running `s2k_derive_list()` */
+	S2K_ENT_PENDING,
+	S2K_ENT_READY,
+	S2K_ENT_FAILED,
+};
+
+struct _s2k_cache_ent {
+	u8 tag[S2K_TAG_BYTES];
+	u8 state;
+	/* the job deriving a pending key */
+	size_t job;
+	/* why a failed derivation failed */
+	int ret;
+	u8 key[S2K_MAX_KEY_BYTES];
+};
+
+/* openpgp hash algorithm ids to libgcrypt ones */
+static int const md_algos[] = {
+	[HASH_MD5] = GCRY_MD_MD5, [HASH_SHA1] = GCRY_MD_SHA1,
+	[HASH_RIPE] = GCRY_MD_RMD160, [HASH_SHA256] = GCRY_MD_SHA256,
+	[HASH_SHA384] = GCRY_MD_SHA384, [HASH_SHA512] = GCRY_MD_SHA512,
+	[HASH_SHA224] = GCRY_MD_SHA224,
+};
+
+/* openpgp symmetric algorithm ids to libgcrypt ones */
+static int const cipher_algos[] = {
+	[SYM_IDEA] = GCRY_CIPHER_IDEA, [SYM_TDES] = GCRY_CIPHER_3DES,
+	[SYM_CAST5] = GCRY_CIPHER_CAST5, [SYM_BLOWFISH] = GCRY_CIPHER_BLOWFISH,
+	[SYM_AES128] = GCRY_CIPHER_AES128, [SYM_AES192] = GCRY_CIPHER_AES192,
+	[SYM_AES256] = GCRY_CIPHER_AES256, [SYM_TWOFISH] = GCRY_CIPHER_TWOFISH,
+};
+
+/* libgcrypt cipher for `sym_algo`, or 0 if there is none */
+int s2k_cipher_algo(u8 sym_algo)
+{
+	if (sym_algo >= ARRLEN(cipher_algos))
+		return 0;
+	return cipher_algos[sym_algo];
+}
+
+/* key length in octets for `sym_algo`, or 0 if unsupported */
+size_t s2k_key_len(u8 sym_algo)
+{
+	int algo = s2k_cipher_algo(sym_algo);
+	return algo ? gcry_cipher_get_algo_keylen(algo) : 0;
+}
+
+/* block (and so IV) length in octets for `sym_algo`, or 0 if unsupported */
+size_t s2k_block_len(u8 sym_algo)
+{
+	int algo = s2k_cipher_algo(sym_algo);
+	return algo ? gcry_cipher_get_algo_blklen(algo) : 0;
+}
+
+/* an Argon2 S2K in the blocks of `arena`, or of a temporary one if it is NULL */
+static int s2k_argon2(S2K const *restrict s2k, void const *restrict pass, size_t pass_len,
+		u8 *restrict key, size_t key_len, ARGON2_ARENA *restrict arena, size_t nthreads)
+{
+	ARGON2_ARENA tmp = {0};
+	int ret;
+
+	/* at least 8 KiB per lane */
+	if (!s2k->passes || !s2k->lanes || s2k->mem_exp > ARGON2_MAX_MEM_EXP
+			|| ((u32)1 << s2k->mem_exp) < 8u * s2k->lanes)
+		return S2K_BAD_ALGO;
+	/* the parameters come straight from the key packet */
+	if (s2k->mem_exp > S2K_ARGON2_MEM_EXP || ((u64)s2k->passes << s2k->mem_exp) > ((u64)1 << S2K_ARGON2_WORK_EXP)) {
+		WARNX("skipping Argon2 S2K over the memory or pass limit");
+		return S2K_BAD_LIMIT;
+	}
+	ret = argon2id(FALLBACK(arena, &tmp), pass, pass_len, s2k->argon2_salt, sizeof s2k->argon2_salt,
+			s2k->passes, s2k->lanes, (u32)1 << s2k->mem_exp, key, key_len, nthreads);
+	argon2_arena_free(&tmp);
+
+	return ret ? S2K_BAD_DERIVE : S2K_OK;
+}
+
+/*
+ * derive a `key_len`-octet key from the passphrase as `s2k` says; libgcrypt
+ * runs the iterated hash over a buffer of repeated salt and passphrase and
+ * preloads one more zero octet into each extra context for keys longer than
+ * the digest, which is the whole of the cost for a protected key
+ */
+int s2k_derive(S2K const *restrict s2k, void const *restrict pass, size_t pass_len, u8 *restrict key, size_t key_len)
+{
+	int md, kdf;
+	unsigned long iters = 0;
+	void const *salt = s2k->salt;
+	size_t salt_len = sizeof s2k->salt;
+
+	if (!key_len || key_len > S2K_MAX_KEY_BYTES)
+		return S2K_BAD_ALGO;
+	/* with its lanes on every cpu */
+	if (s2k->s2k_mode == S2K_ARGON2)
+		return s2k_argon2(s2k, pass, pass_len, key, key_len, NULL, 0);
+	if (s2k->hash_algo >= ARRLEN(md_algos) || !(md = md_algos[s2k->hash_algo]))
+		return S2K_BAD_ALGO;
+	switch (s2k->s2k_mode) {
+	case S2K_SIMPLE:
+		kdf = GCRY_KDF_SIMPLE_S2K;
+		salt = NULL, salt_len = 0;
+		break;
+	case S2K_SALTED:
+		kdf = GCRY_KDF_SALTED_S2K;
+		break;
+	case S2K_ITERSALTED:
+		kdf = GCRY_KDF_ITERSALTED_S2K;
+		iters = S2K_COUNT(s2k->cnt);
+		break;
+	default:
+		return S2K_BAD_ALGO;
+	}
+	/* libgcrypt wants a passphrase pointer even for an empty one */
+	if (gcry_kdf_derive(FALLBACK(pass, ""), pass_len, kdf, md, salt, salt_len, iters, key_len, key))
+		return S2K_BAD_DERIVE;
+
+	return S2K_OK;
+}
+
+/* serialize the lookup key of a derivation */
+static void cache_tag(u8 *restrict tag, u32 pass_id, S2K const *restrict s2k, size_t key_len)
+{
+	memcpy(tag, &pass_id, 4);
+	tag[4] = s2k->s2k_mode;
+	tag[5] = s2k->hash_algo;
+	memcpy(tag + 6, s2k->salt, sizeof s2k->salt);
+	memcpy(tag + 14, &s2k->cnt, 4);
+	tag[18] = key_len;
+	memcpy(tag + 19, s2k->argon2_salt, sizeof s2k->argon2_salt);
+	tag[35] = s2k->passes;
+	tag[36] = s2k->lanes;
+	tag[37] = s2k->mem_exp;
+}
+
+/* FNV-1a */
+static size_t cache_hash(u8 const *restrict tag)
+{
+	u64 h = 0xcbf29ce484222325;
+	for (size_t i = 0; i < S2K_TAG_BYTES; i++)
+		h = (h ^ tag[i]) * 0x100000001b3;
+	return h;
+}
+
+/* the slot holding `tag`, or the empty slot it would go in */
+static S2K_CACHE_ENT *cache_slot(S2K_CACHE const *restrict cache, u8 const *restrict tag)
+{
+	size_t i = cache_hash(tag) & (cache->size - 1);
+	while (cache->ents[i].state != S2K_ENT_EMPTY && memcmp(cache->ents[i].tag, tag, S2K_TAG_BYTES))
+		i = (i + 1) & (cache->size - 1);
+	return &cache->ents[i];
+}
+
+/* make room for one more entry, keeping the table at most half full */
+static void cache_reserve(S2K_CACHE *restrict cache)
+{
+	S2K_CACHE_ENT *old = cache->ents;
+	size_t old_size = cache->size;
+
+	if (2 * (cache->cnt + 1) <= cache->size)
+		return;
+	cache->size = old_size ? 2 * old_size : S2K_CACHE_MIN;
+	if (!(cache->ents = gcry_calloc_secure(cache->size, sizeof *cache->ents)))
+		ERR("cache_reserve() gcry_calloc_secure()");
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].state != S2K_ENT_EMPTY)
+			*cache_slot(cache, old[i].tag) = old[i];
+	}
+	gcry_free(old);
+}
+
+/* the cached key for a derivation, or NULL if there is none yet */
+u8 const *s2k_cache_find(S2K_CACHE const *restrict cache, u32 pass_id, S2K const *restrict s2k, size_t key_len)
+{
+	u8 tag[S2K_TAG_BYTES];
+	S2K_CACHE_ENT const *ent;
+
+	if (!cache->size)
+		return NULL;
+	cache_tag(tag, pass_id, s2k, key_len);
+	ent = cache_slot(cache, tag);
+	return (ent->state == S2K_ENT_READY) ? ent->key : NULL;
+}
+
+/* free the table; libgcrypt wipes secure memory as it is released */
+void s2k_cache_wipe(S2K_CACHE *restrict cache)
+{
+	gcry_free(cache->ents);
+	*cache = (S2K_CACHE){0};
+}
+
+/* one iterated job of `s2k_derive_jobs()` */
+static void s2k_job(void *restrict arg, size_t i)
+{
+	S2K_JOB *job = (S2K_JOB *)arg + i;
+	if (job->s2k->s2k_mode != S2K_ARGON2)
+		job->ret = s2k_derive(job->s2k, job->pass, job->pass_len, job->key, job->key_len);
+}
+
+/*
+ * every iterated derivation is one task, since each can mean tens of
+ * megabytes of hashing; Argon2 ones already spread their lanes over the
+ * threads, so they run one after another in a single reused arena
+ */
+void s2k_derive_jobs(S2K_JOB *restrict jobs, size_t cnt, size_t nthreads)
+{
+	ARGON2_ARENA arena = {0};
+
+	for (size_t i = 0; i < cnt; i++) {
+		if (jobs[i].s2k->s2k_mode == S2K_ARGON2) {
+			jobs[i].ret = s2k_argon2(jobs[i].s2k, jobs[i].pass, jobs[i].pass_len,
+					jobs[i].key, jobs[i].key_len, &arena, nthreads);
+		}
+	}
+	argon2_arena_free(&arena);
+	pool_for(cnt, nthreads, s2k_job, jobs);
+}
+
+/*
+ * derive the key of every protected secret key or subkey in `pkts` from the
+ * passphrase known as `pass_id` into `keys[i]`, setting `results[i]` to the
+ * `s2k_checks` result or -1 for packets without one; only specifiers missing
+ * from `cache` are derived, each once however many keys share it, and their
+ * keys are added to it (a NULL `cache` still shares keys within the call);
+ * returns the number of failed derivations
+ */
+size_t s2k_derive_list(PGP_LIST const *restrict pkts, void const *restrict pass, size_t pass_len, u32 pass_id,
+		S2K_CACHE *restrict cache, u8 (*restrict keys)[S2K_MAX_KEY_BYTES], int *restrict results, size_t nthreads)
+{
+	S2K_CACHE local = {0};
+	S2K_JOB *jobs;
+	size_t *src, cnt = 0, bad = 0;
+	u8 tag[S2K_TAG_BYTES];
+
+	if (!cache)
+		cache = &local;
+	xcalloc(&jobs, FALLBACK(pkts->cnt, 1), sizeof *jobs, "s2k_derive_list() xcalloc()");
+	/* the job each packet waits on, or SIZE_MAX */
+	xcalloc(&src, FALLBACK(pkts->cnt, 1), sizeof *src, "s2k_derive_list() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		PGP_PACKET const *packet = &pkts->list[i];
+		int type = TAGBITS(packet->pheader);
+		SECKEY_INFO const *info = packet->seckey.seckey_info;
+		S2K_CACHE_ENT *ent;
+		size_t key_len;
+
+		results[i] = -1;
+		src[i] = SIZE_MAX;
+		if (type != TAG_SECKEY && type != TAG_SECSUBKEY)
+			continue;
+		/* gnu-dummy keys have no secret parts to protect */
+		if (!info || !info->is_protected || info->s2k.s2k_mode == S2K_GNU)
+			continue;
+		if (!(key_len = s2k_key_len(info->seckey_algo))) {
+			results[i] = S2K_BAD_ALGO;
+			continue;
+		}
+		cache_reserve(cache);
+		cache_tag(tag, pass_id, &info->s2k, key_len);
+		ent = cache_slot(cache, tag);
+		switch (ent->state) {
+		case S2K_ENT_READY:
+			memcpy(keys[i], ent->key, key_len);
+			results[i] = S2K_OK;
+			cache->hits++;
+			continue;
+		case S2K_ENT_FAILED:
+			results[i] = ent->ret;
+			continue;
+		case S2K_ENT_PENDING:
+			src[i] = ent->job;
+			cache->hits++;
+			continue;
+		}
+		memcpy(ent->tag, tag, sizeof tag);
+		ent->state = S2K_ENT_PENDING;
+		ent->job = src[i] = cnt;
+		cache->cnt++;
+		jobs[cnt++] = (S2K_JOB){
+			.s2k = &info->s2k, .pass = pass, .pass_len = pass_len,
+			.key = keys[i], .key_len = key_len,
+		};
+	}
+
+	s2k_derive_jobs(jobs, cnt, nthreads);
+	cache->derived += cnt;
+	for (size_t i = 0; i < cnt; i++) {
+		S2K_CACHE_ENT *ent;
+		cache_tag(tag, pass_id, jobs[i].s2k, jobs[i].key_len);
+		ent = cache_slot(cache, tag);
+		ent->state = jobs[i].ret ? S2K_ENT_FAILED : S2K_ENT_READY;
+		ent->ret = jobs[i].ret;
+		memcpy(ent->key, jobs[i].key, jobs[i].key_len);
+	}
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (src[i] != SIZE_MAX) {
+			S2K_JOB const *job = &jobs[src[i]];
+			if (job->key != keys[i])
+				memcpy(keys[i], job->key, job->key_len);
+			results[i] = job->ret;
+		}
+		if (results[i] > 0)
+			bad++;
+	}
+	free(jobs);
+	free(src);
+	s2k_cache_wipe(&local);
+
+	return bad;
+}
+
+/*
+ * CFB decrypt the secret MPIs of a protected key with its derived `key`
+ * into secure memory, check them against the SHA1 hash or checksum at their
+ * end and parse them straight from there as an unprotected key's would be;
+ * returns the `s2k_checks` result
+ */
+int s2k_unprotect(PGP_PACKET *restrict packet, u8 const *restrict key)
+{
+	SECKEY_INFO const *info = packet->seckey.seckey_info;
+	size_t len = packet_len(packet), enc_len, chk_len;
+	gcry_cipher_hd_t hd;
+	u8 *buf, digest[20];
+	int algo, ret = S2K_OK;
+
+	if (!info || !info->enc_off || !(algo = s2k_cipher_algo(info->seckey_algo)))
+		return S2K_BAD_ALGO;
+	/* already done */
+	if (packet->seckey.rsa.der_data)
+		return S2K_OK;
+	chk_len = info->sha1_chk ? sizeof digest : 2;
+	if (info->enc_off > len || (enc_len = len - info->enc_off) < chk_len)
+		return S2K_BAD_MPI;
+	if (!(buf = gcry_malloc_secure(enc_len)))
+		ERR("s2k_unprotect() gcry_malloc_secure()");
+	if (gcry_cipher_open(&hd, algo, GCRY_CIPHER_MODE_CFB, GCRY_CIPHER_SECURE)) {
+		gcry_free(buf);
+		return S2K_BAD_ALGO;
+	}
+	if (gcry_cipher_setkey(hd, key, s2k_key_len(info->seckey_algo))
+			|| gcry_cipher_setiv(hd, info->iv, info->iv_len)
+			|| gcry_cipher_decrypt(hd, buf, enc_len, packet->pdata + info->enc_off, enc_len))
+		ret = S2K_BAD_ALGO;
+	gcry_cipher_close(hd);
+
+	if (!ret && info->sha1_chk) {
+		gcry_md_hash_buffer(GCRY_MD_SHA1, digest, buf, enc_len - chk_len);
+		if (memcmp(digest, buf + enc_len - chk_len, chk_len))
+			ret = S2K_BAD_CHECKSUM;
+	} else if (!ret) {
+		u16 sum = 0;
+		for (size_t i = 0; i < enc_len - chk_len; i++)
+			sum += buf[i];
+		if (sum != BETOH16(buf + enc_len - chk_len))
+			ret = S2K_BAD_CHECKSUM;
+	}
+	/* a 16-bit checksum passes by chance once in 65536 wrong passphrases */
+	if (!ret && !secret_mpis_len(buf, enc_len - chk_len))
+		ret = S2K_BAD_MPI;
+	if (!ret)
+		parse_secret_mpis(packet, buf);
+	gcry_free(buf);
+
+	return ret;
+}
+
+/* shared state of `s2k_unprotect_list()` */
+typedef struct _unprotect_ctx {
+	PGP_LIST *pkts;
+	u8 (*keys)[S2K_MAX_KEY_BYTES];
+	int *results;
+	size_t const *idx;
+} UNPROTECT_CTX;
+
+/* one packet of `s2k_unprotect_list()` */
+static void unprotect_job(void *restrict arg, size_t i)
+{
+	UNPROTECT_CTX *ctx = arg;
+	size_t pkt = ctx->idx[i];
+	ctx->results[pkt] = s2k_unprotect(&ctx->pkts->list[pkt], ctx->keys[pkt]);
+}
+
+/*
+ * decrypt every packet `s2k_derive_list()` derived a key for, updating
+ * `results` in place; returns the number of failed packets
+ */
+size_t s2k_unprotect_list(PGP_LIST *restrict pkts, u8 (*restrict keys)[S2K_MAX_KEY_BYTES],
+		int *restrict results, size_t nthreads)
+{
+	UNPROTECT_CTX ctx = {.pkts = pkts, .keys = keys, .results = results};
+	size_t *idx, cnt = 0, bad = 0;
+
+	xcalloc(&idx, FALLBACK(pkts->cnt, 1), sizeof *idx, "s2k_unprotect_list() xcalloc()");
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] == S2K_OK)
+			idx[cnt++] = i;
+	}
+	ctx.idx = idx;
+	pool_for(cnt, nthreads, unprotect_job, &ctx);
+	for (size_t i = 0; i < pkts->cnt; i++) {
+		if (results[i] > 0)
+			bad++;
+	}
+	free(idx);
+
+	return bad;
+}
@@ -0,0 +1,93 @@
+/*
+ * s2k.h:	header for s2k.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _S2K_H
+#define _S2K_H 1
+
+#include "defs.h"
+#include "packet.h"
+
+/* octets hashed by an iterated and salted S2K with the coded count `c` */
+#define S2K_COUNT(c)		((u32)(16 + ((c) & 15)) << (((c) >> 4) + 6))
+/* longest key of a supported cipher (AES256 and Twofish) */
+#define S2K_MAX_KEY_BYTES	32
+/* longest passphrase read by `--passphrase-file` */
+#define S2K_MAX_PASS_BYTES	1024
+/*
+ * the most memory an Argon2 S2K from a key packet may ask for, as a power
+ * of two KiB (2 GiB unless built with `make ARGON2_MEM_EXP=<n>`), and the
+ * most its passes may add up to, eight passes over that much
+ */
+#ifndef S2K_ARGON2_MEM_EXP
+# define S2K_ARGON2_MEM_EXP	21
+#endif
+#define S2K_ARGON2_WORK_EXP	(S2K_ARGON2_MEM_EXP + 3)
+
+/* failures reported by `s2k_derive_list()` */
+enum s2k_checks {
+	S2K_OK = 0x00,
+	/* unknown or unsupported cipher, hash or specifier */
+	S2K_BAD_ALGO = 0x01,
+	/* libgcrypt refused the derivation */
+	S2K_BAD_DERIVE = 0x02,
+	/* the decrypted MPIs do not match their SHA1 hash or checksum (a wrong passphrase) */
+	S2K_BAD_CHECKSUM = 0x04,
+	/* the decrypted MPIs are truncated or malformed */
+	S2K_BAD_MPI = 0x08,
+	/* an Argon2 S2K asking for more memory or passes than we allow */
+	S2K_BAD_LIMIT = 0x10,
+};
+
+/* failure names for reporting */
+static char const *const s2k_check_names[] = {
+	"S2K_BAD_ALGO", "S2K_BAD_DERIVE", "S2K_BAD_CHECKSUM", "S2K_BAD_MPI", "S2K_BAD_LIMIT",
+};
+
+/* one cached key, see `s2k_cache_find()` */
+typedef struct _s2k_cache_ent S2K_CACHE_ENT;
+
+/*
+ * derived keys by passphrase id, specifier and key length, so keys and
+ * subkeys sharing a passphrase, salt and count pay for one derivation;
+ * the table lives in secure memory and is wiped by `s2k_cache_wipe()`
+ */
+typedef struct _s2k_cache {
+	/* open addressing, `size` is zero or a power of two */
+	S2K_CACHE_ENT *ents;
+	size_t cnt, size;
+	/* derivations run, and keys handed out without one */
+	size_t derived, hits;
+} S2K_CACHE;
+
+/* one derivation for `s2k_derive_jobs()` */
+typedef struct _s2k_job {
+	S2K const *s2k;
+	void const *pass;
+	size_t pass_len;
+	u8 *key;
+	size_t key_len;
+	/* filled in with the `s2k_checks` result */
+	int ret;
+} S2K_JOB;
+
+/* prototypes */
+int s2k_cipher_algo(u8 sym_algo);
+size_t s2k_key_len(u8 sym_algo);
+size_t s2k_block_len(u8 sym_algo);
+int s2k_derive(S2K const *restrict s2k, void const *restrict pass, size_t pass_len, u8 *restrict key, size_t key_len);
+void s2k_derive_jobs(S2K_JOB *restrict jobs, size_t cnt, size_t nthreads);
+u8 const *s2k_cache_find(S2K_CACHE const *restrict cache, u32 pass_id, S2K const *restrict s2k, size_t key_len);
+void s2k_cache_wipe(S2K_CACHE *restrict cache);
+size_t s2k_derive_list(PGP_LIST const *restrict pkts, void const *restrict pass, size_t pass_len, u32 pass_id,
+		S2K_CACHE *restrict cache, u8 (*restrict keys)[S2K_MAX_KEY_BYTES], int *restrict results, size_t nthreads);
+int s2k_unprotect(PGP_PACKET *restrict packet, u8 const *restrict key);
+size_t s2k_unprotect_list(PGP_LIST *restrict pkts, u8 (*restrict keys)[S2K_MAX_KEY_BYTES],
+		int *restrict results, size_t nthreads);
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * seipd.c:	streaming decryption of symmetrically encrypted integrity protected data packets
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "seipd.h"
+#include "s2k.h"
+#include <ctype.h>
+#include <gcrypt.h>
+
+/*
+ * the state behind a `seipd_open()` stream: one chunk of ciphertext is
+ * decrypted in place at a time, and the SHA1 of the plaintext is updated
+ * as it is handed to the reader, always holding back the last
+ * `SEIPD_MDC_LEN` octets, which turn out to be the MDC packet at the end
+ */
+typedef struct _seipd_stream {
+	FILE *src;
+	/* octets left in the current body chunk, and whether another follows it */
+	size_t left;
+	bool partial;
+	/* the body ended and the MDC was checked */
+	bool done;
+	bool mdc_ok;
+	size_t *bad;
+	gcry_cipher_hd_t hd;
+	gcry_md_hd_t md;
+	/* plaintext not yet handed out is `buf[pos]` up to `buf[end]` */
+	size_t pos, end;
+	u8 buf[SEIPD_CHUNK + SEIPD_MDC_LEN];
+	/* the stdio buffer of the stream, so its plaintext is wiped along with the rest */
+	char iobuf[SEIPD_CHUNK];
+} SEIPD_STREAM;
+
+/*
+ * parse a session key as `gpg --show-session-key` prints it, the
+ * decimal algorithm id, a colon and the key in hex; returns false if it
+ * is malformed or of the wrong length for the algorithm
+ */
+bool sess_key_parse(char const *restrict spec, SESS_KEY *restrict sess)
+{
+	char *end;
+	unsigned long algo;
+	size_t digits = 0;
+
+	errno = 0;
+	algo = strtoul(spec, &end, 10);
+	if (errno || end == spec || *end != ':' || algo > UINT8_MAX || !s2k_key_len(algo))
+		return false;
+	sess->sym_algo = algo;
+	sess->len = s2k_key_len(algo);
+	for (spec = end + 1; *spec; spec++) {
+		int nib;
+		if (!isxdigit((unsigned char)*spec) || digits == 2 * sess->len)
+			return false;
+		nib = isdigit((unsigned char)*spec) ? *spec - '0' : tolower((unsigned char)*spec) - 'a' + 10;
+		if (digits % 2)
+			sess->key[digits / 2] |= nib;
+		else
+			sess->key[digits / 2] = nib << 4;
+		digits++;
+	}
+
+	return digits == 2 * sess->len;
+}
+
+/* read up to `want` octets of the packet body, across partial body lengths; returns the octets read */
+static size_t body_read(FILE *restrict src, size_t *restrict left, bool *restrict partial, u8 *restrict dst, size_t want)
+{
+	size_t got = 0;
+
+	while (got < want) {
+		size_t n, cnt;
+		if (!*left) {
+			/* the next header, which may itself be partial */
+			if (!*partial || !read_new_len(src, left, partial)) {
+				*partial = false;
+				break;
+			}
+			continue;
+		}
+		n = (*left < want - got) ? *left : want - got;
+		cnt = fread(dst + got, 1, n, src);
+		*left -= cnt;
+		got += cnt;
+		/* a short body ends where the file does */
+		if (cnt < n) {
+			*left = 0;
+			*partial = false;
+			break;
+		}
+	}
+
+	return got;
+}
+
+/* a packet body across partial body lengths, see `body_open()` */
+typedef struct _body_stream {
+	FILE *src;
+	size_t left;
+	bool partial;
+	/* the stdio buffer of the stream, wiped on close since the body may be decrypted */
+	char iobuf[BUFSIZ];
+} BODY_STREAM;
+
+static ssize_t body_stream_read(void *cookie, char *buf, size_t size)
+{
+	BODY_STREAM *st = cookie;
+	return body_read(st->src, &st->left, &st->partial, (u8 *)buf, size);
+}
+
+static int body_stream_close(void *cookie)
+{
+	BODY_STREAM *st = cookie;
+
+	seipd_skip(st->src, st->left, st->partial);
+	explicit_bzero(st, sizeof *st);
+	free(st);
+	return 0;
+}
+
+/*
+ * a stream of the packet body of `len` octets that follows in `src`, and
+ * of the partial body lengths after it if `partial` is set; closing it
+ * leaves `src` just past the packet
+ */
+FILE *body_open(FILE *restrict src, size_t len, bool partial)
+{
+	cookie_io_functions_t const io = {.read = body_stream_read, .close = body_stream_close};
+	BODY_STREAM *st;
+	FILE *file;
+
+	xcalloc(&st, 1, sizeof *st, "body_open() xcalloc()");
+	*st = (BODY_STREAM){.src = src, .left = len, .partial = partial};
+	if (!(file = fopencookie(st, "rb", io)))
+		ERR("body_open() fopencookie()");
+	setvbuf(file, st->iobuf, _IOFBF, sizeof st->iobuf);
+
+	return file;
+}
+
+/* the plaintext ended, check the MDC packet held back */
+static void seipd_finish(SEIPD_STREAM *restrict st)
+{
+	u8 const *mdc = st->buf + st->pos;
+
+	st->done = true;
+	if (st->end - st->pos != SEIPD_MDC_LEN || mdc[0] != 0xd3 || mdc[1] != 0x14)
+		return;
+	gcry_md_write(st->md, mdc, 2);
+	st->mdc_ok = !memcmp(gcry_md_read(st->md, GCRY_MD_SHA1), mdc + 2, SEIPD_MDC_LEN - 2);
+}
+
+static ssize_t seipd_read(void *cookie, char *buf, size_t size)
+{
+	SEIPD_STREAM *st = cookie;
+	size_t out = 0;
+
+	while (out < size) {
+		size_t avail = (st->end - st->pos > SEIPD_MDC_LEN) ? st->end - st->pos - SEIPD_MDC_LEN : 0, got;
+		if (avail) {
+			size_t n = (avail < size - out) ? avail : size - out;
+			gcry_md_write(st->md, st->buf + st->pos, n);
+			memcpy(buf + out, st->buf + st->pos, n);
+			st->pos += n;
+			out += n;
+			continue;
+		}
+		if (st->done)
+			break;
+		/* keep the octets held back and decrypt the next chunk after them */
+		memmove(st->buf, st->buf + st->pos, st->end - st->pos);
+		st->end -= st->pos;
+		st->pos = 0;
+		if (!(got = body_read(st->src, &st->left, &st->partial, st->buf + st->end, SEIPD_CHUNK))) {
+			seipd_finish(st);
+			break;
+		}
+		if (gcry_cipher_decrypt(st->hd, st->buf + st->end, got, NULL, 0))
+			ERRX("seipd_read() gcry_cipher_decrypt()");
+		st->end += got;
+	}
+
+	return out;
+}
+
+/* check the MDC even if the reader stopped early, and leave `src` just past the packet */
+static int seipd_close(void *cookie)
+{
+	SEIPD_STREAM *st = cookie;
+	char scratch[4096];
+
+	while (!st->done)
+		seipd_read(st, scratch, sizeof scratch);
+	explicit_bzero(scratch, sizeof scratch);
+	if (!st->mdc_ok) {
+		WARNX("encrypted data packet failed its modification detection check");
+		(*st->bad)++;
+	}
+	seipd_skip(st->src, st->left, st->partial);
+	gcry_cipher_close(st->hd);
+	gcry_md_close(st->md);
+	explicit_bzero(st, sizeof *st);
+	free(st);
+
+	return 0;
+}
+
+/*
+ * a stream of the plaintext of the encrypted data packet body of `len`
+ * octets that follows in `src`, decrypted with `sess` as it is read; a
+ * failed check is counted in `bad` when it is closed, which leaves `src`
+ * just past the packet; returns NULL, skipping the packet, if it is not
+ * a version 1 packet or fails the quick check of its prefix
+ */
+FILE *seipd_open(FILE *restrict src, size_t len, bool partial, SESS_KEY const *restrict sess, size_t *restrict bad)
+{
+	cookie_io_functions_t const io = {.read = seipd_read, .close = seipd_close};
+	size_t block = s2k_block_len(sess->sym_algo);
+	SEIPD_STREAM *st;
+	FILE *file;
+	u8 version;
+
+	if (!block || body_read(src, &len, &partial, &version, 1) != 1 || version != 1) {
+		WARNX("skipping encrypted data packet: unsupported cipher or version");
+		seipd_skip(src, len, partial);
+		return NULL;
+	}
+	/* the plaintext buffered here is wiped on close */
+	xcalloc(&st, 1, sizeof *st, "seipd_open() xcalloc()");
+	st->src = src;
+	st->left = len;
+	st->partial = partial;
+	st->bad = bad;
+	/* CFB with a zero IV and no resynchronization */
+	if (gcry_cipher_open(&st->hd, s2k_cipher_algo(sess->sym_algo), GCRY_CIPHER_MODE_CFB, GCRY_CIPHER_SECURE)
+			|| gcry_cipher_setkey(st->hd, sess->key, sess->len))
+		ERRX("seipd_open() gcry_cipher_open()");
+	if (gcry_md_open(&st->md, GCRY_MD_SHA1, GCRY_MD_FLAG_SECURE))
+		ERRX("seipd_open() gcry_md_open()");
+
+	/* a block of random octets and a repeat of its last two, which a wrong key gets wrong */
+	if (body_read(src, &st->left, &st->partial, st->buf, block + 2) != block + 2
+			|| gcry_cipher_decrypt(st->hd, st->buf, block + 2, NULL, 0)
+			|| memcmp(st->buf + block - 2, st->buf + block, 2)) {
+		WARNX("skipping encrypted data packet: wrong session key");
+		(*bad)++;
+		seipd_skip(src, st->left, st->partial);
+		gcry_cipher_close(st->hd);
+		gcry_md_close(st->md);
+		explicit_bzero(st, sizeof *st);
+		free(st);
+		return NULL;
+	}
+	gcry_md_write(st->md, st->buf, block + 2);
+	if (!(file = fopencookie(st, "rb", io)))
+		ERR("seipd_open() fopencookie()");
+	setvbuf(file, st->iobuf, _IOFBF, sizeof st->iobuf);
+
+	return file;
+}
+
+/* read past the rest of a packet body of `len` octets, then any partial body lengths after it */
+void seipd_skip(FILE *restrict src, size_t len, bool partial)
+{
+	u8 buf[4096];
+
+	while (body_read(src, &len, &partial, buf, sizeof buf) == sizeof buf);
+	explicit_bzero(buf, sizeof buf);
+}
@@ -0,0 +1,57 @@
+/*
+ * seipd.h:	header for seipd.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _SEIPD_H
+#define _SEIPD_H 1
+
+#include "defs.h"
+
+/* ciphertext octets decrypted at a time */
+#define SEIPD_CHUNK		(64 * 1024)
+/* the modification detection code packet closing the plaintext: 0xd3, 0x14 and a SHA1 hash */
+#define SEIPD_MDC_LEN		22
+
+/*
+ * body length from a new format length header, setting `partial` if it
+ * is a partial body length another header follows; returns false if the
+ * header could not be read
+ */
+static inline bool read_new_len(FILE *restrict file, size_t *restrict len, bool *restrict partial)
+{
+	u8 raw[4];
+
+	*partial = false;
+	if (!xfread(raw, 1, 1, file))
+		return false;
+	if (raw[0] < 192) {
+		*len = raw[0];
+	} else if (raw[0] < 224) {
+		*len = ((raw[0] - 192) << 8) + 192;
+		if (!xfread(raw + 1, 1, 1, file))
+			return false;
+		*len += raw[1];
+	} else if (raw[0] < 255) {
+		*len = (size_t)1 << (raw[0] & 0x1f);
+		*partial = true;
+	} else {
+		if (!xfread(raw, 1, sizeof raw, file))
+			return false;
+		*len = (u32)BETOH32(raw);
+	}
+
+	return true;
+}
+
+/* prototypes */
+FILE *body_open(FILE *restrict src, size_t len, bool partial);
+bool sess_key_parse(char const *restrict spec, SESS_KEY *restrict sess);
+FILE *seipd_open(FILE *restrict src, size_t len, bool partial, SESS_KEY const *restrict sess, size_t *restrict bad);
+void seipd_skip(FILE *restrict src, size_t len, bool partial);
+
+#endif
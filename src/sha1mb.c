@@ -0,0 +1,377 @@
+/*
+ * sha1mb.c:	SHA1 over many short messages at once
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "sha1mb.h"
+
+#ifdef SHA1_SIMD
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+#define ROTL32(x, n)		(((x) << (n)) | ((x) >> (32 - (n))))
+
+/* the best kernel allowed, -1 until `sha1_mb_use_simd()` has looked at the cpu */
+static int sha1_isa = -1;
+/* whether batches too small for the vector kernel may use the SHA extensions */
+static bool sha1_ni;
+
+static u32 const sha1_iv[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+static u32 const sha1_k[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+
+/* blocks in a message once it is padded with 0x80, zeros and its 64-bit bit length */
+static inline size_t sha1_blocks(SHA1_MSG const *restrict msg)
+{
+	return (msg->hdr_len + msg->len + 8) / SHA1_BLOCK_BYTES + 1;
+}
+
+/*
+ * block `k` of a message, pointing into `data` when the block lies within
+ * it and otherwise assembled in `buf` from the header, data and padding
+ */
+static inline u8 const *sha1_block(SHA1_MSG const *restrict msg, size_t k, u8 *restrict buf)
+{
+	size_t pos = k * SHA1_BLOCK_BYTES, total = msg->hdr_len + msg->len, start, end;
+
+	if (pos >= msg->hdr_len && pos + SHA1_BLOCK_BYTES <= total)
+		return msg->data + pos - msg->hdr_len;
+	memset(buf, 0, SHA1_BLOCK_BYTES);
+	if (pos < msg->hdr_len)
+		memcpy(buf, msg->hdr + pos, msg->hdr_len - pos);
+	start = (pos > msg->hdr_len) ? pos : msg->hdr_len;
+	end = (pos + SHA1_BLOCK_BYTES < total) ? pos + SHA1_BLOCK_BYTES : total;
+	if (start < end)
+		memcpy(buf + start - pos, msg->data + start - msg->hdr_len, end - start);
+	if (total >= pos && total < pos + SHA1_BLOCK_BYTES)
+		buf[total - pos] = 0x80;
+	if (k == sha1_blocks(msg) - 1) {
+		u64 bits = (u64)total * 8;
+		for (int i = 0; i < 8; i++)
+			buf[SHA1_BLOCK_BYTES - 1 - i] = bits >> (8 * i);
+	}
+	return buf;
+}
+
+static inline u32 load_be32(u8 const *restrict p)
+{
+	return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+static inline void sha1_digest(u8 *restrict digest, u32 const *restrict state, size_t stride)
+{
+	for (int i = 0; i < 5; i++) {
+		u32 s = state[i * stride];
+		digest[4 * i] = s >> 24;
+		digest[4 * i + 1] = s >> 16;
+		digest[4 * i + 2] = s >> 8;
+		digest[4 * i + 3] = s;
+	}
+}
+
+static void sha1_compress_c(u32 *restrict state, u8 const *restrict block)
+{
+	u32 w[16], a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+	for (int t = 0; t < 16; t++)
+		w[t] = load_be32(block + 4 * t);
+	for (int t = 0; t < 80; t++) {
+		u32 f, tmp;
+		if (t >= 16) {
+			tmp = w[(t + 13) & 15] ^ w[(t + 8) & 15] ^ w[(t + 2) & 15] ^ w[t & 15];
+			w[t & 15] = ROTL32(tmp, 1);
+		}
+		if (t < 20)
+			f = (b & c) | (~b & d);
+		else if (t < 40 || t >= 60)
+			f = b ^ c ^ d;
+		else
+			f = (b & c) | (b & d) | (c & d);
+		tmp = ROTL32(a, 5) + f + e + sha1_k[t / 20] + w[t & 15];
+		e = d;
+		d = c;
+		c = ROTL32(b, 30);
+		b = a;
+		a = tmp;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+#ifdef SHA1_SIMD
+/*
+ * rounds 4i to 4i + 3 with the SHA extensions: the message schedule for
+ * later rounds is worked out in the four `msg` registers alongside, and
+ * only as far as the rounds still need it
+ */
+#define SHA1_NI_ROUNDS(i) do {                                                                          \
+	if ((i) < 4)                                                                                    \
+		msg[(i) % 4] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)(block + 16 * ((i) % 4))), bswap); \
+	e[(i) % 2] = (i) ? _mm_sha1nexte_epu32(e[(i) % 2], msg[(i) % 4]) : _mm_add_epi32(e[0], msg[0]); \
+	e[((i) + 1) % 2] = abcd;                                                                        \
+	if ((i) >= 3 && (i) <= 18)                                                                      \
+		msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], msg[(i) % 4]);              \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[(i) % 2], (i) / 5);                                          \
+	if ((i) >= 1 && (i) <= 16)                                                                      \
+		msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], msg[(i) % 4]);              \
+	if ((i) >= 2 && (i) <= 17)                                                                      \
+		msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], msg[(i) % 4]);                   \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_compress_ni(u32 *restrict state, u8 const *restrict block)
+{
+	__m128i const bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const *)state), 0x1b);
+	__m128i e[2] = {_mm_set_epi32(state[4], 0, 0, 0), _mm_setzero_si128()};
+	__m128i msg[4] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+	__m128i abcd_save = abcd, e_save = e[0];
+
+	SHA1_NI_ROUNDS(0);
+	SHA1_NI_ROUNDS(1);
+	SHA1_NI_ROUNDS(2);
+	SHA1_NI_ROUNDS(3);
+	SHA1_NI_ROUNDS(4);
+	SHA1_NI_ROUNDS(5);
+	SHA1_NI_ROUNDS(6);
+	SHA1_NI_ROUNDS(7);
+	SHA1_NI_ROUNDS(8);
+	SHA1_NI_ROUNDS(9);
+	SHA1_NI_ROUNDS(10);
+	SHA1_NI_ROUNDS(11);
+	SHA1_NI_ROUNDS(12);
+	SHA1_NI_ROUNDS(13);
+	SHA1_NI_ROUNDS(14);
+	SHA1_NI_ROUNDS(15);
+	SHA1_NI_ROUNDS(16);
+	SHA1_NI_ROUNDS(17);
+	SHA1_NI_ROUNDS(18);
+	SHA1_NI_ROUNDS(19);
+	/* e was copied out of abcd before the last four rounds */
+	e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = _mm_extract_epi32(e[0], 3);
+}
+
+/* 20 rounds of one kind on every lane, keeping the last 16 schedule words in `w` */
+#define SHA1_AVX2_ROUNDS(t0, f, k) do {                                                                 \
+	__m256i kv = _mm256_set1_epi32(k);                                                              \
+	for (int t = (t0); t < (t0) + 20; t++) {                                                        \
+		__m256i tmp;                                                                            \
+		if (t >= 16) {                                                                          \
+			tmp = _mm256_xor_si256(_mm256_xor_si256(w[(t + 13) & 15], w[(t + 8) & 15]),     \
+					_mm256_xor_si256(w[(t + 2) & 15], w[t & 15]));                  \
+			w[t & 15] = _mm256_or_si256(_mm256_slli_epi32(tmp, 1), _mm256_srli_epi32(tmp, 31)); \
+		}                                                                                       \
+		tmp = _mm256_add_epi32(_mm256_add_epi32(_mm256_or_si256(_mm256_slli_epi32(a, 5),         \
+				_mm256_srli_epi32(a, 27)), (f)), _mm256_add_epi32(_mm256_add_epi32(e, kv), w[t & 15])); \
+		e = d;                                                                                  \
+		d = c;                                                                                  \
+		c = _mm256_or_si256(_mm256_slli_epi32(b, 30), _mm256_srli_epi32(b, 2));                 \
+		b = a;                                                                                  \
+		a = tmp;                                                                                \
+	}                                                                                               \
+} while (0)
+
+/* one block of each of 8 messages, with word i of lane l at `state[i][l]` */
+__attribute__((target("avx2")))
+static void sha1_compress_avx2(u32 (*restrict state)[SHA1_LANES], u8 const *const *restrict blocks)
+{
+	__m256i const bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i a, b, c, d, e, w[16];
+
+	/* word t of every lane's block side by side */
+	for (int t = 0; t < 16; t++) {
+		u32 x[8];
+		for (int l = 0; l < 8; l++)
+			memcpy(&x[l], blocks[l] + 4 * t, sizeof x[l]);
+		w[t] = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i const *)x), bswap);
+	}
+	a = _mm256_loadu_si256((__m256i const *)state[0]);
+	b = _mm256_loadu_si256((__m256i const *)state[1]);
+	c = _mm256_loadu_si256((__m256i const *)state[2]);
+	d = _mm256_loadu_si256((__m256i const *)state[3]);
+	e = _mm256_loadu_si256((__m256i const *)state[4]);
+	/* ch(b, c, d), parity and maj(b, c, d) */
+	SHA1_AVX2_ROUNDS(0, _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d))), sha1_k[0]);
+	SHA1_AVX2_ROUNDS(20, _mm256_xor_si256(_mm256_xor_si256(b, c), d), sha1_k[1]);
+	SHA1_AVX2_ROUNDS(40, _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c))),
+			sha1_k[2]);
+	SHA1_AVX2_ROUNDS(60, _mm256_xor_si256(_mm256_xor_si256(b, c), d), sha1_k[3]);
+	_mm256_storeu_si256((__m256i *)state[0], _mm256_add_epi32(a, _mm256_loadu_si256((__m256i const *)state[0])));
+	_mm256_storeu_si256((__m256i *)state[1], _mm256_add_epi32(b, _mm256_loadu_si256((__m256i const *)state[1])));
+	_mm256_storeu_si256((__m256i *)state[2], _mm256_add_epi32(c, _mm256_loadu_si256((__m256i const *)state[2])));
+	_mm256_storeu_si256((__m256i *)state[3], _mm256_add_epi32(d, _mm256_loadu_si256((__m256i const *)state[3])));
+	_mm256_storeu_si256((__m256i *)state[4], _mm256_add_epi32(e, _mm256_loadu_si256((__m256i const *)state[4])));
+}
+
+/* the same on 16 lanes, with rotates and three-way logic in one instruction each */
+#define SHA1_AVX512_ROUNDS(t0, f, k) do {                                                               \
+	__m512i kv = _mm512_set1_epi32(k);                                                              \
+	for (int t = (t0); t < (t0) + 20; t++) {                                                        \
+		__m512i tmp;                                                                            \
+		if (t >= 16) {                                                                          \
+			tmp = _mm512_ternarylogic_epi32(w[(t + 13) & 15], w[(t + 8) & 15], w[(t + 2) & 15], 0x96); \
+			w[t & 15] = _mm512_rol_epi32(_mm512_xor_si512(tmp, w[t & 15]), 1);               \
+		}                                                                                       \
+		tmp = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(a, 5), (f)),                   \
+				_mm512_add_epi32(_mm512_add_epi32(e, kv), w[t & 15]));                  \
+		e = d;                                                                                  \
+		d = c;                                                                                  \
+		c = _mm512_rol_epi32(b, 30);                                                            \
+		b = a;                                                                                  \
+		a = tmp;                                                                                \
+	}                                                                                               \
+} while (0)
+
+/* and of 16 */
+__attribute__((target("avx512f")))
+static void sha1_compress_avx512(u32 (*restrict state)[SHA1_LANES], u8 const *const *restrict blocks)
+{
+	__m512i a, b, c, d, e, w[16];
+
+	for (int t = 0; t < 16; t++) {
+		u32 x[SHA1_LANES];
+		for (int l = 0; l < SHA1_LANES; l++)
+			x[l] = load_be32(blocks[l] + 4 * t);
+		w[t] = _mm512_loadu_si512(x);
+	}
+	a = _mm512_loadu_si512(state[0]);
+	b = _mm512_loadu_si512(state[1]);
+	c = _mm512_loadu_si512(state[2]);
+	d = _mm512_loadu_si512(state[3]);
+	e = _mm512_loadu_si512(state[4]);
+	/* ternary logic tables for ch(b, c, d), parity and maj(b, c, d) */
+	SHA1_AVX512_ROUNDS(0, _mm512_ternarylogic_epi32(b, c, d, 0xca), sha1_k[0]);
+	SHA1_AVX512_ROUNDS(20, _mm512_ternarylogic_epi32(b, c, d, 0x96), sha1_k[1]);
+	SHA1_AVX512_ROUNDS(40, _mm512_ternarylogic_epi32(b, c, d, 0xe8), sha1_k[2]);
+	SHA1_AVX512_ROUNDS(60, _mm512_ternarylogic_epi32(b, c, d, 0x96), sha1_k[3]);
+	_mm512_storeu_si512(state[0], _mm512_add_epi32(a, _mm512_loadu_si512(state[0])));
+	_mm512_storeu_si512(state[1], _mm512_add_epi32(b, _mm512_loadu_si512(state[1])));
+	_mm512_storeu_si512(state[2], _mm512_add_epi32(c, _mm512_loadu_si512(state[2])));
+	_mm512_storeu_si512(state[3], _mm512_add_epi32(d, _mm512_loadu_si512(state[3])));
+	_mm512_storeu_si512(state[4], _mm512_add_epi32(e, _mm512_loadu_si512(state[4])));
+}
+
+/*
+ * keep `lanes` lanes busy: a lane that finishes its message writes the
+ * digest and starts on the next one, so messages of different lengths
+ * share the kernel until fewer than `lanes` are left
+ */
+static void sha1_mb_lanes(SHA1_MSG *restrict msgs, size_t cnt, int lanes,
+		void (*kernel)(u32 (*restrict)[SHA1_LANES], u8 const *const *restrict))
+{
+	static u8 const idle[SHA1_BLOCK_BYTES];
+	u8 bufs[SHA1_LANES][SHA1_BLOCK_BYTES];
+	u32 state[5][SHA1_LANES];
+	size_t cur[SHA1_LANES], blk[SHA1_LANES], next = 0, active = 0;
+	u8 const *blocks[SHA1_LANES];
+
+	for (int l = 0; l < lanes; l++) {
+		cur[l] = SIZE_MAX;
+		if (next < cnt) {
+			cur[l] = next++;
+			blk[l] = 0;
+			active++;
+			for (int i = 0; i < 5; i++)
+				state[i][l] = sha1_iv[i];
+		}
+	}
+	while (active) {
+		for (int l = 0; l < lanes; l++)
+			blocks[l] = (cur[l] == SIZE_MAX) ? idle : sha1_block(&msgs[cur[l]], blk[l], bufs[l]);
+		kernel(state, blocks);
+		for (int l = 0; l < lanes; l++) {
+			if (cur[l] == SIZE_MAX || ++blk[l] < sha1_blocks(&msgs[cur[l]]))
+				continue;
+			sha1_digest(msgs[cur[l]].digest, &state[0][l], SHA1_LANES);
+			cur[l] = SIZE_MAX;
+			active--;
+			if (next < cnt) {
+				cur[l] = next++;
+				blk[l] = 0;
+				active++;
+				for (int i = 0; i < 5; i++)
+					state[i][l] = sha1_iv[i];
+			}
+		}
+	}
+}
+#endif
+
+/*
+ * the best kernel the cpu has, but none past `max_isa`; called on the
+ * first batch with SHA1_AVX512, or with SHA1_C to force the portable one,
+ * e.g. for cross-checking
+ */
+int sha1_mb_use_simd(int max_isa)
+{
+	sha1_isa = SHA1_C;
+	sha1_ni = false;
+#ifdef SHA1_SIMD
+	unsigned eax, ebx = 0, ecx = 0, edx, xcr0_lo = 0, xcr0_hi;
+	bool sse41;
+
+	/* cpuid leaf 1: ECX bit 19 is SSE4.1, bit 27 OSXSAVE */
+	if (max_isa == SHA1_C || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return sha1_isa;
+	sse41 = (ecx >> 19) & 1;
+	if ((ecx >> 27) & 1)
+		__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	/* cpuid leaf 7: EBX bit 5 is AVX2, bit 16 AVX-512F and bit 29 the SHA extensions */
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return sha1_isa;
+	if (((ebx >> 5) & 1) && (xcr0_lo & 0x06) == 0x06)
+		sha1_isa = SHA1_AVX2;
+	if (max_isa >= SHA1_NI && ((ebx >> 29) & 1) && sse41)
+		sha1_isa = SHA1_NI, sha1_ni = true;
+	/* ymm state, then opmask and zmm state too */
+	if (max_isa >= SHA1_AVX512 && ((ebx >> 16) & 1) && (xcr0_lo & 0xe6) == 0xe6)
+		sha1_isa = SHA1_AVX512;
+#else
+	(void)max_isa;
+#endif
+	return sha1_isa;
+}
+
+/*
+ * hash `cnt` messages into their digests: a batch which fills the lanes
+ * of the vector kernel goes through it, and a smaller one a message at a
+ * time through the SHA extensions, or the portable loop without them
+ */
+void sha1_mb(SHA1_MSG *restrict msgs, size_t cnt)
+{
+	void (*compress)(u32 *restrict, u8 const *restrict) = sha1_compress_c;
+	u8 buf[SHA1_BLOCK_BYTES];
+
+	if (sha1_isa < 0)
+		sha1_mb_use_simd(SHA1_AVX512);
+#ifdef SHA1_SIMD
+	if (sha1_isa == SHA1_AVX512 && cnt >= 16) {
+		sha1_mb_lanes(msgs, cnt, 16, sha1_compress_avx512);
+		return;
+	}
+	if (sha1_isa == SHA1_AVX2 && cnt >= 8) {
+		sha1_mb_lanes(msgs, cnt, 8, sha1_compress_avx2);
+		return;
+	}
+	if (sha1_ni)
+		compress = sha1_compress_ni;
+#endif
+	for (size_t i = 0; i < cnt; i++) {
+		u32 state[5];
+		memcpy(state, sha1_iv, sizeof state);
+		for (size_t k = 0, nblk = sha1_blocks(&msgs[i]); k < nblk; k++)
+			compress(state, sha1_block(&msgs[i], k, buf));
+		sha1_digest(msgs[i].digest, state, 1);
+	}
+}
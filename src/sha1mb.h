@@ -0,0 +1,41 @@
+/*
+ * sha1mb.h:	header for sha1mb.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _SHA1MB_H
+#define _SHA1MB_H 1
+
+#include "defs.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(BN_NO_ASM)
+# define SHA1_SIMD		1
+#endif
+
+/* messages hashed side by side by the widest vector kernel */
+#define SHA1_LANES		16
+#define SHA1_BLOCK_BYTES	64
+#define SHA1_DIGEST_BYTES	20
+
+/* compression kernels, in the order `sha1_mb_use_simd()` prefers them */
+enum sha1_isa { SHA1_C, SHA1_AVX2, SHA1_NI, SHA1_AVX512 };
+
+/* one message of `sha1_mb()`: `hdr_len` octets of `hdr`, then `len` octets at `data` */
+typedef struct _sha1_msg {
+	/* e.g. the 0x99 and length a key packet is hashed after */
+	u8 hdr[8];
+	size_t hdr_len;
+	u8 const *data;
+	size_t len;
+	u8 *digest;
+} SHA1_MSG;
+
+/* prototypes */
+int sha1_mb_use_simd(int max_isa);
+void sha1_mb(SHA1_MSG *restrict msgs, size_t cnt);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * strarena.c:	interned strings in an arena of chunks
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "strarena.h"
+
+/* a block of the arena, newest first */
+struct _str_chunk {
+	struct _str_chunk *next;
+	size_t used, size;
+	char data[];
+};
+
+/* an interned string, NULL when the slot is empty */
+struct _str_slot {
+	char const *str;
+	u32 len;
+	u32 hash;
+};
+
+/* the slot holding `str`, or the empty slot it would go in */
+static struct _str_slot *str_slot(STR_ARENA const *restrict arena, char const *restrict str, size_t len, u32 hash)
+{
+	size_t i = hash & (arena->size - 1);
+	struct _str_slot *slot;
+
+	for (;;) {
+		slot = &arena->slots[i];
+		if (!slot->str || (slot->hash == hash && slot->len == len && !memcmp(slot->str, str, len)))
+			return slot;
+		i = (i + 1) & (arena->size - 1);
+	}
+}
+
+/* make room for one more string, keeping the table at most half full */
+static void str_reserve(STR_ARENA *restrict arena)
+{
+	struct _str_slot *old = arena->slots;
+	size_t old_size = arena->size;
+
+	if (2 * (arena->cnt + 1) <= arena->size)
+		return;
+	arena->size = old_size ? 2 * old_size : STR_TABLE_MIN;
+	xcalloc(&arena->slots, arena->size, sizeof *arena->slots, "str_reserve() xcalloc()");
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].str)
+			*str_slot(arena, old[i].str, old[i].len, old[i].hash) = old[i];
+	}
+	free(old);
+}
+
+/* `len` octets which stay put until the arena is freed */
+void *str_arena_alloc(STR_ARENA *restrict arena, size_t len)
+{
+	struct _str_chunk *chunk = arena->chunks;
+	void *ret;
+
+	if (!chunk || chunk->size - chunk->used < len) {
+		size_t size = (len > STR_CHUNK_BYTES) ? len : STR_CHUNK_BYTES;
+		xcalloc(&chunk, 1, sizeof *chunk + size, "str_arena_alloc() xcalloc()");
+		chunk->size = size;
+		/* a string too long to share its chunk leaves the current one open */
+		if (size > STR_CHUNK_BYTES && arena->chunks) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+	ret = chunk->data + chunk->used;
+	chunk->used += len;
+	return ret;
+}
+
+/* the one copy of `len` octets of `str` with a Nul appended, adding it on first use */
+char const *str_intern(STR_ARENA *restrict arena, char const *restrict str, size_t len)
+{
+	u32 hash = str_hash(str, len);
+	struct _str_slot *slot;
+	char *copy;
+
+	if (len > UINT32_MAX)
+		ERRX("str_intern() string too long");
+	if (arena->size && (slot = str_slot(arena, str, len, hash))->str)
+		return slot->str;
+	str_reserve(arena);
+	copy = str_arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = 0;
+	*str_slot(arena, str, len, hash) = (struct _str_slot){.str = copy, .len = len, .hash = hash};
+	arena->cnt++;
+	return copy;
+}
+
+/* the interned copy of `str`, or NULL if no packet has it */
+char const *str_lookup(STR_ARENA const *restrict arena, char const *restrict str, size_t len)
+{
+	if (!arena->size)
+		return NULL;
+	return str_slot(arena, str, len, str_hash(str, len))->str;
+}
+
+/* octets held by the arena's chunks */
+size_t str_arena_bytes(STR_ARENA const *restrict arena)
+{
+	size_t bytes = 0;
+	for (struct _str_chunk const *chunk = arena->chunks; chunk; chunk = chunk->next)
+		bytes += chunk->size;
+	return bytes;
+}
+
+void str_arena_free(STR_ARENA *restrict arena)
+{
+	while (arena->chunks) {
+		struct _str_chunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	free(arena->slots);
+	arena->slots = NULL;
+	arena->size = 0;
+	arena->cnt = 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * strarena.h:	header for strarena.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#ifndef _STRARENA_H
+#define _STRARENA_H 1
+
+#include "defs.h"
+
+/* octets per chunk, longer strings get a chunk of their own */
+#define STR_CHUNK_BYTES		(64 * 1024)
+/* initial size of the intern table */
+#define STR_TABLE_MIN		256
+
+/* FNV-1a */
+static inline u64 str_hash(char const *restrict str, size_t len)
+{
+	u64 h = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (u8)str[i]) * 0x100000001b3;
+	return h;
+}
+
+/* prototypes */
+void *str_arena_alloc(STR_ARENA *restrict arena, size_t len);
+char const *str_intern(STR_ARENA *restrict arena, char const *restrict str, size_t len);
+char const *str_lookup(STR_ARENA const *restrict arena, char const *restrict str, size_t len);
+size_t str_arena_bytes(STR_ARENA const *restrict arena);
+void str_arena_free(STR_ARENA *restrict arena);
+
+#endif
@@ -0,0 +1,926 @@
+/*
+ * t/bench.c:	benchmarks against libgcrypt
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+/* room for 4096-bit operands */
+#define BN_BYTES 512
+
+#include "../src/bn.h"
+#include "../src/batchgcd.h"
+#include "../src/cdata.h"
+#include "../src/keyindex.h"
+#include "../src/lanes.h"
+#include "../src/packet.h"
+#include "../src/parse.h"
+#include "../src/residue.h"
+#include "../src/rsa.h"
+#include "../src/s2k.h"
+#include "../src/seipd.h"
+#include "../src/sha1mb.h"
+#include "../src/strarena.h"
+#include <gcrypt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_BZ2
+# include <bzlib.h>
+#endif
+
+/* minimum wall time per measurement in seconds */
+#define MIN_TIME 1.0
+/* private operations per `rsa_crt_private_list()` call */
+#define RSA_BATCH 64
+
+/* wall clock in seconds */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* random `bits`-bit value with the top bit set */
+static void random_bits(struct bn *restrict n, int bits)
+{
+	int nwords = bits / (8 * WORD_SIZE);
+	bignum_init(n);
+	gcry_randomize(n->array, sizeof *n->array * nwords, GCRY_WEAK_RANDOM);
+	n->array[nwords - 1] |= (DTYPE)DTYPE_MSB;
+	bignum_normalize(n);
+}
+
+/* convert to a libgcrypt mpi through its big-endian byte representation */
+static gcry_mpi_t bn_to_mpi(struct bn *restrict n)
+{
+	gcry_mpi_t ret;
+	unsigned char buf[BN_BYTES];
+	bignum_to_bytes(n, buf, sizeof buf);
+	gcry_mpi_scan(&ret, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+	return ret;
+}
+
+/* montgomery modmul with portable and mulx/adx rows, against libgcrypt's mulm */
+static int bench_modmul(int bits)
+{
+	struct bn a, b, n, c, c_asm;
+	struct bn_mont mont;
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	random_bits(&n, bits);
+	n.array[0] |= 1;
+	random_bits(&a, bits - 1);
+	random_bits(&b, bits - 1);
+	gcry_mpi_t ma = bn_to_mpi(&a), mb = bn_to_mpi(&b), mn = bn_to_mpi(&n);
+	gcry_mpi_t mc = gcry_mpi_new(bits);
+
+	bignum_mont_init(&mont, &n);
+	bignum_use_asm(0);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		bignum_mont_mul(&mont, &a, &b, &c);
+	printf("%5d-bit bignum_mont_mul() portable: %8.0f ops/sec\n", bits, iters / elapsed);
+	if (bignum_use_asm(1)) {
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+			bignum_mont_mul(&mont, &a, &b, &c_asm);
+		printf("%5d-bit bignum_mont_mul() mulx/adx: %8.0f ops/sec\n", bits, iters / elapsed);
+		if (bignum_cmp(&c, &c_asm) != EQUAL) {
+			printf("%5d-bit modmul mismatch\n", bits);
+			ret = 1;
+		}
+	}
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		gcry_mpi_mulm(mc, ma, mb, mn);
+	printf("%5d-bit gcry_mpi_mulm():            %8.0f ops/sec\n", bits, iters / elapsed);
+
+	gcry_mpi_release(ma), gcry_mpi_release(mb), gcry_mpi_release(mn), gcry_mpi_release(mc);
+	return ret;
+}
+
+/* inverse modulo an odd `bits`-bit number, against libgcrypt's invm */
+static int bench_modinv(int bits)
+{
+	struct bn a, m, c;
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	random_bits(&m, bits);
+	m.array[0] |= 1;
+	random_bits(&a, bits - 1);
+	gcry_mpi_t ma = bn_to_mpi(&a), mm = bn_to_mpi(&m), mc = gcry_mpi_new(bits);
+	gcry_mpi_t mchk;
+
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		bignum_modinv(&a, &m, &c);
+	printf("%5d-bit bignum_modinv():  %8.0f ops/sec\n", bits, iters / elapsed);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		gcry_mpi_invm(mc, ma, mm);
+	printf("%5d-bit gcry_mpi_invm():  %8.0f ops/sec\n", bits, iters / elapsed);
+
+	int has_inv = gcry_mpi_invm(mc, ma, mm);
+	mchk = bn_to_mpi(&c);
+	if ((bignum_modinv(&a, &m, &c) == 0) != has_inv || (has_inv && gcry_mpi_cmp(mchk, mc))) {
+		printf("%5d-bit modinv mismatch\n", bits);
+		ret = 1;
+	}
+	gcry_mpi_release(ma), gcry_mpi_release(mm), gcry_mpi_release(mc), gcry_mpi_release(mchk);
+	return ret;
+}
+
+/* private-exponent sized modexp: bn.h windowed, bn.h constant-time, libgcrypt */
+static int bench_powmod(int bits)
+{
+	struct bn a, e, n, c, c_sec;
+	struct bn_mont mont;
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	random_bits(&n, bits);
+	n.array[0] |= 1;
+	random_bits(&a, bits - 1);
+	random_bits(&e, bits - 1);
+	gcry_mpi_t ma = bn_to_mpi(&a), me = bn_to_mpi(&e), mn = bn_to_mpi(&n);
+	gcry_mpi_t mc = gcry_mpi_new(bits);
+
+	/* the generic word loops, for comparison with the fixed-width kernels */
+	bignum_mont_init(&mont, &n);
+	mont.kern = NULL;
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		bignum_mont_powmod(&mont, &a, &e, &c);
+	printf("%5d-bit bignum_mont_powmod() generic: %6.2f ops/sec\n", bits, iters / elapsed);
+	bignum_mont_init(&mont, &n);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		bignum_mont_powmod(&mont, &a, &e, &c);
+	printf("%5d-bit bignum_mont_powmod():     %10.2f ops/sec\n", bits, iters / elapsed);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		bignum_mont_powmod_sec(&mont, &a, &e, &c_sec);
+	printf("%5d-bit bignum_mont_powmod_sec(): %10.2f ops/sec\n", bits, iters / elapsed);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		gcry_mpi_powm(mc, ma, me, mn);
+	printf("%5d-bit gcry_mpi_powm():          %10.2f ops/sec\n", bits, iters / elapsed);
+
+	gcry_mpi_t mres = bn_to_mpi(&c), mres_sec = bn_to_mpi(&c_sec);
+	if (gcry_mpi_cmp(mres, mc) || gcry_mpi_cmp(mres_sec, mc)) {
+		printf("%5d-bit result mismatch\n", bits);
+		ret = 1;
+	}
+	gcry_mpi_release(ma), gcry_mpi_release(me), gcry_mpi_release(mn);
+	gcry_mpi_release(mc), gcry_mpi_release(mres), gcry_mpi_release(mres_sec);
+	return ret;
+}
+
+/* LANES independent powmods on one core: scalar constant-time and windowed code, then the lanes */
+static int bench_lanes(int bits, int ebits)
+{
+	struct bn a[LANES], e[LANES], n[LANES], c[LANES], r;
+	struct bn *pa[LANES], *pe[LANES], *pn[LANES], *pc[LANES];
+	static char const *const isa_names[] = {"c", "avx2", "avx-512"};
+	struct bn_mont mont;
+	LANE_MONT *lanes = malloc(sizeof *lanes);
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	if (!lanes)
+		return 1;
+	for (int l = 0; l < LANES; l++) {
+		random_bits(&n[l], bits);
+		n[l].array[0] |= 1;
+		random_bits(&a[l], bits - 1);
+		if (ebits)
+			random_bits(&e[l], ebits);
+		else
+			bignum_from_int(&e[l], 65537);
+		pa[l] = &a[l], pe[l] = &e[l], pn[l] = &n[l], pc[l] = &c[l];
+	}
+
+	bignum_mont_init(&mont, &n[0]);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		ebits ? bignum_mont_powmod_sec(&mont, &a[0], &e[0], &r) : bignum_mont_powmod(&mont, &a[0], &e[0], &r);
+	printf("%5d-bit e=%-5s %s: %10.2f ops/sec\n", bits, ebits ? "d" : "65537",
+			ebits ? "bignum_mont_powmod_sec()    " : "bignum_mont_powmod()        ", iters / elapsed);
+	lanes_mont_init(lanes, pn, LANES);
+	/* every kernel up to the widest the cpu has */
+	for (int isa = LANES_C; isa <= lanes_use_simd(1); isa++) {
+		_lanes_isa = isa;
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+			lanes_powmod(lanes, pa, pe, pc);
+		printf("%5d-bit e=%-5s lanes_powmod() x%d %-10s: %10.2f ops/sec\n", bits, ebits ? "d" : "65537",
+				LANES, isa_names[isa], LANES * iters / elapsed);
+		for (int l = 0; l < LANES; l++) {
+			bignum_powmod(&a[l], &e[l], &n[l], &r);
+			if (bignum_cmp(&r, &c[l]) != EQUAL) {
+				printf("%5d-bit lane %d result mismatch\n", bits, l);
+				ret = 1;
+			}
+		}
+	}
+	free(lanes);
+	return ret;
+}
+
+/* copy a libgcrypt mpi into the layout `read_mpi()` produces */
+static void mpi_from_gcry(MPI *restrict mpi, gcry_mpi_t m)
+{
+	size_t nbytes;
+	mpi->length = gcry_mpi_get_nbits(m);
+	mpi->mdata = calloc(1, MPIBYTES(mpi->length) + 1);
+	gcry_mpi_print(GCRYMPI_FMT_USG, mpi->mdata + 1, MPIBYTES(mpi->length), &nbytes, m);
+}
+
+/* CRT private-key operation on a generated key, serial and with parallel halves, against libgcrypt */
+static int bench_rsa(int bits)
+{
+	SECKEY_PACKET seckey = {0};
+	MPI *mpis[] = {
+		&seckey.modulus_n, &seckey.exponent_e, &seckey.exponent_d,
+		&seckey.prime_p, &seckey.prime_q, &seckey.mult_inverse,
+	};
+	gcry_sexp_t parms, key, skey, data, plain;
+	gcry_mpi_t m[6], mc, mres, mout;
+	size_t const nthreads[] = {1, 0};
+	RSA_CRT *crt;
+	static unsigned char in[RSA_BATCH * BN_BYTES], out[RSA_BATCH * BN_BYTES];
+	int results[RSA_BATCH];
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	gcry_sexp_build(&parms, NULL, "(genkey (rsa (nbits %d)))", bits);
+	if (gcry_pk_genkey(&key, parms))
+		return 1;
+	skey = gcry_sexp_find_token(key, "private-key", 0);
+	gcry_sexp_extract_param(skey, "rsa", "nedpqu", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], NULL);
+	for (size_t i = 0; i < sizeof m / sizeof *m; i++)
+		mpi_from_gcry(mpis[i], m[i]);
+
+	/* random input below n */
+	gcry_randomize(in, bits / 8, GCRY_WEAK_RANDOM);
+	in[0] &= 0x7f;
+	gcry_mpi_scan(&mc, GCRYMPI_FMT_USG, in, bits / 8, NULL);
+	gcry_sexp_build(&data, NULL, "(enc-val (flags raw) (rsa (a %m)))", mc);
+
+	/* the same input over and over, spread across the threads a batch at a time */
+	for (size_t i = 1; i < RSA_BATCH; i++)
+		memcpy(in + i * (bits / 8), in, bits / 8);
+	crt = rsa_crt_new(&seckey);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		ret |= rsa_crt_private(crt, in, bits / 8, out);
+	printf("%5d-bit rsa_crt_private():          %10.2f ops/sec\n", bits, iters / elapsed);
+	for (size_t t = 0; t < ARRLEN(nthreads); t++) {
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters += RSA_BATCH)
+			ret |= rsa_crt_private_list(crt, in, out, results, RSA_BATCH, nthreads[t]) != 0;
+		printf("%5d-bit rsa_crt_private_list(), %3zu threads: %10.2f ops/sec\n", bits,
+				FALLBACK(nthreads[t], pool_cpus()), iters / elapsed);
+	}
+	plain = NULL;
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+		gcry_sexp_release(plain);
+		gcry_pk_decrypt(&plain, data, skey);
+	}
+	printf("%5d-bit gcry_pk_decrypt():          %10.2f ops/sec\n", bits, iters / elapsed);
+
+	mres = gcry_sexp_nth_mpi(plain, 1, GCRYMPI_FMT_USG);
+	gcry_mpi_scan(&mout, GCRYMPI_FMT_USG, out, bits / 8, NULL);
+	if (ret || !mres || gcry_mpi_cmp(mres, mout)) {
+		printf("%5d-bit rsa result mismatch\n", bits);
+		ret = 1;
+	}
+
+	rsa_crt_free(crt);
+	for (size_t i = 0; i < sizeof m / sizeof *m; i++) {
+		gcry_mpi_release(m[i]);
+		free(mpis[i]->mdata);
+	}
+	gcry_mpi_release(mc), gcry_mpi_release(mres), gcry_mpi_release(mout);
+	gcry_sexp_release(plain), gcry_sexp_release(data), gcry_sexp_release(skey);
+	gcry_sexp_release(key), gcry_sexp_release(parms);
+	return ret;
+}
+
+/* keyring self-signature verification, against libgcrypt's powm with the same key */
+static int bench_verify(size_t nsigs)
+{
+	PGP_LIST pkts = {0};
+	PGP_PACKET copy;
+	MPI const *n, *e, *sig;
+	gcry_mpi_t mn, me, ms, mres;
+	double start, elapsed;
+	size_t invalid;
+	long iters;
+	int *results;
+
+	/* the sample key with `nsigs` copies of its user id and positive certification */
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) != 5)
+		return 1;
+	for (size_t i = 1; i < nsigs; i++) {
+		for (size_t j = 1; j <= 2; j++) {
+			copy = pkts.list[j];
+			copy.pdata = malloc(packet_len(&copy));
+			memcpy(copy.pdata, pkts.list[j].pdata, packet_len(&copy));
+			add_pgp_list(&pkts, &copy);
+		}
+	}
+	parse_pgp_packets(&pkts);
+	n = &pkts.list[0].seckey.modulus_n, e = &pkts.list[0].seckey.exponent_e;
+	sig = &pkts.list[2].sig.sig_mpi;
+	results = calloc(pkts.cnt, sizeof *results);
+
+	/* through the lanes where the cpu has avx-512, then with the scalar ladder alone */
+	for (int simd = 1; simd >= 0; simd--) {
+		lanes_use_simd(simd);
+		start = now();
+		invalid = rsa_verify_list(&pkts, results, 0);
+		elapsed = now() - start;
+		printf(" 2048-bit rsa_verify_list() %-7s %10.2f sigs/sec (%.2f sec per million)\n",
+				simd ? "lanes:" : "scalar:", nsigs / elapsed, 1e6 * elapsed / nsigs);
+	}
+	lanes_use_simd(1);
+
+	gcry_mpi_scan(&mn, GCRYMPI_FMT_USG, n->mdata + 1, MPIBYTES(n->length), NULL);
+	gcry_mpi_scan(&me, GCRYMPI_FMT_USG, e->mdata + 1, MPIBYTES(e->length), NULL);
+	gcry_mpi_scan(&ms, GCRYMPI_FMT_USG, sig->mdata + 1, MPIBYTES(sig->length), NULL);
+	mres = gcry_mpi_new(0);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		gcry_mpi_powm(mres, ms, me, mn);
+	printf(" 2048-bit gcry_mpi_powm() with e:   %10.2f ops/sec\n", iters / elapsed);
+
+	for (size_t i = 2; i < pkts.cnt; i += 2)
+		invalid += results[i] != RSA_SIG_VALID;
+	if (invalid)
+		printf("%zu signatures failed verification\n", invalid);
+
+	gcry_mpi_release(mn), gcry_mpi_release(me), gcry_mpi_release(ms), gcry_mpi_release(mres);
+	free(results);
+	free_pgp_list(&pkts);
+	return !!invalid;
+}
+
+/* bignum_pow() cost should grow with the bit length of the exponent, not its value */
+static void bench_pow(void)
+{
+	static const int exps[] = { 10, 100, 1000, 10000, 1000000 };
+	struct bn a, b, c;
+	double start, elapsed;
+	long iters;
+
+	bignum_from_int(&a, 3);
+	for (size_t i = 0; i < sizeof exps / sizeof *exps; i++) {
+		bignum_from_int(&b, exps[i]);
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+			bignum_pow(&a, &b, &c);
+		printf("  3^%-7d bignum_pow():          %10.2f ops/sec\n", exps[i], iters / elapsed);
+	}
+}
+
+/* cost of small-value operations at full width should not depend on BN_BYTES */
+static void bench_small(void)
+{
+	struct bn a, b, c;
+	double start, elapsed;
+	long iters;
+	volatile int sink = 0;
+
+	bignum_from_int(&a, 0x12345678);
+	bignum_from_int(&b, 0x9abcdef0);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+		bignum_lshift(&a, &c, 17);
+		bignum_rshift(&c, &c, 17);
+		sink += bignum_cmp(&c, &b);
+	}
+	printf(" 64-bit shift pair + bignum_cmp():  %10.2f ops/sec\n", iters / elapsed);
+}
+
+/* one multiplication algorithm in the sweep, up to `max` words */
+typedef struct _mul_algo {
+	char const *name;
+	void (*mul)(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb);
+	size_t min, max;
+} MUL_ALGO;
+
+static void mul_school(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	_mul_words(c, a, na, b, nb);
+}
+
+static void mul_ntt(DTYPE *c, DTYPE *a, size_t na, DTYPE *b, size_t nb)
+{
+	ntt_mul_words(c, a, na, b, nb);
+}
+
+/* seconds per `n`-word product */
+static double time_mul(MUL_ALGO const *algo, size_t n, DTYPE *a, DTYPE *b, DTYPE *c)
+{
+	double start, elapsed;
+	long iters;
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME / 10; iters++)
+		algo->mul(c, a, n, b, n);
+	return elapsed / iters;
+}
+
+/*
+ * every multiplication on balanced operands from 16 words to 100M bits,
+ * each one recursing into the current thresholds, and the first size
+ * where each one beats the one before it
+ */
+static int bench_mul_sweep(void)
+{
+	static MUL_ALGO const algos[] = {
+		{"schoolbook", mul_school, 0, 1 << 13},
+		{"karatsuba", _bigint_mul_karatsuba, 16, 1 << 17},
+		{"toom-3", _bigint_mul_toom3, 16, 1 << 19},
+		{"ntt", mul_ntt, 64, 1 << 21},
+	};
+	size_t cross[ARRLEN(algos)] = {0};
+	size_t const max = 1 << 21;
+	DTYPE *a = malloc(sizeof *a * max), *b = malloc(sizeof *b * max), *c = malloc(sizeof *c * 2 * max);
+
+	if (!a || !b || !c)
+		return 1;
+	gcry_randomize(a, sizeof *a * max, GCRY_WEAK_RANDOM);
+	gcry_randomize(b, sizeof *b * max, GCRY_WEAK_RANDOM);
+	printf(" %9s %10s", "words", "bits");
+	for (size_t i = 0; i < ARRLEN(algos); i++)
+		printf(" %12s", algos[i].name);
+	puts(" (usec per product)");
+	/* steps of sqrt(2) */
+	for (size_t n = 16, odd = 0; n <= max; n = odd ? n * 4 / 3 : n * 3 / 2, odd ^= 1) {
+		double t[ARRLEN(algos)] = {0};
+		printf(" %9zu %10zu", n, n * 8 * sizeof *a);
+		for (size_t i = 0; i < ARRLEN(algos); i++) {
+			if (n < algos[i].min || n > algos[i].max) {
+				printf(" %12s", "-");
+				continue;
+			}
+			t[i] = time_mul(&algos[i], n, a, b, c);
+			printf(" %12.2f", 1e6 * t[i]);
+			if (i && !cross[i] && t[i - 1] && t[i] < t[i - 1])
+				cross[i] = n;
+		}
+		putchar('\n');
+		fflush(stdout);
+	}
+	printf(" crossovers on this host: -DKARATSUBA_THRESHOLD=%zu -DTOOM3_THRESHOLD=%zu -DNTT_THRESHOLD=%zu\n",
+			cross[1], cross[2], cross[3]);
+	printf(" built with:              -DKARATSUBA_THRESHOLD=%d -DTOOM3_THRESHOLD=%d -DNTT_THRESHOLD=%d\n",
+			KARATSUBA_THRESHOLD, TOOM3_THRESHOLD, NTT_THRESHOLD);
+
+	free(a), free(b), free(c);
+	return 0;
+}
+
+/* batch gcd over `cnt` random 2048-bit moduli, against pairwise gcds in libgcrypt */
+static int bench_batch_gcd(size_t cnt)
+{
+	BIGINT *moduli = calloc(cnt, sizeof *moduli), *gcds = calloc(cnt, sizeof *gcds);
+	u8 buf[256];
+	gcry_mpi_t ma, mb, mg;
+	double start, elapsed;
+	long iters;
+
+	if (!moduli || !gcds)
+		return 1;
+	for (size_t i = 0; i < cnt; i++) {
+		gcry_randomize(buf, sizeof buf, GCRY_WEAK_RANDOM);
+		buf[0] |= 0x80, buf[sizeof buf - 1] |= 0x01;
+		bigint_from_bytes(&moduli[i], buf, sizeof buf);
+	}
+
+	start = now();
+	batch_gcd(moduli, cnt, gcds, 0, 0);
+	elapsed = now() - start;
+	printf(" 2048-bit batch_gcd() of %zu:    %10.2f moduli/sec (%.2f sec)\n", cnt, cnt / elapsed, elapsed);
+
+	mg = gcry_mpi_new(0);
+	gcry_mpi_scan(&ma, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+	gcry_randomize(buf, sizeof buf, GCRY_WEAK_RANDOM);
+	gcry_mpi_scan(&mb, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++)
+		gcry_mpi_gcd(mg, ma, mb);
+	/* every pair needs a gcd without the tree */
+	printf(" 2048-bit gcry_mpi_gcd() pairwise:  %10.2f moduli/sec\n", iters / elapsed / (cnt / 2.0));
+
+	for (size_t i = 0; i < cnt; i++)
+		bigint_free(&moduli[i]), bigint_free(&gcds[i]);
+	free(moduli), free(gcds);
+	gcry_mpi_release(ma), gcry_mpi_release(mb), gcry_mpi_release(mg);
+	return 0;
+}
+
+/* weak key residues of `cnt` random 2048-bit moduli, against one gcry_mpi_mod() per prime */
+static int bench_weak_scan(size_t cnt)
+{
+	RESIDUE_CTX ctx;
+	u8 *buf = malloc(cnt * 256);
+	gcry_mpi_t mn, mp, mr;
+	double start, elapsed;
+	long iters;
+	int weak = 0;
+
+	if (!buf)
+		return 1;
+	residue_init(&ctx);
+	gcry_randomize(buf, cnt * 256, GCRY_WEAK_RANDOM);
+	start = now();
+	for (size_t i = 0; i < cnt; i++)
+		weak += weak_check(&ctx, buf + i * 256, 256) != WEAK_NONE;
+	elapsed = now() - start;
+	printf(" 2048-bit weak_check() of %zu:      %10.0f keys/min (%d weak)\n", cnt, 60 * cnt / elapsed, weak);
+
+	gcry_mpi_scan(&mn, GCRYMPI_FMT_USG, buf, 256, NULL);
+	mp = gcry_mpi_new(0), mr = gcry_mpi_new(0);
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+		for (size_t j = 0; j < RESIDUE_PRIMES; j++) {
+			gcry_mpi_set_ui(mp, (unsigned long)ctx.primes[j]);
+			gcry_mpi_mod(mr, mn, mp);
+		}
+	}
+	printf(" 2048-bit gcry_mpi_mod() per prime: %10.0f keys/min\n", 60 * iters / elapsed);
+
+	free(buf);
+	gcry_mpi_release(mn), gcry_mpi_release(mp), gcry_mpi_release(mr);
+	return 0;
+}
+
+/* gpg's default iterated and salted S2K over one and every cpu */
+static int bench_s2k(size_t cnt)
+{
+	S2K s2k = {.s2k_mode = S2K_ITERSALTED, .hash_algo = HASH_SHA1, .cnt = 235};
+	S2K_JOB *jobs = calloc(cnt, sizeof *jobs);
+	u8 (*keys)[S2K_MAX_KEY_BYTES] = calloc(cnt, sizeof *keys);
+	size_t const nthreads[] = {1, 0};
+	int ret = 0;
+
+	if (!jobs || !keys) {
+		free(jobs), free(keys);
+		return 1;
+	}
+	gcry_randomize(s2k.salt, sizeof s2k.salt, GCRY_WEAK_RANDOM);
+	for (size_t i = 0; i < cnt; i++)
+		jobs[i] = (S2K_JOB){.s2k = &s2k, .pass = "ayy lmao", .pass_len = 8, .key = keys[i], .key_len = 16};
+	for (size_t t = 0; t < ARRLEN(nthreads); t++) {
+		double start = now(), elapsed;
+		s2k_derive_jobs(jobs, cnt, nthreads[t]);
+		elapsed = now() - start;
+		for (size_t i = 0; i < cnt; i++)
+			ret |= jobs[i].ret != S2K_OK;
+		printf(" %u-octet S2K, %3zu threads:  %10.1f derivations/s\n",
+				S2K_COUNT(s2k.cnt), FALLBACK(nthreads[t], pool_cpus()), cnt / elapsed);
+	}
+
+	free(jobs), free(keys);
+	return ret;
+}
+
+/* v4 fingerprints of 2048-bit public keys, one libgcrypt call per key against each `sha1_mb()` kernel */
+static int bench_fingerprint(size_t cnt)
+{
+	static char const *const isa_names[] = {"C", "AVX2", "SHA-NI", "AVX-512"};
+	size_t const body = 6 + 2 + 256 + 2 + 3;
+	PGP_LIST pkts = {.cnt = cnt, .max = cnt};
+	u8 *data = malloc(cnt * body), ref[SHA1_DIGEST_BYTES];
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	if (!data || !(pkts.list = calloc(cnt, sizeof *pkts.list))) {
+		free(data);
+		return 1;
+	}
+	gcry_randomize(data, cnt * body, GCRY_WEAK_RANDOM);
+	for (size_t i = 0; i < cnt; i++) {
+		u8 *p = data + i * body;
+		p[0] = 4, p[5] = PUB_RSA;
+		p[6] = 0x08, p[7] = 0x00, p[8] |= 0x80;
+		p[264] = 0x00, p[265] = 0x11, p[266] = 0x01, p[267] = 0x00, p[268] = 0x01;
+		pkts.list[i] = (PGP_PACKET){.pheader = 0x80 | TAG_PUBKEY << 2 | LEN_TWO, .plen_two = body, .pdata = p};
+	}
+
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+		for (size_t i = 0; i < cnt; i++) {
+			u8 hdr[3] = {0x99, body >> 8, body & 0xff};
+			gcry_md_hash_buffers(GCRY_MD_SHA1, 0, pkts.list[i].fpr, (gcry_buffer_t[]){
+					{.data = hdr, .len = sizeof hdr}, {.data = pkts.list[i].pdata, .len = body}}, 2);
+		}
+	}
+	printf(" v4 fingerprints of %zu, gcry_md_hash_buffers(): %10.0f keys/s\n", cnt, iters * cnt / elapsed);
+	memcpy(ref, pkts.list[cnt - 1].fpr, sizeof ref);
+
+	for (int isa = SHA1_C; isa <= SHA1_AVX512; isa++) {
+		if (sha1_mb_use_simd(isa) != isa)
+			continue;
+		memset(pkts.list[cnt - 1].fpr, 0, sizeof ref);
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+			for (size_t i = 0; i < cnt; i++)
+				pkts.list[i].fpr_len = 0;
+			key_fingerprint_list(&pkts);
+		}
+		ret |= memcmp(ref, pkts.list[cnt - 1].fpr, sizeof ref) != 0;
+		printf(" v4 fingerprints of %zu, sha1_mb() %-7s %10.0f keys/s\n", cnt, isa_names[isa], iters * cnt / elapsed);
+	}
+	sha1_mb_use_simd(SHA1_AVX512);
+
+	free(pkts.list);
+	free(data);
+	return ret;
+}
+
+/* a keyring of `cnt` user ids, two per key: parsing them into the arena, indexing and looking keys up by email */
+static int bench_uid(size_t cnt)
+{
+	size_t const keys = cnt / 2, pkt_cnt = keys * 3;
+	PGP_LIST pkts = {.cnt = pkt_cnt, .max = pkt_cnt};
+	UID_INDEX index;
+	char *text = malloc(cnt * 64), email[64];
+	double start, elapsed;
+	size_t found = 0;
+	long iters;
+	int ret = 0;
+
+	if (!text || !(pkts.list = calloc(pkt_cnt, sizeof *pkts.list))) {
+		free(text);
+		return 1;
+	}
+	for (size_t i = 0; i < keys; i++) {
+		for (size_t j = 0; j < 2; j++) {
+			char *uid = text + (2 * i + j) * 64;
+			int len = snprintf(uid, 64, j ? "User %zu <USER%zu@Work.Example.com>" : "User %zu <user%zu@example.com>", i, i);
+			pkts.list[3 * i + 1 + j] = (PGP_PACKET){.pheader = 0x80 | TAG_UID << 2 | LEN_ONE,
+				.plen_one = len, .pdata = (u8 *)uid};
+		}
+		pkts.list[3 * i].pheader = 0x80 | TAG_PUBKEY << 2 | LEN_ONE;
+	}
+
+	start = now();
+	ret |= parse_uid_packets(&pkts) != cnt;
+	uid_index_build(&index, &pkts);
+	elapsed = now() - start;
+	printf(" user ids of %zu, parse and index:  %10.0f uids/s, %zu strings in %zu KiB\n", cnt, cnt / elapsed,
+		pkts.strs.cnt, str_arena_bytes(&pkts.strs) / 1024);
+
+	for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+		size_t key = (size_t)iters * 7919 % keys;
+		snprintf(email, sizeof email, (iters & 1) ? "user%zu@work.example.com" : "nobody%zu@example.com", key);
+		if (uid_index_find(&index, email, 0) == 3 * key)
+			found++;
+	}
+	ret |= found != (size_t)iters / 2;
+	printf(" user ids of %zu, uid_index_find(): %10.0f lookups/s\n", cnt, iters / elapsed);
+
+	uid_index_free(&index);
+	str_arena_free(&pkts.strs);
+	free(pkts.list);
+	free(text);
+	return ret;
+}
+
+/* compress `len` octets of `data` with `algo` into a new buffer; returns its length, or 0 */
+static size_t bench_compress(int algo, u8 const *restrict data, size_t len, u8 **restrict out)
+{
+	size_t max = len + len / 8 + 1024, ret = 0;
+
+	if (!(*out = malloc(max)))
+		return 0;
+	switch (algo) {
+#ifdef HAVE_ZLIB
+	case CMPR_ZIP: /* fallthrough */
+	case CMPR_ZLIB: {
+		z_stream z = {0};
+		if (deflateInit2(&z, 6, Z_DEFLATED, (algo == CMPR_ZIP) ? -MAX_WBITS : MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			break;
+		z.next_in = (Bytef *)data;
+		z.avail_in = len;
+		z.next_out = *out;
+		z.avail_out = max;
+		if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+			ret = z.total_out;
+		deflateEnd(&z);
+		break;
+	}
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2: {
+		unsigned out_len = max;
+		if (BZ2_bzBuffToBuffCompress((char *)*out, &out_len, (char *)data, len, 9, 0, 0) == BZ_OK)
+			ret = out_len;
+		break;
+	}
+#endif
+	}
+
+	return ret;
+}
+
+/*
+ * decompressing `mib` MiB of half random, half repeated keyring data
+ * through `cdata_open()` windows, against zlib's one-shot `uncompress()`
+ * into a buffer holding the whole stream
+ */
+static int bench_inflate(size_t mib)
+{
+	static char const *const names[] = {[CMPR_ZIP] = "ZIP", [CMPR_ZLIB] = "ZLIB", [CMPR_BZ2] = "BZip2"};
+	/* a user id and the start of its self-signature's hashed area */
+	static u8 const text[] = "ayy lmao <ayy@lmao.plane>\x05\x02\x5a\x04\x3e\x9c\x02\x1b\x03\x05\x09\x03\xc2\x67\x00"
+		"\x05\x0b\x09\x08\x07\x02\x06\x15\x08\x09\x0a\x0b\x02";
+	size_t const len = mib << 20;
+	u8 *data = malloc(len), *buf = malloc(CDATA_WINDOW), *comp;
+	double start, elapsed;
+	long iters;
+	int ret = 0;
+
+	if (!data || !buf) {
+		free(data);
+		free(buf);
+		return 1;
+	}
+	/* random key material between runs of user ids and subpackets */
+	gcry_randomize(data, len, GCRY_WEAK_RANDOM);
+	for (size_t i = 256; i + 256 <= len; i += 512) {
+		for (size_t j = 0; j < 256; j += sizeof text - 1)
+			memcpy(data + i + j, text, (256 - j < sizeof text - 1) ? 256 - j : sizeof text - 1);
+	}
+
+	for (int algo = CMPR_ZIP; algo <= CMPR_BZ2; algo++) {
+		size_t comp_len, out;
+		if (!cdata_supported(algo))
+			continue;
+		if (!(comp_len = bench_compress(algo, data, len, &comp))) {
+			free(comp);
+			ret = 1;
+			continue;
+		}
+		for (iters = 0, start = now(); (elapsed = now() - start) < MIN_TIME; iters++) {
+			FILE *src = fmemopen(comp, comp_len, "rb"), *file;
+			if (!src || !(file = cdata_open(src, algo, comp_len))) {
+				ret = 1;
+				break;
+			}
+			for (out = 0;;) {
+				size_t got = fread(buf, 1, CDATA_WINDOW, file);
+				ret |= memcmp(buf, data + out, got) != 0;
+				out += got;
+				if (got < CDATA_WINDOW)
+					break;
+			}
+			fclose(file);
+			fclose(src);
+			ret |= out != len;
+		}
+		printf(" inflate %zu MiB %-5s (%.2fx), cdata_open() windows: %8.1f MiB/s\n", mib, names[algo],
+			(double)len / comp_len, iters * (double)mib / elapsed);
+#ifdef HAVE_ZLIB
+		if (algo == CMPR_ZLIB) {
+			u8 *whole = malloc(len);
+			uLongf whole_len;
+			for (iters = 0, start = now(); whole && (elapsed = now() - start) < MIN_TIME; iters++) {
+				whole_len = len;
+				ret |= uncompress(whole, &whole_len, comp, comp_len) != Z_OK || whole_len != len;
+			}
+			printf(" inflate %zu MiB %-5s (%.2fx), uncompress() whole:  %8.1f MiB/s\n", mib, names[algo],
+				(double)len / comp_len, iters * (double)mib / elapsed);
+			free(whole);
+		}
+#endif
+		free(comp);
+	}
+
+	free(buf);
+	free(data);
+	return ret;
+}
+
+/*
+ * decrypt an AES256 encrypted data packet of `mib` MiB in 8 KiB partial
+ * body lengths, as gpg writes them, through `seipd_open()` chunks with the
+ * MDC checked on the way, against decrypting and hashing the whole body
+ * at once
+ */
+static int bench_seipd(size_t mib)
+{
+	static u8 const partial = 13;
+	SESS_KEY sess = {.sym_algo = SYM_AES256, .len = 32};
+	size_t const len = mib << 20, block = s2k_block_len(SYM_AES256);
+	/* the version, prefix and MDC around the data, then a header before every chunk */
+	size_t const body_len = 1 + block + 2 + len + SEIPD_MDC_LEN, pkt_len = 2 * body_len + (body_len >> partial) + 8;
+	u8 *body = malloc(body_len), *pkt = malloc(pkt_len), *buf = malloc(SEIPD_CHUNK);
+	gcry_cipher_hd_t hd;
+	double start, elapsed;
+	long iters;
+	size_t pos = 0, rest;
+	int ret = 0;
+
+	if (!body || !pkt || !buf) {
+		free(body);
+		free(pkt);
+		free(buf);
+		return 1;
+	}
+	gcry_randomize(sess.key, sess.len, GCRY_WEAK_RANDOM);
+	gcry_randomize(body, body_len, GCRY_WEAK_RANDOM);
+	body[0] = 1;
+	memcpy(body + 1 + block, body + 1 + block - 2, 2);
+	body[body_len - SEIPD_MDC_LEN] = 0xd3;
+	body[body_len - SEIPD_MDC_LEN + 1] = 0x14;
+	gcry_md_hash_buffer(GCRY_MD_SHA1, body + body_len - SEIPD_MDC_LEN + 2, body + 1, body_len - SEIPD_MDC_LEN + 2 - 1);
+	if (gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CFB, 0) || gcry_cipher_setkey(hd, sess.key, sess.len)
+			|| gcry_cipher_encrypt(hd, body + 1, body_len - 1, NULL, 0))
+		ret = 1;
+	gcry_cipher_close(hd);
+	pkt[pos++] = 0xc0 | TAG_SEIPDATA;
+	for (rest = body_len; rest > (size_t)1 << partial; rest -= (size_t)1 << partial) {
+		pkt[pos++] = 0xe0 | partial;
+		memcpy(pkt + pos, body + (body_len - rest), (size_t)1 << partial);
+		pos += (size_t)1 << partial;
+	}
+	if (rest < 192) {
+		pkt[pos++] = rest;
+	} else {
+		pkt[pos++] = ((rest - 192) >> 8) + 192;
+		pkt[pos++] = (rest - 192) & 0xff;
+	}
+	memcpy(pkt + pos, body + (body_len - rest), rest);
+	pos += rest;
+
+	for (iters = 0, start = now(); !ret && (elapsed = now() - start) < MIN_TIME; iters++) {
+		FILE *src = fmemopen(pkt, pos, "rb"), *file;
+		size_t plen, out = 0, bad = 0;
+		bool part;
+		if (!src || getc(src) != (0xc0 | TAG_SEIPDATA) || !read_new_len(src, &plen, &part)
+				|| !(file = seipd_open(src, plen, part, &sess, &bad))) {
+			ret = 1;
+			break;
+		}
+		for (size_t got; (got = fread(buf, 1, SEIPD_CHUNK, file));)
+			out += got;
+		fclose(file);
+		fclose(src);
+		ret |= out != len || bad;
+	}
+	printf(" seipd %zu MiB AES256, seipd_open() chunks:  %8.1f MiB/s\n", mib, iters * (double)mib / elapsed);
+	/* the whole body held at once, with the plaintext after the packet */
+	for (iters = 0, start = now(); !ret && (elapsed = now() - start) < MIN_TIME; iters++) {
+		u8 *plain = pkt + pos, digest[20];
+		if (gcry_cipher_open(&hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CFB, 0) || gcry_cipher_setkey(hd, sess.key, sess.len)
+				|| gcry_cipher_decrypt(hd, plain, body_len - 1, body + 1, body_len - 1)) {
+			ret = 1;
+			break;
+		}
+		gcry_cipher_close(hd);
+		gcry_md_hash_buffer(GCRY_MD_SHA1, digest, plain, body_len - SEIPD_MDC_LEN + 2 - 1);
+		ret |= memcmp(digest, plain + body_len - 1 - (SEIPD_MDC_LEN - 2), sizeof digest) != 0;
+	}
+	printf(" seipd %zu MiB AES256, whole body decrypt:   %8.1f MiB/s\n", mib, iters * (double)mib / elapsed);
+
+	free(buf);
+	free(pkt);
+	free(body);
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	if (!gcry_check_version(GCRYPT_VERSION)) {
+		fputs("`libgcrypt` version mismatch\n", stderr);
+		return 1;
+	}
+	gcry_control(GCRYCTL_INIT_SECMEM, 0x80000, 0);
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	bench_small();
+	ret |= bench_modmul(2048);
+	ret |= bench_modinv(2048);
+	bench_pow();
+	ret |= bench_powmod(2048);
+	ret |= bench_powmod(3072);
+	ret |= bench_powmod(4096);
+	ret |= bench_lanes(1024, 1024);
+	ret |= bench_lanes(2048, 2048);
+	ret |= bench_lanes(2048, 0);
+	ret |= bench_lanes(4096, 0);
+	ret |= bench_rsa(2048);
+	ret |= bench_rsa(3072);
+	ret |= bench_rsa(4096);
+	ret |= bench_verify(50000);
+	ret |= bench_mul_sweep();
+	ret |= bench_batch_gcd(2048);
+	ret |= bench_weak_scan(100000);
+	ret |= bench_s2k(64);
+	ret |= bench_fingerprint(10000);
+	ret |= bench_uid(500000);
+	ret |= bench_inflate(64);
+	ret |= bench_seipd(256);
+
+	return ret;
+}
@@ -0,0 +1,92 @@
+/*
+ * t/testargon2.c:	unit-test for argon2.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/argon2.h"
+#include <gcrypt.h>
+
+/* BLAKE2b-512("abc") from RFC 7693 appendix A */
+static u8 const abc_digest[64] = {
+	0xba, 0x80, 0xa5, 0x3f, 0x98, 0x1c, 0x4d, 0x0d, 0x6a, 0x27, 0x97, 0xb6, 0x9f, 0x12, 0xf6, 0xe9,
+	0x4c, 0x21, 0x2f, 0x14, 0x68, 0x5a, 0xc4, 0xb7, 0x4b, 0x12, 0xbb, 0x6f, 0xdb, 0xff, 0xa2, 0xd1,
+	0x7d, 0x87, 0xc5, 0x39, 0x2a, 0xab, 0x79, 0x2d, 0xc2, 0x52, 0xd5, 0xde, 0x45, 0x33, 0xcc, 0x95,
+	0x18, 0xd3, 0x8a, 0xa8, 0xdb, 0xf1, 0x92, 0x5a, 0xb9, 0x23, 0x86, 0xed, 0xd4, 0x00, 0x99, 0x23,
+};
+
+static ARGON2_ARENA arena;
+
+/* libgcrypt's Argon2id */
+static void ref_argon2id(char const *restrict pass, u8 const *restrict salt, unsigned long passes,
+		unsigned long lanes, unsigned long mem_kib, u8 *restrict tag, unsigned long tag_len)
+{
+	unsigned long params[4] = {tag_len, passes, mem_kib, lanes};
+	gcry_kdf_hd_t hd;
+
+	gcry_kdf_open(&hd, GCRY_KDF_ARGON2, GCRY_KDF_ARGON2ID, params, 4,
+			pass, strlen(pass), salt, 16, NULL, 0, NULL, 0);
+	gcry_kdf_compute(hd, NULL);
+	gcry_kdf_final(hd, tag_len, tag);
+	gcry_kdf_close(hd);
+}
+
+/* `argon2id()` against libgcrypt over lanes, passes, memory and tag lengths; returns mismatches */
+static int test_params(size_t nthreads)
+{
+	/* passes, lanes, KiB and tag length, with memory that is not a whole number of segments */
+	static unsigned long const params[][4] = {
+		{1, 1, 8, 16}, {3, 4, 32, 32}, {2, 3, 100, 24}, {1, 4, 1024, 64}, {4, 2, 300, 4},
+	};
+	int bad = 0;
+
+	for (size_t i = 0; i < ARRLEN(params); i++) {
+		u8 salt[16], tag[ARGON2_MAX_TAG], ref[ARGON2_MAX_TAG];
+		gcry_randomize(salt, sizeof salt, GCRY_WEAK_RANDOM);
+		ref_argon2id("ayy lmao", salt, params[i][0], params[i][1], params[i][2], ref, params[i][3]);
+		bad += argon2id(&arena, "ayy lmao", 8, salt, sizeof salt, params[i][0], params[i][1], params[i][2],
+				tag, params[i][3], nthreads) != 0;
+		bad += memcmp(tag, ref, params[i][3]) != 0;
+	}
+	return bad;
+}
+
+int main(void)
+{
+	u8 digest[64] = {0}, ref[64], salt[16] = {0}, tag[32], msg[300];
+	ARGON2_BLOCK *blocks;
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(7);
+
+	/* tests */
+	argon2_blake2b(digest, 64, (u8 const *)"abc", 3);
+	ok(!memcmp(digest, abc_digest, sizeof digest), "test BLAKE2b-512");
+	/* a short digest, over more than one block */
+	gcry_randomize(msg, sizeof msg, GCRY_WEAK_RANDOM);
+	argon2_blake2b(digest, 20, msg, sizeof msg);
+	gcry_md_hash_buffer(GCRY_MD_BLAKE2B_160, ref, msg, sizeof msg);
+	ok(!memcmp(digest, ref, 20), "test short BLAKE2b against libgcrypt");
+	ok(test_params(1) == 0, "test argon2id against libgcrypt");
+	ok(test_params(4) == 0, "test argon2id lanes on threads");
+	/* the largest memory so far is kept for smaller derivations */
+	blocks = arena.blocks;
+	ok(argon2id(&arena, "", 0, salt, sizeof salt, 1, 1, 64, tag, sizeof tag, 0) == 0 && arena.blocks == blocks
+		&& arena.cnt == 1024, "test arena reuse");
+	ok(argon2id(&arena, "", 0, salt, 4, 1, 1, 64, tag, sizeof tag, 0) == -1
+		&& argon2id(&arena, "", 0, salt, sizeof salt, 1, 4, 16, tag, sizeof tag, 0) == -1
+		&& argon2id(&arena, "", 0, salt, sizeof salt, 0, 1, 64, tag, sizeof tag, 0) == -1, "test bad parameters");
+	argon2_arena_free(&arena);
+	ok(!arena.blocks && !arena.cnt, "test arena cleanup");
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,174 @@
+/*
+ * t/testbatchgcd.c:	unit-test for batchgcd.c
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/batchgcd.h"
+#include "../src/parse.h"
+#include <gcrypt.h>
+
+/* number of generated moduli */
+#define MODULI 24
+/* largest operand in words */
+#define MAX_WORDS 512
+
+static gcry_mpi_t mpi_from_bigint(BIGINT const *restrict x)
+{
+	u8 buf[MAX_WORDS * sizeof(DTYPE)];
+	gcry_mpi_t m;
+	for (size_t i = 0; i < x->len; i++) {
+		for (size_t j = 0; j < sizeof(DTYPE); j++)
+			buf[(x->len - 1 - i) * sizeof(DTYPE) + sizeof(DTYPE) - 1 - j] = x->w[i] >> (8 * j);
+	}
+	gcry_mpi_scan(&m, GCRYMPI_FMT_USG, buf, x->len * sizeof(DTYPE), NULL);
+	return m;
+}
+
+static void bigint_from_mpi(BIGINT *restrict x, gcry_mpi_t m)
+{
+	u8 buf[MAX_WORDS * sizeof(DTYPE)];
+	size_t len;
+	gcry_mpi_print(GCRYMPI_FMT_USG, buf, sizeof buf, &len, m);
+	bigint_from_bytes(x, buf, len);
+}
+
+static void bigint_random(BIGINT *restrict x, size_t words)
+{
+	u8 buf[MAX_WORDS * sizeof(DTYPE)];
+	gcry_randomize(buf, words * sizeof(DTYPE), GCRY_WEAK_RANDOM);
+	/* keep the top word set so operands have exactly `words` words */
+	buf[0] |= 0x80;
+	bigint_from_bytes(x, buf, words * sizeof(DTYPE));
+}
+
+/* products and remainders against libgcrypt across the Karatsuba and Newton thresholds; returns mismatches */
+static int test_arith(void)
+{
+	int bad = 0;
+	for (size_t n = 1; n <= 4 * KARATSUBA_THRESHOLD; n += 5) {
+		BIGINT a = {0}, b = {0}, m = {0}, c = {0}, v = {0}, r = {0};
+		gcry_mpi_t ma, mb, mm, mc, mr;
+		bigint_random(&a, n);
+		bigint_random(&b, n / 3 + 1);
+		bigint_random(&m, n / 2 + 1);
+		/* a small top word is the worst case for the reciprocal estimate */
+		if (n & 1)
+			m.w[m.len - 1] = 1;
+		ma = mpi_from_bigint(&a), mb = mpi_from_bigint(&b), mm = mpi_from_bigint(&m);
+		mc = gcry_mpi_new(0), mr = gcry_mpi_new(0);
+		/* lopsided and square products */
+		bigint_mul(&c, &a, &b);
+		gcry_mpi_mul(mc, ma, mb);
+		bigint_from_mpi(&r, mc);
+		bad += bigint_cmp(&c, &r) != EQUAL;
+		bigint_mul(&c, &a, &a);
+		gcry_mpi_mul(mc, ma, ma);
+		bigint_from_mpi(&r, mc);
+		bad += bigint_cmp(&c, &r) != EQUAL;
+		/* a^2 is longer than twice m, which needs the folding path */
+		bigint_recip(&v, &m);
+		bigint_mod(&c, &c, &m, &v);
+		gcry_mpi_mod(mr, mc, mm);
+		bigint_from_mpi(&r, mr);
+		bad += bigint_cmp(&c, &r) != EQUAL;
+		bigint_free(&a), bigint_free(&b), bigint_free(&m);
+		bigint_free(&c), bigint_free(&v), bigint_free(&r);
+		gcry_mpi_release(ma), gcry_mpi_release(mb), gcry_mpi_release(mm);
+		gcry_mpi_release(mc), gcry_mpi_release(mr);
+	}
+	return bad;
+}
+
+/* Toom-3 and NTT products against schoolbook, all-ones operands for the longest carries; returns mismatches */
+static int test_mul_algos(void)
+{
+	int bad = 0;
+	for (size_t na = 3; na <= 2 * MAX_WORDS; na = na * 3 / 2) {
+		for (size_t nb = na / 2 + 1; nb <= na; nb += na / 4 + 1) {
+			DTYPE a[2 * MAX_WORDS], b[2 * MAX_WORDS], c[4 * MAX_WORDS], d[4 * MAX_WORDS];
+			for (int ones = 0; ones < 2; ones++) {
+				gcry_randomize(a, sizeof *a * na, GCRY_WEAK_RANDOM);
+				gcry_randomize(b, sizeof *b * nb, GCRY_WEAK_RANDOM);
+				if (ones) {
+					memset(a, 0xff, sizeof *a * na);
+					memset(b, 0xff, sizeof *b * nb);
+				}
+				_mul_words(c, a, na, b, nb);
+				_bigint_mul_toom3(d, a, na, b, nb);
+				bad += !!memcmp(c, d, sizeof *c * (na + nb));
+				ntt_mul_words(d, a, na, b, nb);
+				bad += !!memcmp(c, d, sizeof *c * (na + nb));
+				_mul_words(c, a, na, a, na);
+				ntt_mul_words(d, a, na, a, na);
+				bad += !!memcmp(c, d, sizeof *c * 2 * na);
+			}
+		}
+	}
+	return bad;
+}
+
+/* 512-bit moduli where every third one reuses the prime of the one before; returns mismatches */
+static int test_shared(size_t batch, size_t nthreads)
+{
+	int bad = 0;
+	BIGINT moduli[MODULI] = {0}, gcds[MODULI] = {0};
+	gcry_mpi_t primes[2 * MODULI], n = gcry_mpi_new(0);
+
+	for (size_t i = 0; i < 2 * MODULI; i++)
+		gcry_prime_generate(&primes[i], 256, 0, NULL, NULL, NULL, GCRY_WEAK_RANDOM, 0);
+	for (size_t i = 0; i < MODULI; i++) {
+		/* moduli 1, 4, 7, ... share their first prime with 0, 3, 6, ... */
+		gcry_mpi_mul(n, primes[(i % 3 == 1) ? 2 * i - 2 : 2 * i], primes[2 * i + 1]);
+		bigint_from_mpi(&moduli[i], n);
+	}
+	batch_gcd(moduli, MODULI, gcds, batch, nthreads);
+	for (size_t i = 0; i < MODULI; i++) {
+		size_t bits = bigint_bits(&gcds[i]);
+		bool weak = i % 3 != 2;
+		bad += weak ? (bits < 250 || bits > 256) : (gcds[i].len != 1 || gcds[i].w[0] != 1);
+		bigint_free(&moduli[i]), bigint_free(&gcds[i]);
+	}
+	for (size_t i = 0; i < 2 * MODULI; i++)
+		gcry_mpi_release(primes[i]);
+	gcry_mpi_release(n);
+	return bad;
+}
+
+int main(void)
+{
+	PGP_LIST pkts = {0}, prot = {0};
+	int results[5] = {0}, prot_results[5] = {0};
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(11);
+
+	/* tests */
+	ok(test_arith() == 0, "test bigint arithmetic against libgcrypt");
+	ok(test_mul_algos() == 0, "test toom-3 and ntt products against schoolbook");
+	ok(test_shared(0, 1) == 0, "test shared primes in one tree");
+	ok(test_shared(5, 2) == 0, "test shared primes across batches");
+	ok(test_shared(7, 1) == 0, "test shared primes across uneven batches");
+	ok(test_shared(1, 1) == 0, "test shared primes across single modulus batches");
+	ok(read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) == 5, "test binary parsing");
+	parse_pgp_packets(&pkts);
+	ok(batch_gcd_list(&pkts, results, 0, 0) == 0 && results[0] == 0 && results[3] == 0
+		&& results[1] == -1 && results[2] == -1 && results[4] == -1, "test keyring moduli");
+	/* the public parts of protected keys are enough */
+	ok(read_pgp_bin(NULL, "./t/4yyylmao.gpg", &prot) == 5, "test protected key parsing");
+	parse_pgp_packets(&prot);
+	ok(batch_gcd_list(&prot, prot_results, 0, 0) == 0 && prot_results[0] == 0 && prot_results[3] == 0,
+		"test protected keyring moduli");
+	lives_ok({free_pgp_list(&pkts); free_pgp_list(&prot);}, "test successful packet list cleanup");
+
+	/* return handled */
+	done_testing();
+}
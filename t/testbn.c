@@ -0,0 +1,311 @@
+/*
+ * t/testbn.c:	unit-test for bn.h
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/bn.h"
+#include <gcrypt.h>
+#include <string.h>
+
+/* number of random operand pairs per differential test */
+#define ROUNDS 500
+
+/* fill the low `nwords` words of `n` with random (and often extreme) words */
+static void random_bn(struct bn *restrict n, int nwords)
+{
+	unsigned char pick[BN_ARRAY_SIZE];
+	bignum_init(n);
+	gcry_randomize(n->array, sizeof *n->array * nwords, GCRY_WEAK_RANDOM);
+	gcry_randomize(pick, sizeof pick, GCRY_WEAK_RANDOM);
+	/* all-ones and zero words stress the quotient estimate corrections */
+	for (int i = 0; i < nwords; i++) {
+		if (pick[i] < 0x20)
+			n->array[i] = (DTYPE)MAX_VAL;
+		else if (pick[i] < 0x30)
+			n->array[i] = 0;
+	}
+	bignum_normalize(n);
+}
+
+/* convert to a libgcrypt mpi through its big-endian byte representation */
+static gcry_mpi_t bn_to_mpi(struct bn *restrict n)
+{
+	gcry_mpi_t ret;
+	unsigned char buf[BN_BYTES];
+	bignum_to_bytes(n, buf, sizeof buf);
+	gcry_mpi_scan(&ret, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+	return ret;
+}
+
+/* compare against a libgcrypt mpi */
+static int bn_eq_mpi(struct bn *restrict n, gcry_mpi_t m)
+{
+	gcry_mpi_t tmp = bn_to_mpi(n);
+	int ret = !gcry_mpi_cmp(tmp, m);
+	gcry_mpi_release(tmp);
+	return ret;
+}
+
+/* random values through libgcrypt's byte and hex formats; returns number of mismatches */
+static int test_convert(void)
+{
+	int bad = 0;
+	unsigned char len[1], buf[BN_BYTES + 1];
+	char hex[2 * BN_BYTES + 1];
+	for (int i = 0; i < ROUNDS; i++) {
+		struct bn a, b;
+		size_t nbytes;
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		random_bn(&a, 1 + len[0] % BN_ARRAY_SIZE);
+		gcry_mpi_t ma = bn_to_mpi(&a);
+		gcry_mpi_print(GCRYMPI_FMT_USG, buf, sizeof buf, &nbytes, ma);
+		bad += (int)nbytes != bignum_num_bytes(&a);
+		bignum_from_bytes(&b, buf, nbytes);
+		bad += bignum_cmp(&a, &b) != EQUAL;
+		/* odd digit counts leave a partial top word */
+		bignum_to_string(&a, hex, sizeof hex);
+		bignum_from_string(&b, hex, (int)strlen(hex));
+		bad += bignum_cmp(&a, &b) != EQUAL;
+		gcry_mpi_release(ma);
+	}
+	return bad;
+}
+
+/* random shifts in both directions, in place and not; returns number of mismatches */
+static int test_shift(void)
+{
+	int bad = 0;
+	unsigned char len[2];
+	for (int i = 0; i < ROUNDS; i++) {
+		struct bn a, b, c;
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		random_bn(&a, 1 + len[0] % BN_ARRAY_SIZE);
+		int nbits = len[1] % (BN_BYTES * 8 / 2);
+		bignum_assign(&c, &a);
+		gcry_mpi_t ma = bn_to_mpi(&a), mb = gcry_mpi_new(0);
+		/* the fixed width truncates left shifts */
+		gcry_mpi_t mtop = gcry_mpi_set_ui(NULL, 0);
+		gcry_mpi_set_bit(mtop, BN_BYTES * 8);
+		gcry_mpi_lshift(mb, ma, nbits);
+		gcry_mpi_mod(mb, mb, mtop);
+		bignum_lshift(&a, &b, nbits);
+		bad += !bn_eq_mpi(&b, mb) || bignum_cmp(&a, &c) != EQUAL;
+		bignum_lshift(&c, &c, nbits);
+		bad += bignum_cmp(&b, &c) != EQUAL;
+		gcry_mpi_rshift(mb, ma, nbits);
+		bignum_rshift(&a, &b, nbits);
+		bad += !bn_eq_mpi(&b, mb);
+		bignum_assign(&c, &a);
+		bignum_rshift(&c, &c, nbits);
+		bad += bignum_cmp(&b, &c) != EQUAL;
+		gcry_mpi_release(ma), gcry_mpi_release(mb), gcry_mpi_release(mtop);
+	}
+	return bad;
+}
+
+/* random a / b, with `b` at most `max_b` words; returns number of mismatches */
+static int test_divmod(int max_b)
+{
+	int bad = 0;
+	unsigned char len[2];
+	for (int i = 0; i < ROUNDS; i++) {
+		struct bn a, b, q, r;
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		int na = 1 + len[0] % BN_ARRAY_SIZE;
+		int nb = 1 + len[1] % (max_b < na ? max_b : na);
+		random_bn(&a, na);
+		do {
+			random_bn(&b, nb);
+		} while (bignum_is_zero(&b));
+		gcry_mpi_t ma = bn_to_mpi(&a), mb = bn_to_mpi(&b);
+		gcry_mpi_t mq = gcry_mpi_new(0), mr = gcry_mpi_new(0);
+		gcry_mpi_div(mq, mr, ma, mb, 0);
+		bignum_divmod(&a, &b, &q, &r);
+		bad += !bn_eq_mpi(&q, mq) || !bn_eq_mpi(&r, mr);
+		/* the single-result wrappers must agree with bignum_divmod() */
+		bignum_div(&a, &b, &q);
+		bignum_mod(&a, &b, &r);
+		bad += !bn_eq_mpi(&q, mq) || !bn_eq_mpi(&r, mr);
+		gcry_mpi_release(ma), gcry_mpi_release(mb);
+		gcry_mpi_release(mq), gcry_mpi_release(mr);
+	}
+	return bad;
+}
+
+/* random a^e mod n for odd `n`; returns number of mismatches */
+static int test_powmod(int sec)
+{
+	int bad = 0;
+	unsigned char len[3];
+	for (int i = 0; i < ROUNDS / 10; i++) {
+		struct bn a, e, n, c;
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		random_bn(&a, 1 + len[0] % BN_ARRAY_SIZE);
+		random_bn(&e, 1 + len[1] % BN_ARRAY_SIZE);
+		random_bn(&n, 1 + len[2] % BN_ARRAY_SIZE);
+		n.array[0] |= 1;
+		bignum_normalize(&n);
+		gcry_mpi_t ma = bn_to_mpi(&a), me = bn_to_mpi(&e), mn = bn_to_mpi(&n);
+		gcry_mpi_t mc = gcry_mpi_new(0);
+		gcry_mpi_powm(mc, ma, me, mn);
+		if (sec)
+			bignum_powmod_sec(&a, &e, &n, &c);
+		else
+			bignum_powmod(&a, &e, &n, &c);
+		bad += !bn_eq_mpi(&c, mc);
+		gcry_mpi_release(ma), gcry_mpi_release(me);
+		gcry_mpi_release(mn), gcry_mpi_release(mc);
+	}
+	return bad;
+}
+
+/* random gcd, lcm and inverses modulo odd or even `m`; returns number of mismatches */
+static int test_modinv(int even)
+{
+	int bad = 0;
+	unsigned char len[2];
+	for (int i = 0; i < ROUNDS / 5; i++) {
+		struct bn a, m, c, g, l;
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		random_bn(&a, 1 + len[0] % BN_ARRAY_SIZE);
+		do {
+			random_bn(&m, 1 + len[1] % BN_ARRAY_SIZE);
+			m.array[0] = even ? m.array[0] & ~(DTYPE)1 : m.array[0] | 1;
+			bignum_normalize(&m);
+		/* libgcrypt reports no inverses modulo one, where every number is its own */
+		} while (bignum_is_zero(&m) || (m.top == 1 && m.array[0] == 1));
+		/* even moduli only have inverses of odd numbers */
+		if (even) {
+			a.array[0] |= 1;
+			bignum_normalize(&a);
+		}
+		gcry_mpi_t ma = bn_to_mpi(&a), mm = bn_to_mpi(&m);
+		gcry_mpi_t mc = gcry_mpi_new(0), mg = gcry_mpi_new(0);
+		int has_inv = gcry_mpi_invm(mc, ma, mm);
+		bad += (bignum_modinv(&a, &m, &c) == 0) != has_inv;
+		bad += has_inv && !bn_eq_mpi(&c, mc);
+		gcry_mpi_gcd(mg, ma, mm);
+		bignum_gcd(&a, &m, &g);
+		bad += !bn_eq_mpi(&g, mg);
+		/* lcm(a, m) * gcd(a, m) = a * m when that fits */
+		if (a.top + m.top <= BN_ARRAY_SIZE) {
+			bignum_lcm(&a, &m, &l);
+			bignum_mul(&l, &g, &l);
+			bignum_mul(&a, &m, &c);
+			bad += bignum_cmp(&l, &c) != EQUAL;
+		}
+		gcry_mpi_release(ma), gcry_mpi_release(mm);
+		gcry_mpi_release(mc), gcry_mpi_release(mg);
+	}
+	return bad;
+}
+
+int main(void)
+{
+	struct bn a, b, c, d;
+	struct bn_mont mont;
+	unsigned char buf[64];
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(28);
+
+	/* tests */
+	ok(test_convert() == 0, "test byte and hex round trips against libgcrypt");
+	bignum_from_string(&a, "1fffffffff", 10);
+	bignum_to_string(&a, (char *)buf, sizeof buf);
+	ok(!strcmp((char *)buf, "1fffffffff"), "test odd-length hex string");
+	bignum_from_bytes(&a, (unsigned char []){0x00, 0x01, 0x02, 0x03, 0x04, 0x05}, 6);
+	ok(bignum_num_bytes(&a) == 5 && bignum_to_bytes(&a, buf, 5) == 0
+		&& !memcmp(buf, "\x01\x02\x03\x04\x05", 5), "test leading zero mpi byte");
+	ok(bignum_to_bytes(&a, buf, 3) != 0 && !memcmp(buf, "\x03\x04\x05", 3), "test truncated byte export");
+	bignum_init(&a);
+	bignum_to_string(&a, (char *)buf, sizeof buf);
+	ok(buf[0] == 0, "test zero is the empty string");
+	bignum_from_int(&a, 27);
+	bignum_from_int(&b, 7);
+	bignum_divmod(&a, &b, &c, &d);
+	ok(bignum_to_int(&c) == 3 && bignum_to_int(&d) == 6, "test small quotient and remainder");
+	bignum_divmod(&b, &a, &c, &d);
+	ok(bignum_is_zero(&c) && bignum_cmp(&d, &b) == EQUAL, "test divisor larger than dividend");
+	bignum_divmod(&a, &b, &a, &b);
+	ok(bignum_to_int(&a) == 3 && bignum_to_int(&b) == 6, "test results aliasing operands");
+	ok(test_shift() == 0, "test shifts against libgcrypt");
+	bignum_from_int(&a, 1);
+	bignum_lshift(&a, &b, BN_BYTES * 8 - 1);
+	bignum_sub(&b, &b, &c);
+	ok(bignum_is_zero(&c) && bignum_cmp(&c, &a) == SMALLER, "test difference normalized to zero");
+	bignum_sub(&c, &a, &c);
+	bignum_inc(&c);
+	ok(bignum_is_zero(&c), "test full-width wrap around");
+	bignum_dec(&c);
+	bignum_inc(&c);
+	ok(bignum_is_zero(&c) && bignum_cmp(&a, &b) == SMALLER, "test decrement of zero wraps");
+	ok(test_divmod(1) == 0, "test single-word divisors against libgcrypt");
+	ok(test_divmod(BN_ARRAY_SIZE) == 0, "test multi-word divisors against libgcrypt");
+	bignum_from_int(&a, 123);
+	bignum_from_int(&b, 17);
+	bignum_from_int(&c, 3233);
+	bignum_powmod(&a, &b, &c, &d);
+	ok(bignum_to_int(&d) == 855, "test textbook rsa encryption");
+	bignum_from_int(&b, 0);
+	bignum_powmod_sec(&a, &b, &c, &d);
+	ok(bignum_to_int(&d) == 1, "test zero exponent");
+	random_bn(&a, BN_ARRAY_SIZE);
+	random_bn(&c, BN_ARRAY_SIZE);
+	c.array[0] |= 1;
+	bignum_normalize(&c);
+	bignum_mont_init(&mont, &c);
+	bignum_mod(&a, &c, &b);
+	bignum_mont_to(&mont, &a, &d);
+	bignum_mont_from(&mont, &d, &d);
+	ok(bignum_cmp(&b, &d) == EQUAL, "test montgomery form round trip");
+	ok(test_powmod(0) == 0, "test sliding-window powmod against libgcrypt");
+	ok(test_powmod(1) == 0, "test constant-time powmod against libgcrypt");
+	ok(test_modinv(0) == 0, "test gcd and inverse modulo odd numbers against libgcrypt");
+	ok(test_modinv(1) == 0, "test gcd and inverse modulo even numbers against libgcrypt");
+	/* 17^-1 mod lcm(p - 1, q - 1) of the textbook key p = 61, q = 53 */
+	bignum_from_int(&a, 60);
+	bignum_from_int(&b, 52);
+	bignum_lcm(&a, &b, &c);
+	bignum_from_int(&a, 17);
+	ok(bignum_to_int(&c) == 780 && bignum_modinv(&a, &c, &d) == 0
+		&& bignum_to_int(&d) == 413, "test textbook rsa private exponent");
+	bignum_from_int(&a, 6);
+	bignum_from_int(&b, 9);
+	ok(bignum_modinv(&a, &b, &a) != 0 && bignum_is_zero(&a), "test missing inverse");
+	bignum_from_int(&a, 2);
+	bignum_from_int(&b, 1000);
+	bignum_pow(&a, &b, &c);
+	gcry_mpi_t mc = gcry_mpi_set_ui(NULL, 0);
+	gcry_mpi_set_bit(mc, 1000);
+	ok(bn_eq_mpi(&c, mc), "test 2^1000 against libgcrypt");
+	gcry_mpi_release(mc);
+	ok(bignum_to_int(&b) == 1000, "test exponent left untouched");
+	bignum_from_int(&b, BN_ARRAY_SIZE * WORD_SIZE * 8 - 1);
+	ok(!bignum_pow_checked(&a, &b, &c) && c.array[BN_ARRAY_SIZE - 1] == (DTYPE)DTYPE_MSB, "test largest power of two fits");
+	bignum_inc(&b);
+	ok(bignum_pow_checked(&a, &b, &c) && bignum_is_zero(&c), "test truncation is reported");
+	bignum_from_int(&a, 3);
+	bignum_from_int(&b, 700);
+	int ovf = bignum_pow_checked(&a, &b, &c);
+	mc = gcry_mpi_new(0);
+	gcry_mpi_t ma = gcry_mpi_set_ui(NULL, 3), mb = gcry_mpi_set_ui(NULL, 700);
+	gcry_mpi_t mm = gcry_mpi_set_ui(NULL, 0);
+	gcry_mpi_set_bit(mm, BN_ARRAY_SIZE * WORD_SIZE * 8);
+	gcry_mpi_powm(mc, ma, mb, mm);
+	ok(ovf && bn_eq_mpi(&c, mc), "test truncated result is a^b mod 2^width");
+	gcry_mpi_release(ma), gcry_mpi_release(mb);
+	gcry_mpi_release(mm), gcry_mpi_release(mc);
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,215 @@
+/*
+ * t/testcdata.c:	unit-test for cdata.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/cdata.h"
+#include "../src/packet.h"
+#include "../src/parse.h"
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_BZ2
+# include <bzlib.h>
+#endif
+
+/* a compressed packet is at most this long here */
+#define WRAP_MAX	(64 * 1024)
+
+/* the contents of a keyring file into `buf`; returns its length */
+static size_t slurp(char const *restrict filename, u8 *restrict buf)
+{
+	FILE *file = fopen(filename, "rb");
+	size_t len;
+
+	if (!file)
+		return 0;
+	len = fread(buf, 1, WRAP_MAX / 2, file);
+	fclose(file);
+	return len;
+}
+
+/* compress `len` octets of `data` with `algo` into `out`; returns the compressed length, or 0 */
+static size_t compress_buf(int algo, u8 const *restrict data, size_t len, u8 *restrict out, size_t max)
+{
+	switch (algo) {
+	case CMPR_RAW:
+		if (len > max)
+			return 0;
+		memcpy(out, data, len);
+		return len;
+#ifdef HAVE_ZLIB
+	case CMPR_ZIP: /* fallthrough */
+	case CMPR_ZLIB: {
+		z_stream z = {0};
+		size_t ret;
+		if (deflateInit2(&z, 9, Z_DEFLATED, (algo == CMPR_ZIP) ? -MAX_WBITS : MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return 0;
+		z.next_in = (Bytef *)data;
+		z.avail_in = len;
+		z.next_out = out;
+		z.avail_out = max;
+		ret = (deflate(&z, Z_FINISH) == Z_STREAM_END) ? z.total_out : 0;
+		deflateEnd(&z);
+		return ret;
+	}
+#endif
+#ifdef HAVE_BZ2
+	case CMPR_BZ2: {
+		unsigned out_len = max;
+		if (BZ2_bzBuffToBuffCompress((char *)out, &out_len, (char *)data, len, 9, 0, 0) != BZ_OK)
+			return 0;
+		return out_len;
+	}
+#endif
+	}
+
+	return 0;
+}
+
+/*
+ * wrap `len` octets of `data` in a compressed packet with a `hdr_len`
+ * octet length, or an indeterminate one if it is 0; returns the packet length
+ */
+static size_t wrap(int algo, size_t hdr_len, u8 const *restrict data, size_t len, u8 *restrict out)
+{
+	static u8 const len_types[5] = {LEN_OTHER, LEN_ONE, LEN_TWO, 0, LEN_FOUR};
+	size_t body = compress_buf(algo, data, len, out + 2 + hdr_len, WRAP_MAX - 2 - hdr_len);
+
+	if (!body && len)
+		return 0;
+	out[0] = 0x80 | TAG_CDATA << 2 | len_types[hdr_len];
+	for (size_t i = 0; i < hdr_len; i++)
+		out[1 + i] = (body + 1) >> 8 * (hdr_len - 1 - i);
+	out[1 + hdr_len] = algo;
+	return 2 + hdr_len + body;
+}
+
+/* read `len` octets of `data` as a keyring; returns the packets read */
+static size_t read_buf(u8 *restrict data, size_t len, PGP_LIST *restrict pkts)
+{
+	FILE *file = fmemopen(data, len, "rb");
+
+	free_pgp_list(pkts);
+	init_pgp_list(pkts);
+	if (!file)
+		return 0;
+	return read_pgp_bin(file, NULL, pkts);
+}
+
+/* whether the packets of `pkts` from `start` are the ones of `ref` */
+static bool same_packets(PGP_LIST const *restrict pkts, size_t start, PGP_LIST const *restrict ref)
+{
+	if (pkts->cnt < start + ref->cnt)
+		return false;
+	for (size_t i = 0; i < ref->cnt; i++) {
+		PGP_PACKET const *a = &pkts->list[start + i], *b = &ref->list[i];
+		if (a->pheader != b->pheader || packet_len(a) != packet_len(b) || memcmp(a->pdata, b->pdata, packet_len(b))
+				|| a->fpr_len != b->fpr_len || memcmp(a->fpr, b->fpr, sizeof a->fpr))
+			return false;
+	}
+	return true;
+}
+
+/* `key` in a packet of `algo`, then `tail` as is; returns failures */
+static int test_algo(int algo, size_t hdr_len, u8 const *restrict key, size_t key_len,
+	u8 const *restrict tail, size_t tail_len, PGP_LIST const *restrict ref, PGP_LIST const *restrict ref_tail)
+{
+	static u8 buf[WRAP_MAX * 2];
+	PGP_LIST pkts = {0};
+	size_t len;
+	int bad = 0;
+
+	if (!(len = wrap(algo, hdr_len, key, key_len, buf)))
+		return 1;
+	/* an indeterminate length runs to the end, so nothing can follow */
+	if (hdr_len) {
+		memcpy(buf + len, tail, tail_len);
+		len += tail_len;
+	}
+	bad += read_buf(buf, len, &pkts) != ref->cnt + (hdr_len ? ref_tail->cnt : 0);
+	bad += !same_packets(&pkts, 0, ref) || (hdr_len && !same_packets(&pkts, ref->cnt, ref_tail));
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/* compressed packets `depth` deep around `key`; returns the packets read */
+static size_t test_nested(int algo, size_t depth, u8 const *restrict key, size_t key_len, PGP_LIST const *restrict ref)
+{
+	static u8 bufs[2][WRAP_MAX];
+	PGP_LIST pkts = {0};
+	size_t len = key_len, ret;
+
+	memcpy(bufs[0], key, len);
+	for (size_t i = 0; i < depth; i++) {
+		if (!(len = wrap((i % 2) ? CMPR_RAW : algo, 4, bufs[i % 2], len, bufs[(i + 1) % 2])))
+			return SIZE_MAX;
+	}
+	ret = read_buf(bufs[depth % 2], len, &pkts);
+	if (ret && !same_packets(&pkts, 0, ref))
+		ret = SIZE_MAX;
+	free_pgp_list(&pkts);
+	return ret;
+}
+
+int main(void)
+{
+	static u8 key[WRAP_MAX / 2], tail[WRAP_MAX / 2], buf[WRAP_MAX * 2];
+	PGP_LIST ref = {0}, ref_tail = {0}, pkts = {0};
+	size_t key_len, tail_len, len;
+
+	key_len = slurp("./t/nopasswd.gpg", key);
+	tail_len = slurp("./t/4yyylmao.gpg", tail);
+	read_pgp_bin(NULL, "./t/nopasswd.gpg", &ref);
+	read_pgp_bin(NULL, "./t/4yyylmao.gpg", &ref_tail);
+
+	/* start test block */
+	plan(10);
+
+	/* tests */
+	ok(key_len && tail_len && ref.cnt == 5 && ref_tail.cnt == 5, "test reading the keyrings");
+	ok(test_algo(CMPR_RAW, 2, key, key_len, tail, tail_len, &ref, &ref_tail) == 0
+		&& test_algo(CMPR_RAW, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0, "test uncompressed packets");
+	skip(!cdata_supported(CMPR_ZIP), 2, "built without zlib");
+	ok(test_algo(CMPR_ZIP, 2, key, key_len, tail, tail_len, &ref, &ref_tail) == 0
+		&& test_algo(CMPR_ZIP, 4, key, key_len, tail, tail_len, &ref, &ref_tail) == 0, "test ZIP packets");
+	ok(test_algo(CMPR_ZLIB, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0
+		&& test_algo(CMPR_ZLIB, 2, key, key_len, tail, tail_len, &ref, &ref_tail) == 0, "test ZLIB packets");
+	end_skip;
+	skip(!cdata_supported(CMPR_BZ2), 1, "built without bzip2");
+	ok(test_algo(CMPR_BZ2, 4, key, key_len, tail, tail_len, &ref, &ref_tail) == 0
+		&& test_algo(CMPR_BZ2, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0, "test BZip2 packets");
+	end_skip;
+	ok(test_nested(cdata_supported(CMPR_ZLIB) ? CMPR_ZLIB : CMPR_RAW, CDATA_MAX_DEPTH, key, key_len, &ref) == 5,
+		"test nested compressed packets");
+	ok(test_nested(CMPR_RAW, CDATA_MAX_DEPTH + 1, key, key_len, &ref) == 0, "test compressed packets nested too deep");
+	/* an unknown algorithm is skipped over */
+	len = wrap(CMPR_RAW, 2, key, key_len, buf);
+	buf[3] = CMPR_PRIV0;
+	memcpy(buf + len, tail, tail_len);
+	ok(read_buf(buf, len + tail_len, &pkts) == 5 && same_packets(&pkts, 0, &ref_tail), "test unknown compression algorithms");
+	skip(!cdata_supported(CMPR_ZLIB), 2, "built without zlib");
+	/* the compressed stream is cut short by its packet length, then corrupted */
+	len = wrap(CMPR_ZLIB, 2, key, key_len, buf);
+	buf[1] = (len - 3 - 16) >> 8, buf[2] = (len - 3 - 16) & 0xff;
+	memmove(buf + len - 16, tail, tail_len);
+	ok(read_buf(buf, len - 16 + tail_len, &pkts) < 10 && pkts.cnt >= 5 && same_packets(&pkts, pkts.cnt - 5, &ref_tail),
+		"test truncated compressed packets");
+	/* the first deflate block after the ZLIB header gets the reserved type */
+	len = wrap(CMPR_ZLIB, 0, key, key_len, buf);
+	buf[4] |= 0x06;
+	ok(read_buf(buf, len, &pkts) == 0, "test corrupt compressed packets");
+	end_skip;
+
+	free_pgp_list(&pkts);
+	free_pgp_list(&ref);
+	free_pgp_list(&ref_tail);
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,198 @@
+/*
+ * t/testkernels.c:	unit-test for the fixed-width kernels in bn.h
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+/* wide enough for every kernel width */
+#define BN_BYTES 512
+
+#include "tap.h"
+#include "../src/bn.h"
+#include <gcrypt.h>
+#include <string.h>
+
+/* number of random operands per kernel */
+#define ROUNDS 50
+
+/* fill `n` words with random (and often extreme) words */
+static void random_words(DTYPE *restrict w, int n)
+{
+	unsigned char pick[BN_ARRAY_SIZE];
+	gcry_randomize(w, sizeof *w * n, GCRY_WEAK_RANDOM);
+	gcry_randomize(pick, sizeof pick, GCRY_WEAK_RANDOM);
+	for (int i = 0; i < n; i++) {
+		if (pick[i] < 0x20)
+			w[i] = (DTYPE)MAX_VAL;
+		else if (pick[i] < 0x30)
+			w[i] = 0;
+	}
+}
+
+/* one kernel against the generic word routines; returns number of mismatches */
+static int test_kernel(const struct bn_kernel *restrict k)
+{
+	int bad = 0, n = k->nwords;
+	for (int i = 0; i < ROUNDS; i++) {
+		DTYPE a[BN_ARRAY_SIZE], b[BN_ARRAY_SIZE], m[BN_ARRAY_SIZE];
+		DTYPE c[2 * BN_ARRAY_SIZE], d[2 * BN_ARRAY_SIZE];
+		DTYPE carry;
+		random_words(a, n);
+		random_words(b, n);
+		random_words(m, n);
+		m[0] |= 1;
+		m[n - 1] |= (DTYPE)DTYPE_MSB;
+
+		/* add and sub undo each other, carry for borrow */
+		carry = k->add(c, a, b);
+		bad += k->sub(d, c, b) != carry || memcmp(d, a, sizeof *a * n);
+		k->mul(c, a, b);
+		_mul_words(d, a, n, b, n);
+		bad += !!memcmp(c, d, sizeof *c * 2 * n);
+		k->sqr(c, a);
+		_mul_words(d, a, n, a, n);
+		bad += !!memcmp(c, d, sizeof *c * 2 * n);
+
+		/* operands below the modulus for the montgomery product */
+		a[n - 1] &= (DTYPE)(m[n - 1] >> 1);
+		b[n - 1] &= (DTYPE)(m[n - 1] >> 1);
+		DTYPE ninv = _mont_ninv(m[0]);
+		k->mul(c, a, b);
+		k->redc(c, c, m, ninv);
+		_mont_mul_words(d, a, b, m, ninv, n);
+		bad += !!memcmp(c, d, sizeof *c * n);
+	}
+	return bad;
+}
+
+/* multiply-accumulate rows with and without mulx/adx; returns number of mismatches */
+static int test_rows(void)
+{
+	int bad = 0;
+	unsigned char len[1];
+	for (int i = 0; i < ROUNDS * 10; i++) {
+		DTYPE a[BN_ARRAY_SIZE], b[1], r[BN_ARRAY_SIZE], s[BN_ARRAY_SIZE];
+		gcry_randomize(len, sizeof len, GCRY_WEAK_RANDOM);
+		int n = len[0] % (BN_ARRAY_SIZE + 1);
+		random_words(a, n);
+		random_words(b, 1);
+		random_words(r, n);
+		memcpy(s, r, sizeof *r * n);
+		bignum_use_asm(0);
+		DTYPE carry = _muladd_words(r, a, n, b[0]);
+		bignum_use_asm(1);
+		bad += _muladd_words(s, a, n, b[0]) != carry || memcmp(r, s, sizeof *r * n);
+	}
+	return bad;
+}
+
+/* bignum_mont_powmod() for a `bits`-bit modulus against libgcrypt */
+static int test_powmod(int bits)
+{
+	int bad = 0, n = bits / (8 * WORD_SIZE);
+	unsigned char buf[BN_BYTES];
+	for (int i = 0; i < ROUNDS / 10; i++) {
+		struct bn a, e, m, c;
+		gcry_mpi_t ma, me, mm, mc = gcry_mpi_new(0), mr;
+		bignum_init(&a), bignum_init(&e), bignum_init(&m);
+		random_words(a.array, n);
+		random_words(e.array, n);
+		random_words(m.array, n);
+		m.array[0] |= 1;
+		bignum_normalize(&a), bignum_normalize(&e), bignum_normalize(&m);
+		bignum_powmod(&a, &e, &m, &c);
+		bignum_to_bytes(&a, buf, sizeof buf);
+		gcry_mpi_scan(&ma, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+		bignum_to_bytes(&e, buf, sizeof buf);
+		gcry_mpi_scan(&me, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+		bignum_to_bytes(&m, buf, sizeof buf);
+		gcry_mpi_scan(&mm, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+		bignum_to_bytes(&c, buf, sizeof buf);
+		gcry_mpi_scan(&mr, GCRYMPI_FMT_USG, buf, sizeof buf, NULL);
+		gcry_mpi_powm(mc, ma, me, mm);
+		bad += !!gcry_mpi_cmp(mc, mr);
+		gcry_mpi_release(ma), gcry_mpi_release(me), gcry_mpi_release(mm);
+		gcry_mpi_release(mc), gcry_mpi_release(mr);
+	}
+	return bad;
+}
+
+/*
+ * the kernel paths of add, sub, mul and montgomery multiplication with
+ * operands a word short of the kernel width and junk above their top:
+ * the inputs and the context stay as they were, and the results match
+ * those of clean operands; returns number of mismatches
+ */
+static int test_inputs_untouched(int bits)
+{
+	int bad = 0, n = bits / (8 * WORD_SIZE);
+	struct bn a, b, ca, cb, m, r[2][5];
+	struct bn_mont ctx;
+
+	for (int i = 0; i < ROUNDS / 10; i++) {
+		struct bn *in[2] = {&a, &b};
+		bignum_init(&m);
+		random_words(m.array, n);
+		m.array[0] |= 1, m.array[n - 1] |= DTYPE_MSB;
+		bignum_normalize(&m);
+		bignum_mont_init(&ctx, &m);
+		for (int j = 0; j < 2; j++) {
+			memset(in[j]->array, 0xa5, sizeof in[j]->array);
+			random_words(in[j]->array, n - 1);
+			in[j]->array[n - 2] |= 1;
+			in[j]->top = n - 1;
+		}
+		bignum_init(&ca), bignum_init(&cb);
+		memcpy(ca.array, a.array, sizeof *a.array * (n - 1)), ca.top = n - 1;
+		memcpy(cb.array, b.array, sizeof *b.array * (n - 1)), cb.top = n - 1;
+		for (int j = 0; j < 2; j++) {
+			struct bn sa = a, sb = b;
+			struct bn_mont sctx = ctx;
+			struct bn *x = j ? &ca : &a, *y = j ? &cb : &b;
+			bignum_add(x, y, &r[j][0]);
+			bignum_sub(x, y, &r[j][1]);
+			bignum_mul(x, y, &r[j][2]);
+			bignum_mont_mul(&ctx, x, y, &r[j][3]);
+			bignum_mont_to(&ctx, x, &r[j][4]);
+			bad += !j && (memcmp(&sa, &a, sizeof a) || memcmp(&sb, &b, sizeof b) || memcmp(&sctx, &ctx, sizeof ctx));
+		}
+		for (int k = 0; k < 5; k++)
+			bad += bignum_cmp(&r[0][k], &r[1][k]) != EQUAL;
+	}
+	return bad;
+}
+
+int main(void)
+{
+	static const int bits[] = { 1024, 1536, 2048, 3072, 4096 };
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(18);
+
+	/* tests */
+	ok(_bn_kernel_find(BN_KWORDS(1024) / 2) == NULL, "test no kernel for small operands");
+	skip(!bignum_use_asm(1), 1, "no mulx/adx support");
+	ok(test_rows() == 0, "test mulx/adx rows against portable rows");
+	end_skip;
+	for (size_t i = 0; i < sizeof bits / sizeof *bits; i++) {
+		const struct bn_kernel *k = _bn_kernel_find(BN_KWORDS(bits[i]));
+		bignum_use_asm(0);
+		ok(k && k->nwords == BN_KWORDS(bits[i]) && test_kernel(k) == 0,
+			"test %d-bit portable kernels against generic code", bits[i]);
+		bignum_use_asm(1);
+		ok(k && k->nwords == BN_KWORDS(bits[i]) && test_kernel(k) == 0,
+			"test %d-bit kernels with the cpu's fastest rows", bits[i]);
+		ok(test_powmod(bits[i]) == 0, "test %d-bit powmod against libgcrypt", bits[i]);
+	}
+	ok(test_inputs_untouched(2048) == 0, "test kernels leave their inputs alone");
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,273 @@
+/*
+ * t/testkeyindex.c:	unit-test for keyindex.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/keyindex.h"
+#include "../src/packet.h"
+#include "../src/parse.h"
+#include "../src/rsa.h"
+#include <gcrypt.h>
+
+/* the key and subkey fingerprints of t/nopasswd.gpg then t/4yyylmao.gpg, as listed by `gpg --show-keys` */
+static char const *const fprs[4] = {
+	"1FB2 48BC 5ADC 9C15 AEA7  4722 8B45 40ED AF6C 235E",
+	"D374 B255 0797 55D5 EC57  E630 31AB DA1C F7C7 E475",
+	"42EFB19B516BFAFA21DD3EEDC1D6D028CB48BE22",
+	"422E4287D55434956544D80BA0C32742C21F9EC3",
+};
+
+/* both keyrings in one list */
+static size_t read_both(PGP_LIST *restrict pkts)
+{
+	FILE *file;
+
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", pkts) != 5 || !(file = fopen("./t/4yyylmao.gpg", "rb")))
+		return 0;
+	return read_pgp_bin(file, NULL, pkts);
+}
+
+/* every key packet carries its fingerprint and nothing else does; returns mismatches */
+static int test_fingerprints(PGP_LIST const *restrict pkts)
+{
+	size_t const keys[4] = {0, 3, 5, 8};
+	u8 fpr[KEY_FPR_LEN];
+	int bad = 0;
+
+	for (size_t i = 0, k = 0; i < pkts->cnt; i++) {
+		if (k < ARRLEN(keys) && i == keys[k]) {
+			bad += key_spec_parse(fprs[k++], fpr) != KEY_FPR_LEN || pkts->list[i].fpr_len != KEY_FPR_LEN
+				|| memcmp(pkts->list[i].fpr, fpr, sizeof fpr);
+			continue;
+		}
+		bad += pkts->list[i].fpr_len != 0;
+	}
+	return bad;
+}
+
+/* user ids of all three keyrings, two of which share one; returns failures */
+static int test_uids(void)
+{
+	PGP_LIST pkts = {0};
+	UID_INDEX index;
+	FILE *file;
+	u8 hash[20];
+	int bad = 0;
+
+	if (read_both(&pkts) != 10 || !(file = fopen("./t/passwd.gpg", "rb")) || read_pgp_bin(file, NULL, &pkts) != 15)
+		return 1;
+	bad += parse_uid_packets(&pkts) != 3;
+	/* the repeated user id and its mailbox are interned once */
+	bad += pkts.strs.cnt != 4 || pkts.list[6].ui.uid_txt != pkts.list[11].ui.uid_txt
+		|| strcmp(pkts.list[1].ui.uid_txt, "ayy lmao <ayy@lmao.plane>") || strcmp(pkts.list[1].ui.mbox, "ayy@lmao.plane");
+	gcry_md_hash_buffer(GCRY_MD_RMD160, hash, pkts.list[1].pdata, packet_len(&pkts.list[1]));
+	bad += memcmp(pkts.list[1].ui.name_hash, hash, sizeof hash) != 0;
+	uid_index_build(&index, &pkts);
+	bad += uid_index_find(&index, "ayy@lmao.plane", 0) != 0;
+	bad += uid_index_find(&index, "Someone <LMAOOOOOO@lmaooooo.com>", 0) != 5;
+	bad += uid_index_find(&index, "lmaoooooo@lmaooooo.com", 6) != 10;
+	bad += uid_index_find(&index, "nobody@lmao.plane", 0) != SIZE_MAX || uid_index_find(&index, "ayy", 0) != SIZE_MAX;
+	uid_index_free(&index);
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/* self-signature metadata of both keyrings before their packets are parsed; returns mismatches */
+static int test_meta(void)
+{
+	PGP_LIST pkts = {0};
+	KEY_META meta;
+	int bad = 0;
+
+	if (read_both(&pkts) != 10)
+		return 1;
+	bad += !key_meta(&pkts, 0, NULL, &meta) || meta.created != 1510204316 || meta.expires != 1510204316 + 63072000
+		|| meta.flags != (KEY_CERTIFY | KEY_SIGN) || meta.revoked || meta.sig != 2 || meta.primary_uid != 1;
+	bad += !key_usable(&meta, KEY_SIGN, meta.created + 1) || key_usable(&meta, KEY_SIGN, meta.expires)
+		|| key_usable(&meta, KEY_ENCRYPT_COMM, meta.created + 1);
+	bad += !key_meta(&pkts, 8, NULL, &meta) || meta.created != 1509559313 || meta.sig != 9 || meta.primary_uid != SIZE_MAX
+		|| !key_usable(&meta, KEY_ENCRYPT_COMM | KEY_ENCRYPT_STORE, meta.created) || key_usable(&meta, KEY_SIGN, 0);
+	/* only key packets have self-signatures */
+	bad += key_meta(&pkts, 1, NULL, &meta) || key_meta(&pkts, 2, NULL, &meta);
+	/* nothing was parsed to get there */
+	for (size_t i = 0; i < pkts.cnt; i++)
+		bad += TAGBITS(pkts.list[i].pheader) == TAG_SIG && pkts.list[i].sig.version;
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/* append a copy of the signature packet at `idx` to `pkts`, returning its subpackets in `sig` */
+static PGP_PACKET *forge(PGP_LIST *restrict pkts, size_t idx, SIG_PACKET *restrict sig)
+{
+	PGP_PACKET forged = pkts->list[idx];
+
+	xcalloc(&forged.pdata, 1, packet_len(&forged), "forge() xcalloc()");
+	memcpy(forged.pdata, pkts->list[idx].pdata, packet_len(&forged));
+	add_pgp_list(pkts, &forged);
+	if (!sig_subpackets(&pkts->list[pkts->cnt - 1], sig))
+		return NULL;
+	return &pkts->list[pkts->cnt - 1];
+}
+
+/* the type octet of subpacket `type` in `area`, to rename it to one nothing reads */
+static u8 *sub_type(SIGSUB_PACKET const *restrict area, u8 type)
+{
+	size_t len;
+	u8 const *sub = find_subpacket(area, type, &len);
+	return sub ? (u8 *)sub - 1 : NULL;
+}
+
+/* a subkey revocation that is only honored once its signature verified; returns mismatches */
+static int test_revoked(void)
+{
+	PGP_LIST pkts = {0};
+	PGP_PACKET *forged;
+	SIG_PACKET sig;
+	KEY_META meta;
+	int results[6] = {-1, -1, RSA_SIG_VALID, -1, RSA_SIG_VALID, RSA_SIG_BAD_SIG};
+	int bad = 0;
+
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) != 5)
+		return 1;
+	/* the binding signature of the subkey with its class turned into a revocation */
+	if (!(forged = forge(&pkts, 4, &sig)))
+		return 1;
+	forged->pdata[1] = SIG_SUBKEY_REVOKE;
+	bad += !key_meta(&pkts, 3, NULL, &meta) || meta.revoked || meta.sig != 4;
+	bad += !key_meta(&pkts, 3, results, &meta) || meta.revoked || !key_usable(&meta, KEY_ENCRYPT_COMM, meta.created);
+	results[5] = RSA_SIG_VALID;
+	bad += !key_meta(&pkts, 3, results, &meta) || !meta.revoked || key_usable(&meta, KEY_ENCRYPT_COMM, meta.created);
+	/* the primary key is not revoked by its subkey */
+	bad += !key_meta(&pkts, 0, results, &meta) || meta.revoked;
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/* a newer binding without the expiry and with every usage only wins if it verified; returns mismatches */
+static int test_forged_binding(void)
+{
+	PGP_LIST pkts = {0};
+	PGP_PACKET *forged;
+	SIG_PACKET sig;
+	KEY_META meta;
+	int results[7] = {-1, -1, RSA_SIG_VALID, -1, RSA_SIG_VALID, RSA_SIG_BAD_SIG, RSA_SIG_VALID};
+	u8 *type, *created;
+	size_t len;
+	int bad = 0;
+
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) != 5 || !(forged = forge(&pkts, 4, &sig)))
+		return 1;
+	if (!(type = sub_type(&sig.hashed, SUB_KEY_EXPIRES)) || !(created = sub_type(&sig.hashed, SUB_CREATED)))
+		return 1;
+	*type = 0x65;
+	created[4]++;
+	*(u8 *)find_subpacket(&sig.hashed, SUB_KEY_FLAGS, &len) = 0xff;
+	/* the same signature without issuer subpackets is nobody's self-signature */
+	if (!(forged = forge(&pkts, 5, &sig)))
+		return 1;
+	if (!(type = sub_type(&sig.hashed, SUB_ISSUER_FPR)))
+		return 1;
+	*type = 0x66;
+	if (!(type = sub_type(&sig.unhashed, SUB_ISSUER)))
+		return 1;
+	*type = 0x66;
+	bad += !key_meta(&pkts, 3, NULL, &meta) || meta.sig != 5 || meta.expires || meta.flags != 0xff;
+	bad += !key_meta(&pkts, 3, results, &meta) || meta.sig != 4 || meta.expires != meta.created + 63072000
+		|| meta.flags != (KEY_ENCRYPT_COMM | KEY_ENCRYPT_STORE) || key_usable(&meta, KEY_SIGN, meta.created);
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/* EdDSA, ECDH and DSA keys of the secret and public keyrings gpg exports; returns mismatches */
+static int test_non_rsa(void)
+{
+	static char const *const files[2] = {"./t/eddsa.gpg", "./t/eddsa-pub.gpg"};
+	static char const *const eddsa_fprs[3] = {
+		"EEBB2136458336F0EEC3BA866D880D01439AC0E3",
+		"D582687F071F9C94486B01B7D07B98EAE55BA321",
+		"6AD73AEB7DC320EE4136B9900C03DB45D68815A0",
+	};
+	size_t const keys[3] = {0, 3, 5};
+	PGP_LIST pkts = {0};
+	KEY_INDEX index;
+	u8 fpr[KEY_FPR_LEN];
+	int bad = 0;
+
+	for (size_t i = 0; i < ARRLEN(files); i++) {
+		if (read_pgp_bin(NULL, files[i], &pkts) != 7)
+			return 1;
+		for (size_t k = 0; k < ARRLEN(keys); k++) {
+			bad += key_spec_parse(eddsa_fprs[k], fpr) != KEY_FPR_LEN || pkts.list[keys[k]].fpr_len != KEY_FPR_LEN
+				|| memcmp(pkts.list[keys[k]].fpr, fpr, sizeof fpr);
+		}
+		key_index_build(&index, &pkts);
+		key_spec_parse("D07B98EAE55BA321", fpr);
+		bad += key_index_find(&index, fpr, KEY_ID_LEN) != 3;
+		key_index_free(&index);
+	}
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+int main(void)
+{
+	PGP_LIST pkts = {0};
+	KEY_INDEX index;
+	u8 id[KEY_FPR_LEN];
+	int sig_results[5];
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(16);
+
+	/* tests */
+	ok(key_spec_parse("8B4540EDAF6C235E", id) == KEY_ID_LEN && id[0] == 0x8b && id[7] == 0x5e
+		&& key_spec_parse("0x31abda1cf7c7e475", id) == KEY_ID_LEN && id[0] == 0x31 && id[7] == 0x75
+		&& key_spec_parse(fprs[0], id) == KEY_FPR_LEN && id[0] == 0x1f && id[19] == 0x5e,
+		"test key id and fingerprint parsing");
+	ok(!key_spec_parse("", id) && !key_spec_parse("8B4540EDAF6C235", id) && !key_spec_parse("8B4540EDAF6C235G", id)
+		&& !key_spec_parse("1FB248BC5ADC9C15AEA747228B4540EDAF6C235E0", id), "test bad key specs");
+	ok(read_both(&pkts) == 10, "test reading both keyrings");
+	ok(test_fingerprints(&pkts) == 0, "test fingerprints while reading");
+	key_index_build(&index, &pkts);
+	key_spec_parse("C1D6D028CB48BE22", id);
+	ok(key_index_find(&index, id, KEY_ID_LEN) == 5 && key_index_find(&index, (u8 const *)"\x31\xab\xda\x1c\xf7\xc7\xe4\x75",
+		KEY_ID_LEN) == 3, "test finding keys by id");
+	key_spec_parse(fprs[3], id);
+	ok(key_index_find(&index, id, KEY_FPR_LEN) == 8, "test finding keys by fingerprint");
+	/* the right key id under a different fingerprint */
+	id[0] ^= 1;
+	ok(key_index_find(&index, id, KEY_FPR_LEN) == SIZE_MAX
+		&& key_index_find(&index, (u8 const *)"\0\0\0\0\0\0\0\0", KEY_ID_LEN) == SIZE_MAX, "test missing keys");
+	key_index_free(&index);
+	/* the subkey of the second keyring with its primary key, user id and binding signature */
+	ok(key_select(&pkts, 8) == 5 && TAGBITS(pkts.list[0].pheader) == TAG_SECKEY
+		&& !memcmp(pkts.list[3].fpr + 12, id + 12, KEY_ID_LEN), "test selecting a subkey");
+	parse_pgp_packets(&pkts);
+	ok(rsa_verify_list(&pkts, sig_results, 0) == 0 && sig_results[2] == RSA_SIG_VALID
+		&& sig_results[4] == RSA_SIG_VALID, "test selected key signatures");
+	read_both(&pkts);
+	ok(key_select(&pkts, 0) == 5 && pkts.list[3].fpr_len && !memcmp(pkts.list[3].fpr + 12, "\x31\xab\xda\x1c", 4),
+		"test selecting a whole certificate");
+	free_pgp_list(&pkts);
+	ok(uid_mailbox("ayy lmao <Ayy@Lmao.Plane>", 25, (char *)id) == 14 && !memcmp(id, "ayy@lmao.plane", 14)
+		&& uid_mailbox("bare@lmao.plane", 15, (char *)id) == 15 && !uid_mailbox("ayy lmao", 8, (char *)id)
+		&& !uid_mailbox("<a@b@c>", 7, (char *)id) && !uid_mailbox("<@lmao>", 7, (char *)id)
+		&& !uid_mailbox("ayy <lmao@plane> x", 18, (char *)id), "test mailbox extraction");
+	ok(test_uids() == 0, "test user id parsing and mailbox index");
+	ok(test_meta() == 0, "test key metadata from self-signatures");
+	ok(test_revoked() == 0, "test only verified revocations");
+	ok(test_forged_binding() == 0, "test only verified binding signatures");
+	ok(test_non_rsa() == 0, "test fingerprints of non-RSA keys");
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,122 @@
+/*
+ * t/testlanes.c:	unit-test for lanes.h
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+/* room for 4096-bit moduli and bases above them */
+#define BN_BYTES 1024
+
+#include "tap.h"
+#include "../src/lanes.h"
+#include <gcrypt.h>
+#include <string.h>
+
+/* operands per batch, enough for full and partial groups of every size */
+#define BATCH 61
+
+/* random `bits`-bit number, its top bit set */
+static void random_bits(struct bn *restrict n, int bits)
+{
+	unsigned char buf[BN_BYTES];
+	int len = (bits + 7) / 8;
+	gcry_randomize(buf, len, GCRY_WEAK_RANDOM);
+	buf[0] &= 0xff >> (8 * len - bits);
+	buf[0] |= 0x80 >> (8 * len - bits);
+	bignum_from_bytes(n, buf, len);
+}
+
+/* lanes_powmod_batch() over moduli of mixed sizes against bignum_powmod(); returns mismatches */
+static int test_batch(size_t nthreads)
+{
+	static const int bits[] = { 512, 1024, 1023, 2048, 3072, 4096 };
+	static struct bn a[BATCH], e[BATCH], n[BATCH], c[BATCH];
+	struct bn *pa[BATCH], *pe[BATCH], *pn[BATCH], *pc[BATCH];
+	int bad = 0;
+
+	for (size_t i = 0; i < BATCH; i++) {
+		int nbits = bits[i % (sizeof bits / sizeof *bits)];
+		random_bits(&n[i], nbits);
+		n[i].array[0] |= 1;
+		/* bases above the modulus, public and full-length exponents, and zero */
+		random_bits(&a[i], (i % 5 == 0) ? nbits + 5 : nbits - 1);
+		if (i % 7 == 0)
+			bignum_from_int(&e[i], 65537);
+		else if (i % 11 == 0)
+			bignum_init(&e[i]);
+		else
+			random_bits(&e[i], nbits);
+		pa[i] = &a[i], pe[i] = &e[i], pn[i] = &n[i], pc[i] = &c[i];
+	}
+	lanes_powmod_batch(pa, pe, pn, pc, BATCH, nthreads);
+	for (size_t i = 0; i < BATCH; i++) {
+		struct bn r;
+		bignum_powmod(&a[i], &e[i], &n[i], &r);
+		bad += bignum_cmp(&r, &c[i]) != EQUAL;
+	}
+	return bad;
+}
+
+/* a modulus just below a whole number of limbs, where the headroom is tightest */
+static int test_edge(void)
+{
+	struct bn a[LANES], e[LANES], n[LANES], c[LANES], r;
+	struct bn *pa[LANES], *pe[LANES], *pn[LANES], *pc[LANES];
+	LANE_MONT *mont;
+	int bad = 0;
+
+	xmalloc(&mont, sizeof *mont, "test_edge() xmalloc()");
+	for (int l = 0; l < LANES; l++) {
+		random_bits(&n[l], 20 * LANE_BITS - 2);
+		/* all ones in the first lane, so every limb of n and n - 1 is full */
+		if (l == 0) {
+			bignum_from_int(&n[l], 1);
+			bignum_lshift(&n[l], &n[l], 20 * LANE_BITS - 2);
+			bignum_dec(&n[l]);
+		}
+		n[l].array[0] |= 1;
+		bignum_assign(&a[l], &n[l]);
+		bignum_dec(&a[l]);
+		random_bits(&e[l], 64);
+		pa[l] = &a[l], pe[l] = &e[l], pn[l] = &n[l], pc[l] = &c[l];
+	}
+	lanes_mont_init(mont, pn, LANES);
+	lanes_powmod(mont, pa, pe, pc);
+	for (int l = 0; l < LANES; l++) {
+		bignum_powmod(&a[l], &e[l], &n[l], &r);
+		bad += bignum_cmp(&r, &c[l]) != EQUAL;
+	}
+	free(mont);
+	return bad;
+}
+
+int main(void)
+{
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(6);
+
+	/* tests */
+	lanes_use_simd(0);
+	ok(test_edge() == 0, "test portable lanes on moduli filling every limb");
+	ok(test_batch(1) == 0, "test portable lanes against bignum_powmod()");
+	skip(lanes_use_simd(1) == LANES_C, 3, "no avx2 or avx-512 support");
+	ok(test_edge() == 0, "test vector lanes on moduli filling every limb");
+	ok(test_batch(1) == 0, "test vector lanes against bignum_powmod()");
+	ok(test_batch(2) == 0, "test vector lanes on two threads");
+	end_skip;
+	/* the avx2 kernel on a cpu that would pick avx-512 */
+	skip(lanes_use_simd(1) != LANES_AVX512, 1, "no avx-512 support");
+	_lanes_isa = LANES_AVX2;
+	ok(test_batch(1) == 0, "test avx2 lanes against bignum_powmod()");
+	end_skip;
+
+	/* return handled */
+	done_testing();
+}
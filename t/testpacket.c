@@ -11,6 +11,74 @@
 #include "../src/packet.h"
 #include "../src/parse.h"
 
+/* the hashed and unhashed subpacket types of each self-certification, as listed by `gpg --list-packets` */
+static u8 const hashed_types[] = {SUB_ISSUER_FPR, SUB_CREATED, SUB_KEY_FLAGS, SUB_KEY_EXPIRES, 11, 21, 22, 30, 23};
+static u8 const unhashed_types[] = {SUB_ISSUER};
+
+/* walk both areas of a signature; returns mismatches */
+static int test_iter(SIG_PACKET const *restrict sig)
+{
+	SIGSUB_ITER iter = sigsub_iter(&sig->hashed);
+	SIGSUB sub;
+	size_t cnt = 0;
+	int bad = 0;
+
+	while (sigsub_next(&iter, &sub)) {
+		bad += cnt >= ARRLEN(hashed_types) || sub.type != hashed_types[cnt] || sub.critical;
+		/* slices of the packet data, not copies */
+		bad += sub.data < sig->hashed.subpkt_data || sub.data + sub.len > sig->hashed.subpkt_data + sig->hashed.subpkt_len;
+		cnt++;
+	}
+	bad += cnt != ARRLEN(hashed_types);
+	iter = sigsub_iter(&sig->unhashed);
+	for (cnt = 0; sigsub_next(&iter, &sub); cnt++)
+		bad += cnt >= ARRLEN(unhashed_types) || sub.type != unhashed_types[cnt] || sub.len != 8;
+	bad += cnt != ARRLEN(unhashed_types);
+	return bad;
+}
+
+/* a made up area with long lengths, a critical primary user id, and a subpacket running past the end */
+static int test_area(void)
+{
+	u8 data[] = {
+		0xff, 0x00, 0x00, 0x00, 0x05, SUB_CREATED, 0x5a, 0x04, 0x3e, 0x9c,
+		0xc0, 0x01, SUB_KEY_FLAGS, 0x01, [205] = 0x02, 0x80 | SUB_PRIMARY_UID, 0x01,
+		0x09, SUB_KEY_EXPIRES, 0x00,
+	};
+	SIG_PACKET sig = {.hashed = {.subpkt_len = sizeof data, .subpkt_data = data}};
+	SIGSUB_ITER iter = sigsub_iter(&sig.hashed);
+	SIGSUB sub;
+	u8 flags;
+	int bad = 0;
+
+	bad += sig_created(&sig) != 0x5a043e9c || !sig_key_flags(&sig, &flags) || flags != KEY_CERTIFY;
+	bad += !sig_primary_uid(&sig) || sig_key_expires(&sig) != 0;
+	bad += !sigsub_next(&iter, &sub) || sub.len != 4 || !sigsub_next(&iter, &sub) || sub.len != 192;
+	bad += !sigsub_next(&iter, &sub) || !sub.critical || sub.type != SUB_PRIMARY_UID;
+	bad += sigsub_next(&iter, &sub) || sigsub_next(&iter, &sub);
+	return bad;
+}
+
+/* the certification and the binding signature, the latter without parsing it; returns mismatches */
+static int test_accessors(PGP_LIST const *restrict pkts)
+{
+	SIG_PACKET const *cert = &pkts->list[2].sig;
+	SIG_PACKET bind = {0};
+	u32 created = BETOH32(pkts->list[0].pdata + 1);
+	u8 id[8], flags;
+	int bad = 0;
+
+	bad += sig_subpackets(&pkts->list[4], &bind) != packet_len(&pkts->list[4]) - 2 - 256 || bind.sig_mpi.mdata;
+	bad += sig_created(cert) != created || sig_created(&bind) != created;
+	/* two years */
+	bad += sig_key_expires(cert) != 63072000 || sig_key_expires(&bind) != 63072000;
+	bad += !sig_key_flags(cert, &flags) || flags != (KEY_CERTIFY | KEY_SIGN);
+	bad += !sig_key_flags(&bind, &flags) || flags != (KEY_ENCRYPT_COMM | KEY_ENCRYPT_STORE);
+	bad += sig_primary_uid(cert) || sig_primary_uid(&bind);
+	bad += !sig_issuer(&bind, id) || memcmp(id, pkts->list[0].fpr + 12, sizeof id);
+	return bad;
+}
+
 int main(void)
 {
 	char const *const vec_bin[2] = {
@@ -19,7 +87,7 @@ int main(void)
 	};
 
 	/* start test block */
-	plan(14);
+	plan(23);
 
 	/* tests */
 	for (size_t i = 0; i < ARRLEN(vec_bin); i++) {
@@ -31,8 +99,15 @@ int main(void)
 		ok(TAGBITS(pkts.list[3].pheader) == TAG_SECSUBKEY, "test secret subkey header match");
 		ok(parse_pubkey_packet(&pkts.list[0]) > 0, "test successful public key packet parsing");
 		ok(parse_seckey_packet(&pkts.list[3]) > 0, "test successful sec key packet parsing");
+		ok(parse_sig_packet(&pkts.list[2]) == packet_len(&pkts.list[2])
+			&& pkts.list[2].sig.sig_class == SIG_CERT_POSITIVE, "test successful signature packet parsing");
+		ok(parse_sig_packet(&pkts.list[4]) == packet_len(&pkts.list[4])
+			&& pkts.list[4].sig.sig_class == SIG_SUBKEY_BIND, "test successful binding signature parsing");
+		ok(test_iter(&pkts.list[2].sig) == 0, "test iterating over subpackets");
+		ok(test_accessors(&pkts) == 0, "test subpacket accessors");
 		lives_ok({free_pgp_list(&pkts);}, "test successful packet list cleanup");
 	}
+	ok(test_area() == 0, "test subpacket lengths and flags");
 
 	/* return handled */
 	done_testing();
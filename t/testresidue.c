@@ -0,0 +1,136 @@
+/*
+ * t/testresidue.c:	unit-test for residue.c
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/parse.h"
+#include "../src/residue.h"
+#include <gcrypt.h>
+
+/* largest generated modulus in bytes */
+#define MAX_BYTES 512
+
+static RESIDUE_CTX ctx;
+
+static size_t mpi_bytes(u8 *restrict buf, gcry_mpi_t m)
+{
+	size_t len;
+	gcry_mpi_print(GCRYMPI_FMT_USG, buf, MAX_BYTES, &len, m);
+	return len;
+}
+
+/* residues of random operands of every length against libgcrypt; returns mismatches */
+static int test_residues(void)
+{
+	int bad = 0;
+	gcry_mpi_t mn, mp = gcry_mpi_new(0), mr = gcry_mpi_new(0);
+
+	for (size_t len = 1; len <= MAX_BYTES; len += (len < 16) ? 1 : 7) {
+		u8 buf[MAX_BYTES];
+		u16 res[RESIDUE_PRIMES];
+		gcry_randomize(buf, len, GCRY_WEAK_RANDOM);
+		/* all-ones operands keep every chunk at its largest */
+		if (len % 3 == 0)
+			memset(buf, 0xff, len);
+		residue_mod(&ctx, buf, len, res);
+		gcry_mpi_scan(&mn, GCRYMPI_FMT_USG, buf, len, NULL);
+		for (size_t i = 0; i < RESIDUE_PRIMES; i++) {
+			unsigned int r;
+			gcry_mpi_set_ui(mp, (unsigned long)ctx.primes[i]);
+			gcry_mpi_mod(mr, mn, mp);
+			gcry_mpi_get_ui(&r, mr);
+			bad += r != res[i];
+		}
+		gcry_mpi_release(mn);
+	}
+	gcry_mpi_release(mp), gcry_mpi_release(mr);
+	return bad;
+}
+
+/* a product of two random primes, scaled by `factor` */
+static int check_product(unsigned long factor)
+{
+	u8 buf[MAX_BYTES];
+	gcry_mpi_t p, q, n = gcry_mpi_new(0);
+	size_t len;
+
+	gcry_prime_generate(&p, 512, 0, NULL, NULL, NULL, GCRY_WEAK_RANDOM, 0);
+	gcry_prime_generate(&q, 512, 0, NULL, NULL, NULL, GCRY_WEAK_RANDOM, 0);
+	gcry_mpi_mul(n, p, q);
+	gcry_mpi_mul_ui(n, n, factor);
+	len = mpi_bytes(buf, n);
+	gcry_mpi_release(p), gcry_mpi_release(q), gcry_mpi_release(n);
+	return weak_check(&ctx, buf, len);
+}
+
+/* k * M + (65537^a mod M) with M the primorial of ROCA_MAX_PRIME, as RSALib builds its primes */
+static gcry_mpi_t roca_prime(void)
+{
+	gcry_mpi_t m = gcry_mpi_set_ui(NULL, 2), k = gcry_mpi_new(0), e = gcry_mpi_new(0);
+	gcry_mpi_t g = gcry_mpi_set_ui(NULL, 65537), r = gcry_mpi_new(0);
+
+	for (size_t i = 0; i < ROCA_PRIMES; i++)
+		gcry_mpi_mul_ui(m, m, (unsigned long)ctx.primes[i]);
+	gcry_mpi_randomize(k, 256, GCRY_WEAK_RANDOM);
+	gcry_mpi_randomize(e, 64, GCRY_WEAK_RANDOM);
+	gcry_mpi_powm(r, g, e, m);
+	gcry_mpi_mul(k, k, m);
+	gcry_mpi_add(k, k, r);
+	gcry_mpi_release(m), gcry_mpi_release(e), gcry_mpi_release(g), gcry_mpi_release(r);
+	return k;
+}
+
+static int check_roca(void)
+{
+	u8 buf[MAX_BYTES];
+	gcry_mpi_t p = roca_prime(), q = roca_prime(), n = gcry_mpi_new(0);
+	size_t len;
+
+	gcry_mpi_mul(n, p, q);
+	len = mpi_bytes(buf, n);
+	gcry_mpi_release(p), gcry_mpi_release(q), gcry_mpi_release(n);
+	/* the factors are not checked for primality, so small ones may show up too */
+	return weak_check(&ctx, buf, len) & WEAK_ROCA;
+}
+
+int main(void)
+{
+	PGP_LIST pkts = {0}, prot = {0};
+	int results[5] = {0}, prot_results[5] = {0};
+	u8 even[] = {0xc5, 0x01, 0x02};
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+	residue_init(&ctx);
+
+	/* start test block */
+	plan(10);
+
+	/* tests */
+	ok(ctx.primes[0] == 3 && ctx.primes[ROCA_PRIMES - 1] == ROCA_MAX_PRIME
+		&& ctx.primes[RESIDUE_PRIMES - 1] == 4093, "test prime table");
+	ok(test_residues() == 0, "test residues against libgcrypt");
+	ok(check_product(1) == WEAK_NONE, "test strong modulus");
+	ok(check_product(4093) == WEAK_SMALL_FACTOR && weak_check(&ctx, even, sizeof even) == WEAK_SMALL_FACTOR,
+		"test small factors");
+	ok(check_roca() == WEAK_ROCA, "test RSALib fingerprint");
+	ok(read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) == 5, "test binary parsing");
+	parse_pgp_packets(&pkts);
+	ok(weak_scan_list(&pkts, results, 0) == 0 && results[0] == 0 && results[3] == 0
+		&& results[1] == -1 && results[2] == -1 && results[4] == -1, "test keyring moduli");
+	/* the public parts of protected keys are enough */
+	ok(read_pgp_bin(NULL, "./t/4yyylmao.gpg", &prot) == 5, "test protected key parsing");
+	parse_pgp_packets(&prot);
+	ok(weak_scan_list(&prot, prot_results, 2) == 0 && prot_results[0] == 0 && prot_results[3] == 0,
+		"test protected keyring moduli");
+	lives_ok({free_pgp_list(&pkts); free_pgp_list(&prot);}, "test successful packet list cleanup");
+
+	/* return handled */
+	done_testing();
+}
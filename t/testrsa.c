@@ -0,0 +1,207 @@
+/*
+ * t/testrsa.c:	unit-test for rsa.c
+ *
+ * AUTHORS:		Joey Pabalinas <alyptik@protonmail.com>
+ *			Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/bn.h"
+#include "../src/lanes.h"
+#include "../src/packet.h"
+#include "../src/parse.h"
+#include "../src/rsa.h"
+#include <gcrypt.h>
+
+/* number of generated keys */
+#define KEYS 4
+
+/* copy a libgcrypt mpi into the layout `read_mpi()` produces */
+static void mpi_from_gcry(MPI *restrict mpi, gcry_mpi_t m)
+{
+	size_t nbytes;
+	mpi->length = gcry_mpi_get_nbits(m);
+	xcalloc(&mpi->mdata, 1, MPIBYTES(mpi->length) + 1, "mpi_from_gcry() xcalloc()");
+	gcry_mpi_print(GCRYMPI_FMT_USG, mpi->mdata + 1, MPIBYTES(mpi->length), &nbytes, m);
+}
+
+/* generate a 1024-bit key; returns non-zero on failure */
+static int gen_seckey(SECKEY_PACKET *restrict seckey)
+{
+	gcry_sexp_t parms, key, rsa;
+	gcry_mpi_t m[6];
+	if (gcry_sexp_build(&parms, NULL, "(genkey (rsa (nbits 4:1024)))"))
+		return 1;
+	if (gcry_pk_genkey(&key, parms))
+		return 1;
+	rsa = gcry_sexp_find_token(key, "private-key", 0);
+	/* libgcrypt also keeps p < q and u = p^-1 mod q */
+	if (gcry_sexp_extract_param(rsa, "rsa", "nedpqu", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], NULL))
+		return 1;
+	mpi_from_gcry(&seckey->modulus_n, m[0]);
+	mpi_from_gcry(&seckey->exponent_e, m[1]);
+	mpi_from_gcry(&seckey->exponent_d, m[2]);
+	mpi_from_gcry(&seckey->prime_p, m[3]);
+	mpi_from_gcry(&seckey->prime_q, m[4]);
+	mpi_from_gcry(&seckey->mult_inverse, m[5]);
+	for (size_t i = 0; i < ARRLEN(m); i++)
+		gcry_mpi_release(m[i]);
+	gcry_sexp_release(rsa);
+	gcry_sexp_release(key);
+	gcry_sexp_release(parms);
+	return 0;
+}
+
+/*
+ * random c^d mod n through the CRT engine against libgcrypt, one at a
+ * time and then all at once on `nthreads` threads; returns number of mismatches
+ */
+static int test_crt(SECKEY_PACKET const *restrict seckey, size_t nthreads)
+{
+	/* the list takes full length inputs `len` octets apart, with n last */
+	static u8 ins[17 * RSA_MAX_BITS / 8], outs[17 * RSA_MAX_BITS / 8], want[16 * RSA_MAX_BITS / 8];
+	int bad = 0, results[17];
+	u8 in[RSA_MAX_BITS / 8], out[RSA_MAX_BITS / 8];
+	gcry_mpi_t mn, md, mc, mm, mout;
+	RSA_CRT *crt = rsa_crt_new(seckey);
+	if (!crt)
+		return 1;
+	size_t len = rsa_crt_size(crt);
+	gcry_mpi_scan(&mn, GCRYMPI_FMT_USG, seckey->modulus_n.mdata + 1, MPIBYTES(seckey->modulus_n.length), NULL);
+	gcry_mpi_scan(&md, GCRYMPI_FMT_USG, seckey->exponent_d.mdata + 1, MPIBYTES(seckey->exponent_d.length), NULL);
+	mm = gcry_mpi_new(0);
+	for (int i = 0; i < 16; i++) {
+		/* shorter inputs are fine too */
+		size_t in_len = len - (i & 3);
+		gcry_randomize(in, in_len, GCRY_WEAK_RANDOM);
+		in[0] &= 0x7f;
+		gcry_mpi_scan(&mc, GCRYMPI_FMT_USG, in, in_len, NULL);
+		gcry_mpi_powm(mm, mc, md, mn);
+		bad += rsa_crt_private(crt, in, in_len, out) != 0;
+		gcry_mpi_scan(&mout, GCRYMPI_FMT_USG, out, len, NULL);
+		bad += !!gcry_mpi_cmp(mm, mout);
+		gcry_mpi_release(mc), gcry_mpi_release(mout);
+		memset(ins + i * len, 0, len);
+		memcpy(ins + (i + 1) * len - in_len, in, in_len);
+		memcpy(want + i * len, out, len);
+	}
+	/* n itself is not a valid input */
+	bad += rsa_crt_private(crt, seckey->modulus_n.mdata + 1, len, out) == 0;
+	memcpy(ins + 16 * len, seckey->modulus_n.mdata + 1, len);
+	bad += rsa_crt_private_list(crt, ins, outs, results, 17, nthreads) != 1 || !results[16];
+	bad += memcmp(outs, want, 16 * len) != 0;
+	gcry_mpi_release(mn), gcry_mpi_release(md), gcry_mpi_release(mm);
+	rsa_crt_free(crt);
+	return bad;
+}
+
+/*
+ * many certifications of one key, enough for `rsa_verify_list()` to put
+ * them through the lanes where the cpu has them, with one tampered; the
+ * results must match those of the scalar ladder; returns mismatches
+ */
+static int test_verify_many(void)
+{
+	PGP_LIST pkts = {0};
+	PGP_PACKET copy;
+	int results[2][43];
+	int bad = 0;
+
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) != 5)
+		return 1;
+	for (size_t i = 0; i < 19; i++) {
+		for (size_t j = 1; j <= 2; j++) {
+			copy = pkts.list[j];
+			xmalloc(&copy.pdata, packet_len(&copy), "test_verify_many() xmalloc()");
+			memcpy(copy.pdata, pkts.list[j].pdata, packet_len(&copy));
+			add_pgp_list(&pkts, &copy);
+		}
+	}
+	parse_pgp_packets(&pkts);
+	pkts.list[30].sig.sig_mpi.mdata[MPIBYTES(pkts.list[30].sig.sig_mpi.length)] ^= 0x01;
+	for (int simd = 0; simd < 2; simd++) {
+		lanes_use_simd(simd);
+		bad += rsa_verify_list(&pkts, results[simd], 0) != 1;
+	}
+	for (size_t i = 0; i < pkts.cnt; i++) {
+		int want = (i == 30) ? RSA_SIG_BAD_SIG : (TAGBITS(pkts.list[i].pheader) == TAG_SIG) ? RSA_SIG_VALID : -1;
+		bad += results[0][i] != want || results[1][i] != want;
+	}
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+int main(void)
+{
+	PGP_LIST pkts = {0}, prot = {0};
+	PGP_PACKET gen[KEYS] = {0};
+	int results[5] = {0}, sig_results[5] = {0};
+	int bad = 0;
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(19);
+
+	/* tests */
+	ok(read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) == 5, "test binary parsing");
+	parse_pgp_packets(&pkts);
+	ok(rsa_validate(&pkts.list[0].seckey, 16) == RSA_VALID, "test valid secret key");
+	ok(rsa_validate(&pkts.list[3].seckey, 16) == RSA_VALID, "test valid secret subkey");
+	ok(rsa_validate_list(&pkts, results, 8) == 0 && results[0] == RSA_VALID && results[3] == RSA_VALID
+		&& results[1] == -1 && results[2] == -1 && results[4] == -1, "test keyring validation");
+	ok(rsa_verify_list(&pkts, sig_results, 1) == 0 && sig_results[2] == RSA_SIG_VALID
+		&& sig_results[4] == RSA_SIG_VALID && sig_results[0] == -1 && sig_results[1] == -1
+		&& sig_results[3] == -1, "test self-signature verification");
+	/* a changed user id no longer hashes to the quick check octets */
+	pkts.list[1].pdata[0] ^= 0x20;
+	ok(rsa_verify_list(&pkts, sig_results, 2) == 1 && sig_results[2] == RSA_SIG_BAD_DIGEST
+		&& sig_results[4] == RSA_SIG_VALID, "test tampered user id");
+	pkts.list[1].pdata[0] ^= 0x20;
+	/* a changed signature still passes the quick check */
+	pkts.list[4].sig.sig_mpi.mdata[MPIBYTES(pkts.list[4].sig.sig_mpi.length)] ^= 0x01;
+	ok(rsa_verify_list(&pkts, sig_results, 1) == 1 && sig_results[2] == RSA_SIG_VALID
+		&& sig_results[4] == RSA_SIG_BAD_SIG, "test tampered binding signature");
+	pkts.list[4].sig.sig_mpi.mdata[MPIBYTES(pkts.list[4].sig.sig_mpi.length)] ^= 0x01;
+	/* the public parts of protected keys are enough */
+	ok(read_pgp_bin(NULL, "./t/4yyylmao.gpg", &prot) == 5, "test protected key parsing");
+	parse_pgp_packets(&prot);
+	ok(rsa_verify_list(&prot, sig_results, 0) == 0 && sig_results[2] == RSA_SIG_VALID
+		&& sig_results[4] == RSA_SIG_VALID, "test protected key self-signatures");
+	for (size_t i = 0; i < KEYS; i++)
+		bad += gen_seckey(&gen[i].seckey) || rsa_validate(&gen[i].seckey, 8) != RSA_VALID;
+	ok(bad == 0, "test generated keys against libgcrypt");
+	ok(test_crt(&pkts.list[3].seckey, 1) == 0 && test_crt(&pkts.list[0].seckey, 2) == 0,
+		"test crt private operation against libgcrypt");
+	for (size_t i = 0; i < KEYS; i++)
+		bad += test_crt(&gen[i].seckey, i % 2 + 1);
+	ok(bad == 0, "test crt private operation with generated keys");
+	/* the portable rows stay forced in rsa.c, which shares the flag with this file */
+	bignum_use_asm(0);
+	ok(rsa_validate_list(&pkts, results, 8) == 0 && rsa_verify_list(&pkts, sig_results, 2) == 0
+		&& test_crt(&pkts.list[0].seckey, 2) == 0 && !BN_ASM_ROWS, "test portable rows across files");
+	bignum_use_asm(1);
+	ok(test_verify_many() == 0, "test many signatures of one key");
+	/* a flipped bit in d only breaks the exponent check */
+	pkts.list[3].seckey.exponent_d.mdata[1] ^= 0x01;
+	ok(rsa_validate(&pkts.list[3].seckey, 8) == RSA_BAD_D, "test tampered private exponent");
+	pkts.list[3].seckey.exponent_d.mdata[1] ^= 0x01;
+	pkts.list[3].seckey.mult_inverse.mdata[5] ^= 0x10;
+	ok(rsa_validate(&pkts.list[3].seckey, 8) == RSA_BAD_U, "test tampered coefficient");
+	pkts.list[3].seckey.mult_inverse.mdata[5] ^= 0x10;
+	/* an even p is composite and no longer divides n */
+	pkts.list[3].seckey.prime_p.mdata[MPIBYTES(pkts.list[3].seckey.prime_p.length)] ^= 0x01;
+	ok((rsa_validate(&pkts.list[3].seckey, 8) & (RSA_BAD_N | RSA_BAD_P)) == (RSA_BAD_N | RSA_BAD_P),
+		"test tampered prime");
+	ok(rsa_validate(&(SECKEY_PACKET){0}, 8) == RSA_BAD_MPI, "test missing mpis");
+	lives_ok({free_pgp_list(&pkts); free_pgp_list(&prot);}, "test successful packet list cleanup");
+	for (size_t i = 0; i < KEYS; i++)
+		free_seckey_packet(&gen[i]);
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,300 @@
+/*
+ * t/tests2k.c:	unit-test for s2k.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/argon2.h"
+#include "../src/parse.h"
+#include "../src/rsa.h"
+#include "../src/s2k.h"
+#include <gcrypt.h>
+
+/* the S2K of the primary key in t/4yyylmao.gpg, as listed by `gpg --list-packets` */
+static u8 const prot_salt[8] = {0x39, 0x6b, 0x28, 0x37, 0xcc, 0x6b, 0xc6, 0x53};
+static u8 const prot_iv[16] = {
+	0x6e, 0xc5, 0x7d, 0xc7, 0xe5, 0xab, 0x00, 0xa1,
+	0x36, 0xd1, 0xdc, 0x32, 0x8a, 0x60, 0x74, 0xba,
+};
+
+/* the S2K of RFC 4880 3.7.1 written out one octet at a time */
+static void ref_s2k(S2K const *restrict s2k, int md, char const *restrict pass, u8 *restrict key, size_t key_len)
+{
+	size_t dlen = gcry_md_get_algo_dlen(md), pass_len = strlen(pass);
+
+	for (size_t done = 0, pre = 0; done < key_len; pre++) {
+		gcry_md_hd_t hd;
+		size_t total = sizeof s2k->salt + pass_len;
+		gcry_md_open(&hd, md, 0);
+		/* one more zero octet for each digest already used */
+		for (size_t i = 0; i < pre; i++)
+			gcry_md_putc(hd, 0);
+		if (s2k->s2k_mode == S2K_ITERSALTED && S2K_COUNT(s2k->cnt) > total)
+			total = S2K_COUNT(s2k->cnt);
+		if (s2k->s2k_mode == S2K_SIMPLE)
+			total = pass_len;
+		for (size_t i = 0; i < total; i++) {
+			size_t pos = (s2k->s2k_mode == S2K_SIMPLE) ? i + 8 : i % (sizeof s2k->salt + pass_len);
+			gcry_md_putc(hd, (pos < 8) ? s2k->salt[pos] : (u8)pass[pos - 8]);
+		}
+		memcpy(key + done, gcry_md_read(hd, md), (key_len - done < dlen) ? key_len - done : dlen);
+		done += (key_len - done < dlen) ? key_len - done : dlen;
+		gcry_md_close(hd);
+	}
+}
+
+/* `s2k_derive()` against `ref_s2k()` for every mode, digest and key length; returns mismatches */
+static int test_derive(void)
+{
+	static int const hashes[][2] = {{HASH_SHA1, GCRY_MD_SHA1}, {HASH_SHA256, GCRY_MD_SHA256}};
+	static int const modes[] = {S2K_SIMPLE, S2K_SALTED, S2K_ITERSALTED};
+	static size_t const key_lens[] = {16, 24, 32};
+	char const *const pass = "correct horse battery staple, and then some";
+	int bad = 0;
+
+	for (size_t h = 0; h < ARRLEN(hashes); h++) {
+		for (size_t m = 0; m < ARRLEN(modes); m++) {
+			for (size_t k = 0; k < ARRLEN(key_lens); k++) {
+				S2K s2k = {.s2k_mode = modes[m], .hash_algo = hashes[h][0], .cnt = 16 * k};
+				u8 key[S2K_MAX_KEY_BYTES], ref[S2K_MAX_KEY_BYTES];
+				gcry_randomize(s2k.salt, sizeof s2k.salt, GCRY_WEAK_RANDOM);
+				ref_s2k(&s2k, hashes[h][1], pass, ref, key_lens[k]);
+				bad += s2k_derive(&s2k, pass, strlen(pass), key, key_lens[k]) != S2K_OK;
+				bad += memcmp(key, ref, key_lens[k]) != 0;
+			}
+		}
+	}
+	return bad;
+}
+
+/* a keyring of subkeys sharing one specifier against the cache; returns failures */
+static int test_cache(void)
+{
+	SECKEY_INFO info = {.is_protected = 1, .seckey_algo = SYM_AES256, .s2k = {.s2k_mode = S2K_ITERSALTED}};
+	PGP_PACKET subkeys[6] = {{0}};
+	PGP_LIST list = {.cnt = ARRLEN(subkeys), .list = subkeys};
+	S2K_CACHE cache = {0};
+	int results[ARRLEN(subkeys)], bad = 0;
+	u8 keys[ARRLEN(subkeys)][S2K_MAX_KEY_BYTES], ref[S2K_MAX_KEY_BYTES];
+	u8 const *hit;
+
+	info.s2k.hash_algo = HASH_SHA256;
+	gcry_randomize(info.s2k.salt, sizeof info.s2k.salt, GCRY_WEAK_RANDOM);
+	for (size_t i = 0; i < ARRLEN(subkeys); i++) {
+		subkeys[i].pheader = 0x80 | TAG_SECSUBKEY << 2;
+		subkeys[i].seckey.seckey_info = &info;
+	}
+	s2k_derive(&info.s2k, "ayy", 3, ref, 32);
+	/* one derivation for the whole keyring, then none for the same passphrase */
+	bad += s2k_derive_list(&list, "ayy", 3, 0, &cache, keys, results, 2) != 0;
+	bad += cache.derived != 1 || cache.hits != ARRLEN(subkeys) - 1;
+	for (size_t i = 0; i < ARRLEN(subkeys); i++)
+		bad += results[i] != S2K_OK || memcmp(keys[i], ref, 32);
+	memset(keys, 0, sizeof keys);
+	bad += s2k_derive_list(&list, "ayy", 3, 0, &cache, keys, results, 2) != 0;
+	bad += cache.derived != 1 || memcmp(keys[ARRLEN(subkeys) - 1], ref, 32);
+	bad += !(hit = s2k_cache_find(&cache, 0, &info.s2k, 32)) || memcmp(hit, ref, 32);
+	/* another passphrase id is another key */
+	bad += s2k_derive_list(&list, "lmao", 4, 1, &cache, keys, results, 2) != 0;
+	bad += cache.derived != 2 || !memcmp(keys[0], ref, 32);
+	/* a failed derivation is not retried, and keeps reporting why it failed */
+	info.s2k = (S2K){.s2k_mode = S2K_ARGON2, .passes = 1, .lanes = 4, .mem_exp = S2K_ARGON2_MEM_EXP + 1};
+	for (size_t pass = 0; pass < 2; pass++) {
+		bad += s2k_derive_list(&list, "ayy", 3, 0, &cache, keys, results, 2) != ARRLEN(subkeys);
+		for (size_t i = 0; i < ARRLEN(subkeys); i++)
+			bad += results[i] != S2K_BAD_LIMIT;
+	}
+	bad += cache.derived != 3 || s2k_cache_find(&cache, 0, &info.s2k, 32);
+	s2k_cache_wipe(&cache);
+	bad += cache.ents || s2k_cache_find(&cache, 0, &info.s2k, 32);
+	return bad;
+}
+
+/* nothing of a decrypted key is left in its buffers once `free_seckey_packet()` wipes them; returns failures */
+static int test_wipe(PGP_PACKET *restrict packet)
+{
+	MPI const *const secrets[] = {
+		&packet->seckey.exponent_d, &packet->seckey.prime_p,
+		&packet->seckey.prime_q, &packet->seckey.mult_inverse,
+	};
+	int bad = 0;
+
+	wipe_seckey_packet(packet);
+	for (size_t i = 0; i < ARRLEN(secrets); i++) {
+		bad += !secrets[i]->mdata;
+		for (size_t j = 0; secrets[i]->mdata && j < MPIBYTES(secrets[i]->length) + 1u; j++)
+			bad += secrets[i]->mdata[j] != 0;
+	}
+	for (size_t j = 0; j < packet->seckey.rsa.der_len; j++)
+		bad += packet->seckey.rsa.der_data[j] != 0;
+	/* the public MPIs are left alone */
+	bad += !packet->seckey.modulus_n.mdata[1];
+	return bad;
+}
+
+/* t/passwd.gpg with a wrong passphrase and then its own; returns failures */
+static int test_unprotect(void)
+{
+	PGP_LIST pkts = {0};
+	int results[5], bad = 0;
+	u8 keys[5][S2K_MAX_KEY_BYTES];
+
+	if (read_pgp_bin(NULL, "./t/passwd.gpg", &pkts) != 5)
+		return 1;
+	parse_pgp_packets(&pkts);
+	s2k_derive_list(&pkts, "ayy", 3, 0, NULL, keys, results, 2);
+	bad += s2k_unprotect_list(&pkts, keys, results, 2) != 2;
+	bad += results[0] != S2K_BAD_CHECKSUM || results[3] != S2K_BAD_CHECKSUM || pkts.list[0].seckey.rsa.der_data;
+	s2k_derive_list(&pkts, "ayy lmao", 8, 0, NULL, keys, results, 2);
+	bad += s2k_unprotect_list(&pkts, keys, results, 2) != 0;
+	for (size_t i = 0; i < 5; i += 3) {
+		bad += results[i] != S2K_OK || !pkts.list[i].seckey.rsa.der_data;
+		bad += rsa_validate(&pkts.list[i].seckey, 0) != RSA_VALID;
+	}
+	bad += test_wipe(&pkts.list[0]);
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+/*
+ * the first key of t/nopasswd.gpg protected by hand with `s2k` under `usage`,
+ * then parsed, derived and decrypted again; returns failures
+ */
+static int test_protect(S2K const *restrict s2k, u8 usage)
+{
+	PGP_LIST raw = {0}, prot = {0};
+	PGP_PACKET packet = {.pheader = 0x80 | TAG_SECKEY << 2 | LEN_TWO};
+	SECKEY_INFO const *info;
+	u8 key[S2K_MAX_KEY_BYTES], iv[16], *src, *plain;
+	size_t pub_len, mpi_len, plain_len, off;
+	gcry_cipher_hd_t hd;
+	int results[1], bad = 0;
+
+	if (read_pgp_bin(NULL, "./t/nopasswd.gpg", &raw) != 5)
+		return 1;
+	parse_pgp_packets(&raw);
+	/* the usage octet then the MPIs and their checksum, which SHA1 protection replaces */
+	pub_len = pubkey_body_len(&raw.list[0]);
+	src = raw.list[0].pdata + pub_len + 1;
+	mpi_len = packet_len(&raw.list[0]) - pub_len - 3;
+	plain_len = mpi_len + (usage == STR_S2K1 ? 20 : 2);
+	xcalloc(&plain, 1, plain_len, "test_protect() xcalloc()");
+	memcpy(plain, src, mpi_len);
+	if (usage == STR_S2K1)
+		gcry_md_hash_buffer(GCRY_MD_SHA1, plain + mpi_len, plain, mpi_len);
+	else
+		memcpy(plain + mpi_len, src + mpi_len, 2);
+	xcalloc(&packet.pdata, 1, pub_len + 40 + sizeof iv + plain_len, "test_protect() xcalloc()");
+	memcpy(packet.pdata, raw.list[0].pdata, pub_len);
+	off = pub_len;
+	packet.pdata[off++] = usage;
+	packet.pdata[off++] = SYM_AES128;
+	packet.pdata[off++] = s2k->s2k_mode;
+	if (s2k->s2k_mode == S2K_ARGON2) {
+		memcpy(packet.pdata + off, s2k->argon2_salt, sizeof s2k->argon2_salt);
+		off += sizeof s2k->argon2_salt;
+		packet.pdata[off++] = s2k->passes;
+		packet.pdata[off++] = s2k->lanes;
+		packet.pdata[off++] = s2k->mem_exp;
+	} else {
+		packet.pdata[off++] = s2k->hash_algo;
+		memcpy(packet.pdata + off, s2k->salt, sizeof s2k->salt);
+		off += sizeof s2k->salt;
+	}
+	gcry_randomize(iv, sizeof iv, GCRY_WEAK_RANDOM);
+	memcpy(packet.pdata + off, iv, sizeof iv);
+	off += sizeof iv;
+	s2k_derive(s2k, "ayy", 3, key, 16);
+	gcry_cipher_open(&hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CFB, 0);
+	gcry_cipher_setkey(hd, key, 16);
+	gcry_cipher_setiv(hd, iv, sizeof iv);
+	gcry_cipher_encrypt(hd, packet.pdata + off, plain_len, plain, plain_len);
+	gcry_cipher_close(hd);
+	packet.plen_two = off + plain_len;
+	free(plain);
+
+	init_pgp_list(&prot);
+	add_pgp_list(&prot, &packet);
+	parse_pgp_packets(&prot);
+	info = prot.list[0].seckey.seckey_info;
+	bad += info->sha1_chk != (usage == STR_S2K1) || info->s2k.s2k_mode != s2k->s2k_mode;
+	bad += s2k->s2k_mode == S2K_ARGON2
+		? memcmp(info->s2k.argon2_salt, s2k->argon2_salt, sizeof s2k->argon2_salt)
+			|| info->s2k.passes != s2k->passes || info->s2k.lanes != s2k->lanes
+			|| info->s2k.mem_exp != s2k->mem_exp
+		: memcmp(info->s2k.salt, s2k->salt, sizeof s2k->salt) || info->s2k.hash_algo != s2k->hash_algo;
+	s2k_derive_list(&prot, "ayy", 3, 0, NULL, &key, results, 2);
+	bad += s2k_unprotect_list(&prot, &key, results, 1) != 0 || results[0] != S2K_OK;
+	bad += prot.list[0].seckey.rsa.der_len != raw.list[0].seckey.rsa.der_len
+		|| memcmp(prot.list[0].seckey.rsa.der_data, raw.list[0].seckey.rsa.der_data, raw.list[0].seckey.rsa.der_len);
+	free_pgp_list(&raw);
+	free_pgp_list(&prot);
+	return bad;
+}
+
+int main(void)
+{
+	PGP_LIST pkts = {0}, prot = {0};
+	SECKEY_INFO const *info;
+	S2K bad_hash = {.s2k_mode = S2K_SALTED, .hash_algo = HASH_RSVRD0};
+	S2K bad_mode = {.s2k_mode = S2K_RSRVD, .hash_algo = HASH_SHA1};
+	S2K salted = {.s2k_mode = S2K_SALTED, .hash_algo = HASH_SHA256};
+	S2K argon2 = {.s2k_mode = S2K_ARGON2, .passes = 1, .lanes = 4, .mem_exp = 10};
+	S2K huge = {.s2k_mode = S2K_ARGON2, .passes = 1, .lanes = 4}, many = {.s2k_mode = S2K_ARGON2, .passes = 9, .lanes = 4};
+	ARGON2_ARENA arena = {0};
+	int results[5] = {0}, prot_results[5] = {0};
+	u8 keys[5][S2K_MAX_KEY_BYTES] = {{0}}, key[S2K_MAX_KEY_BYTES], ref[S2K_MAX_KEY_BYTES];
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(16);
+
+	/* tests */
+	ok(S2K_COUNT(0) == 1024 && S2K_COUNT(96) == 65536 && S2K_COUNT(255) == 65011712, "test coded counts");
+	ok(test_derive() == 0, "test derivations against the reference");
+	ok(s2k_derive(&bad_hash, "", 0, key, 16) == S2K_BAD_ALGO && s2k_derive(&bad_mode, "", 0, key, 16) == S2K_BAD_ALGO,
+		"test unsupported specifiers");
+	ok(read_pgp_bin(NULL, "./t/4yyylmao.gpg", &prot) == 5, "test protected key parsing");
+	parse_pgp_packets(&prot);
+	info = prot.list[0].seckey.seckey_info;
+	ok(info && info->is_protected && info->sha1_chk && info->seckey_algo == SYM_AES128
+		&& info->s2k.s2k_mode == S2K_ITERSALTED && info->s2k.hash_algo == HASH_SHA1
+		&& !memcmp(info->s2k.salt, prot_salt, sizeof prot_salt) && S2K_COUNT(info->s2k.cnt) == 28311552
+		&& info->iv_len == sizeof prot_iv && !memcmp(info->iv, prot_iv, sizeof prot_iv),
+		"test S2K specifier parsing");
+	ok(s2k_derive_list(&prot, "ayy", 3, 0, NULL, keys, prot_results, 2) == 0 && prot_results[0] == S2K_OK
+		&& prot_results[3] == S2K_OK && prot_results[1] == -1 && prot_results[2] == -1
+		&& prot_results[4] == -1, "test protected keyring derivations");
+	ok(s2k_derive(&info->s2k, "ayy", 3, key, 16) == S2K_OK && !memcmp(key, keys[0], 16)
+		&& memcmp(keys[0], keys[3], 16), "test threaded derivations match");
+	ok(test_cache() == 0, "test derived key cache");
+	ok(test_unprotect() == 0, "test decryption with SHA1 protection");
+	gcry_randomize(salted.salt, sizeof salted.salt, GCRY_WEAK_RANDOM);
+	ok(test_protect(&salted, STR_S2K2) == 0, "test decryption with a 16-bit checksum");
+	gcry_randomize(argon2.argon2_salt, sizeof argon2.argon2_salt, GCRY_WEAK_RANDOM);
+	ok(s2k_derive(&argon2, "ayy", 3, key, 32) == S2K_OK && argon2id(&arena, "ayy", 3, argon2.argon2_salt,
+		sizeof argon2.argon2_salt, 1, 4, 1024, ref, 32, 4) == 0 && !memcmp(key, ref, 32),
+		"test Argon2 derivations");
+	argon2_arena_free(&arena);
+	ok(test_protect(&argon2, STR_S2K1) == 0, "test decryption with an Argon2 S2K");
+	/* refused before anything is allocated */
+	huge.mem_exp = S2K_ARGON2_MEM_EXP + 1;
+	many.mem_exp = S2K_ARGON2_MEM_EXP;
+	ok(s2k_derive(&huge, "ayy", 3, key, 32) == S2K_BAD_LIMIT && s2k_derive(&many, "ayy", 3, key, 32) == S2K_BAD_LIMIT,
+		"test Argon2 S2K limits");
+	ok(read_pgp_bin(NULL, "./t/nopasswd.gpg", &pkts) == 5, "test binary parsing");
+	parse_pgp_packets(&pkts);
+	s2k_derive_list(&pkts, "ayy", 3, 0, NULL, keys, results, 0);
+	ok(results[0] == -1 && results[3] == -1, "test unprotected keyring");
+	lives_ok({free_pgp_list(&pkts); free_pgp_list(&prot);}, "test successful packet list cleanup");
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,218 @@
+/*
+ * t/testseipd.c:	unit-test for seipd.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/seipd.h"
+#include "../src/s2k.h"
+#include "../src/packet.h"
+#include "../src/parse.h"
+#include <gcrypt.h>
+
+/* an encrypted packet is at most this long here */
+#define SEAL_MAX	(64 * 1024)
+
+/* the contents of a keyring file into `buf`; returns its length */
+static size_t slurp(char const *restrict filename, u8 *restrict buf)
+{
+	FILE *file = fopen(filename, "rb");
+	size_t len;
+
+	if (!file)
+		return 0;
+	len = fread(buf, 1, SEAL_MAX / 4, file);
+	fclose(file);
+	return len;
+}
+
+/*
+ * a new format packet of `tag` around `len` octets of `data`, in partial
+ * body lengths of `1 << part_bits` octets if `part_bits` is set; returns
+ * the packet length
+ */
+static size_t new_packet(int tag, int part_bits, u8 const *restrict data, size_t len, u8 *restrict out)
+{
+	size_t pos = 0;
+
+	out[pos++] = 0xc0 | tag;
+	for (; part_bits && len > (size_t)1 << part_bits; len -= (size_t)1 << part_bits) {
+		out[pos++] = 0xe0 | part_bits;
+		memcpy(out + pos, data, (size_t)1 << part_bits);
+		data += (size_t)1 << part_bits;
+		pos += (size_t)1 << part_bits;
+	}
+	if (len < 192) {
+		out[pos++] = len;
+	} else if (len < 8384) {
+		out[pos++] = ((len - 192) >> 8) + 192;
+		out[pos++] = (len - 192) & 0xff;
+	} else {
+		out[pos++] = 0xff;
+		for (int i = 3; i >= 0; i--)
+			out[pos++] = len >> 8 * i;
+	}
+	memcpy(out + pos, data, len);
+	return pos + len;
+}
+
+/* encrypt `len` octets of `data` with `sess` into an encrypted data packet, as gpg does; returns the packet length */
+static size_t seal(SESS_KEY const *restrict sess, int part_bits, u8 const *restrict data, size_t len, u8 *restrict out)
+{
+	static u8 body[SEAL_MAX];
+	size_t block = s2k_block_len(sess->sym_algo), pos = 0;
+	gcry_cipher_hd_t hd;
+
+	body[pos++] = 1;
+	for (size_t i = 0; i < block; i++)
+		body[pos++] = 0x5a ^ i;
+	body[pos] = body[pos - 2], body[pos + 1] = body[pos - 1];
+	pos += 2;
+	memcpy(body + pos, data, len);
+	pos += len;
+	body[pos++] = 0xd3;
+	body[pos++] = 0x14;
+	gcry_md_hash_buffer(GCRY_MD_SHA1, body + pos, body + 1, pos - 1);
+	pos += SEIPD_MDC_LEN - 2;
+	if (gcry_cipher_open(&hd, s2k_cipher_algo(sess->sym_algo), GCRY_CIPHER_MODE_CFB, 0)
+			|| gcry_cipher_setkey(hd, sess->key, sess->len)
+			|| gcry_cipher_encrypt(hd, body + 1, pos - 1, NULL, 0))
+		return 0;
+	gcry_cipher_close(hd);
+	return new_packet(TAG_SEIPDATA, part_bits, body, pos, out);
+}
+
+/* a literal data packet of `mode` around `len` octets of `data`; returns the packet length */
+static size_t literal(u8 mode, u8 const *restrict data, size_t len, u8 *restrict out)
+{
+	static u8 body[SEAL_MAX];
+	u8 const hdr[] = {mode, 4, 'a', 'y', 'y', 'y', 0, 0, 0, 0};
+
+	memcpy(body, hdr, sizeof hdr);
+	memcpy(body + sizeof hdr, data, len);
+	return new_packet(TAG_LITDATA, 0, body, sizeof hdr + len, out);
+}
+
+/* read `len` octets of `data` as a keyring, decrypting with `sess`; returns the packets read */
+static size_t read_buf(u8 *restrict data, size_t len, SESS_KEY const *restrict sess, PGP_LIST *restrict pkts)
+{
+	FILE *file = fmemopen(data, len, "rb");
+
+	free_pgp_list(pkts);
+	init_pgp_list(pkts);
+	pkts->sess = sess;
+	pkts->seipd_bad = 0;
+	if (!file)
+		return 0;
+	return read_pgp_bin(file, NULL, pkts);
+}
+
+/* whether the packets of `pkts` from `start` are the ones of `ref` */
+static bool same_packets(PGP_LIST const *restrict pkts, size_t start, PGP_LIST const *restrict ref)
+{
+	if (pkts->cnt < start + ref->cnt)
+		return false;
+	for (size_t i = 0; i < ref->cnt; i++) {
+		PGP_PACKET const *a = &pkts->list[start + i], *b = &ref->list[i];
+		if (a->pheader != b->pheader || packet_len(a) != packet_len(b) || memcmp(a->pdata, b->pdata, packet_len(b))
+				|| a->fpr_len != b->fpr_len || memcmp(a->fpr, b->fpr, sizeof a->fpr))
+			return false;
+	}
+	return true;
+}
+
+/* `key` sealed with `sess` and decrypted with `use`, then `tail` as is; returns failures */
+static int test_seal(SESS_KEY const *restrict sess, SESS_KEY const *restrict use, int part_bits, size_t want_bad,
+	u8 const *restrict key, size_t key_len, u8 const *restrict tail, size_t tail_len,
+	PGP_LIST const *restrict ref, PGP_LIST const *restrict ref_tail)
+{
+	static u8 buf[SEAL_MAX * 2];
+	PGP_LIST pkts = {0};
+	size_t len, want;
+	int bad = 0;
+
+	if (!(len = seal(sess, part_bits, key, key_len, buf)))
+		return 1;
+	memcpy(buf + len, tail, tail_len);
+	want = (use && !want_bad) ? ref->cnt : 0;
+	bad += read_buf(buf, len + tail_len, use, &pkts) != want + ref_tail->cnt || pkts.seipd_bad != want_bad;
+	bad += (want && !same_packets(&pkts, 0, ref)) || !same_packets(&pkts, want, ref_tail);
+	free_pgp_list(&pkts);
+	return bad;
+}
+
+int main(void)
+{
+	static u8 key[SEAL_MAX / 4], tail[SEAL_MAX / 4], buf[SEAL_MAX * 2], inner[SEAL_MAX];
+	SESS_KEY aes128 = {0}, aes256 = {0}, wrong = {0}, parsed = {0};
+	PGP_LIST ref = {0}, ref_tail = {0}, pkts = {0};
+	size_t key_len, tail_len, len, inner_len;
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INIT_SECMEM, 0x80000, 0);
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	key_len = slurp("./t/nopasswd.gpg", key);
+	tail_len = slurp("./t/4yyylmao.gpg", tail);
+	read_pgp_bin(NULL, "./t/nopasswd.gpg", &ref);
+	read_pgp_bin(NULL, "./t/4yyylmao.gpg", &ref_tail);
+	sess_key_parse("7:000102030405060708090a0b0c0d0e0f", &aes128);
+	sess_key_parse("9:9787A725EB3E3C4B7E7BFAB4AB5E8C5BA8EA0B7BE92AEF40D5E26D1D0D8B5A72", &aes256);
+	sess_key_parse("9:0787A725EB3E3C4B7E7BFAB4AB5E8C5BA8EA0B7BE92AEF40D5E26D1D0D8B5A72", &wrong);
+
+	/* start test block */
+	plan(11);
+
+	/* tests */
+	ok(key_len && tail_len && ref.cnt == 5 && ref_tail.cnt == 5, "test reading the keyrings");
+	ok(sess_key_parse("7:000102030405060708090A0B0C0D0E0F", &parsed) && parsed.sym_algo == SYM_AES128
+		&& parsed.len == 16 && !memcmp(parsed.key, aes128.key, 16) && parsed.key[15] == 0x0f
+		&& aes256.sym_algo == SYM_AES256 && aes256.len == 32 && aes256.key[31] == 0x72, "test parsing session keys");
+	ok(!sess_key_parse("7:000102030405060708090a0b0c0d0e", &parsed) && !sess_key_parse("7:000102030405060708090a0b0c0d0e0f00", &parsed)
+		&& !sess_key_parse("7:000102030405060708090a0b0c0d0e0g", &parsed) && !sess_key_parse("7000102030405060708090a0b0c0d0e0f", &parsed)
+		&& !sess_key_parse(":00", &parsed) && !sess_key_parse("300:00", &parsed) && !sess_key_parse("0:", &parsed),
+		"test rejecting malformed session keys");
+	ok(test_seal(&aes128, &aes128, 0, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0,
+		"test encrypted packets");
+	ok(test_seal(&aes256, &aes256, 9, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0
+		&& test_seal(&aes128, &aes128, 6, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0,
+		"test encrypted packets in partial body lengths");
+	ok(test_seal(&aes256, &wrong, 9, 1, key, key_len, tail, tail_len, &ref, &ref_tail) == 0,
+		"test the wrong session key");
+	ok(test_seal(&aes256, NULL, 9, 0, key, key_len, tail, tail_len, &ref, &ref_tail) == 0,
+		"test skipping encrypted packets without a session key");
+	/* the last octet of the MDC hash is flipped, the packets before it still decrypt */
+	len = seal(&aes128, 0, key, key_len, buf);
+	buf[len - 1] ^= 0x01;
+	memcpy(buf + len, tail, tail_len);
+	ok(read_buf(buf, len + tail_len, &aes128, &pkts) == 10 && pkts.seipd_bad == 1 && same_packets(&pkts, 5, &ref_tail),
+		"test tampered encrypted packets");
+	/* the packet ends in its last packet, whose end is held back as if it were the MDC */
+	len = seal(&aes256, 9, key, key_len, buf);
+	ok(read_buf(buf, len - 40, &aes256, &pkts) == 4 && pkts.seipd_bad == 1 && pkts.list[3].pheader == ref.list[3].pheader,
+		"test truncated encrypted packets");
+	/* a keyring in a literal packet in an uncompressed packet, as `gpg --export-secret-keys | gpg -c` makes */
+	inner[0] = 0x80 | TAG_CDATA << 2 | LEN_OTHER;
+	inner[1] = CMPR_RAW;
+	inner_len = 2 + literal('b', key, key_len, inner + 2);
+	len = seal(&aes256, 9, inner, inner_len, buf);
+	ok(read_buf(buf, len, &aes256, &pkts) == 5 && !pkts.seipd_bad && same_packets(&pkts, 0, &ref),
+		"test keyrings in encrypted literal packets");
+	/* text is skipped over, even if it looks like a keyring */
+	len = literal('t', key, key_len, buf);
+	memcpy(buf + len, tail, tail_len);
+	ok(read_buf(buf, len + tail_len, NULL, &pkts) == 5 && same_packets(&pkts, 0, &ref_tail),
+		"test skipping other literal packets");
+
+	free_pgp_list(&pkts);
+	free_pgp_list(&ref);
+	free_pgp_list(&ref_tail);
+
+	/* return handled */
+	done_testing();
+}
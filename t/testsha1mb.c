@@ -0,0 +1,78 @@
+/*
+ * t/testsha1mb.c:	unit-test for sha1mb.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/sha1mb.h"
+#include <gcrypt.h>
+
+/* more messages than the widest kernel has lanes, so lanes refill and then idle */
+#define NMSGS			53
+
+/* SHA1("abc") from FIPS 180-2 appendix A */
+static u8 const abc_digest[SHA1_DIGEST_BYTES] = {
+	0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+	0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d,
+};
+
+static char const *const isa_names[] = {"C", "AVX2", "SHA-NI", "AVX-512"};
+
+/*
+ * `cnt` messages with random headers and lengths around every padding
+ * boundary, hashed by the current kernel against libgcrypt; returns mismatches
+ */
+static int test_batch(size_t cnt)
+{
+	static u8 data[NMSGS * 300];
+	SHA1_MSG msgs[NMSGS];
+	u8 digests[NMSGS][SHA1_DIGEST_BYTES], ref[SHA1_DIGEST_BYTES];
+	int bad = 0;
+
+	gcry_randomize(data, sizeof data, GCRY_WEAK_RANDOM);
+	for (size_t i = 0; i < cnt; i++) {
+		msgs[i] = (SHA1_MSG){.hdr_len = i % 9, .data = data + i * 300,
+			.len = (i < 16) ? 48 + i : (i * 37) % 300, .digest = digests[i]};
+		gcry_randomize(msgs[i].hdr, sizeof msgs[i].hdr, GCRY_WEAK_RANDOM);
+	}
+	sha1_mb(msgs, cnt);
+	for (size_t i = 0; i < cnt; i++) {
+		gcry_md_hash_buffers(GCRY_MD_SHA1, 0, ref, (gcry_buffer_t[]){
+				{.data = msgs[i].hdr, .len = msgs[i].hdr_len},
+				{.data = (void *)msgs[i].data, .len = msgs[i].len}}, 2);
+		bad += memcmp(ref, digests[i], sizeof ref) != 0;
+	}
+	return bad;
+}
+
+int main(void)
+{
+	u8 digest[SHA1_DIGEST_BYTES] = {0};
+	SHA1_MSG abc = {.data = (u8 const *)"abc", .len = 3, .digest = digest};
+
+	if (!gcry_check_version(GCRYPT_VERSION))
+		BAIL_OUT("`libgcrypt` version mismatch");
+	gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	/* start test block */
+	plan(6);
+
+	/* tests */
+	sha1_mb_use_simd(SHA1_C);
+	sha1_mb(&abc, 1);
+	ok(!memcmp(digest, abc_digest, sizeof digest), "test SHA1 of \"abc\"");
+	/* kernels the cpu lacks fall back to a narrower one, which is checked again */
+	for (int isa = SHA1_C; isa <= SHA1_AVX512; isa++) {
+		int used = sha1_mb_use_simd(isa);
+		ok(test_batch(NMSGS) == 0, "test %s kernel against libgcrypt (using %s)", isa_names[isa], isa_names[used]);
+	}
+	sha1_mb_use_simd(SHA1_AVX512);
+	ok(test_batch(3) == 0, "test batches smaller than the lanes");
+
+	/* return handled */
+	done_testing();
+}
@@ -0,0 +1,67 @@
+/*
+ * t/teststrarena.c:	unit-test for strarena.c
+ *
+ * AUTHORS:	Joey Pabalinas <alyptik@protonmail.com>
+ *		Santiago Torres <sangy@riseup.net>
+ *
+ * See LICENSE.md file for copyright and license details.
+ */
+
+#include "tap.h"
+#include "../src/strarena.h"
+
+#define STR_CNT		5000
+
+/* intern enough strings to grow the table and fill several chunks; returns failures */
+static int test_growth(STR_ARENA *restrict arena)
+{
+	char const *first[STR_CNT];
+	char buf[32];
+	size_t cnt = arena->cnt;
+	int bad = 0;
+
+	for (size_t i = 0; i < STR_CNT; i++) {
+		int len = snprintf(buf, sizeof buf, "user%zu@lmao.plane", i);
+		first[i] = str_intern(arena, buf, len);
+	}
+	bad += arena->cnt != cnt + STR_CNT;
+	/* earlier strings neither moved nor were copied again */
+	for (size_t i = 0; i < STR_CNT; i++) {
+		int len = snprintf(buf, sizeof buf, "user%zu@lmao.plane", i);
+		bad += str_intern(arena, buf, len) != first[i] || str_lookup(arena, buf, len) != first[i]
+			|| strcmp(first[i], buf);
+	}
+	bad += arena->cnt != cnt + STR_CNT;
+	return bad;
+}
+
+int main(void)
+{
+	STR_ARENA arena = {0};
+	char const *str, *big_str;
+	char *big;
+
+	/* start test block */
+	plan(5);
+
+	/* tests */
+	ok(!str_lookup(&arena, "ayy", 3), "test lookup in an empty arena");
+	str = str_intern(&arena, "ayy lmao", 3);
+	ok(!strcmp(str, "ayy") && str_intern(&arena, "ayy", 3) == str && str_lookup(&arena, "ayy", 3) == str
+		&& !str_lookup(&arena, "ayyy", 4) && arena.cnt == 1, "test interning a string once");
+	ok(test_growth(&arena) == 0, "test stable strings across table and arena growth");
+	xcalloc(&big, 1, 2 * STR_CHUNK_BYTES, "main() xcalloc()");
+	memset(big, 'a', 2 * STR_CHUNK_BYTES);
+	big_str = str_intern(&arena, big, 2 * STR_CHUNK_BYTES);
+	/* the long string gets its own chunk and the open one keeps filling */
+	str = str_intern(&arena, "lmao", 4);
+	ok(!memcmp(big_str, big, 2 * STR_CHUNK_BYTES) && !big_str[2 * STR_CHUNK_BYTES]
+		&& str_lookup(&arena, big, 2 * STR_CHUNK_BYTES) == big_str && !strcmp(str, "lmao")
+		&& str_arena_bytes(&arena) >= 2 * STR_CHUNK_BYTES + 1 + STR_CHUNK_BYTES, "test oversized strings");
+	free(big);
+	str_arena_free(&arena);
+	ok(!arena.chunks && !arena.slots && !arena.cnt && !str_lookup(&arena, "ayy", 3), "test freeing the arena");
+
+	/* return handled */
+	done_testing();
+}